@@ -882,6 +882,18 @@ int Client::deserializeSysStat(SysStat& sys, char* buf, int size)
       p += 92 + i->m_strDataDir.length() + 1;
    }
 
+   // recovery progress, not sent by older masters
+   sys.m_llRecoveryPending = sys.m_llRecoveryDone = sys.m_llRecoveryRate = sys.m_llRecoveryTrans = 0;
+   sys.m_llRecoveryETA = -1;
+   if (p + 40 <= buf + size)
+   {
+      sys.m_llRecoveryPending = *(int64_t*)p;
+      sys.m_llRecoveryDone = *(int64_t*)(p + 8);
+      sys.m_llRecoveryRate = *(int64_t*)(p + 16);
+      sys.m_llRecoveryETA = *(int64_t*)(p + 24);
+      sys.m_llRecoveryTrans = *(int64_t*)(p + 32);
+   }
+
    return 0;
 }
 
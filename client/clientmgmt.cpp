@@ -384,10 +384,10 @@ int64_t SectorFile::write(const char* buf, const int64_t& size)
    return f->write(buf, size);
 }
 
-int64_t SectorFile::download(const char* localpath, const bool& cont)
+int64_t SectorFile::download(const char* localpath, const bool& cont, const int& streams)
 {
    FIND_FILE_OR_ERROR(f)
-   return f->download(localpath, cont);
+   return f->download(localpath, cont, streams);
 }
 
 int64_t SectorFile::upload(const char* localpath, const bool& cont)
@@ -497,6 +497,18 @@ int SphereProcess::waitForCompletion()
    return d->waitForCompletion();
 }
 
+int SphereProcess::getShuffleSize(int64_t& before, int64_t& after)
+{
+   FIND_SPHERE_OR_ERROR(d)
+   return d->getShuffleSize(before, after);
+}
+
+int SphereProcess::getCompressionStat(int64_t& raw, int64_t& compressed, int64_t& usec)
+{
+   FIND_SPHERE_OR_ERROR(d)
+   return d->getCompressionStat(raw, compressed, usec);
+}
+
 void SphereProcess::setMinUnitSize(int size)
 {
    DCClient* d = Client::g_ClientMgmt.lookupDC(m_iID);
@@ -518,9 +530,30 @@ void SphereProcess::setProcNumPerNode(int num)
       d->setProcNumPerNode(num);
 }
 
+void SphereProcess::setProcThreadNum(int num)
+{
+   DCClient* d = Client::g_ClientMgmt.lookupDC(m_iID);
+   if (NULL != d)
+      d->setProcThreadNum(num);
+}
+
 void SphereProcess::setDataMoveAttr(bool move)
 {
    DCClient* d = Client::g_ClientMgmt.lookupDC(m_iID);
    if (NULL != d)
       d->setDataMoveAttr(move);
 }
+
+void SphereProcess::setShuffleCompression(bool compress)
+{
+   DCClient* d = Client::g_ClientMgmt.lookupDC(m_iID);
+   if (NULL != d)
+      d->setShuffleCompression(compress);
+}
+
+void SphereProcess::setSpeculation(bool speculate)
+{
+   DCClient* d = Client::g_ClientMgmt.lookupDC(m_iID);
+   if (NULL != d)
+      d->setSpeculation(speculate);
+}
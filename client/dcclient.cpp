@@ -20,9 +20,13 @@ written by
 *****************************************************************************/
 
 #include "dcclient.h"
+#include "fsclient.h"
+#include "dhash.h"
 #include <errno.h>
 #include <common.h>
 #include <iostream>
+#include <algorithm>
+#include <iterator>
 #ifdef WIN32
    #include <sys/types.h>
    #include <sys/stat.h>
@@ -161,7 +165,12 @@ DCClient::DCClient():
 m_iMinUnitSize(1000000),
 m_iMaxUnitSize(256000000),
 m_iCore(1),
-m_bDataMove(true)
+m_iThreads(1),
+m_bDataMove(true),
+m_llThroughput(0),
+m_iCompression(0),
+m_bSpeculation(false),
+m_llLastSPECheck(0)
 {
    m_strOperator = "";
    m_pcParam = NULL;
@@ -181,6 +190,11 @@ m_bDataMove(true)
    m_iTotalSPE = 0;
    m_iAvailRes = 0;
    m_bBucketHealth = true;
+   m_llRawShuffleSize = 0;
+   m_llShuffleSize = 0;
+   m_llWireShuffleSize = 0;
+   m_llCompressTime = 0;
+   m_mDSWinner.clear();
 
    m_bOpened = false;
 
@@ -217,7 +231,17 @@ int DCClient::loadOperator(const char* library)
       cerr << "loadOperator: bad file.\n";
       return SectorError::E_LOCALFILE;
    }
+   char* buf = new char[s.m_llSize];
+   lib.read(buf, s.m_llSize);
+   bool fail = lib.fail();
    lib.close();
+   string hash = DHash::digest(buf, s.m_llSize);
+   delete [] buf;
+   if (fail)
+   {
+      cerr << "loadOperator: bad file.\n";
+      return SectorError::E_LOCALFILE;
+   }
 
    // TODO : check ".so"
 
@@ -228,53 +252,301 @@ int DCClient::loadOperator(const char* library)
    op.m_strLibrary = dir[dir.size() - 1];
    op.m_strLibPath = library;
    op.m_iSize = s.m_llSize;
+   op.m_strHash = hash;
    op.m_sUploaded.clear();
+   op.m_vHolders.clear();
+
+   // the same library loaded again is still on the slaves it has been sent to
+   map<string, OP>::iterator i = m_mOP.find(op.m_strLibrary);
+   if ((i != m_mOP.end()) && (i->second.m_strHash == hash))
+   {
+      op.m_sUploaded = i->second.m_sUploaded;
+      op.m_vHolders = i->second.m_vHolders;
+   }
 
    m_mOP[op.m_strLibrary] = op;
 
    return 0;
 }
 
+int DCClient::preloadOperator()
+{
+   vector<LibTarget> targets;
+   vector<LibTarget> others;
+   set<string> slaves;
+
+   // shufflers load the libraries of a MapReduce job as well
+   if (m_iProcType == 1)
+   {
+      for (map<int, BUCKET>::iterator b = m_mBucket.begin(); b != m_mBucket.end(); ++ b)
+      {
+         LibTarget t;
+         t.m_strIP = b->second.m_strIP;
+         t.m_iPort = b->second.m_iPort;
+         t.m_iDataPort = b->second.m_iDataPort;
+         t.m_iSession = b->second.m_iSession;
+
+         char addr[128];
+         sprintf(addr, "%s:%d", t.m_strIP.c_str(), t.m_iPort);
+         if (slaves.insert(addr).second)
+            targets.push_back(t);
+         else
+            others.push_back(t);
+      }
+   }
+
+   // start the first SPE on each slave now, so that the libraries reach all slaves before any data segment is processed
+   for (map<int, SPE>::iterator s = m_mSPE.begin(); s != m_mSPE.end(); ++ s)
+   {
+      if (s->first >= m_iSPENum)
+         continue;
+
+      if (connectSPE(s->second, false) < 0)
+      {
+         s->second.m_iStatus = -1;
+         continue;
+      }
+
+      LibTarget t;
+      t.m_strIP = s->second.m_strIP;
+      t.m_iPort = s->second.m_iPort;
+      t.m_iDataPort = s->second.m_iDataPort;
+      t.m_iSession = s->second.m_iSession;
+
+      char addr[128];
+      sprintf(addr, "%s:%d", t.m_strIP.c_str(), t.m_iPort);
+      if (slaves.insert(addr).second)
+         targets.push_back(t);
+      else
+         others.push_back(t);
+   }
+
+   int result = loadOperator(targets);
+
+   // the slaves of these sessions have the libraries already
+   for (vector<LibTarget>::iterator t = others.begin(); t != others.end(); ++ t)
+      loadOperator(t->m_strIP, t->m_iPort, t->m_iDataPort, t->m_iSession);
+
+   return result;
+}
+
 int DCClient::loadOperator(const string& ip, const int port, const int dataport, const int session)
 {
-   char addr[128];
-   sprintf(addr, "%s:%d", ip.c_str(), port);
+   vector<LibTarget> targets;
+   LibTarget t;
+   t.m_strIP = ip;
+   t.m_iPort = port;
+   t.m_iDataPort = dataport;
+   t.m_iSession = session;
+   targets.push_back(t);
+
+   return loadOperator(targets);
+}
 
-   int num = 0;
-   for (map<string, OP>::iterator i = m_mOP.begin(); i != m_mOP.end(); ++ i)
+int DCClient::loadOperator(const vector<LibTarget>& targets)
+{
+   vector<string> addr;
+   vector<int> num(targets.size(), 0);
+   vector<bool> lost(targets.size(), false);
+
+   for (unsigned int t = 0; t < targets.size(); ++ t)
    {
-      if (i->second.m_sUploaded.find(addr) == i->second.m_sUploaded.end())
-         ++ num;
+      char tmp[128];
+      sprintf(tmp, "%s:%d", targets[t].m_strIP.c_str(), targets[t].m_iPort);
+      addr.push_back(tmp);
+
+      for (map<string, OP>::iterator i = m_mOP.begin(); i != m_mOP.end(); ++ i)
+      {
+         if (i->second.m_sUploaded.find(addr[t]) == i->second.m_sUploaded.end())
+            ++ num[t];
+      }
+      m_pClient->m_DataChn.send(targets[t].m_strIP, targets[t].m_iDataPort, targets[t].m_iSession, (char*)&num[t], 4);
    }
-   m_pClient->m_DataChn.send(ip, dataport, session, (char*)&num, 4);
 
    for (map<string, OP>::iterator i = m_mOP.begin(); i != m_mOP.end(); ++ i)
    {
-      if (i->second.m_sUploaded.find(addr) == i->second.m_sUploaded.end())
+      OP& op = i->second;
+
+      vector<unsigned int> recv;
+      for (unsigned int t = 0; t < targets.size(); ++ t)
+      {
+         if (lost[t] || (op.m_sUploaded.find(addr[t]) != op.m_sUploaded.end()))
+            continue;
+
+         const LibTarget& dst = targets[t];
+         m_pClient->m_DataChn.send(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, op.m_strLibrary.c_str(), op.m_strLibrary.length() + 1);
+         m_pClient->m_DataChn.send(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, op.m_strHash.c_str(), op.m_strHash.length() + 1);
+         recv.push_back(t);
+      }
+
+      // the slave may have the library in its cache from an earlier session
+      vector<unsigned int> need;
+      for (vector<unsigned int>::iterator t = recv.begin(); t != recv.end(); ++ t)
+      {
+         const LibTarget& dst = targets[*t];
+         int32_t cached = 0;
+         if (m_pClient->m_DataChn.recv4(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, cached) < 0)
+            lost[*t] = true;
+         else if (0 == cached)
+            need.push_back(*t);
+         else
+         {
+            LibHolder h;
+            h.m_strIP = dst.m_strIP;
+            h.m_iPort = dst.m_iPort;
+            h.m_iDataPort = dst.m_iDataPort;
+            op.m_vHolders.push_back(h);
+            op.m_sUploaded.insert(addr[*t]);
+         }
+      }
+
+      char* buf = NULL;
+
+      // slaves that have the library form a tree: the k-th holder gets it from holder (k - 1) / fanout,
+      // so that the library leaves the client once and each slave sends at most m_iLibFanout copies.
+      // The tree is built level by level, all transfers of a level run at the same time.
+      unsigned int next = 0;
+      while (next < need.size())
       {
-         m_pClient->m_DataChn.send(ip, dataport, session, i->second.m_strLibrary.c_str(), i->second.m_strLibrary.length() + 1);
+         int holders = op.m_vHolders.size();
+         unsigned int width = (0 == holders) ? 1 : holders * (m_iLibFanout - 1) + 1;
+         if (width > need.size() - next)
+            width = need.size() - next;
+
+         // parents are chosen before any of them can be dropped from the holder list
+         vector<LibHolder> parent(width);
+         vector<int32_t> src(width, 0);
+         for (unsigned int j = 0; j < width; ++ j)
+         {
+            if (holders > 0)
+            {
+               parent[j] = op.m_vHolders[(holders + j - 1) / m_iLibFanout];
+               src[j] = 1;
+            }
+         }
+
+         for (unsigned int j = 0; j < width; ++ j)
+         {
+            const LibTarget& dst = targets[need[next + j]];
+            if ((1 == src[j]) && (sendLibrary(op, parent[j], dst.m_strIP, dst.m_iDataPort, dst.m_iSession) < 0))
+            {
+               m_pClient->m_Log << "failed to send library " << op.m_strLibrary << " from " << parent[j].m_strIP << LogEnd();
+               dropHolder(op, parent[j]);
+               src[j] = 0;
+            }
+
+            m_pClient->m_DataChn.send(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, (char*)&src[j], 4);
+            if (1 == src[j])
+            {
+               m_pClient->m_DataChn.send(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, parent[j].m_strIP.c_str(), parent[j].m_strIP.length() + 1);
+               m_pClient->m_DataChn.send(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, (char*)&parent[j].m_iDataPort, 4);
+            }
+         }
+
+         for (unsigned int j = 0; j < width; ++ j)
+         {
+            const unsigned int t = need[next + j];
+            const LibTarget& dst = targets[t];
+
+            if (1 == src[j])
+            {
+               // the slave reports -1 if the library cannot be fetched from the parent, then it waits for the client
+               int32_t result = -1;
+               if (m_pClient->m_DataChn.recv4(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, result) < 0)
+               {
+                  lost[t] = true;
+                  continue;
+               }
+
+               if (result < 0)
+               {
+                  // otherwise each later child of this parent would wait for the data channel timeout
+                  m_pClient->m_Log << "failed to fetch library " << op.m_strLibrary << " from " << parent[j].m_strIP << LogEnd();
+                  dropHolder(op, parent[j]);
+                  src[j] = 0;
+               }
+            }
+
+            if (0 == src[j])
+            {
+               if (NULL == buf)
+               {
+                  ifstream lib;
+                  lib.open(op.m_strLibPath.c_str(), ios::in | ios::binary);
+                  buf = new char[op.m_iSize];
+                  lib.read(buf, op.m_iSize);
+                  lib.close();
+               }
+
+               m_pClient->m_DataChn.send(dst.m_strIP, dst.m_iDataPort, dst.m_iSession, buf, op.m_iSize);
+            }
 
-         ifstream lib;
-         lib.open(i->second.m_strLibPath.c_str(), ios::in | ios::binary);
-         char* buf = new char[i->second.m_iSize];
-         lib.read(buf, i->second.m_iSize);
-         lib.close();
+            LibHolder h;
+            h.m_strIP = dst.m_strIP;
+            h.m_iPort = dst.m_iPort;
+            h.m_iDataPort = dst.m_iDataPort;
+            op.m_vHolders.push_back(h);
 
-         m_pClient->m_DataChn.send(ip, dataport, session, buf, i->second.m_iSize);
+            // this library will not be uploaded again during the current client session
+            op.m_sUploaded.insert(addr[t]);
+         }
 
-         // this library will not be uploaded again during the current client session
-         i->second.m_sUploaded.insert(addr);
+         next += width;
       }
+
+      delete [] buf;
    }
 
-   if (num > 0)
+   int result = 0;
+   for (unsigned int t = 0; t < targets.size(); ++ t)
    {
-      // wait for library transfer to complete
-      int32_t confirm;
-      m_pClient->m_DataChn.recv4(ip, dataport, session, confirm);
+      if (lost[t])
+      {
+         result = SectorError::E_CONNECTION;
+         continue;
+      }
+
+      if (num[t] > 0)
+      {
+         // wait for library transfer to complete
+         int32_t confirm;
+         m_pClient->m_DataChn.recv4(targets[t].m_strIP, targets[t].m_iDataPort, targets[t].m_iSession, confirm);
+      }
    }
 
-   return num;
+   return result;
+}
+
+void DCClient::dropHolder(OP& op, const LibHolder& holder)
+{
+   for (vector<LibHolder>::iterator h = op.m_vHolders.begin(); h != op.m_vHolders.end(); ++ h)
+   {
+      if ((h->m_strIP == holder.m_strIP) && (h->m_iPort == holder.m_iPort))
+      {
+         op.m_vHolders.erase(h);
+         break;
+      }
+   }
+}
+
+int DCClient::sendLibrary(const OP& op, const LibHolder& src, const string& ip, const int dataport, const int session)
+{
+   SectorMsg msg;
+   msg.setType(206); // send a cached library to another slave
+   msg.setKey(m_pClient->m_iKey);
+   msg.setData(0, src.m_strIP.c_str(), src.m_strIP.length() + 1);
+   msg.setData(64, (char*)&src.m_iPort, 4);
+   msg.setData(68, (char*)&session, 4);
+   msg.setData(72, ip.c_str(), ip.length() + 1);
+   msg.setData(136, (char*)&dataport, 4);
+   msg.setData(140, op.m_strHash.c_str(), op.m_strHash.length() + 1);
+
+   Address serv;
+   m_pClient->m_Routing.getPrimaryMaster(serv);
+   if ((m_pClient->m_GMP.rpc(serv.m_strIP.c_str(), serv.m_iPort, &msg, &msg) < 0) || (msg.getType() < 0))
+      return SectorError::E_CONNECTION;
+
+   return 0;
 }
 
 int DCClient::run(const SphereStream& input, SphereStream& output, const string& op, const int& rows, const char* param, const int& size, const int& type)
@@ -319,7 +591,7 @@ int DCClient::run(const SphereStream& input, SphereStream& output, const string&
    if (msg.getType() < 0)
       return *(int32_t*)msg.getData();
 
-   m_iSPENum = (msg.m_iDataLength - 4) / 72;
+   m_iSPENum = (msg.m_iDataLength - SectorMsg::m_iHdrSize) / 76;
    if (0 == m_iSPENum)
       return SectorError::E_RESOURCE;
 
@@ -342,15 +614,29 @@ int DCClient::run(const SphereStream& input, SphereStream& output, const string&
    if (result < 0)
       return result;
 
+   preloadOperator();
+
    m_iProgress = 0;
    m_iAvgRunTime = -1;
    m_iTotalDS = m_mpDS.size();
    m_iTotalSPE = m_mSPE.size();
    m_iAvailRes = 0;
    m_bBucketHealth = true;
+   m_llRawShuffleSize = 0;
+   m_llShuffleSize = 0;
+   m_llWireShuffleSize = 0;
+   m_llCompressTime = 0;
+   m_mDSWinner.clear();
 
    m_pClient->m_Log << m_mSPE.size() << " spes found! " << m_mpDS.size() << " data seg total." << LogEnd();
 
+   // every SPE starts idle
+   m_qIdleSPE.clear();
+   m_sParkedSPE.clear();
+   for (map<int, SPE>::iterator s = m_mSPE.begin(); s != m_mSPE.end(); ++ s)
+      m_qIdleSPE.push_back(s->first);
+   m_llLastSPECheck = 0;
+
    // starting...
 #ifndef WIN32
    pthread_t scheduler;
@@ -394,6 +680,9 @@ int DCClient::close()
    m_iTotalSPE = 0;
    m_iAvailRes = 0;
 
+   m_qIdleSPE.clear();
+   m_sParkedSPE.clear();
+
    m_bOpened = false;
 
    return 0;
@@ -438,12 +727,29 @@ DWORD WINAPI DCClient::run(LPVOID param)
 
       if (progress < 0)
       {
+         // nothing is lost if the other copy of this data segment has completed or is still running
+         DS* d = s->second.m_pDS;
+         SPE* other = self->otherCopy(s->second);
+         if ((SectorError::E_CANCELED == progress) || (1 != d->m_iStatus) || (NULL != other))
+         {
+            if (NULL != other)
+            {
+               d->m_iSPEID = other->m_iID;
+               d->m_iBackupSPEID = -1;
+            }
+            s->second.m_iStatus = (progress == SectorError::E_SPEUDF) ? -1 : 1;
+            if (1 == s->second.m_iStatus)
+               self->m_qIdleSPE.push_back(s->first);
+            continue;
+         }
+
          cerr << "SPE PROCESSING ERROR " << ip << " " << port << " CODE: " << progress << endl;
 
          //error, quit this segment on the SPE
          s->second.m_pDS->m_iStatus = -1;
          s->second.m_pDS->m_iSPEID = -1;
          s->second.m_iStatus = 1;
+         self->m_qIdleSPE.push_back(s->first);
 
          s->second.m_pDS->m_pResult->m_iStatus = *(int32_t*)(msg.getData() + 8);
          int errsize = msg.m_iDataLength - SectorMsg::m_iHdrSize - 12;
@@ -480,6 +786,41 @@ DWORD WINAPI DCClient::run(LPVOID param)
       if (progress < 100)
          continue;
 
+      // the other copy of this data segment has completed first
+      if (1 != s->second.m_pDS->m_iStatus)
+      {
+         self->discardResult(&(s->second));
+         continue;
+      }
+
+      if (s->second.m_pDS->m_bSpeculated)
+      {
+         // keep this copy, the buckets drop the output of the other one
+         self->m_mDSWinner[s->second.m_pDS->m_iID] = s->second.m_iID;
+
+         SPE* other = self->otherCopy(s->second);
+         if (NULL != other)
+            self->cancelSPE(*other);
+
+         s->second.m_pDS->m_iSPEID = s->second.m_iID;
+         s->second.m_pDS->m_iBackupSPEID = -1;
+      }
+
+      // older slaves do not send the shuffle statistics
+      if (msg.m_iDataLength >= SectorMsg::m_iHdrSize + 24)
+      {
+         self->m_llRawShuffleSize += *(int64_t*)(msg.getData() + 8);
+         self->m_llShuffleSize += *(int64_t*)(msg.getData() + 16);
+      }
+      if (msg.m_iDataLength >= SectorMsg::m_iHdrSize + 40)
+      {
+         self->m_llWireShuffleSize += *(int64_t*)(msg.getData() + 24);
+         self->m_llCompressTime += *(int64_t*)(msg.getData() + 32);
+      }
+
+      // the DS may be released by the reader once its result is ready
+      int64_t datasize = s->second.m_pDS->m_llDataSize;
+
       self->readResult(&(s->second));
 
       // one SPE completes!
@@ -488,6 +829,16 @@ DWORD WINAPI DCClient::run(LPVOID param)
          self->m_iAvgRunTime = (t - s->second.m_StartTime) / 1000000;
       else
          self->m_iAvgRunTime = (self->m_iAvgRunTime * 7 + (t - s->second.m_StartTime) / 1000000) / 8;
+
+      // processing speed, used to size the data segments of later runs
+      if (t > s->second.m_StartTime)
+      {
+         int64_t throughput = datasize * 1000000 / (t - s->second.m_StartTime);
+         if (self->m_llThroughput <= 0)
+            self->m_llThroughput = throughput;
+         else
+            self->m_llThroughput = (self->m_llThroughput * 7 + throughput) / 8;
+      }
    }
 
    self->m_dRunningProgress = 0;
@@ -505,6 +856,18 @@ DWORD WINAPI DCClient::run(LPVOID param)
       SectorMsg msg;
       int32_t cmd = -1;
       msg.setData(0, (char*)&cmd, 4);
+
+      // data segments processed twice: the buckets keep the output of the SPE whose result was read
+      int32_t num = self->m_mDSWinner.size();
+      msg.setData(4, (char*)&num, 4);
+      int pos = 8;
+      for (map<int, int>::iterator w = self->m_mDSWinner.begin(); w != self->m_mDSWinner.end(); ++ w)
+      {
+         msg.setData(pos, (char*)&(w->first), 4);
+         msg.setData(pos + 4, (char*)&(w->second), 4);
+         pos += 8;
+      }
+
       int id = 0;
       self->m_pClient->m_GMP.sendto(i->second.m_strIP.c_str(), i->second.m_iShufflerPort, id, &msg);
    }
@@ -549,114 +912,164 @@ DWORD WINAPI DCClient::run(LPVOID param)
 
 int DCClient::checkSPE()
 {
+   // the data channels of all SPEs are checked once a second, idle SPEs are served as soon as they are queued
+   int64_t now = CTimer::getTime();
+   bool scan = (now - m_llLastSPECheck >= 1000000);
    bool spe_busy = false;
-   bool ds_found = false;
-
-   m_dRunningProgress = 0.0;
-
-   //TODO: this may be optimized with an extra data structure to record available SPE only, to reduce SPE status scan
+   bool requeued = false;
 
-   for (map<int, SPE>::iterator s = m_mSPE.begin(); s != m_mSPE.end(); ++ s)
+   if (scan)
    {
-      // this SPE is abandond
-      if (-1 == s->second.m_iStatus)
-         continue;
+      m_llLastSPECheck = now;
+      m_dRunningProgress = 0.0;
 
-      // check if the SPE is still alive
-      if ((s->second.m_iStatus > 0) && (!m_pClient->m_DataChn.isConnected(s->second.m_strIP, s->second.m_iDataPort)))
+      for (map<int, SPE>::iterator s = m_mSPE.begin(); s != m_mSPE.end(); ++ s)
       {
-         cerr << "SPE lost " << s->second.m_strIP << " " << s->second.m_iPort << endl;
+         // this SPE is abandond
+         if (-1 == s->second.m_iStatus)
+            continue;
 
-         if (!m_mBucket.empty())
+         // check if the SPE is still alive
+         if ((s->second.m_iStatus > 0) && (!m_pClient->m_DataChn.isConnected(s->second.m_strIP, s->second.m_iDataPort)))
          {
-            cerr << "cannot recover the hashing bucket due to the lost SPE. Process failed." << endl;
-            m_bBucketHealth = false;
-            return 0;
-         }
+            cerr << "SPE lost " << s->second.m_strIP << " " << s->second.m_iPort << endl;
 
-         // dismiss this SPE and release its job
-         s->second.m_iStatus = -1;
-         m_iTotalSPE --;
+            if (!m_mBucket.empty())
+            {
+               cerr << "cannot recover the hashing bucket due to the lost SPE. Process failed." << endl;
+               m_bBucketHealth = false;
+               return 0;
+            }
 
-         CGuard::enterCS(m_DSLock);
+            // dismiss this SPE and release its job, if it is running one
+            bool running = (2 == s->second.m_iStatus);
+            SPE* other = running ? otherCopy(s->second) : NULL;
+            s->second.m_iStatus = -1;
+            m_iTotalSPE --;
 
-         if (++ s->second.m_pDS->m_iRetryNum > 3)
-         {
-            //if the DS still fails after several retries, it means there is a bug in processing the specific data.
-            s->second.m_pDS->m_iStatus = -1;
+            if (!running)
+               continue;
+
+            CGuard::enterCS(m_DSLock);
+
+            if (NULL != other)
+            {
+               // a speculative copy is still running
+               s->second.m_pDS->m_iSPEID = other->m_iID;
+               s->second.m_pDS->m_iBackupSPEID = -1;
+               CGuard::leaveCS(m_DSLock);
+               continue;
+            }
 
-            ++ m_iProgress;
+            if (++ s->second.m_pDS->m_iRetryNum > 3)
+            {
+               //if the DS still fails after several retries, it means there is a bug in processing the specific data.
+               s->second.m_pDS->m_iStatus = -1;
+
+               ++ m_iProgress;
 
 #ifndef WIN32
-            pthread_mutex_lock(&m_ResLock);
-            ++ m_iAvailRes;
-            pthread_cond_signal(&m_ResCond);
-            pthread_mutex_unlock(&m_ResLock);
+               pthread_mutex_lock(&m_ResLock);
+               ++ m_iAvailRes;
+               pthread_cond_signal(&m_ResCond);
+               pthread_mutex_unlock(&m_ResLock);
 #else
-            ++ m_iAvailRes;
-            SetEvent(m_ResCond);
+               ++ m_iAvailRes;
+               SetEvent(m_ResCond);
 #endif
+            }
+            else
+            {
+               s->second.m_pDS->m_iStatus = 0;
+               m_Scheduler.requeue(s->second.m_pDS->m_iID);
+               requeued = true;
+            }
+
+            s->second.m_pDS->m_iSPEID = -1;
+
+            CGuard::leaveCS(m_DSLock);
+            continue;
          }
-         else
+
+         if (2 == s->second.m_iStatus)
          {
-            s->second.m_pDS->m_iStatus = 0;
+            spe_busy = true;
+            if (s->second.m_pDS->m_iSPEID == s->second.m_iID)
+               m_dRunningProgress += s->second.m_iProgress / 100.0;
          }
-
-         s->second.m_pDS->m_iSPEID = -1;
-
-         CGuard::leaveCS(m_DSLock);
       }
+   }
 
-      // if the SPE is not running, 0 = init but not conncted, 1 = idle, 2 = processing
-      if (2 != s->second.m_iStatus)
-      {
-         // find a new DS in the job queue and start it
-         CGuard::enterCS(m_DSLock);
+   bool ds_found = false;
 
-         for (map<int, list<int> >::iterator dist = s->second.m_mDSQueue.begin(); dist != s->second.m_mDSQueue.end(); ++ dist)
-         {
-            for (list<int>::iterator dsid = dist->second.begin(); dsid != dist->second.end();)
-            {
-               map<int, DS*>::iterator ds = m_mpDS.find(*dsid);
-               if (ds == m_mpDS.end())
-               {
-                  // DS already processed, remove from job queue
-                  list<int>::iterator tmp = dsid;
-                  ++ dsid;
-                  dist->second.erase(tmp);
-               }
-               else if (ds->second->m_iStatus == 0)
-               {
-                  //TODO: for same distance, process DS with less copies first
-                  //TODO: process DS with slower progress first
+   CGuard::enterCS(m_DSLock);
 
-                  // found nearest DS to process
-                  startSPE(s->second, ds->second);
-                  ds_found = true;
-                  break;
-               }
-               else
-               {
-                  // this DS is either being processed or has been completed
-                  ++ dsid;
-               }
-            }
+   // a requeued DS may be local to an SPE that has found nothing before
+   if (requeued)
+   {
+      m_qIdleSPE.insert(m_qIdleSPE.end(), m_sParkedSPE.begin(), m_sParkedSPE.end());
+      m_sParkedSPE.clear();
+   }
 
-            if (ds_found)
-               break;
+   // 0 = init but not conncted, 1 = idle, 2 = processing
+   requeued = false;
+   while (!m_qIdleSPE.empty())
+   {
+      map<int, SPE>::iterator s = m_mSPE.find(m_qIdleSPE.front());
+      m_qIdleSPE.pop_front();
+      if ((s == m_mSPE.end()) || (-1 == s->second.m_iStatus) || (2 == s->second.m_iStatus))
+         continue;
+
+      // find the nearest DS waiting to be processed and start it
+      int dsid = m_Scheduler.next(s->first);
+      map<int, DS*>::iterator ds = (dsid >= 0) ? m_mpDS.find(dsid) : m_mpDS.end();
+      if (ds != m_mpDS.end())
+      {
+         if (startSPE(s->second, ds->second) > 0)
+         {
+            ds_found = true;
+            continue;
          }
 
-         CGuard::leaveCS(m_DSLock);
+         m_Scheduler.requeue(dsid);
+         requeued = true;
       }
-      else 
+
+      if (-1 != s->second.m_iStatus)
+         m_sParkedSPE.insert(s->first);
+   }
+
+   // let the parked SPEs try the DSs that failed to start again at the next check
+   if (requeued)
+   {
+      m_qIdleSPE.insert(m_qIdleSPE.end(), m_sParkedSPE.begin(), m_sParkedSPE.end());
+      m_sParkedSPE.clear();
+   }
+
+   // nothing left to start on the parked SPEs, they may take over stragglers
+   if (scan && m_bSpeculation && !m_sParkedSPE.empty() && (m_iAvgRunTime > 0) && (0 == m_Scheduler.pending()))
+   {
+      vector<SPE*> stragglers;
+      if (findStragglers(stragglers) > 0)
       {
-         spe_busy = true;
-         m_dRunningProgress += s->second.m_iProgress / 100.0;
+         for (set<int>::iterator i = m_sParkedSPE.begin(); i != m_sParkedSPE.end(); )
+         {
+            map<int, SPE>::iterator s = m_mSPE.find(*i);
+            if ((1 == s->second.m_iStatus) && (startBackup(s->second, stragglers) > 0))
+            {
+               ds_found = true;
+               m_sParkedSPE.erase(i ++);
+            }
+            else
+               ++ i;
+         }
       }
    }
 
+   CGuard::leaveCS(m_DSLock);
+
    // All SPEs are spare but none of them can be assigned a DS. Error occurs!
-   if (!spe_busy && !ds_found && (m_iProgress < m_iTotalDS))
+   if (scan && !spe_busy && !ds_found && m_qIdleSPE.empty() && (m_iProgress < m_iTotalDS))
    {
       cerr << "Cannot allocate SPE for certain data segments. Process failed." << endl;
       return 0;
@@ -686,7 +1099,7 @@ int DCClient::checkBucket()
    return m_mBucket.size() - count;
 }
 
-int DCClient::startSPE(SPE& s, DS* d)
+int DCClient::startSPE(SPE& s, DS* d, const bool& backup)
 {
    int res = 0;
 
@@ -705,6 +1118,8 @@ int DCClient::startSPE(SPE& s, DS* d)
    s.m_pDS = d;
 
    int32_t size = 20 + s.m_pDS->m_strDataFile.length() + 1;
+   for (unsigned int i = 0; i < s.m_pDS->m_vMergedFiles.size(); ++ i)
+      size += 8 + s.m_pDS->m_vMergedFiles[i].length() + 1;
    char* dataseg = new char[size];
 
    *(int64_t*)(dataseg) = s.m_pDS->m_llOffset;
@@ -712,11 +1127,28 @@ int DCClient::startSPE(SPE& s, DS* d)
    *(int32_t*)(dataseg + 16) = s.m_pDS->m_iID;
    strcpy(dataseg + 20, s.m_pDS->m_strDataFile.c_str());
 
+   // merged files follow, each as {number of records, file name}
+   char* p = dataseg + 20 + s.m_pDS->m_strDataFile.length() + 1;
+   for (unsigned int i = 0; i < s.m_pDS->m_vMergedFiles.size(); ++ i)
+   {
+      *(int64_t*)p = s.m_pDS->m_vMergedRecNum[i];
+      strcpy(p + 8, s.m_pDS->m_vMergedFiles[i].c_str());
+      p += 8 + s.m_pDS->m_vMergedFiles[i].length() + 1;
+   }
+
    if (m_pClient->m_DataChn.send(s.m_strIP, s.m_iDataPort, s.m_iSession, dataseg, size) > 0)
    {
-      d->m_iSPEID = s.m_iID;
-      d->m_iStatus = 1;
-      d->m_iRetryNum ++;
+      if (backup)
+      {
+         d->m_iBackupSPEID = s.m_iID;
+         d->m_bSpeculated = true;
+      }
+      else
+      {
+         d->m_iSPEID = s.m_iID;
+         d->m_iStatus = 1;
+         d->m_iRetryNum ++;
+      }
       s.m_iStatus = 2;
       s.m_iProgress = 0;
       s.m_StartTime = CTimer::getTime();
@@ -729,6 +1161,136 @@ int DCClient::startSPE(SPE& s, DS* d)
    return res;
 }
 
+int DCClient::findStragglers(vector<SPE*>& stragglers)
+{
+   stragglers.clear();
+
+   // only near the end of the job, when every data segment has been started, and its run time is known
+   if ((m_iAvgRunTime <= 0) || (m_Scheduler.pending() > 0))
+      return 0;
+
+   int64_t now = CTimer::getTime();
+
+   // SPEs whose projected run time is more than twice the average, the longest first
+   vector<pair<int64_t, SPE*> > slow;
+   for (map<int, SPE>::iterator p = m_mSPE.begin(); p != m_mSPE.end(); ++ p)
+   {
+      if ((2 != p->second.m_iStatus) || (NULL == p->second.m_pDS))
+         continue;
+
+      DS* d = p->second.m_pDS;
+      if ((1 != d->m_iStatus) || d->m_bSpeculated || (d->m_iSPEID != p->first))
+         continue;
+
+      int64_t elapsed = (now - p->second.m_StartTime) / 1000000;
+      if (elapsed <= m_iAvgRunTime)
+         continue;
+
+      int64_t projected = (p->second.m_iProgress > 0) ? elapsed * 100 / p->second.m_iProgress : elapsed;
+      if (projected > m_iAvgRunTime * 2)
+         slow.push_back(pair<int64_t, SPE*>(-projected, &(p->second)));
+   }
+
+   std::sort(slow.begin(), slow.end());
+   for (vector<pair<int64_t, SPE*> >::iterator i = slow.begin(); i != slow.end(); ++ i)
+      stragglers.push_back(i->second);
+
+   return stragglers.size();
+}
+
+int DCClient::startBackup(SPE& s, const vector<SPE*>& stragglers)
+{
+   Address sn;
+   sn.m_strIP = s.m_strIP;
+   sn.m_iPort = s.m_iPort;
+
+   // the slowest straggler that this SPE can copy
+   for (vector<SPE*>::const_iterator p = stragglers.begin(); p != stragglers.end(); ++ p)
+   {
+      // a straggler is only copied once
+      DS* d = (*p)->m_pDS;
+      if ((1 != d->m_iStatus) || d->m_bSpeculated)
+         continue;
+
+      // another SPE on the same node shares the slow disk or CPU
+      if ((*p)->m_strIP == s.m_strIP)
+         continue;
+
+      // the copy reads a local replica
+      if (m_pClient->m_Topology.min_distance(sn, *(d->m_pLoc)) != 0)
+         continue;
+
+      m_pClient->m_Log << "speculative copy of DS " << d->m_iID << " on " << s.m_strIP << LogEnd();
+
+      return startSPE(s, d, true);
+   }
+
+   return 0;
+}
+
+DCClient::SPE* DCClient::otherCopy(SPE& s)
+{
+   DS* d = s.m_pDS;
+   if (NULL == d)
+      return NULL;
+
+   int id = (d->m_iSPEID == s.m_iID) ? d->m_iBackupSPEID : d->m_iSPEID;
+   if ((id < 0) || (id == s.m_iID))
+      return NULL;
+
+   map<int, SPE>::iterator p = m_mSPE.find(id);
+   if ((p == m_mSPE.end()) || (2 != p->second.m_iStatus) || (p->second.m_pDS != d))
+      return NULL;
+
+   return &(p->second);
+}
+
+int DCClient::cancelSPE(SPE& s)
+{
+   SectorMsg msg;
+   msg.setType(205); // cancel a data segment
+   msg.setKey(m_pClient->m_iKey);
+   msg.setData(0, s.m_strIP.c_str(), s.m_strIP.length() + 1);
+   msg.setData(64, (char*)&(s.m_iPort), 4);
+   msg.setData(68, (char*)&(s.m_iSession), 4);
+   msg.setData(72, (char*)&(s.m_pDS->m_iID), 4);
+
+   Address serv;
+   m_pClient->m_Routing.getPrimaryMaster(serv);
+   if ((m_pClient->m_GMP.rpc(serv.m_strIP.c_str(), serv.m_iPort, &msg, &msg) < 0) || (msg.getType() < 0))
+      return SectorError::E_CONNECTION;
+
+   m_pClient->m_Log << "cancel DS " << s.m_pDS->m_iID << " on " << s.m_strIP << LogEnd();
+
+   return 0;
+}
+
+int DCClient::discardResult(SPE* s)
+{
+   // read the result from the data channel as readResult() does, but keep the output of the other copy
+   if (m_iOutputType == -1)
+   {
+      int size = 0;
+      m_pClient->m_DataChn.recv4(s->m_strIP, s->m_iDataPort, s->m_iSession, size);
+      m_pClient->m_DataChn.recv4(s->m_strIP, s->m_iDataPort, s->m_iSession, size);
+   }
+   else
+   {
+      char* tmp = NULL;
+      int size = 0;
+      m_pClient->m_DataChn.recv(s->m_strIP, s->m_iDataPort, s->m_iSession, tmp, size);
+      delete [] tmp;
+      tmp = NULL;
+      m_pClient->m_DataChn.recv(s->m_strIP, s->m_iDataPort, s->m_iSession, tmp, size);
+      delete [] tmp;
+   }
+
+   s->m_iStatus = 1;
+   m_qIdleSPE.push_back(s->m_iID);
+
+   return 0;
+}
+
 int DCClient::checkProgress()
 {
    if (!m_bOpened)
@@ -825,6 +1387,21 @@ int DCClient::waitForCompletion()
    return 0;
 }
 
+int DCClient::getShuffleSize(int64_t& before, int64_t& after)
+{
+   before = m_llRawShuffleSize;
+   after = m_llShuffleSize;
+   return 0;
+}
+
+int DCClient::getCompressionStat(int64_t& raw, int64_t& compressed, int64_t& usec)
+{
+   raw = m_llShuffleSize;
+   compressed = m_llWireShuffleSize;
+   usec = m_llCompressTime;
+   return 0;
+}
+
 int DCClient::read(SphereResult*& res, const bool /*inorder*/, const bool wait)
 {
    if (!m_bOpened)
@@ -1054,9 +1631,10 @@ int DCClient::prepareSPE(const char* spenodes)
          spe.m_iStatus = 0;
          spe.m_iProgress = 0;
 
-         spe.m_strIP = spenodes + i * 72;
-         spe.m_iPort = *(int32_t*)(spenodes + i * 72 + 64);
-         spe.m_iDataPort = *(int32_t*)(spenodes + i * 72 + 68);
+         spe.m_strIP = spenodes + i * 76;
+         spe.m_iPort = *(int32_t*)(spenodes + i * 76 + 64);
+         spe.m_iDataPort = *(int32_t*)(spenodes + i * 76 + 68);
+         spe.m_iCapability = *(int32_t*)(spenodes + i * 76 + 72);
 
          m_mSPE[spe.m_iID] = spe;
       }
@@ -1065,7 +1643,7 @@ int DCClient::prepareSPE(const char* spenodes)
    return m_mSPE.size();
 }
 
-int DCClient::connectSPE(SPE& s)
+int DCClient::connectSPE(SPE& s, const bool& lib)
 {
    if (s.m_iStatus != 0)
       return -1;
@@ -1085,6 +1663,8 @@ int DCClient::connectSPE(SPE& s)
    msg.setData(offset + 8, m_pcParam, m_iParamSize);
    offset += 4 + 8 + m_iParamSize;
    msg.setData(offset, (char*)&m_iProcType, 4);
+   msg.setData(offset + 4, (char*)&m_iCompression, 4);
+   msg.setData(offset + 8, (char*)&m_iThreads, 4);
 
    Address serv;
    m_pClient->m_Routing.getPrimaryMaster(serv);
@@ -1109,7 +1689,9 @@ int DCClient::connectSPE(SPE& s)
    else if (m_iOutputType < 0)
       m_pClient->m_DataChn.send(s.m_strIP, s.m_iDataPort, s.m_iSession, m_pOutputLoc, strlen(m_pOutputLoc) + 1);
 
-   loadOperator(s.m_strIP, s.m_iPort, s.m_iDataPort, s.m_iSession);
+   // the first SPE on each slave is started by preloadOperator(), which loads the libraries for all of them together
+   if (lib)
+      loadOperator(s.m_strIP, s.m_iPort, s.m_iDataPort, s.m_iSession);
 
    s.m_iStatus = 1;
 
@@ -1126,79 +1708,98 @@ int DCClient::segmentData()
          if (m_pInput->m_vLocation[i].empty())
             return SectorError::E_MISSINGINPUT;
 
-         DS* ds = new DS;
-         ds->m_iID = seq ++;
-         ds->m_strDataFile = m_pInput->m_vFiles[i];
-         ds->m_llOffset = 0;
-         ds->m_llSize = m_pInput->m_vRecNum[i];
-         ds->m_iSPEID = -1;
-         ds->m_iStatus = 0;
-         ds->m_pLoc = &m_pInput->m_vLocation[i];
-
-         ds->m_pResult = new SphereResult;
-         ds->m_pResult->m_iResID = ds->m_iID;
-         ds->m_pResult->m_strOrigFile = ds->m_strDataFile;
-         ds->m_pResult->m_llOrigStartRec = 0;
+         DS* ds = createDS(seq ++, i, 0, m_pInput->m_vRecNum[i]);
          ds->m_pResult->m_llOrigEndRec = -1;
-
-         m_mpDS[ds->m_iID] = ds;
       }
    }
    else if (m_pInput->m_llRecNum != -1)
    {
-      int64_t avg = m_pInput->m_llSize / m_iSPENum;
-      int64_t unitsize;
-      if (avg > m_iMaxUnitSize)
-      {
-         int64_t n = m_pInput->m_llSize / m_iMaxUnitSize;
-         if (m_pInput->m_llSize % m_iMaxUnitSize != 0)
-            n ++;
-         unitsize = m_pInput->m_llRecNum / n;
-      }
-      else if (avg < m_iMinUnitSize)
+      // segment size in bytes: spread the input over all SPEs, but if the processing speed is known from
+      // earlier runs, keep each segment within about a minute of work so that the load can be balanced
+      const int64_t segtime = 60;
+      int64_t unitsize = m_pInput->m_llSize / m_mSPE.size();
+      if ((m_llThroughput > 0) && (unitsize > m_llThroughput * segtime))
+         unitsize = m_llThroughput * segtime;
+      if (unitsize > m_iMaxUnitSize)
+         unitsize = m_iMaxUnitSize;
+      if (unitsize < m_iMinUnitSize)
+         unitsize = m_iMinUnitSize;
+
+      // DS collecting small files, by the node where all of them are located
+      map<Address, DS*, AddrComp> group;
+
+      // any SPE may take any DS, so small files are only merged if every SPE can process merged DSs
+      bool merge = true;
+      for (map<int, SPE>::iterator s = m_mSPE.begin(); s != m_mSPE.end(); ++ s)
       {
-         int64_t n = m_pInput->m_llSize / m_iMinUnitSize;
-         if (m_pInput->m_llSize % m_iMinUnitSize != 0)
-            n ++;
-         unitsize = m_pInput->m_llRecNum / n;
+         if (0 == (s->second.m_iCapability & SlaveCapability::MERGED_DS))
+            merge = false;
       }
-      else
-         unitsize = m_pInput->m_llRecNum / m_iSPENum;
-
-      // at least 1 record per segement
-      if (unitsize < 1)
-         unitsize = 1;
 
       int seq = 0;
       for (int i = 0; i < m_pInput->m_iFileNum; ++ i)
       {
-         int64_t off = 0;
-         while (off < m_pInput->m_vRecNum[i])
-         {
-            if ((0 == m_pInput->m_vFiles[i].length()) || (0 == m_pInput->m_vSize[i]))
-               continue;
+         if ((0 == m_pInput->m_vFiles[i].length()) || (0 == m_pInput->m_vSize[i]) || (0 == m_pInput->m_vRecNum[i]))
+            continue;
+
+         if (m_pInput->m_vLocation[i].empty())
+            return SectorError::E_MISSINGINPUT;
+
+         const int64_t filesize = m_pInput->m_vSize[i];
+         const int64_t recnum = m_pInput->m_vRecNum[i];
 
-            if (m_pInput->m_vLocation[i].empty())
-               return SectorError::E_MISSINGINPUT;
+         if (merge && (filesize < unitsize / 2))
+         {
+            DS* ds = NULL;
+            for (set<Address, AddrComp>::iterator a = m_pInput->m_vLocation[i].begin(); a != m_pInput->m_vLocation[i].end(); ++ a)
+            {
+               map<Address, DS*, AddrComp>::iterator g = group.find(*a);
+               if ((g != group.end()) && (g->second->m_llDataSize + filesize <= unitsize))
+               {
+                  ds = g->second;
+                  break;
+               }
+            }
 
-            DS* ds = new DS;
-            ds->m_iID = seq ++;
-            ds->m_strDataFile = m_pInput->m_vFiles[i];
-            ds->m_llOffset = off;
-            ds->m_llSize = (m_pInput->m_vRecNum[i] - off > unitsize) ? unitsize : (m_pInput->m_vRecNum[i] - off);
-            ds->m_iSPEID = -1;
-            ds->m_iStatus = 0;
-            ds->m_pLoc = &m_pInput->m_vLocation[i];
+            if (NULL != ds)
+            {
+               // only the nodes holding every file of the DS are local to it
+               set<Address, AddrComp> loc;
+               set_intersection(ds->m_pLoc->begin(), ds->m_pLoc->end(), m_pInput->m_vLocation[i].begin(), m_pInput->m_vLocation[i].end(),
+                                inserter(loc, loc.begin()), AddrComp());
+               ds->m_sMergedLoc.swap(loc);
+               ds->m_pLoc = &ds->m_sMergedLoc;
+
+               ds->m_vMergedFiles.push_back(m_pInput->m_vFiles[i]);
+               ds->m_vMergedRecNum.push_back(recnum);
+               ds->m_llDataSize += filesize;
+               ds->m_pResult->m_llOrigEndRec = -1;
+            }
+            else
+               group[*m_pInput->m_vLocation[i].begin()] = createDS(seq ++, i, 0, recnum);
 
-            ds->m_pResult = new SphereResult;
-            ds->m_pResult->m_iResID = ds->m_iID;
-            ds->m_pResult->m_strOrigFile = ds->m_strDataFile;
-            ds->m_pResult->m_llOrigStartRec = ds->m_llOffset;
-            ds->m_pResult->m_llOrigEndRec = ds->m_llSize;
+            continue;
+         }
 
-            m_mpDS[ds->m_iID] = ds;
+         // cut large files at near-equal byte boundaries
+         int parts = (filesize + unitsize - 1) / unitsize;
+         vector<int64_t> cuts;
+         if ((parts > 1) && (cutFile(i, parts, cuts) < 0))
+         {
+            // no index available at the client, assume records of the same size
+            m_pClient->m_Log << "unable to read the index of " << m_pInput->m_vFiles[i] << ", segmenting by record count" << LogEnd();
+            cuts.clear();
+         }
+         if (cuts.empty())
+         {
+            for (int p = 0; p <= parts; ++ p)
+               cuts.push_back(recnum * p / parts);
+         }
 
-            off += ds->m_llSize;
+         for (unsigned int p = 0; p + 1 < cuts.size(); ++ p)
+         {
+            if (cuts[p + 1] > cuts[p])
+               createDS(seq ++, i, cuts[p], cuts[p + 1] - cuts[p]);
          }
       }
    }
@@ -1211,6 +1812,129 @@ int DCClient::segmentData()
    return m_mpDS.size();
 }
 
+DCClient::DS* DCClient::createDS(const int& id, const int& file, const int64_t& offset, const int64_t& rows)
+{
+   DS* ds = new DS;
+   ds->m_iID = id;
+   ds->m_strDataFile = m_pInput->m_vFiles[file];
+   ds->m_llOffset = offset;
+   ds->m_llSize = rows;
+   ds->m_llDataSize = m_pInput->m_vSize[file];
+   if ((m_pInput->m_vRecNum[file] > 0) && (rows < m_pInput->m_vRecNum[file]))
+      ds->m_llDataSize = m_pInput->m_vSize[file] * rows / m_pInput->m_vRecNum[file];
+   ds->m_iSPEID = -1;
+   ds->m_iBackupSPEID = -1;
+   ds->m_bSpeculated = false;
+   ds->m_iStatus = 0;
+   ds->m_iRetryNum = 0;
+   ds->m_pLoc = &m_pInput->m_vLocation[file];
+
+   ds->m_pResult = new SphereResult;
+   ds->m_pResult->m_iResID = ds->m_iID;
+   ds->m_pResult->m_strOrigFile = ds->m_strDataFile;
+   ds->m_pResult->m_llOrigStartRec = ds->m_llOffset;
+   ds->m_pResult->m_llOrigEndRec = ds->m_llSize;
+
+   m_mpDS[ds->m_iID] = ds;
+
+   return ds;
+}
+
+int DCClient::cutFile(const int& file, const int& parts, vector<int64_t>& cuts)
+{
+   const int64_t recnum = m_pInput->m_vRecNum[file];
+   const int64_t filesize = m_pInput->m_vSize[file];
+
+   FSClient* f = m_pClient->createFSClient();
+   if (NULL == f)
+      return -1;
+   if (f->open(m_pInput->m_vFiles[file] + ".idx", SF_MODE::READ) < 0)
+   {
+      m_pClient->releaseFSClient(f);
+      return -1;
+   }
+
+   // the index is read in windows around the expected cut, usually one window per cut
+   const int64_t window = 4096;
+   int64_t* buf = new int64_t[window];
+   int result = 0;
+
+   cuts.clear();
+   cuts.push_back(0);
+   int64_t prevoff = 0;
+
+   for (int k = 1; (k < parts) && (result == 0); ++ k)
+   {
+      const int64_t target = filesize * k / parts;
+
+      // records lo and hi bracket the target, at byte offsets looff and hioff
+      int64_t lo = cuts.back();
+      int64_t looff = prevoff;
+      int64_t hi = recnum;
+      int64_t hioff = filesize;
+      int64_t cut = -1;
+      int64_t cutoff = 0;
+
+      for (int round = 0; (cut < 0) && (round < 64); ++ round)
+      {
+         // guess from the record size between the bounds; bisect every other round in case of heavy skew
+         int64_t guess = (lo + hi) / 2;
+         if ((0 == round % 2) && (hioff > looff))
+            guess = lo + int64_t(double(target - looff) / (hioff - looff) * (hi - lo));
+
+         int64_t start = guess - window / 2;
+         if (start > hi + 1 - window)
+            start = hi + 1 - window;
+         if (start < lo)
+            start = lo;
+         int64_t n = (hi + 1 - start < window) ? hi + 1 - start : window;
+
+         if (f->read((char*)buf, start * 8, n * 8) != n * 8)
+         {
+            result = -1;
+            break;
+         }
+
+         if (buf[0] > target)
+         {
+            hi = start;
+            hioff = buf[0];
+            continue;
+         }
+         if (buf[n - 1] < target)
+         {
+            lo = start + n - 1;
+            looff = buf[n - 1];
+            continue;
+         }
+
+         // the target is within this window, cut at the nearest record boundary
+         int64_t j = 0;
+         while (buf[j] < target)
+            ++ j;
+         if ((j > 0) && (target - buf[j - 1] < buf[j] - target))
+            -- j;
+         cut = start + j;
+         cutoff = buf[j];
+      }
+
+      // a very large record may cover more than one cut
+      if ((cut > cuts.back()) && (cut < recnum))
+      {
+         cuts.push_back(cut);
+         prevoff = cutoff;
+      }
+   }
+
+   cuts.push_back(recnum);
+
+   delete [] buf;
+   f->close();
+   m_pClient->releaseFSClient(f);
+
+   return result;
+}
+
 int DCClient::prepareOutput(const char* spenodes)
 {
    m_pOutputLoc = NULL;
@@ -1226,8 +1950,8 @@ int DCClient::prepareOutput(const char* spenodes)
 
       for (int i = 0; i < m_iSPENum; ++ i)
       {
-         msg.setData(0, spenodes + i * 72, strlen(spenodes + i * 72) + 1);
-         msg.setData(64, spenodes + i * 72 + 64, 4);
+         msg.setData(0, spenodes + i * 76, strlen(spenodes + i * 76) + 1);
+         msg.setData(64, spenodes + i * 76 + 64, 4);
          msg.setData(68, (char*)&(m_pOutput->m_iFileNum), 4);
          msg.setData(72, (char*)&i, 4);
          int size = m_pOutput->m_strPath.length() + 1;
@@ -1250,7 +1974,7 @@ int DCClient::prepareOutput(const char* spenodes)
             msg.setData(offset + 4, m_strOperator.c_str(), m_strOperator.length() + 1);
          }
 
-         m_pClient->m_Log << "request shuffler " << spenodes + i * 72 << " " << *(int*)(spenodes + i * 72 + 64) << LogEnd();
+         m_pClient->m_Log << "request shuffler " << spenodes + i * 76 << " " << *(int*)(spenodes + i * 76 + 64) << LogEnd();
 
          Address serv;
          m_pClient->m_Routing.getPrimaryMaster(serv);
@@ -1267,22 +1991,19 @@ int DCClient::prepareOutput(const char* spenodes)
 
          BUCKET b;
          b.m_iID = i;
-         b.m_strIP = spenodes + i * 72;
-         b.m_iPort = *(int32_t*)(spenodes + i * 72 + 64);
-         b.m_iDataPort = *(int32_t*)(spenodes + i * 72 + 68);
+         b.m_strIP = spenodes + i * 76;
+         b.m_iPort = *(int32_t*)(spenodes + i * 76 + 64);
+         b.m_iDataPort = *(int32_t*)(spenodes + i * 76 + 68);
          b.m_iShufflerPort = *(int32_t*)msg.getData();
          b.m_iSession = *(int32_t*)(msg.getData() + 4);
          b.m_iProgress = 0;
          b.m_LastUpdateTime = CTimer::getTime();
 
          // set up data connection, not for data transfter, but for keep-alive
+         // library files for MapReduce processing are uploaded by preloadOperator()
          if (m_pClient->m_DataChn.connect(b.m_strIP, b.m_iDataPort) < 0)
             continue;
 
-         // upload library files for MapReduce processing
-         if (m_iProcType == 1)
-            loadOperator(b.m_strIP, b.m_iPort, b.m_iDataPort, b.m_iSession);
-
          m_mBucket[b.m_iID] = b;
       }
 
@@ -1447,6 +2168,7 @@ int DCClient::readResult(SPE* s)
 
    s->m_pDS->m_iStatus = 2;
    s->m_iStatus = 1;
+   m_qIdleSPE.push_back(s->m_iID);
    ++ m_iProgress;
 
 #ifndef WIN32
@@ -1464,43 +2186,36 @@ int DCClient::readResult(SPE* s)
 
 int DCClient::prepareSPEJobQueue()
 {
+   // if a file is processed via pass by filename, it must be processed on its original location
+   // also, this depends on if the source data is allowed to move
+   m_Scheduler.reset(!m_bDataMove);
+
    for (map<int, SPE>::iterator s = m_mSPE.begin(); s != m_mSPE.end(); ++ s)
    {
       Address sn;
       sn.m_strIP = s->second.m_strIP;
       sn.m_iPort = s->second.m_iPort;
 
-      // scan all DSs and put them into each SPE's job queue
-      CGuard::enterCS(m_DSLock);
+      vector<int> path;
+      m_pClient->m_Topology.lookup(sn.m_strIP.c_str(), path);
+      m_Scheduler.addSPE(s->first, sn, path);
+   }
 
-      // start from random node
-      map<int, DS*>::iterator dss = m_mpDS.end();
-      int rs = 0;
-      if (!m_mpDS.empty())
-         rs = int(m_mpDS.size() * (double(rand()) / RAND_MAX)) % m_mpDS.size();
-      map<int, DS*>::iterator d = m_mpDS.begin();
-      for (int i = 0; i < rs; ++ i)
-         ++ d;
+   CGuard::enterCS(m_DSLock);
 
-      for (int i = 0, n = m_mpDS.size(); i < n; ++ i)
+   for (map<int, DS*>::iterator d = m_mpDS.begin(); d != m_mpDS.end(); ++ d)
+   {
+      vector< vector<int> > racks;
+      for (set<Address, AddrComp>::iterator a = d->second->m_pLoc->begin(); a != d->second->m_pLoc->end(); ++ a)
       {
-         if (++ d == m_mpDS.end())
-            d = m_mpDS.begin();
-
-         unsigned int dist = m_pClient->m_Topology.min_distance(sn, *(d->second->m_pLoc));
-
-         if ((!m_bDataMove) && (0 != dist))
-         {
-            // if a file is processed via pass by filename, it must be processed on its original location
-            // also, this depends on if the source data is allowed to move
-            continue;
-         }
-
-         s->second.m_mDSQueue[dist].push_back(d->first);
+         vector<int> path;
+         m_pClient->m_Topology.lookup(a->m_strIP.c_str(), path);
+         racks.push_back(path);
       }
-
-      CGuard::leaveCS(m_DSLock);
+      m_Scheduler.addDS(d->first, *(d->second->m_pLoc), racks);
    }
 
+   CGuard::leaveCS(m_DSLock);
+
    return 0;
 }
@@ -22,7 +22,10 @@ written by
 #ifndef __SPHERE_CLIENT_H__
 #define __SPHERE_CLIENT_H__
 
+#include <deque>
+
 #include "client.h"
+#include "dsscheduler.h"
 
 namespace sector
 {
@@ -55,12 +58,36 @@ public:
    int checkReduceProgress();
    int waitForCompletion();
 
+      // Functionality:
+      //    report the size of the map output before and after the map side combiner, summed over all completed segments.
+      // Parameters:
+      //    1) [out] before: map output size
+      //    2) [out] after: data size sent to the buckets
+      // Returned value:
+      //    0.
+
+   int getShuffleSize(int64_t& before, int64_t& after);
+
+      // Functionality:
+      //    report the effect of shuffle compression, summed over all completed segments.
+      // Parameters:
+      //    1) [out] raw: data size sent to the buckets, before compression
+      //    2) [out] compressed: bytes sent to the buckets, including the record index
+      //    3) [out] usec: CPU time spent on compression, in microseconds
+      // Returned value:
+      //    0.
+
+   int getCompressionStat(int64_t& raw, int64_t& compressed, int64_t& usec);
+
    // TODO: support callback APIs for result handling.
 
    inline void setMinUnitSize(int size) {m_iMinUnitSize = size;}
    inline void setMaxUnitSize(int size) {m_iMaxUnitSize = size;}
    inline void setProcNumPerNode(int num) {m_iCore = num;}
+   inline void setProcThreadNum(int num) {m_iThreads = (num > 0) ? num : 1;}
    inline void setDataMoveAttr(bool move) {m_bDataMove = move;}
+   inline void setShuffleCompression(bool compress) {m_iCompression = compress ? 1 : 0;}
+   inline void setSpeculation(bool speculate) {m_bSpeculation = speculate;}
 
 private:
    int m_iProcType;				// 0: sphere 1: mapreduce
@@ -80,8 +107,14 @@ private:
       int m_iID;				// DS ID
       std::string m_strDataFile;		// input data file
       int64_t m_llOffset;			// input data offset
-      int64_t m_llSize;				// input data size
+      int64_t m_llSize;				// input data size, number of records in m_strDataFile
+      int64_t m_llDataSize;			// input data size, in bytes
+      std::vector<std::string> m_vMergedFiles;	// small files processed whole in the same DS, after m_strDataFile
+      std::vector<int64_t> m_vMergedRecNum;	// number of records in each merged file
+      std::set<Address, AddrComp> m_sMergedLoc;	// nodes holding all the merged files, m_pLoc points here if there are any
       int m_iSPEID;				// processing SPE
+      int m_iBackupSPEID;			// SPE running a speculative copy, -1 if none
+      bool m_bSpeculated;			// if a speculative copy has ever been started
       std::set<Address, AddrComp>* m_pLoc;	// locations of DS
 
       int m_iStatus;                            // 0: not started yet; 1: in progress; 2: done, result ready; 3: result read; -1: failed
@@ -103,10 +136,13 @@ private:
       int64_t m_StartTime;			// SPE start time
       int64_t m_LastUpdateTime;			// SPE last update time
       int m_iSession;				// SPE session ID for data channel
-
-      std::map<int, std::list<int> > m_mDSQueue;	// job queue
+      int32_t m_iCapability;			// features supported by the SPE slave, see SlaveCapability
    };
    std::map<int, SPE> m_mSPE;
+   DSScheduler m_Scheduler;			// DSs waiting for an SPE, by location
+   std::deque<int> m_qIdleSPE;			// SPEs that may take a DS, in the order they became idle
+   std::set<int> m_sParkedSPE;			// idle SPEs that found no DS, queued again when a DS is requeued
+   int64_t m_llLastSPECheck;			// last time all SPEs were checked for loss and progress
 
    struct BUCKET
    {
@@ -128,6 +164,10 @@ private:
    int m_iTotalSPE;				// total number of SPEs
    int m_iAvailRes;				// number of availale result to be read
    bool m_bBucketHealth;			// if all bucket nodes are alive; unable to recover from bucket failure
+   int64_t m_llRawShuffleSize;			// map output size, before the combiner
+   int64_t m_llShuffleSize;			// data size sent to the buckets
+   int64_t m_llWireShuffleSize;			// data size sent to the buckets, after compression
+   int64_t m_llCompressTime;			// CPU time spent on shuffle compression, microseconds
 
    pthread_mutex_t m_ResLock;
    pthread_cond_t m_ResCond;
@@ -135,23 +175,52 @@ private:
    int m_iMinUnitSize;				// minimum data segment size
    int m_iMaxUnitSize;				// maximum data segment size, must be smaller than physical memory
    int m_iCore;					// number of processing instances on each node
+   int m_iThreads;				// number of threads running a thread safe UDF in each SPE
    bool m_bDataMove;				// if source data is allowed to move for Sphere process
+   int64_t m_llThroughput;			// input bytes processed per second by one SPE, measured over all runs; 0 if unknown
+   int m_iCompression;				// shuffle compression: 0, none; 1, LZ4 blocks
+   bool m_bSpeculation;				// if straggling data segments are duplicated near the end of the job
+   std::map<int, int> m_mDSWinner;		// duplicated data segment -> SPE whose result is kept
+
+   struct LibHolder
+   {
+      std::string m_strIP;			// slave IP
+      int m_iPort;				// slave GMP port
+      int m_iDataPort;				// slave data port
+   };
 
    struct OP
    {
       std::string m_strLibrary;			// UDF name
       std::string m_strLibPath;			// path of the dynamic library that contains the UDF
       int m_iSize;				// size of the library
+      std::string m_strHash;			// content hash of the library, slaves cache libraries by it
       std::set<std::string> m_sUploaded;	// slave address that the op has been uploaded to; to avoid uploading a library multiple times
+      std::vector<LibHolder> m_vHolders;	// slaves known to have the library in their cache, in the order they got it
    };
+   struct LibTarget
+   {
+      std::string m_strIP;			// slave IP
+      int m_iPort;				// slave GMP port
+      int m_iDataPort;				// slave data port
+      int m_iSession;				// session of the SPE or shuffler that receives the libraries
+   };
+
    std::map<std::string, OP> m_mOP;
+   static const int m_iLibFanout = 4;		// number of slaves each holder sends a library to
+   int preloadOperator();
    int loadOperator(const std::string& ip, const int port, const int dataport, const int session);
+   int loadOperator(const std::vector<LibTarget>& targets);
+   int sendLibrary(const OP& op, const LibHolder& src, const std::string& ip, const int dataport, const int session);
+   void dropHolder(OP& op, const LibHolder& holder);
 
 private: // inputs and outputs
    int dataInfo(const std::vector<std::string>& files, std::vector<std::string>& info);
    int prepareInput();
    int prepareSPE(const char* spenodes);
    int segmentData();
+   DS* createDS(const int& id, const int& file, const int64_t& offset, const int64_t& rows);
+   int cutFile(const int& file, const int& parts, std::vector<int64_t>& cuts);
    int prepareSPEJobQueue();
    int prepareOutput(const char* spenodes);
    int postProcessOutput();
@@ -168,11 +237,18 @@ private: // running and schedulling
 
    int start();
    int checkSPE();
-   int startSPE(SPE& s, DS* d);
-   int connectSPE(SPE& s);
+   int startSPE(SPE& s, DS* d, const bool& backup = false);
+   int connectSPE(SPE& s, const bool& lib = true);
    int checkBucket();
    int readResult(SPE* s);
 
+private: // speculative execution
+   int findStragglers(std::vector<SPE*>& stragglers);
+   int startBackup(SPE& s, const std::vector<SPE*>& stragglers);
+   SPE* otherCopy(SPE& s);
+   int cancelSPE(SPE& s);
+   int discardResult(SPE* s);
+
 private:
    Client* m_pClient;				// pointer to the sector client
    int m_iID;					// unique instance id
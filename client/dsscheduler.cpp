@@ -0,0 +1,143 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include "dsscheduler.h"
+
+using namespace std;
+
+DSScheduler::DSScheduler():
+m_bLocal(false),
+m_iPending(0)
+{
+}
+
+void DSScheduler::reset(const bool& local)
+{
+   m_bLocal = local;
+   m_mSPE.clear();
+   m_vDS.clear();
+   m_mNodePool.clear();
+   m_mRackPool.clear();
+   m_AllPool = Pool();
+   m_iPending = 0;
+}
+
+void DSScheduler::addSPE(const int& speid, const Address& node, const vector<int>& rack)
+{
+   SPEInfo& s = m_mSPE[speid];
+   s.m_Node = node;
+   s.m_viRack = rack;
+}
+
+void DSScheduler::addDS(const int& dsid, const set<Address, AddrComp>& loc, const vector< vector<int> >& racks)
+{
+   if (dsid >= int(m_vDS.size()))
+      m_vDS.resize(dsid + 1);
+
+   DSInfo& d = m_vDS[dsid];
+   d.m_sLoc = loc;
+   d.m_sRack.clear();
+   d.m_sRack.insert(racks.begin(), racks.end());
+   d.m_bPending = false;
+
+   push(dsid);
+}
+
+int DSScheduler::next(const int& speid)
+{
+   if (0 == m_iPending)
+      return -1;
+
+   map<int, SPEInfo>::iterator s = m_mSPE.find(speid);
+   if (s == m_mSPE.end())
+      return -1;
+
+   map<Address, Pool, AddrComp>::iterator n = m_mNodePool.find(s->second.m_Node);
+   if (n != m_mNodePool.end())
+   {
+      int dsid = take(n->second);
+      if (n->second.empty())
+         m_mNodePool.erase(n);
+      if (dsid >= 0)
+         return dsid;
+   }
+
+   if (m_bLocal)
+      return -1;
+
+   map<vector<int>, Pool>::iterator r = m_mRackPool.find(s->second.m_viRack);
+   if (r != m_mRackPool.end())
+   {
+      int dsid = take(r->second);
+      if (r->second.empty())
+         m_mRackPool.erase(r);
+      if (dsid >= 0)
+         return dsid;
+   }
+
+   return take(m_AllPool);
+}
+
+void DSScheduler::requeue(const int& dsid)
+{
+   if ((dsid < 0) || (dsid >= int(m_vDS.size())) || m_vDS[dsid].m_bPending)
+      return;
+
+   push(dsid);
+}
+
+int DSScheduler::take(Pool& pool)
+{
+   // a DS is in several pools, skip the ones already taken from another pool
+   while (!pool.empty())
+   {
+      int dsid = pool.top().second;
+      pool.pop();
+
+      if (m_vDS[dsid].m_bPending)
+      {
+         m_vDS[dsid].m_bPending = false;
+         -- m_iPending;
+         return dsid;
+      }
+   }
+
+   return -1;
+}
+
+void DSScheduler::push(const int& dsid)
+{
+   DSInfo& d = m_vDS[dsid];
+   pair<int, int> key(d.m_sLoc.size(), dsid);
+
+   for (set<Address, AddrComp>::const_iterator i = d.m_sLoc.begin(); i != d.m_sLoc.end(); ++ i)
+      m_mNodePool[*i].push(key);
+
+   if (!m_bLocal)
+   {
+      for (set< vector<int> >::const_iterator i = d.m_sRack.begin(); i != d.m_sRack.end(); ++ i)
+         m_mRackPool[*i].push(key);
+      m_AllPool.push(key);
+   }
+
+   d.m_bPending = true;
+   ++ m_iPending;
+}
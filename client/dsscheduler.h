@@ -0,0 +1,129 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#ifndef __SPHERE_DS_SCHEDULER_H__
+#define __SPHERE_DS_SCHEDULER_H__
+
+#include <functional>
+#include <map>
+#include <queue>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sector.h"
+
+// Assign data segments (DS) to SPEs. Pending DSs are kept in pools by the node and by the rack
+// where they are located, plus one pool of all DSs, so that an idle SPE finds its nearest DS
+// without scanning the job. Within a pool, DSs with fewer replicas come first: they have fewer
+// nodes to be processed locally on.
+
+class DSScheduler
+{
+public:
+   DSScheduler();
+
+public:
+      // Functionality:
+      //    remove all SPEs and DSs.
+      // Parameters:
+      //    1) [in] local: if a DS can only be processed on a node where it is located
+      // Returned value:
+      //    None.
+
+   void reset(const bool& local);
+
+      // Functionality:
+      //    add an SPE.
+      // Parameters:
+      //    1) [in] speid: SPE ID
+      //    2) [in] node: address of the slave running the SPE
+      //    3) [in] rack: topology path of the slave
+      // Returned value:
+      //    None.
+
+   void addSPE(const int& speid, const Address& node, const std::vector<int>& rack);
+
+      // Functionality:
+      //    add a DS to be processed.
+      // Parameters:
+      //    1) [in] dsid: DS ID, small non-negative numbers
+      //    2) [in] loc: slaves where the DS is located
+      //    3) [in] racks: topology paths of these slaves
+      // Returned value:
+      //    None.
+
+   void addDS(const int& dsid, const std::set<Address, AddrComp>& loc, const std::vector< std::vector<int> >& racks);
+
+      // Functionality:
+      //    take the next DS for an idle SPE: a local one, else one on the same rack, else any.
+      // Parameters:
+      //    1) [in] speid: SPE ID
+      // Returned value:
+      //    DS ID, or -1 if there is nothing the SPE can process.
+
+   int next(const int& speid);
+
+      // Functionality:
+      //    return a DS taken by next() to the pools, e.g., after its SPE was lost.
+      // Parameters:
+      //    1) [in] dsid: DS ID
+      // Returned value:
+      //    None.
+
+   void requeue(const int& dsid);
+
+   inline int pending() const {return m_iPending;}
+
+private:
+   // (replicas, DS ID), smallest first
+   typedef std::priority_queue<std::pair<int, int>, std::vector< std::pair<int, int> >, std::greater< std::pair<int, int> > > Pool;
+
+   int take(Pool& pool);
+   void push(const int& dsid);
+
+private:
+   bool m_bLocal;				// DSs are processed on their own nodes only
+
+   struct SPEInfo
+   {
+      Address m_Node;				// slave address
+      std::vector<int> m_viRack;		// topology path
+   };
+   std::map<int, SPEInfo> m_mSPE;
+
+   struct DSInfo
+   {
+      std::set<Address, AddrComp> m_sLoc;	// DS locations
+      std::set< std::vector<int> > m_sRack;	// racks of the locations
+      bool m_bPending;				// waiting for an SPE
+   };
+   std::vector<DSInfo> m_vDS;			// indexed by DS ID
+
+   std::map<Address, Pool, AddrComp> m_mNodePool;	// pending DSs on each node
+   std::map<std::vector<int>, Pool> m_mRackPool;	// pending DSs on each rack
+   Pool m_AllPool;				// all pending DSs
+
+   int m_iPending;				// number of pending DSs
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <queue>
+#include <set>
+#include <vector>
+
+#include "dsscheduler.h"
+
+using namespace std;
+
+Address node(int n)
+{
+   char ip[32];
+   sprintf(ip, "10.0.%d.%d", n / 250, n % 250 + 1);
+   Address a;
+   a.m_strIP = ip;
+   a.m_iPort = 6000;
+   return a;
+}
+
+vector<int> rack(int n, int nodes_per_rack)
+{
+   vector<int> path;
+   path.push_back(n / nodes_per_rack);
+   return path;
+}
+
+void addDS(DSScheduler& s, int id, const vector<int>& nodes, int nodes_per_rack)
+{
+   set<Address, AddrComp> loc;
+   vector< vector<int> > racks;
+   for (unsigned int i = 0; i < nodes.size(); ++ i)
+   {
+      loc.insert(node(nodes[i]));
+      racks.push_back(rack(nodes[i], nodes_per_rack));
+   }
+   s.addDS(id, loc, racks);
+}
+
+// local DSs first, then the same rack, then any; fewer replicas first
+int test1()
+{
+   DSScheduler s;
+   s.reset(false);
+
+   // 4 nodes, 2 per rack, one SPE on each
+   for (int i = 0; i < 4; ++ i)
+      s.addSPE(i, node(i), rack(i, 2));
+
+   vector<int> loc;
+   loc.push_back(0);
+   loc.push_back(2);
+   addDS(s, 0, loc, 2);		// nodes 0 and 2
+   loc.clear();
+   loc.push_back(0);
+   addDS(s, 1, loc, 2);		// node 0 only
+   loc.clear();
+   loc.push_back(1);
+   addDS(s, 2, loc, 2);		// node 1 only
+   assert(s.pending() == 3);
+
+   // the DS with a single replica goes first
+   assert(s.next(0) == 1);
+   assert(s.next(0) == 0);
+   // nothing left on node 0, take one from the same rack
+   assert(s.next(0) == 2);
+   assert(s.next(3) == -1);
+   assert(s.pending() == 0);
+
+   // a DS returned to the pools is found again, but only once
+   s.requeue(2);
+   s.requeue(2);
+   assert(s.pending() == 1);
+   assert(s.next(3) == 2);
+   assert(s.next(1) == -1);
+
+   // when data cannot move, only local DSs are assigned
+   s.reset(true);
+   for (int i = 0; i < 4; ++ i)
+      s.addSPE(i, node(i), rack(i, 2));
+   loc.clear();
+   loc.push_back(1);
+   addDS(s, 0, loc, 2);
+   assert(s.next(0) == -1);
+   assert(s.next(1) == 0);
+
+   cout << "DS scheduler testing passed.\n";
+   return 0;
+}
+
+// simulate a large job: SPEs ask for a DS whenever they become idle
+int test2(int nodes, int spe_per_node, int dsnum)
+{
+   const int nodes_per_rack = 20;
+
+   DSScheduler s;
+   s.reset(false);
+   for (int n = 0; n < nodes; ++ n)
+      for (int c = 0; c < spe_per_node; ++ c)
+         s.addSPE(c * nodes + n, node(n), rack(n, nodes_per_rack));
+
+   srand(0);
+   vector< vector<int> > placement(dsnum);
+   for (int d = 0; d < dsnum; ++ d)
+   {
+      // 1 to 3 replicas, with a few hot nodes holding more data
+      int replicas = 1 + rand() % 3;
+      for (int r = 0; r < replicas; ++ r)
+         placement[d].push_back((rand() % 4 == 0) ? rand() % (nodes / 10) : rand() % nodes);
+      addDS(s, d, placement[d], nodes_per_rack);
+   }
+
+   // events: (finish time, SPE); a local DS takes 10 time units, a rack local one 15 and a remote one 30
+   priority_queue<pair<int64_t, int>, vector<pair<int64_t, int> >, greater<pair<int64_t, int> > > events;
+   for (int i = 0; i < nodes * spe_per_node; ++ i)
+      events.push(make_pair(0, i));
+
+   int done = 0;
+   int local = 0;
+   int racklocal = 0;
+   int64_t makespan = 0;
+   clock_t start = clock();
+
+   while (!events.empty())
+   {
+      int64_t t = events.top().first;
+      int spe = events.top().second;
+      events.pop();
+      makespan = t;
+
+      int d = s.next(spe);
+      if (d < 0)
+         continue;
+
+      // now and then an SPE is lost and its DS is processed by another one
+      if (rand() % 1000 == 0)
+      {
+         s.requeue(d);
+         continue;
+      }
+
+      int n = spe % nodes;
+      int cost = 30;
+      for (unsigned int r = 0; r < placement[d].size(); ++ r)
+      {
+         if (placement[d][r] == n)
+            cost = 10;
+         else if ((cost > 15) && (placement[d][r] / nodes_per_rack == n / nodes_per_rack))
+            cost = 15;
+      }
+
+      if (10 == cost)
+         ++ local;
+      else if (15 == cost)
+         ++ racklocal;
+      ++ done;
+
+      events.push(make_pair(t + cost, spe));
+   }
+
+   double sec = double(clock() - start) / CLOCKS_PER_SEC;
+
+   assert(done == dsnum);
+   assert(s.pending() == 0);
+   assert(local > dsnum * 0.9);
+
+   cout << nodes * spe_per_node << " SPEs, " << dsnum << " DSs: " << local << " local, " << racklocal << " rack local, ";
+   cout << "makespan " << makespan << ", scheduling time " << sec << " seconds\n";
+   return 0;
+}
+
+int main()
+{
+   test1();
+   test2(100, 2, 10000);
+   test2(500, 4, 200000);
+
+   return 0;
+}
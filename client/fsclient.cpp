@@ -22,6 +22,8 @@ written by
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <set>
 #include <ctime>
 
 #include "common.h"
@@ -53,6 +55,12 @@ namespace
 
       return myLogger;
    }
+
+   // per-range progress of a parallel download is kept next to the local file until it completes
+   inline string progressPath(const char* localpath)
+   {
+      return string(localpath) + ".sector_progress";
+   }
 }
 
 
@@ -89,11 +97,16 @@ int Client::releaseFSClient(FSClient* sf)
 }
 
 FSClient::FSClient():
+m_pErasure(NULL),
+m_vShards(),
+m_viShardIndex(),
+m_llChunkSize(0),
 m_iSession(),
 m_strSlaveIP(),
 m_iSlaveDataPort(),
 m_pEncoder(NULL),
 m_pDecoder(NULL),
+m_mCipher(),
 m_strFileName(),
 m_llSize(0),
 m_llCurReadPos(0),
@@ -120,6 +133,7 @@ FSClient::~FSClient()
 
    delete m_pEncoder;
    delete m_pDecoder;
+   delete m_pErasure;
 
    CGuard::releaseMutex(m_FileLock);
 }
@@ -156,6 +170,10 @@ int FSClient::open(const string& filename, int mode, const SF_OPT* option)
    if (len_opt > 0)
       msg.setData(16 + len_name, buf.c_str(), len_opt);
 
+   // ciphers this client can use, the slaves choose one of them for a secure transfer
+   int32_t ciphers = Crypto::getCipherList();
+   msg.setData(16 + len_name + len_opt, (char*)&ciphers, 4);
+
    Address serv;
    if (m_pClient->lookup(m_strFileName, serv) < 0)
       return SectorError::E_MASTER;
@@ -168,12 +186,15 @@ int FSClient::open(const string& filename, int mode, const SF_OPT* option)
          return SectorError::E_MASTER;
       if (m_pClient->m_GMP.rpc(serv.m_strIP.c_str(), serv.m_iPort, &msg, &msg) < 0)
          return SectorError::E_MASTER;
-      if (msg.getType() < 0)
-         return *(int32_t*)msg.getData();
    }
-   else if (msg.getType() < 0)
+
+   if (msg.getType() < 0)
    {
-      return *(int32_t*)msg.getData();
+      // a cold file may have been erasure coded, in which case it can still be read from its shards
+      int32_t err = *(int32_t*)msg.getData();
+      if ((SectorError::E_NOEXIST == err) && !(mode & 2) && !ECShard::isShard(m_strFileName))
+         return openShards_(mode);
+      return err;
    }
 
    m_iSession = *(int32_t*)msg.getData();
@@ -190,13 +211,19 @@ int FSClient::open(const string& filename, int mode, const SF_OPT* option)
    int32_t slave_num = *(int32_t*)(msg.getData() + 20);
    int offset = 24;
 
+   // the addresses are followed by the cipher of each node, unless the master is an older version
+   bool cipher_list = msg.m_iDataLength >= SectorMsg::m_iHdrSize + offset + slave_num * (68 + 4);
+   int cipher_pos = offset + slave_num * 68;
+
    m_vReplicaAddress.clear();
+   m_mCipher.clear();
    for (int i = 0; i < slave_num; ++ i)
    {
       Address addr;
       addr.m_strIP = msg.getData() + offset;
       addr.m_iPort = *(int32_t*)(msg.getData() + offset + 64);
       offset += 68;
+      m_mCipher[addr] = cipher_list ? *(int32_t*)(msg.getData() + cipher_pos + i * 4) : CipherType::BLOWFISH;
       if (m_pClient->m_DataChn.connect(addr.m_strIP, addr.m_iPort) >= 0)
          m_vReplicaAddress.push_back(addr);
    }
@@ -269,15 +296,8 @@ int FSClient::open(const string& filename, int mode, const SF_OPT* option)
    if (mode & 8)
       m_llCurWritePos = m_llSize;
 
-   if (m_bSecure)
-   {
-      memcpy(m_pcKey, m_pClient->m_pcCryptoKey, 16);
-      memcpy(m_pcIV, m_pClient->m_pcCryptoIV, 8);
-      m_pEncoder = new Crypto;
-      m_pEncoder->initEnc(m_pcKey, m_pcIV);
-      m_pDecoder = new Crypto;
-      m_pDecoder->initDec(m_pcKey, m_pcIV);
-   }
+   if (m_bSecure && (initCoders_() < 0))
+      return SectorError::E_SECURITY;
 
    m_pClient->m_Cache.update(m_strFileName, m_llTimeStamp, m_llSize, true);
 
@@ -308,6 +328,8 @@ int FSClient::reopen()
    msg.setData(0, (char*)&m_iSession, 4);
    int32_t port = m_pClient->m_DataChn.getPort();
    msg.setData(4, (char*)&port, 4);
+   int32_t ciphers = Crypto::getCipherList();
+   msg.setData(8, (char*)&ciphers, 4);
 
    Address serv;
    if (m_pClient->lookup(m_strFileName, serv) < 0)
@@ -325,21 +347,34 @@ int FSClient::reopen()
    addr.m_strIP = m_strSlaveIP;
    addr.m_iPort = m_iSlaveDataPort;
    m_vReplicaAddress.push_back(addr);
+   m_mCipher[addr] = (msg.m_iDataLength >= SectorMsg::m_iHdrSize + 72) ? *(int32_t*)(msg.getData() + 68) : CipherType::BLOWFISH;
 
    if (m_pClient->m_DataChn.connect(m_strSlaveIP, m_iSlaveDataPort) < 0)
       return SectorError::E_CONNECTION;
 
    if (m_bSecure)
-   {
-      memcpy(m_pcKey, m_pClient->m_pcCryptoKey, 16);
-      memcpy(m_pcIV, m_pClient->m_pcCryptoIV, 8);
-      delete m_pEncoder;
-      m_pEncoder = new Crypto;
-      m_pEncoder->initEnc(m_pcKey, m_pcIV);
-      delete m_pDecoder;
-      m_pDecoder = new Crypto;
-      m_pDecoder->initDec(m_pcKey, m_pcIV);
-   }
+      return initCoders_();
+
+   return 0;
+}
+
+int FSClient::initCoders_()
+{
+   // the coders are made for the node the client talks to, with the cipher that node has chosen
+   Address addr;
+   addr.m_strIP = m_strSlaveIP;
+   addr.m_iPort = m_iSlaveDataPort;
+   map<Address, int, AddrComp>::iterator c = m_mCipher.find(addr);
+   int cipher = (c != m_mCipher.end()) ? c->second : CipherType::BLOWFISH;
+
+   memcpy(m_pcKey, m_pClient->m_pcCryptoKey, 16);
+   memcpy(m_pcIV, m_pClient->m_pcCryptoIV, 8);
+   delete m_pEncoder;
+   m_pEncoder = new Crypto;
+   delete m_pDecoder;
+   m_pDecoder = new Crypto;
+   if ((m_pEncoder->initEnc(m_pcKey, m_pcIV, cipher) < 0) || (m_pDecoder->initDec(m_pcKey, m_pcIV, cipher) < 0))
+      return SectorError::E_SECURITY;
 
    return 0;
 }
@@ -367,6 +402,14 @@ int64_t FSClient::read(char* buf, const int64_t& offset, const int64_t& size, co
    if (m_llCurReadPos + size > m_llSize)
       realsize = int(m_llSize - m_llCurReadPos);
 
+   if (NULL != m_pErasure)
+   {
+      int64_t r = readShards_(buf, m_llCurReadPos, realsize);
+      if (r > 0)
+         m_llCurReadPos += r;
+      return r;
+   }
+
    // optimization on local file; read directly outside Sector
    if (m_bReadLocal)
    {
@@ -542,7 +585,7 @@ int64_t FSClient::write(const char* buf, const int64_t& size)
    return write(buf, offset, size);
 }
 
-int64_t FSClient::download(const char* localpath, const bool& cont)
+int64_t FSClient::download(const char* localpath, const bool& cont, const int& streams)
 {
    log().debug << __PRETTY_FUNCTION__ << ": downloading to file " << localpath << ", cont = "
 	<< std::boolalpha << cont << std::endl;
@@ -552,6 +595,14 @@ int64_t FSClient::download(const char* localpath, const bool& cont)
 
    CGuard fg(m_FileLock);
 
+   if (NULL != m_pErasure)
+      return downloadShards_(localpath, cont);
+
+   // a file partially received by parallel streams has holes, so it can only be resumed from its progress log
+   SNode s;
+   if ((streams > 1) || (cont && (LocalFS::stat(progressPath(localpath), s) >= 0)))
+      return pdownload_(localpath, cont, streams);
+
    int64_t offset;
    fstream ofs;
 
@@ -647,6 +698,264 @@ int64_t FSClient::download(const char* localpath, const bool& cont)
    return realsize;
 }
 
+// ranges of a parallel download that are still to be received, shared by all streams
+struct FSClient::DownloadJob
+{
+   string m_strLocalPath;	// local destination file
+   int64_t m_llSize;		// source file size
+   int64_t m_llUnit;		// range size
+
+   list<int64_t> m_lPending;	// index of ranges not received yet
+   int64_t m_llRecvd;		// bytes received by this download
+   ofstream m_Progress;		// log of completed ranges
+   pthread_mutex_t m_Lock;
+
+   bool next(int64_t& range)
+   {
+      CGuard jg(m_Lock);
+      if (m_lPending.empty())
+         return false;
+      range = m_lPending.front();
+      m_lPending.pop_front();
+      return true;
+   }
+
+   void giveBack(const int64_t& range)
+   {
+      CGuard jg(m_Lock);
+      m_lPending.push_back(range);
+   }
+
+   void done(const int64_t& range, const int64_t& size)
+   {
+      CGuard jg(m_Lock);
+      m_llRecvd += size;
+      // one line per range, flushed immediately, so that an interrupted download loses at most the ranges in flight
+      m_Progress << range << endl;
+   }
+};
+
+struct FSClient::DownloadStream
+{
+   FSClient* m_pFile;		// file session used by this stream
+   DownloadJob* m_pJob;
+};
+
+int FSClient::recvrange_(fstream& ofs, const int64_t& offset, const int64_t& size)
+{
+   // read command: 1; the range is received directly into the local file
+   int32_t cmd = 1;
+   if (m_pClient->m_DataChn.send(m_strSlaveIP, m_iSlaveDataPort, m_iSession, (char*)&cmd, 4) < 0)
+      return SectorError::E_CONNECTION;
+
+   char req[16];
+   *(int64_t*)req = offset;
+   *(int64_t*)(req + 8) = size;
+   if (m_pClient->m_DataChn.send(m_strSlaveIP, m_iSlaveDataPort, m_iSession, req, 16) < 0)
+      return SectorError::E_CONNECTION;
+
+   int response = -1;
+   if ((m_pClient->m_DataChn.recv4(m_strSlaveIP, m_iSlaveDataPort, m_iSession, response) < 0) || (-1 == response))
+      return SectorError::E_CONNECTION;
+
+   int64_t recvsize = size;
+   if ((m_pClient->m_DataChn.recvfile(m_strSlaveIP, m_iSlaveDataPort, m_iSession, ofs, offset, recvsize, m_pDecoder) < 0) || (recvsize != size))
+      return SectorError::E_CONNECTION;
+
+   return 0;
+}
+
+#ifndef WIN32
+void* FSClient::downloadHandler(void* param)
+#else
+DWORD WINAPI FSClient::downloadHandler(LPVOID param)
+#endif
+{
+   FSClient* self = ((DownloadStream*)param)->m_pFile;
+   DownloadJob* job = ((DownloadStream*)param)->m_pJob;
+
+   fstream ofs(job->m_strLocalPath.c_str(), ios::in | ios::out | ios::binary);
+   if (ofs.fail())
+      return NULL;
+
+   bool reopened = false;
+   int64_t range;
+   while (job->next(range))
+   {
+      int64_t offset = range * job->m_llUnit;
+      int64_t size = job->m_llSize - offset;
+      if (size > job->m_llUnit)
+         size = job->m_llUnit;
+
+      if (self->recvrange_(ofs, offset, size) < 0)
+      {
+         job->giveBack(range);
+
+         // retry once with another copy, otherwise leave the remaining ranges to the other streams
+         if (reopened || (self->reopen() < 0))
+         {
+            log().error << "download stream from " << self->m_strSlaveIP << " failed at offset " << offset << std::endl;
+            break;
+         }
+         reopened = true;
+         continue;
+      }
+
+      job->done(range, size);
+   }
+
+   ofs.close();
+
+   return NULL;
+}
+
+int64_t FSClient::pdownload_(const char* localpath, const bool& cont, const int& streams)
+{
+   DownloadJob job;
+   job.m_strLocalPath = localpath;
+   job.m_llSize = m_llSize;
+   job.m_llUnit = m_llRangeSize;
+   job.m_llRecvd = 0;
+
+   int64_t ranges = (m_llSize + job.m_llUnit - 1) / job.m_llUnit;
+   string progress = progressPath(localpath);
+
+   // find the ranges received by a previous download of the same file version
+   set<int64_t> done;
+   SNode s;
+   if (cont && (LocalFS::stat(localpath, s) >= 0))
+   {
+      ifstream ifs(progress.c_str());
+      int64_t size = -1;
+      int64_t ts = -1;
+      int64_t unit = -1;
+      if (ifs >> size >> ts >> unit)
+      {
+         int64_t r;
+         if ((size == m_llSize) && (ts == m_llTimeStamp) && (unit == job.m_llUnit))
+         {
+            while (ifs >> r)
+            {
+               if ((r >= 0) && (r < ranges))
+                  done.insert(r);
+            }
+         }
+      }
+      else
+      {
+         // a sequential download leaves a contiguous prefix of the file
+         for (int64_t r = 0; (r < ranges) && ((r + 1) * job.m_llUnit <= s.m_llSize); ++ r)
+            done.insert(r);
+      }
+      ifs.close();
+   }
+
+   if (done.empty())
+   {
+      ofstream ofs(localpath, ios::out | ios::binary | ios::trunc);
+      if (ofs.fail())
+         return SectorError::E_LOCALFILE;
+      ofs.close();
+   }
+   else
+   {
+      log().debug << "continuing download, " << done.size() << " of " << ranges << " ranges already received" << std::endl;
+   }
+
+   job.m_Progress.open(progress.c_str(), ios::out | ios::trunc);
+   if (job.m_Progress.fail())
+      return SectorError::E_LOCALFILE;
+   job.m_Progress << m_llSize << " " << m_llTimeStamp << " " << job.m_llUnit << endl;
+   for (int64_t r = 0; r < ranges; ++ r)
+   {
+      if (done.find(r) == done.end())
+         job.m_lPending.push_back(r);
+      else
+         job.m_Progress << r << endl;
+   }
+
+   // open one more session per stream, spread over the replicas of the file
+   vector<FSClient*> files;
+   files.push_back(this);
+
+   vector<string> replicas;
+   SNode attr;
+   if (m_pClient->stat(m_strFileName, attr) >= 0)
+   {
+      for (set<Address, AddrComp>::iterator i = attr.m_sLocation.begin(); i != attr.m_sLocation.end(); ++ i)
+         replicas.push_back(i->m_strIP);
+   }
+
+   int mode = SF_MODE::READ;
+   if (m_bSecure)
+      mode |= SF_MODE::SECURE;
+
+   for (int i = 1; (i < streams) && (i < int(job.m_lPending.size())); ++ i)
+   {
+      SF_OPT option;
+      if (!replicas.empty())
+         option.m_strHintIP = replicas[i % replicas.size()];
+
+      FSClient* f = m_pClient->createFSClient();
+      if (NULL == f)
+         break;
+      if (f->open(m_strFileName, mode, &option) < 0)
+      {
+         m_pClient->releaseFSClient(f);
+         continue;
+      }
+      files.push_back(f);
+   }
+
+   log().debug << "downloading " << job.m_lPending.size() << " ranges of " << m_strFileName << " over " << files.size() << " streams" << std::endl;
+
+   CGuard::createMutex(job.m_Lock);
+
+   vector<DownloadStream> param(files.size());
+   vector<pthread_t> handler(files.size());
+   for (unsigned int i = 0; i < files.size(); ++ i)
+   {
+      param[i].m_pFile = files[i];
+      param[i].m_pJob = &job;
+#ifndef WIN32
+      pthread_create(&handler[i], NULL, downloadHandler, &param[i]);
+#else
+      handler[i] = CreateThread(NULL, 0, downloadHandler, &param[i], 0, NULL);
+#endif
+   }
+
+   for (unsigned int i = 0; i < files.size(); ++ i)
+   {
+#ifndef WIN32
+      pthread_join(handler[i], NULL);
+#else
+      WaitForSingleObject(handler[i], INFINITE);
+#endif
+   }
+
+   CGuard::releaseMutex(job.m_Lock);
+
+   for (vector<FSClient*>::iterator i = files.begin() + 1; i != files.end(); ++ i)
+   {
+      (*i)->close();
+      m_pClient->releaseFSClient(*i);
+   }
+
+   job.m_Progress.close();
+
+   if (!job.m_lPending.empty())
+   {
+      // keep the progress log so that the download can be continued later
+      log().error << "failed to download file, " << job.m_lPending.size() << " ranges left to receive" << std::endl;
+      return SectorError::E_CONNECTION;
+   }
+
+   LocalFS::erase(progress);
+
+   log().debug << "download of " << job.m_llRecvd << " bytes successful" << std::endl;
+   return job.m_llRecvd;
+}
+
 int64_t FSClient::upload(const char* localpath, const bool& /*cont*/)
 {
    if (!m_bOpened)
@@ -727,6 +1036,8 @@ int FSClient::close()
    if (m_bReadLocal || m_bWriteLocal)
       m_LocalFile.close();
 
+   closeShards_();
+
    flush_();
 
    for (vector<Address>::iterator i = m_vReplicaAddress.begin(); i != m_vReplicaAddress.end(); ++ i)
@@ -941,6 +1252,8 @@ int FSClient::organizeChainOfWrite()
          {
             m_strSlaveIP = m_vReplicaAddress.begin()->m_strIP;
             m_iSlaveDataPort = m_vReplicaAddress.begin()->m_iPort;
+            if (m_bSecure && (NULL != m_pEncoder))
+               initCoders_();
          }
          return -1;
       }
@@ -1064,3 +1377,179 @@ int FSClient::flush_()
 
    return 0;
 }
+
+int FSClient::openShards_(const int& mode)
+{
+   string dir = ECShard::shardDir(m_strFileName);
+   vector<SNode> list;
+   if (m_pClient->list(dir, list) < 0)
+      return SectorError::E_NOEXIST;
+
+   // shards are ordered by index, so that data shards are opened first and can be read without decoding
+   map<int, string> names;
+   int k = 0;
+   int m = 0;
+   for (vector<SNode>::iterator i = list.begin(); i != list.end(); ++ i)
+   {
+      int sk, sm, index;
+      if (ECShard::parseName(i->m_strName, sk, sm, index) < 0)
+         continue;
+      if (0 == k)
+      {
+         k = sk;
+         m = sm;
+      }
+      if ((sk == k) && (sm == m))
+         names[index] = dir + "/" + i->m_strName;
+   }
+
+   if (0 == k)
+      return SectorError::E_NOEXIST;
+
+   m_pErasure = new ErasureCode;
+   m_pErasure->init(k, m);
+   m_vReplicaAddress.clear();
+
+   for (map<int, string>::iterator i = names.begin(); (i != names.end()) && (int(m_vShards.size()) < k); ++ i)
+   {
+      FSClient* f = m_pClient->createFSClient();
+      if (NULL == f)
+         break;
+
+      char buf[ECShard::m_iHdrSize];
+      ECShard hdr;
+      if ((f->open(i->second, mode) < 0) || (f->read(buf, 0, ECShard::m_iHdrSize) != ECShard::m_iHdrSize)
+         || (hdr.deserialize(buf) < 0) || (hdr.m_iIndex != i->first)
+         || (!m_vShards.empty() && ((hdr.m_llFileSize != m_llSize) || (hdr.m_llTimeStamp != m_llTimeStamp))))
+      {
+         f->close();
+         m_pClient->releaseFSClient(f);
+         continue;
+      }
+
+      m_llSize = hdr.m_llFileSize;
+      m_llTimeStamp = hdr.m_llTimeStamp;
+      m_llChunkSize = hdr.getChunkSize();
+      m_vShards.push_back(f);
+      m_viShardIndex.push_back(i->first);
+   }
+
+   if (int(m_vShards.size()) < k)
+   {
+      ERR_MSG("Only " << m_vShards.size() << " of " << k << " required shards can be read");
+      closeShards_();
+      return SectorError::E_CONNECTION;
+   }
+
+   m_llCurReadPos = m_llCurWritePos = 0;
+   m_bRead = true;
+   m_bWrite = false;
+   m_bSecure = mode & 16;
+   m_bOpened = true;
+
+   return 0;
+}
+
+int64_t FSClient::readShards_(char* buf, const int64_t& offset, const int64_t& size)
+{
+   const int k = m_pErasure->getDataShards();
+   const int64_t unit = 8000000;
+   vector<char> block;
+
+   int64_t done = 0;
+   while (done < size)
+   {
+      int64_t pos = offset + done;
+      int col = int(pos / m_llChunkSize);
+      int64_t off = pos % m_llChunkSize;
+      int64_t len = size - done;
+      if (len > m_llChunkSize - off)
+         len = m_llChunkSize - off;
+
+      int s = int(find(m_viShardIndex.begin(), m_viShardIndex.end(), col) - m_viShardIndex.begin());
+      if (s < k)
+      {
+         // the data shard of this column is open, read it directly
+         if (m_vShards[s]->read(buf + done, ECShard::m_iHdrSize + off, len) != len)
+            return SectorError::E_CONNECTION;
+      }
+      else
+      {
+         // decode the column from all open shards, a bounded amount at a time
+         if (len > unit)
+            len = unit;
+         block.resize(k * len);
+         vector<const char*> in(k);
+         for (int i = 0; i < k; ++ i)
+         {
+            in[i] = &block[i * len];
+            if (m_vShards[i]->read(&block[i * len], ECShard::m_iHdrSize + off, len) != len)
+               return SectorError::E_CONNECTION;
+         }
+
+         char* out = buf + done;
+         if (m_pErasure->reconstruct(&m_viShardIndex[0], &in[0], 1, &col, &out, int(len)) < 0)
+            return SectorError::E_INVALID;
+      }
+
+      done += len;
+   }
+
+   return done;
+}
+
+int64_t FSClient::downloadShards_(const char* localpath, const bool& cont)
+{
+   int64_t offset = 0;
+   fstream ofs;
+
+   if (cont)
+   {
+      ofs.open(localpath, ios::out | ios::binary | ios::app);
+      ofs.seekp(0, ios::end);
+      offset = ofs.tellp();
+   }
+   else
+   {
+      ofs.open(localpath, ios::out | ios::binary | ios::trunc);
+   }
+
+   if (ofs.bad() || ofs.fail())
+      return SectorError::E_LOCALFILE;
+
+   const int64_t unit = 8000000;
+   vector<char> buf(unit);
+   for (int64_t pos = offset; pos < m_llSize; )
+   {
+      int64_t len = (m_llSize - pos < unit) ? m_llSize - pos : unit;
+      int64_t r = readShards_(&buf[0], pos, len);
+      if (r <= 0)
+      {
+         ofs.close();
+         return SectorError::E_CONNECTION;
+      }
+
+      ofs.write(&buf[0], r);
+      pos += r;
+   }
+
+   ofs.close();
+   if (ofs.fail())
+      return SectorError::E_LOCALFILE;
+
+   return m_llSize - offset;
+}
+
+void FSClient::closeShards_()
+{
+   for (vector<FSClient*>::iterator i = m_vShards.begin(); i != m_vShards.end(); ++ i)
+   {
+      (*i)->close();
+      m_pClient->releaseFSClient(*i);
+   }
+
+   m_vShards.clear();
+   m_viShardIndex.clear();
+   delete m_pErasure;
+   m_pErasure = NULL;
+}
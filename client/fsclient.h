@@ -24,6 +24,7 @@ written by
 
 #include <writelog.h>
 #include <client.h>
+#include <erasure.h>
 #include <vector>
 #include <fstream>
 
@@ -46,7 +47,7 @@ public:
    int64_t write(const char* buf, const int64_t& offset, const int64_t& size, const int64_t& buffer = 0);
    int64_t read(char* buf, const int64_t& size);
    int64_t write(const char* buf, const int64_t& size);
-   int64_t download(const char* localpath, const bool& cont = false);
+   int64_t download(const char* localpath, const bool& cont = false, const int& streams = 1);
    int64_t upload(const char* localpath, const bool& cont = false);
    int flush();
    //int truncate(const int64_t& size);
@@ -62,6 +63,32 @@ private:
    int64_t prefetch(const int64_t& offset, const int64_t& size);
    int flush_();
    int organizeChainOfWrite();
+   int initCoders_();
+
+private: // parallel download
+   struct DownloadJob;
+   struct DownloadStream;
+
+   int64_t pdownload_(const char* localpath, const bool& cont, const int& streams);
+   int recvrange_(std::fstream& ofs, const int64_t& offset, const int64_t& size);
+#ifndef WIN32
+   static void* downloadHandler(void*);
+#else
+   static DWORD WINAPI downloadHandler(LPVOID);
+#endif
+
+   static const int64_t m_llRangeSize = 64000000;	// size of each range in a parallel download
+
+private: // degraded read of erasure coded files
+   int openShards_(const int& mode);
+   int64_t readShards_(char* buf, const int64_t& offset, const int64_t& size);
+   int64_t downloadShards_(const char* localpath, const bool& cont);
+   void closeShards_();
+
+   ErasureCode* m_pErasure;		// code of the file, NULL if the file is stored as replicas
+   std::vector<FSClient*> m_vShards;	// k open shards of the file
+   std::vector<int> m_viShardIndex;	// index of each open shard
+   int64_t m_llChunkSize;		// size of each column of the code
 
 private:
    int32_t m_iSession;		// session ID for data channel
@@ -73,6 +100,7 @@ private:
    unsigned char m_pcIV[8];
    Crypto* m_pEncoder;
    Crypto* m_pDecoder;
+   std::map<Address, int, AddrComp> m_mCipher;	// cipher chosen by each replica node for secure transfer
 
    std::string m_strFileName;	// Sector file name
    int64_t m_llSize;            // file size
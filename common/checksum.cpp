@@ -0,0 +1,272 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include <cstring>
+#include <fstream>
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(WIN32)
+   #define CRC_X86_SSE42
+   #include <nmmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+   // slicing-by-8 tables for the portable version, reflected polynomial 0x82F63B78
+   struct CRCTables
+   {
+      uint32_t m_piTable[8][256];
+      bool m_bSSE42;
+
+      CRCTables()
+      {
+         for (int i = 0; i < 256; ++ i)
+         {
+            uint32_t c = i;
+            for (int j = 0; j < 8; ++ j)
+               c = (c & 1) ? ((c >> 1) ^ 0x82F63B78) : (c >> 1);
+            m_piTable[0][i] = c;
+         }
+         for (int i = 0; i < 256; ++ i)
+         {
+            for (int t = 1; t < 8; ++ t)
+               m_piTable[t][i] = (m_piTable[t - 1][i] >> 8) ^ m_piTable[0][m_piTable[t - 1][i] & 0xFF];
+         }
+
+         m_bSSE42 = false;
+      #ifdef CRC_X86_SSE42
+         __builtin_cpu_init();
+         m_bSSE42 = __builtin_cpu_supports("sse4.2");
+      #endif
+      }
+   };
+
+   const CRCTables g_CRC;
+
+   uint32_t crcPortable(uint32_t crc, const unsigned char* p, int64_t len)
+   {
+      const uint32_t (*t)[256] = g_CRC.m_piTable;
+      while (len >= 8)
+      {
+         uint32_t lo;
+         uint32_t hi;
+         memcpy(&lo, p, 4);
+         memcpy(&hi, p + 4, 4);
+         lo ^= crc;
+         crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+             ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+         p += 8;
+         len -= 8;
+      }
+      while (len-- > 0)
+         crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+      return crc;
+   }
+
+#ifdef CRC_X86_SSE42
+   __attribute__((target("sse4.2")))
+   uint32_t crcSSE42(uint32_t crc, const unsigned char* p, int64_t len)
+   {
+   #ifdef __x86_64__
+      uint64_t c = crc;
+      while (len >= 8)
+      {
+         uint64_t v;
+         memcpy(&v, p, 8);
+         c = _mm_crc32_u64(c, v);
+         p += 8;
+         len -= 8;
+      }
+      crc = uint32_t(c);
+   #endif
+      while (len >= 4)
+      {
+         uint32_t v;
+         memcpy(&v, p, 4);
+         crc = _mm_crc32_u32(crc, v);
+         p += 4;
+         len -= 4;
+      }
+      while (len-- > 0)
+         crc = _mm_crc32_u8(crc, *p++);
+      return crc;
+   }
+#endif
+}
+
+uint32_t CRC32C::update(uint32_t crc, const char* buf, const int64_t& len)
+{
+   const unsigned char* p = (const unsigned char*)buf;
+   crc = ~crc;
+#ifdef CRC_X86_SSE42
+   if (g_CRC.m_bSSE42)
+      return ~crcSSE42(crc, p, len);
+#endif
+   return ~crcPortable(crc, p, len);
+}
+
+
+BlockChecksum::BlockChecksum():
+m_llSize(-1),
+m_llTimeStamp(-1),
+m_vCRC()
+{
+}
+
+int BlockChecksum::load(const string& path)
+{
+   ifstream ifs(path.c_str(), ios::in | ios::binary);
+   if (ifs.fail())
+      return -1;
+
+   char hdr[32];
+   ifs.read(hdr, 32);
+   if ((ifs.gcount() != 32) || (memcmp(hdr, "SECTORCK", 8) != 0) || (*(int32_t*)(hdr + 8) != m_iBlockSize))
+      return -1;
+
+   m_llSize = *(int64_t*)(hdr + 16);
+   m_llTimeStamp = *(int64_t*)(hdr + 24);
+   if (m_llSize < 0)
+      return -1;
+
+   m_vCRC.resize((m_llSize + m_iBlockSize - 1) / m_iBlockSize);
+   if (!m_vCRC.empty())
+   {
+      ifs.read((char*)&m_vCRC[0], m_vCRC.size() * 4);
+      if (ifs.gcount() != int64_t(m_vCRC.size() * 4))
+         return -1;
+   }
+
+   return 0;
+}
+
+int BlockChecksum::save(const string& path) const
+{
+   // write to a temporary file first, so that a crash never leaves a truncated sidecar behind
+   string tmp = path + ".new";
+   ofstream ofs(tmp.c_str(), ios::out | ios::binary | ios::trunc);
+   if (ofs.fail())
+      return -1;
+
+   char hdr[32];
+   memset(hdr, 0, 32);
+   memcpy(hdr, "SECTORCK", 8);
+   *(int32_t*)(hdr + 8) = m_iBlockSize;
+   *(int64_t*)(hdr + 16) = m_llSize;
+   *(int64_t*)(hdr + 24) = m_llTimeStamp;
+   ofs.write(hdr, 32);
+   if (!m_vCRC.empty())
+      ofs.write((const char*)&m_vCRC[0], m_vCRC.size() * 4);
+   ofs.close();
+
+   if (ofs.fail() || (rename(tmp.c_str(), path.c_str()) < 0))
+   {
+      remove(tmp.c_str());
+      return -1;
+   }
+
+   return 0;
+}
+
+int BlockChecksum::compute(istream& data, const int64_t& size, const int64_t& offset, const int64_t& len)
+{
+   int64_t blocks = (size + m_iBlockSize - 1) / m_iBlockSize;
+   int64_t first = offset / m_iBlockSize;
+   int64_t last = (len < 0) ? blocks - 1 : (offset + len - 1) / m_iBlockSize;
+   if (last >= blocks)
+      last = blocks - 1;
+
+   // blocks past the old end of the file, and a last block whose length changed, are always computed,
+   // because a write past the end leaves a hole and a truncation shortens the last block
+   int64_t fresh = m_vCRC.size();
+   if ((fresh > 0) && (m_llSize % m_iBlockSize != 0))
+      -- fresh;
+   if ((size % m_iBlockSize != 0) && (fresh > blocks - 1))
+      fresh = blocks - 1;
+
+   m_vCRC.resize(blocks, 0);
+   m_llSize = size;
+
+   vector<char> buf(m_iBlockSize);
+   for (int64_t b = first; b <= last; ++ b)
+   {
+      if (checkblock_(data, b, buf, m_vCRC[b]) < 0)
+         return -1;
+   }
+   for (int64_t b = fresh; b < blocks; ++ b)
+   {
+      if ((b >= first) && (b <= last))
+         continue;
+      if (checkblock_(data, b, buf, m_vCRC[b]) < 0)
+         return -1;
+   }
+
+   return 0;
+}
+
+int BlockChecksum::verify(istream& data, const int64_t& offset, const int64_t& len, int64_t& bad) const
+{
+   if (len <= 0)
+      return 0;
+
+   int64_t first = offset / m_iBlockSize;
+   int64_t last = (offset + len - 1) / m_iBlockSize;
+   if (last >= int64_t(m_vCRC.size()))
+      last = m_vCRC.size() - 1;
+
+   vector<char> buf(m_iBlockSize);
+   for (int64_t b = first; b <= last; ++ b)
+   {
+      uint32_t crc;
+      if ((checkblock_(data, b, buf, crc) < 0) || (crc != m_vCRC[b]))
+      {
+         bad = b;
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+string BlockChecksum::sidecar(const string& homedir, const string& path)
+{
+   return homedir + ".checksum" + path;
+}
+
+int BlockChecksum::checkblock_(istream& data, const int64_t& block, vector<char>& buf, uint32_t& crc) const
+{
+   int64_t pos = block * m_iBlockSize;
+   int size = (m_llSize - pos < m_iBlockSize) ? int(m_llSize - pos) : m_iBlockSize;
+
+   // the stream is shared with the IO that follows, so leave it in a good state
+   data.clear();
+   data.seekg(pos);
+   data.read(&buf[0], size);
+   bool ok = (data.gcount() == size);
+   data.clear();
+   if (!ok)
+      return -1;
+
+   crc = CRC32C::compute(&buf[0], size);
+   return 0;
+}
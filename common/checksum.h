@@ -0,0 +1,88 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#ifndef __SECTOR_CHECKSUM_H__
+#define __SECTOR_CHECKSUM_H__
+
+#include <udt.h>
+#include <istream>
+#include <string>
+#include <vector>
+
+// CRC-32C (Castagnoli polynomial), computed with the SSE4.2 crc32 instruction when the CPU has it.
+class CRC32C
+{
+public:
+   static uint32_t update(uint32_t crc, const char* buf, const int64_t& len);
+   static uint32_t compute(const char* buf, const int64_t& len) {return update(0, buf, len);}
+};
+
+// Checksums of each fixed size block of a data file. They are kept in a sidecar file and
+// are only valid for the size and time stamp of the data file recorded with them.
+class BlockChecksum
+{
+public:
+   BlockChecksum();
+
+public:
+   int load(const std::string& path);
+   int save(const std::string& path) const;
+
+   bool match(const int64_t& size, const int64_t& ts) const {return (size == m_llSize) && (ts == m_llTimeStamp);}
+
+      // Functionality:
+      //    recompute the checksums of all blocks overlapping a range of the data file.
+      // Parameters:
+      //    1) [in] data: data file
+      //    2) [in] size: current size of the data file
+      //    3) [in] offset: start of the range
+      //    4) [in] len: length of the range, -1 for the whole file
+      // Returned value:
+      //    0 on success, -1 if the data file cannot be read.
+
+   int compute(std::istream& data, const int64_t& size, const int64_t& offset = 0, const int64_t& len = -1);
+
+      // Functionality:
+      //    check all blocks overlapping a range of the data file.
+      // Parameters:
+      //    1) [in] data: data file
+      //    2) [in] offset: start of the range
+      //    3) [in] len: length of the range
+      //    4) [out] bad: the first corrupted block
+      // Returned value:
+      //    0 if the data matches the checksums, -1 if a block is corrupted or cannot be read.
+
+   int verify(std::istream& data, const int64_t& offset, const int64_t& len, int64_t& bad) const;
+
+   static std::string sidecar(const std::string& homedir, const std::string& path);
+
+public:
+   int64_t m_llSize;			// size of the data file
+   int64_t m_llTimeStamp;		// time stamp of the data file
+   std::vector<uint32_t> m_vCRC;	// checksum of each block
+
+   static const int m_iBlockSize = 65536;
+
+private:
+   int checkblock_(std::istream& data, const int64_t& block, std::vector<char>& buf, uint32_t& crc) const;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "checksum.h"
+
+using namespace std;
+
+// known answers, and incremental computation over unaligned pieces
+int test1()
+{
+   assert(CRC32C::compute("123456789", 9) == 0xE3069283);
+   assert(CRC32C::compute("", 0) == 0);
+
+   char zero[32];
+   memset(zero, 0, 32);
+   assert(CRC32C::compute(zero, 32) == 0x8A9136AA);
+
+   vector<char> buf(100000);
+   for (unsigned int i = 0; i < buf.size(); ++ i)
+      buf[i] = rand();
+
+   uint32_t whole = CRC32C::compute(&buf[0], buf.size());
+   uint32_t crc = 0;
+   int64_t pos = 0;
+   for (int step = 1; pos < int64_t(buf.size()); step = step * 3 + 1)
+   {
+      int64_t len = (int64_t(buf.size()) - pos < step) ? buf.size() - pos : step;
+      crc = CRC32C::update(crc, &buf[pos], len);
+      pos += len;
+   }
+   assert(crc == whole);
+
+   return 0;
+}
+
+// block checksums follow writes, extension and truncation, and catch a flipped bit
+int test2()
+{
+   const int bs = BlockChecksum::m_iBlockSize;
+   string data(bs * 3 + 100, 'a');
+   for (unsigned int i = 0; i < data.size(); ++ i)
+      data[i] = rand();
+
+   stringstream file(data);
+   BlockChecksum ck;
+   assert(ck.compute(file, data.size()) == 0);
+   assert(ck.m_vCRC.size() == 4);
+
+   int64_t bad = -1;
+   assert(ck.verify(file, 0, data.size(), bad) == 0);
+
+   // overwrite inside block 1 and append two more blocks
+   data[bs + 5] ^= 1;
+   data.append(bs * 2, 'b');
+   file.str(data);
+   assert(ck.compute(file, data.size(), bs + 5, 1) == 0);
+   assert(ck.m_vCRC.size() == 6);
+   BlockChecksum full;
+   full.compute(file, data.size());
+   assert(ck.m_vCRC == full.m_vCRC);
+
+   // truncation shortens the last block
+   data.resize(bs * 2 + 7);
+   file.str(data);
+   assert(ck.compute(file, data.size(), 0, 0) == 0);
+   full = BlockChecksum();
+   full.compute(file, data.size());
+   assert(ck.m_vCRC == full.m_vCRC);
+
+   // a silent change is detected in the right block
+   data[bs * 2 + 3] ^= 0x10;
+   file.str(data);
+   assert(ck.verify(file, 0, bs, bad) == 0);
+   assert(ck.verify(file, bs, bs * 2, bad) < 0);
+   assert(bad == 2);
+
+   // sidecar round trip
+   ck.m_llTimeStamp = 1318000000;
+   string path = "checksum_unittest.tmp";
+   assert(ck.save(path) == 0);
+   BlockChecksum ld;
+   assert(ld.load(path) == 0);
+   assert(ld.match(ck.m_llSize, ck.m_llTimeStamp));
+   assert(ld.m_vCRC == ck.m_vCRC);
+   remove(path.c_str());
+
+   return 0;
+}
+
+int main()
+{
+   test1();
+   test2();
+
+   cout << "checksum_unittest passed" << endl;
+   return 0;
+}
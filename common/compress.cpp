@@ -0,0 +1,352 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include <cstring>
+#include "compress.h"
+
+namespace
+{
+   // limits of the LZ4 block format
+   const int g_iMinMatch = 4;		// shortest match
+   const int g_iLastLiterals = 5;	// the last 5 bytes are always literals
+   const int g_iMFLimit = 12;		// the last match must start at least 12 bytes before the end
+   const int g_iMaxDistance = 65535;	// longest match offset
+
+   const int g_iHashLog = 12;		// 4096 entries, the hash table stays in the L1 cache
+
+   inline uint32_t read32(const unsigned char* p)
+   {
+      uint32_t v;
+      memcpy(&v, p, 4);
+      return v;
+   }
+
+   inline int hash(const uint32_t& v)
+   {
+      return (v * 2654435761U) >> (32 - g_iHashLog);
+   }
+
+   inline unsigned char* writeLength(unsigned char* op, int len)
+   {
+      while (len >= 255)
+      {
+         *op ++ = 255;
+         len -= 255;
+      }
+      *op ++ = (unsigned char)len;
+      return op;
+   }
+
+   // one sequence: literals from anchor to ip, then a match of len bytes at distance offset; len = 0 for the last literals
+   inline unsigned char* writeSequence(unsigned char* op, const unsigned char* anchor, const int& litlen, const int& offset, const int& len)
+   {
+      unsigned char* token = op ++;
+
+      if (litlen >= 15)
+      {
+         *token = 15 << 4;
+         op = writeLength(op, litlen - 15);
+      }
+      else
+         *token = (unsigned char)(litlen << 4);
+
+      if (litlen > 0)
+         memcpy(op, anchor, litlen);
+      op += litlen;
+
+      if (0 == len)
+         return op;
+
+      *op ++ = (unsigned char)(offset & 0xFF);
+      *op ++ = (unsigned char)(offset >> 8);
+
+      int ml = len - g_iMinMatch;
+      if (ml >= 15)
+      {
+         *token |= 15;
+         op = writeLength(op, ml - 15);
+      }
+      else
+         *token |= (unsigned char)ml;
+
+      return op;
+   }
+
+   inline unsigned char* writeVarint(unsigned char* p, uint64_t v)
+   {
+      while (v >= 0x80)
+      {
+         *p ++ = (unsigned char)(v | 0x80);
+         v >>= 7;
+      }
+      *p ++ = (unsigned char)v;
+      return p;
+   }
+
+   inline const unsigned char* readVarint(const unsigned char* p, const unsigned char* end, uint64_t& v)
+   {
+      v = 0;
+      for (int shift = 0; (p < end) && (shift < 64); shift += 7)
+      {
+         unsigned char b = *p ++;
+         v |= (uint64_t)(b & 0x7F) << shift;
+         if (0 == (b & 0x80))
+            return p;
+      }
+      return NULL;
+   }
+}
+
+int Compressor::bound(const int& size)
+{
+   return size + size / 255 + 16;
+}
+
+int Compressor::compress(const char* in, const int& size, char* out)
+{
+   const unsigned char* base = (const unsigned char*)in;
+   const unsigned char* ip = base;
+   const unsigned char* anchor = base;
+   const unsigned char* iend = base + size;
+   unsigned char* op = (unsigned char*)out;
+
+   if (size > g_iMFLimit)
+   {
+      const unsigned char* mflimit = iend - g_iMFLimit;
+      const unsigned char* matchlimit = iend - g_iLastLiterals;
+
+      int table[1 << g_iHashLog];
+      memset(table, 0, sizeof(table));
+
+      // skip faster over data that does not compress
+      int attempts = 1 << 6;
+
+      ++ ip;
+      while (ip < mflimit)
+      {
+         uint32_t v = read32(ip);
+         int h = hash(v);
+         const unsigned char* ref = base + table[h];
+         table[h] = ip - base;
+
+         if ((ref >= ip) || (ip - ref > g_iMaxDistance) || (read32(ref) != v))
+         {
+            ip += attempts ++ >> 6;
+            continue;
+         }
+         attempts = 1 << 6;
+
+         while ((ip > anchor) && (ref > base) && (ip[-1] == ref[-1]))
+         {
+            -- ip;
+            -- ref;
+         }
+
+         int len = g_iMinMatch;
+         while ((ip + len < matchlimit) && (ip[len] == ref[len]))
+            ++ len;
+
+         op = writeSequence(op, anchor, ip - anchor, ip - ref, len);
+         ip += len;
+         anchor = ip;
+
+         if (ip < mflimit)
+            table[hash(read32(ip - 2))] = ip - 2 - base;
+      }
+   }
+
+   op = writeSequence(op, anchor, iend - anchor, 0, 0);
+
+   return op - (unsigned char*)out;
+}
+
+int Compressor::decompress(const char* in, const int& size, char* out, const int& rawsize)
+{
+   const unsigned char* ip = (const unsigned char*)in;
+   const unsigned char* iend = ip + size;
+   unsigned char* op = (unsigned char*)out;
+   unsigned char* oend = op + rawsize;
+
+   while (ip < iend)
+   {
+      unsigned char token = *ip ++;
+
+      int litlen = token >> 4;
+      if (15 == litlen)
+      {
+         unsigned char b;
+         do
+         {
+            if (ip >= iend)
+               return -1;
+            b = *ip ++;
+            litlen += b;
+
+            // stop at once on corrupted input, before the length can overflow
+            if ((litlen > oend - op) || (litlen > iend - ip))
+               return -1;
+         } while (255 == b);
+      }
+
+      if ((litlen > oend - op) || (litlen > iend - ip))
+         return -1;
+      memcpy(op, ip, litlen);
+      op += litlen;
+      ip += litlen;
+
+      // the last sequence has no match
+      if (ip == iend)
+         break;
+
+      if (iend - ip < 2)
+         return -1;
+      int offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if ((0 == offset) || (offset > op - (unsigned char*)out))
+         return -1;
+
+      int len = token & 15;
+      if (15 == len)
+      {
+         unsigned char b;
+         do
+         {
+            if (ip >= iend)
+               return -1;
+            b = *ip ++;
+            len += b;
+
+            if (len > oend - op)
+               return -1;
+         } while (255 == b);
+      }
+      len += g_iMinMatch;
+
+      if (len > oend - op)
+         return -1;
+
+      const unsigned char* ref = op - offset;
+      if (offset >= len)
+      {
+         memcpy(op, ref, len);
+         op += len;
+      }
+      else
+      {
+         // overlapping match, e.g., a run of the same byte
+         for (int i = 0; i < len; ++ i)
+            *op ++ = *ref ++;
+      }
+   }
+
+   return (op == oend) ? rawsize : -1;
+}
+
+
+int RecordBlock::encode(const char* data, const int64_t* index, const int& rows, char*& block)
+{
+   const int rawsize = index[rows] - index[0];
+   const char* src = data + index[0];
+
+   block = new char[m_iHdrSize + Compressor::bound(rawsize) + rows * 10];
+
+   int32_t codec = 1;
+   int32_t datasize = Compressor::compress(src, rawsize, block + m_iHdrSize);
+   if (datasize >= rawsize)
+   {
+      codec = 0;
+      datasize = rawsize;
+      memcpy(block + m_iHdrSize, src, rawsize);
+   }
+
+   // record sizes are small numbers, one or two bytes each
+   unsigned char* p = (unsigned char*)block + m_iHdrSize + datasize;
+   unsigned char* start = p;
+   for (int r = 0; r < rows; ++ r)
+      p = writeVarint(p, index[r + 1] - index[r]);
+   int32_t idxsize = p - start;
+
+   memcpy(block, "SRB1", 4);
+   *(int32_t*)(block + 4) = codec;
+   *(int32_t*)(block + 8) = rows;
+   *(int32_t*)(block + 12) = rawsize;
+   *(int32_t*)(block + 16) = datasize;
+   *(int32_t*)(block + 20) = idxsize;
+
+   return m_iHdrSize + datasize + idxsize;
+}
+
+int RecordBlock::parse(const char* block, const int& size, int& rows, int& rawsize)
+{
+   if ((size < m_iHdrSize) || (memcmp(block, "SRB1", 4) != 0))
+      return -1;
+
+   int32_t codec = *(int32_t*)(block + 4);
+   rows = *(int32_t*)(block + 8);
+   rawsize = *(int32_t*)(block + 12);
+   int32_t datasize = *(int32_t*)(block + 16);
+   int32_t idxsize = *(int32_t*)(block + 20);
+
+   if ((codec < 0) || (codec > 1) || (rows < 0) || (rawsize < 0) || (datasize < 0) || (idxsize < 0))
+      return -1;
+   if (int64_t(m_iHdrSize) + datasize + idxsize > size)
+      return -1;
+
+   return m_iHdrSize + datasize + idxsize;
+}
+
+int RecordBlock::decode(const char* block, const int& size, char* data, int64_t* index, const int64_t& base)
+{
+   int rows;
+   int rawsize;
+   if (parse(block, size, rows, rawsize) < 0)
+      return -1;
+
+   int32_t codec = *(int32_t*)(block + 4);
+   int32_t datasize = *(int32_t*)(block + 16);
+   int32_t idxsize = *(int32_t*)(block + 20);
+
+   if (0 == codec)
+   {
+      if (datasize != rawsize)
+         return -1;
+      memcpy(data, block + m_iHdrSize, rawsize);
+   }
+   else if (Compressor::decompress(block + m_iHdrSize, datasize, data, rawsize) < 0)
+      return -1;
+
+   const unsigned char* p = (const unsigned char*)block + m_iHdrSize + datasize;
+   const unsigned char* end = p + idxsize;
+   int64_t offset = base;
+   for (int r = 0; r < rows; ++ r)
+   {
+      uint64_t len;
+      if (NULL == (p = readVarint(p, end, len)))
+         return -1;
+      offset += len;
+      index[r] = offset;
+   }
+
+   if (offset - base != rawsize)
+      return -1;
+
+   return rows;
+}
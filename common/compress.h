@@ -0,0 +1,104 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#ifndef __SECTOR_COMPRESS_H__
+#define __SECTOR_COMPRESS_H__
+
+#include <udt.h>
+
+// Fast LZ77 compression of a memory block. The output is in the LZ4 block format,
+// so it can also be read by the LZ4 library, but no external library is needed.
+class Compressor
+{
+public:
+      // maximum compressed size of a block of "size" bytes
+   static int bound(const int& size);
+
+      // Functionality:
+      //    compress a block.
+      // Parameters:
+      //    1) [in] in: input data
+      //    2) [in] size: input size
+      //    3) [out] out: output buffer, at least bound(size) bytes
+      // Returned value:
+      //    compressed size.
+
+   static int compress(const char* in, const int& size, char* out);
+
+      // Functionality:
+      //    decompress a block.
+      // Parameters:
+      //    1) [in] in: compressed data
+      //    2) [in] size: compressed size
+      //    3) [out] out: output buffer
+      //    4) [in] rawsize: original size of the block
+      // Returned value:
+      //    rawsize on success, -1 if the input is corrupted.
+
+   static int decompress(const char* in, const int& size, char* out, const int& rawsize);
+};
+
+// A block of records as it is shuffled between SPEs and buckets: a fixed header, the compressed
+// record data, and the size of each record as a varint. A block is left uncompressed if that is smaller.
+class RecordBlock
+{
+public:
+   static const int m_iHdrSize = 24;
+
+      // Functionality:
+      //    build a block from records.
+      // Parameters:
+      //    1) [in] data: record data
+      //    2) [in] index: rows + 1 offsets of the records in data, index[0] is the start of the first record
+      //    3) [in] rows: number of records
+      //    4) [out] block: new buffer holding the block, to be deleted by the caller
+      // Returned value:
+      //    size of the block.
+
+   static int encode(const char* data, const int64_t* index, const int& rows, char*& block);
+
+      // Functionality:
+      //    read the header of a block.
+      // Parameters:
+      //    1) [in] block: start of the block
+      //    2) [in] size: available bytes
+      //    3) [out] rows: number of records
+      //    4) [out] rawsize: size of the record data
+      // Returned value:
+      //    total size of the block, -1 if it is not a valid block.
+
+   static int parse(const char* block, const int& size, int& rows, int& rawsize);
+
+      // Functionality:
+      //    restore the records of a block.
+      // Parameters:
+      //    1) [in] block: start of the block
+      //    2) [in] size: available bytes
+      //    3) [out] data: buffer for the record data, "rawsize" bytes
+      //    4) [out] index: buffer for the end offset of each record, "rows" entries
+      //    5) [in] base: offset of the data buffer, added to the index
+      // Returned value:
+      //    number of records, -1 if the block is corrupted.
+
+   static int decode(const char* block, const int& size, char* data, int64_t* index, const int64_t& base);
+};
+
+#endif
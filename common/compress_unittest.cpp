@@ -0,0 +1,175 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "compress.h"
+
+using namespace std;
+
+int roundtrip(const vector<char>& in)
+{
+   const int size = in.size();
+   vector<char> c(Compressor::bound(size) + 1);
+   int csize = Compressor::compress(size ? &in[0] : NULL, size, &c[0]);
+   assert((csize > 0) && (csize <= Compressor::bound(size)));
+
+   vector<char> d(size + 1);
+   assert(Compressor::decompress(&c[0], csize, &d[0], size) == size);
+   assert((0 == size) || (memcmp(&in[0], &d[0], size) == 0));
+
+   return csize;
+}
+
+// compress and decompress random, text and constant data of various sizes
+int test1()
+{
+   const int sizes[] = {0, 1, 5, 12, 13, 16, 100, 4096 + 7, 70000, 300000};
+
+   for (unsigned int s = 0; s < sizeof(sizes) / sizeof(int); ++ s)
+   {
+      const int size = sizes[s];
+
+      vector<char> r(size);
+      for (int i = 0; i < size; ++ i)
+         r[i] = rand();
+      roundtrip(r);
+
+      vector<char> t(size);
+      for (int i = 0; i < size; ++ i)
+         t[i] = "the quick brown fox jumps over the lazy dog "[(i * 7 + i / 50) % 44];
+      int ct = roundtrip(t);
+
+      vector<char> z(size, 0);
+      int cz = roundtrip(z);
+
+      if (size >= 4096)
+      {
+         assert(ct < size / 2);
+         assert(cz < size / 100);
+      }
+   }
+
+   return 0;
+}
+
+// corrupted or truncated input is detected
+int test2()
+{
+   vector<char> in(10000);
+   for (int i = 0; i < 10000; ++ i)
+      in[i] = "abcdefgh"[rand() % 8];
+
+   vector<char> c(Compressor::bound(10000));
+   int csize = Compressor::compress(&in[0], 10000, &c[0]);
+   vector<char> d(10000);
+
+   assert(Compressor::decompress(&c[0], csize - 1, &d[0], 10000) < 0);
+   assert(Compressor::decompress(&c[0], csize, &d[0], 9999) < 0);
+
+   // random changes must never write past the output buffer
+   for (int i = 0; i < 1000; ++ i)
+   {
+      vector<char> x(c.begin(), c.begin() + csize);
+      x[rand() % csize] = rand();
+      Compressor::decompress(&x[0], csize, &d[0], 10000);
+   }
+
+   // length extensions long enough to overflow an int are rejected
+   vector<char> ext(10000000, char(255));
+   ext[0] = char(0xFF);
+   assert(Compressor::decompress(&ext[0], ext.size(), &d[0], 10000) < 0);
+   ext[0] = char(0x1F);
+   ext[1] = 'a';
+   ext[2] = 1;
+   ext[3] = 0;
+   assert(Compressor::decompress(&ext[0], ext.size(), &d[0], 10000) < 0);
+
+   return 0;
+}
+
+// record blocks
+int test3()
+{
+   const int rows = 1000;
+   vector<char> data;
+   vector<int64_t> index;
+   index.push_back(0);
+   for (int r = 0; r < rows; ++ r)
+   {
+      char rec[64];
+      int len = sprintf(rec, "key%d\tvalue %d", r % 37, r * r);
+      data.insert(data.end(), rec, rec + len);
+      index.push_back(data.size());
+   }
+
+   // the block covers rows 10 to 999
+   char* block = NULL;
+   int size = RecordBlock::encode(&data[0], &index[10], rows - 10, block);
+   assert(size < (index[rows] - index[10]) * 3 / 4);
+
+   int n, rawsize;
+   assert(RecordBlock::parse(block, size, n, rawsize) == size);
+   assert((n == rows - 10) && (rawsize == index[rows] - index[10]));
+   assert(RecordBlock::parse(block, size - 1, n, rawsize) < 0);
+
+   vector<char> out(rawsize);
+   vector<int64_t> idx(n);
+   assert(RecordBlock::decode(block, size, &out[0], &idx[0], 100) == n);
+   assert(memcmp(&out[0], &data[index[10]], rawsize) == 0);
+   for (int r = 0; r < n; ++ r)
+      assert(idx[r] == index[r + 11] - index[10] + 100);
+
+   delete [] block;
+
+   // random records are stored as they are
+   vector<char> rnd(5000);
+   for (int i = 0; i < 5000; ++ i)
+      rnd[i] = rand();
+   int64_t ri[3] = {0, 1000, 5000};
+   size = RecordBlock::encode(&rnd[0], ri, 2, block);
+   assert(size < 5000 + RecordBlock::m_iHdrSize + 8);
+   int64_t ro[2];
+   assert(RecordBlock::decode(block, size, &out[0], ro, 0) == 2);
+   assert((ro[0] == 1000) && (ro[1] == 5000));
+   assert(memcmp(&out[0], &rnd[0], 5000) == 0);
+
+   block[0] = 'X';
+   assert(RecordBlock::decode(block, size, &out[0], ro, 0) < 0);
+   delete [] block;
+
+   return 0;
+}
+
+int main()
+{
+   test1();
+   test2();
+   test3();
+
+   cout << "compress_unittest passed" << endl;
+   return 0;
+}
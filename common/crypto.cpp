@@ -31,17 +31,57 @@ written by
 #include <errno.h>
 #include <string.h>
 #include <common.h>
+#include <openssl/rand.h>
 #include "crypto.h"
 
+#if OPENSSL_VERSION_NUMBER >= 0x10001000L
+   #define CRYPTO_AES_GCM
+#endif
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+   #define CRYPTO_CHACHA20
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(WIN32)
+   #define CRYPTO_X86
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+   #include <openssl/provider.h>
+
+namespace
+{
+   // Blowfish has moved to the legacy provider in OpenSSL 3; loading a provider
+   // explicitly disables the implicit default one, so both are loaded
+   struct LegacyProvider
+   {
+      LegacyProvider()
+      {
+         OSSL_PROVIDER_load(NULL, "legacy");
+         OSSL_PROVIDER_load(NULL, "default");
+      }
+   };
+
+   const LegacyProvider g_LegacyProvider;
+}
+#endif
+
 Crypto::Crypto():
-m_CoderType(INIT)
+m_pCTX(NULL),
+m_CoderType(INIT),
+m_iCipher(CipherType::BLOWFISH),
+m_iNonceCount(0),
+m_bPeerNonce(false),
+m_pcBuffer(NULL),
+m_iBufSize(0)
 {
    memset(m_pcKey, 0, 16);
    memset(m_pcIV, 0, 8);
+   memset(m_pcNonce, 0, g_iNonceSize);
+   memset(m_pcPeerNonce, 0, g_iNonceSize);
 }
 
 Crypto::~Crypto()
 {
+   release();
+   delete [] m_pcBuffer;
 }
 
 int Crypto::generateKey(unsigned char key[16], unsigned char iv[8])
@@ -62,26 +102,86 @@ int Crypto::generateKey(unsigned char key[16], unsigned char iv[8])
    return 0;
 }
 
-int Crypto::initEnc(unsigned char key[16], unsigned char iv[8])
+int Crypto::getCipherList()
+{
+   int list = 1 << CipherType::BLOWFISH;
+#ifdef CRYPTO_AES_GCM
+   list |= 1 << CipherType::AES_GCM;
+#endif
+#ifdef CRYPTO_CHACHA20
+   list |= 1 << CipherType::CHACHA20;
+#endif
+   return list;
+}
+
+int Crypto::negotiate(const int& list)
 {
+   // anything else than a list with Blowfish and known ciphers only comes from an older peer
+   if (((list & (1 << CipherType::BLOWFISH)) == 0) || (list & ~0xFF))
+      return CipherType::BLOWFISH;
+
+   int common = list & getCipherList();
+
+   bool aesni = true;
+#ifdef CRYPTO_X86
+   __builtin_cpu_init();
+   aesni = __builtin_cpu_supports("aes");
+#endif
+
+   if (aesni && (common & (1 << CipherType::AES_GCM)))
+      return CipherType::AES_GCM;
+   if (common & (1 << CipherType::CHACHA20))
+      return CipherType::CHACHA20;
+   if (common & (1 << CipherType::AES_GCM))
+      return CipherType::AES_GCM;
+
+   return CipherType::BLOWFISH;
+}
+
+int Crypto::initEnc(unsigned char key[16], unsigned char iv[8], const int cipher)
+{
+   release();
+
    memcpy(m_pcKey, key, 16);
    memcpy(m_pcIV, iv, 8);
+   m_iCipher = cipher;
 
-   EVP_CIPHER_CTX_init(&m_CTX);
-   EVP_EncryptInit(&m_CTX, EVP_bf_cbc(), m_pcKey, m_pcIV);
+   m_pCTX = EVP_CIPHER_CTX_new();
+   if (NULL == m_pCTX)
+      return -1;
+
+   if (CipherType::BLOWFISH == m_iCipher)
+   {
+      if (EVP_EncryptInit_ex(m_pCTX, EVP_bf_cbc(), NULL, m_pcKey, m_pcIV) != 1)
+         return -1;
+   }
+   else if (initAEAD_(key, iv) < 0)
+      return -1;
 
    m_CoderType = ENC;
 
    return 0;
 }
 
-int Crypto::initDec(unsigned char key[16], unsigned char iv[8])
+int Crypto::initDec(unsigned char key[16], unsigned char iv[8], const int cipher)
 {
+   release();
+
    memcpy(m_pcKey, key, 16);
    memcpy(m_pcIV, iv, 8);
+   m_iCipher = cipher;
 
-   EVP_CIPHER_CTX_init(&m_CTX);
-   EVP_DecryptInit(&m_CTX, EVP_bf_cbc(), m_pcKey, m_pcIV);
+   m_pCTX = EVP_CIPHER_CTX_new();
+   if (NULL == m_pCTX)
+      return -1;
+
+   if (CipherType::BLOWFISH == m_iCipher)
+   {
+      if (EVP_DecryptInit_ex(m_pCTX, EVP_bf_cbc(), NULL, m_pcKey, m_pcIV) != 1)
+         return -1;
+   }
+   else if (initAEAD_(key, iv) < 0)
+      return -1;
 
    m_CoderType = DEC;
 
@@ -90,7 +190,11 @@ int Crypto::initDec(unsigned char key[16], unsigned char iv[8])
 
 int Crypto::release()
 {
-   EVP_CIPHER_CTX_cleanup(&m_CTX);
+   if (NULL != m_pCTX)
+   {
+      EVP_CIPHER_CTX_free(m_pCTX);
+      m_pCTX = NULL;
+   }
    m_CoderType = INIT;
    return 0;
 }
@@ -100,6 +204,97 @@ int Crypto::encrypt(unsigned char* input, int insize, unsigned char* output, int
    if (ENC != m_CoderType)
       return -1;
 
+   if (CipherType::BLOWFISH == m_iCipher)
+      return encryptCBC_(input, insize, output, outsize);
+   return encryptAEAD_(input, insize, output, outsize);
+}
+
+int Crypto::decrypt(unsigned char* input, int insize, unsigned char* output, int& outsize)
+{
+   if (DEC != m_CoderType)
+      return -1;
+
+   if (CipherType::BLOWFISH == m_iCipher)
+   {
+      if (input != output + getHeaderSize())
+         return decryptCBC_(input, insize, output, outsize);
+
+      // the CBC decoder holds back the last block, so it cannot write over its own input
+      unsigned char* tmp = new unsigned char[insize];
+      int r = decryptCBC_(input, insize, tmp, outsize);
+      if (r >= 0)
+         memcpy(output, tmp, outsize);
+      delete [] tmp;
+      return r;
+   }
+
+   return decryptAEAD_(input, insize, output, outsize);
+}
+
+int Crypto::getHeaderSize() const
+{
+   return (CipherType::BLOWFISH == m_iCipher) ? 0 : g_iNonceSize;
+}
+
+int Crypto::getOverhead() const
+{
+   // CBC padding adds up to one 8-byte Blowfish block
+   return (CipherType::BLOWFISH == m_iCipher) ? 8 : g_iNonceSize + g_iTagSize;
+}
+
+unsigned char* Crypto::getBuffer(const int& size)
+{
+   if (size > m_iBufSize)
+   {
+      delete [] m_pcBuffer;
+      m_pcBuffer = new unsigned char[size];
+      m_iBufSize = size;
+   }
+   return m_pcBuffer;
+}
+
+int Crypto::initAEAD_(unsigned char key[16], unsigned char iv[8])
+{
+   const EVP_CIPHER* type = NULL;
+#ifdef CRYPTO_AES_GCM
+   if (CipherType::AES_GCM == m_iCipher)
+      type = EVP_aes_128_gcm();
+#endif
+#ifdef CRYPTO_CHACHA20
+   if (CipherType::CHACHA20 == m_iCipher)
+      type = EVP_chacha20_poly1305();
+#endif
+   if (NULL == type)
+      return -1;
+
+   // derive a key of the size of the cipher from the session key, the IV and the cipher
+   unsigned char seed[16 + 8 + 1];
+   memcpy(seed, key, 16);
+   memcpy(seed + 16, iv, 8);
+   seed[24] = m_iCipher;
+   unsigned char k[EVP_MAX_MD_SIZE];
+   if (EVP_Digest(seed, sizeof(seed), k, NULL, EVP_sha256(), NULL) != 1)
+      return -1;
+
+   // each coder starts with a random nonce prefix, as both sides of a session use the same key
+   if (RAND_bytes(m_pcNonce, g_iNonceSize - 4) != 1)
+      return -1;
+   memset(m_pcNonce + g_iNonceSize - 4, 0, 4);
+   m_iNonceCount = 0;
+   m_bPeerNonce = false;
+
+   if (EVP_CipherInit_ex(m_pCTX, type, NULL, NULL, NULL, -1) != 1)
+      return -1;
+   if (EVP_CIPHER_CTX_ctrl(m_pCTX, EVP_CTRL_GCM_SET_IVLEN, g_iNonceSize, NULL) != 1)
+      return -1;
+   if (EVP_CipherInit_ex(m_pCTX, NULL, NULL, k, NULL, -1) != 1)
+      return -1;
+
+   return 0;
+}
+
+int Crypto::encryptCBC_(unsigned char* input, int insize, unsigned char* output, int& outsize)
+{
    unsigned char* ip = input;
    unsigned char* op = output;
 
@@ -108,7 +303,7 @@ int Crypto::encrypt(unsigned char* input, int insize, unsigned char* output, int
    {
       int unitsize = (ts < g_iEncBlockSize) ? ts : g_iEncBlockSize;
 
-      if (EVP_EncryptUpdate(&m_CTX, op, &len, ip, unitsize) != 1)
+      if (EVP_EncryptUpdate(m_pCTX, op, &len, ip, unitsize) != 1)
       {
          printf ("error in encrypt update\n");
          return -1;
@@ -120,7 +315,7 @@ int Crypto::encrypt(unsigned char* input, int insize, unsigned char* output, int
    }
 
    // the last block, padding
-   if (EVP_EncryptFinal(&m_CTX, op, &len) != 1)
+   if (EVP_EncryptFinal_ex(m_pCTX, op, &len) != 1)
    {
        printf ("error in encrypt final\n");
        return -1;
@@ -131,11 +326,8 @@ int Crypto::encrypt(unsigned char* input, int insize, unsigned char* output, int
    return 0;
 }
 
-int Crypto::decrypt(unsigned char* input, int insize, unsigned char* output, int& outsize)
+int Crypto::decryptCBC_(unsigned char* input, int insize, unsigned char* output, int& outsize)
 {
-   if (DEC != m_CoderType)
-      return -1;
-
    unsigned char* ip = input;
    unsigned char* op = output;
 
@@ -145,7 +337,7 @@ int Crypto::decrypt(unsigned char* input, int insize, unsigned char* output, int
       int unitsize = (ts < g_iDecBlockSize) ? ts : g_iDecBlockSize;
 
       int len;
-      if (EVP_DecryptUpdate(&m_CTX, op, &len, ip, unitsize) != 1)
+      if (EVP_DecryptUpdate(m_pCTX, op, &len, ip, unitsize) != 1)
       {
          printf("error in decrypt update\n");
          return -1;
@@ -157,7 +349,7 @@ int Crypto::decrypt(unsigned char* input, int insize, unsigned char* output, int
    }
 
    // decrypt last block
-   if (EVP_DecryptFinal(&m_CTX, op, &len) != 1)
+   if (EVP_DecryptFinal_ex(m_pCTX, op, &len) != 1)
    {
       printf("error in decrypt final\n");
       return -1;
@@ -168,3 +360,83 @@ int Crypto::decrypt(unsigned char* input, int insize, unsigned char* output, int
    return 0;
 }
 
+int Crypto::encryptAEAD_(unsigned char* input, int insize, unsigned char* output, int& outsize)
+{
+   // message: nonce, cipher text, tag; the whole message is encrypted in one pass,
+   // since the AES-NI (or vectorized ChaCha20) code in OpenSSL runs much faster on large buffers
+   unsigned char* nonce = output;
+   unsigned char* op = output + g_iNonceSize;
+
+   memcpy(nonce, m_pcNonce, g_iNonceSize);
+   if (++ m_iNonceCount == 0)
+   {
+      if (RAND_bytes(m_pcNonce, g_iNonceSize - 4) != 1)
+         return -1;
+   }
+   for (int i = 0; i < 4; ++ i)
+      m_pcNonce[g_iNonceSize - 1 - i] = (m_iNonceCount >> (i * 8)) & 0xFF;
+
+   int len = 0;
+   int final = 0;
+   if ((EVP_EncryptInit_ex(m_pCTX, NULL, NULL, NULL, nonce) != 1) ||
+       ((insize > 0) && (EVP_EncryptUpdate(m_pCTX, op, &len, input, insize) != 1)) ||
+       (EVP_EncryptFinal_ex(m_pCTX, op + len, &final) != 1) ||
+       (EVP_CIPHER_CTX_ctrl(m_pCTX, EVP_CTRL_GCM_GET_TAG, g_iTagSize, op + len + final) != 1))
+   {
+      printf("error in encrypt\n");
+      return -1;
+   }
+
+   outsize = g_iNonceSize + len + final + g_iTagSize;
+   return 0;
+}
+
+int Crypto::decryptAEAD_(unsigned char* input, int insize, unsigned char* output, int& outsize)
+{
+   int size = insize - g_iNonceSize - g_iTagSize;
+   if (size < 0)
+      return -1;
+
+   unsigned char* ip = input + g_iNonceSize;
+   unsigned char* tag = ip + size;
+
+   // the sender counts its messages after a random prefix, and picks a new prefix when the counter wraps;
+   // after the first message, any other nonce belongs to a message that has been accepted before, or to one
+   // sent in the other direction
+   bool fresh = true;
+   if (m_bPeerNonce && (0 == memcmp(input, m_pcPeerNonce, g_iNonceSize - 4)))
+      fresh = (memcmp(input + g_iNonceSize - 4, m_pcPeerNonce + g_iNonceSize - 4, 4) > 0);
+   else if (m_bPeerNonce)
+      fresh = (0 == memcmp(input + g_iNonceSize - 4, "\0\0\0\0", 4)) && (0 == memcmp(m_pcPeerNonce + g_iNonceSize - 4, "\xFF\xFF\xFF\xFF", 4));
+   if (!fresh)
+   {
+      printf("replayed message rejected in decrypt\n");
+      return -1;
+   }
+   unsigned char nonce[g_iNonceSize];
+   memcpy(nonce, input, g_iNonceSize);
+
+   int len = 0;
+   int final = 0;
+   if ((EVP_DecryptInit_ex(m_pCTX, NULL, NULL, NULL, input) != 1) ||
+       (EVP_CIPHER_CTX_ctrl(m_pCTX, EVP_CTRL_GCM_SET_TAG, g_iTagSize, tag) != 1) ||
+       ((size > 0) && (EVP_DecryptUpdate(m_pCTX, output, &len, ip, size) != 1)))
+   {
+      printf("error in decrypt\n");
+      return -1;
+   }
+
+   // the tag is checked here, a modified message is rejected
+   if (EVP_DecryptFinal_ex(m_pCTX, output + len, &final) != 1)
+   {
+      printf("message authentication failed in decrypt\n");
+      return -1;
+   }
+
+   // only an authentic message moves the nonce forward
+   memcpy(m_pcPeerNonce, nonce, g_iNonceSize);
+   m_bPeerNonce = true;
+
+   outsize = len + final;
+   return 0;
+}
@@ -24,6 +24,14 @@ written by
 
 #include <openssl/evp.h>
 
+// ciphers for secure data transfers
+struct CipherType
+{
+   static const int BLOWFISH = 0;	// Blowfish-CBC, used with peers that do not negotiate a cipher
+   static const int AES_GCM = 1;	// AES-128-GCM, authenticated
+   static const int CHACHA20 = 2;	// ChaCha20-Poly1305, authenticated, fast without AES instructions
+};
+
 class Crypto
 {
 enum Type {INIT, ENC, DEC};
@@ -35,21 +43,78 @@ public:
 public:
    static int generateKey(unsigned char key[16], unsigned char iv[8]);
 
-   int initEnc(unsigned char key[16], unsigned char iv[8]);
-   int initDec(unsigned char key[16], unsigned char iv[8]);
+      // Functionality:
+      //    list the ciphers supported by the local OpenSSL library, as a bit mask of 1 << CipherType.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    the bit mask; Blowfish is always included.
+
+   static int getCipherList();
+
+      // Functionality:
+      //    choose the cipher for a transfer, from the ciphers supported by both sides.
+      //    AES-GCM is preferred if the CPU has AES instructions, ChaCha20-Poly1305 otherwise.
+      // Parameters:
+      //    1) [in] list: ciphers supported by the peer, see getCipherList()
+      // Returned value:
+      //    the chosen CipherType.
+
+   static int negotiate(const int& list);
+
+   int initEnc(unsigned char key[16], unsigned char iv[8], const int cipher = CipherType::BLOWFISH);
+   int initDec(unsigned char key[16], unsigned char iv[8], const int cipher = CipherType::BLOWFISH);
    int release();
 
+      // Functionality:
+      //    encrypt or decrypt one message. An authenticated message is the nonce, the cipher text
+      //    and the tag; decrypt() fails if the message has been modified, or if its nonce is not
+      //    newer than that of the last message accepted, i.e., it has been replayed or reordered.
+      //    Both work in place if input == output + getHeaderSize().
+      // Parameters:
+      //    1) [in] input: input buffer
+      //    2) [in] insize: size of the input
+      //    3) [out] output: output buffer, at least insize + getOverhead() bytes
+      //    4) [out] outsize: size of the output
+      // Returned value:
+      //    0 on success, -1 on error.
+
    int encrypt(unsigned char* input, int insize, unsigned char* output, int& outsize);
    int decrypt(unsigned char* input, int insize, unsigned char* output, int& outsize);
 
+   int getCipher() const {return m_iCipher;}
+   int getHeaderSize() const;		// bytes in front of the cipher text in a message
+   int getOverhead() const;		// maximum size difference between a message and its plain text
+
+      // a buffer kept by the coder, so that each message does not need a new one
+   unsigned char* getBuffer(const int& size);
+
+private:
+   int initAEAD_(unsigned char key[16], unsigned char iv[8]);
+   int encryptCBC_(unsigned char* input, int insize, unsigned char* output, int& outsize);
+   int decryptCBC_(unsigned char* input, int insize, unsigned char* output, int& outsize);
+   int encryptAEAD_(unsigned char* input, int insize, unsigned char* output, int& outsize);
+   int decryptAEAD_(unsigned char* input, int insize, unsigned char* output, int& outsize);
+
 private:
    unsigned char m_pcKey[16];
    unsigned char m_pcIV[8];
-   EVP_CIPHER_CTX m_CTX;
+   EVP_CIPHER_CTX* m_pCTX;
    Type m_CoderType;
+   int m_iCipher;
+
+   unsigned char m_pcNonce[12];		// random prefix and message counter of the next AEAD nonce
+   unsigned int m_iNonceCount;
+   unsigned char m_pcPeerNonce[12];	// nonce of the last message accepted by the decoder
+   bool m_bPeerNonce;			// if any message has been accepted yet
+
+   unsigned char* m_pcBuffer;
+   int m_iBufSize;
 
    static const int g_iEncBlockSize = 1024;
    static const int g_iDecBlockSize = 1024;
+   static const int g_iNonceSize = 12;
+   static const int g_iTagSize = 16;
 };
 
 #endif
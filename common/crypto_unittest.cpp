@@ -20,9 +20,12 @@ written by
 *****************************************************************************/
 
 #include <assert.h>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
+#include <common.h>
 #include "crypto.h"
 
 using namespace std;
@@ -61,9 +64,155 @@ int test1()
    return 0;
 }
 
+// authenticated ciphers: several messages per coder, in place, and modified messages
+int test2(int cipher)
+{
+   if ((Crypto::getCipherList() & (1 << cipher)) == 0)
+      return 0;
+
+   unsigned char key[16];
+   unsigned char iv[8];
+   Crypto::generateKey(key, iv);
+
+   Crypto enc, dec;
+   assert(enc.initEnc(key, iv, cipher) == 0);
+   assert(dec.initDec(key, iv, cipher) == 0);
+   assert(enc.getCipher() == cipher);
+
+   const int size = 100000 + 3;
+   vector<unsigned char> plain(size);
+   for (int i = 0; i < size; ++ i)
+      plain[i] = rand();
+
+   vector<unsigned char> msg1(size + enc.getOverhead());
+   vector<unsigned char> msg2(size + enc.getOverhead());
+   int len1 = 0;
+   int len2 = 0;
+   assert(enc.encrypt(&plain[0], size, &msg1[0], len1) == 0);
+   assert(len1 == size + enc.getOverhead());
+
+   // the same plain text gives a different message, as every message has its own nonce
+   assert(enc.encrypt(&plain[0], size, &msg2[0], len2) == 0);
+   assert((len1 == len2) && (memcmp(&msg1[0], &msg2[0], len1) != 0));
+
+   vector<unsigned char> out(size + dec.getOverhead());
+   int outlen = 0;
+   assert(dec.decrypt(&msg1[0], len1, &out[0], outlen) == 0);
+   assert((outlen == size) && (memcmp(&out[0], &plain[0], size) == 0));
+   assert(dec.decrypt(&msg2[0], len2, &out[0], outlen) == 0);
+   assert((outlen == size) && (memcmp(&out[0], &plain[0], size) == 0));
+
+   // a message that has been accepted, or an older one, is rejected
+   assert(dec.decrypt(&msg2[0], len2, &out[0], outlen) < 0);
+   assert(dec.decrypt(&msg1[0], len1, &out[0], outlen) < 0);
+
+   // so is a message sent by the decoder's own side
+   Crypto back;
+   assert(back.initEnc(key, iv, cipher) == 0);
+   assert(back.encrypt(&plain[0], size, &msg2[0], len2) == 0);
+   assert(back.encrypt(&plain[0], size, &msg2[0], len2) == 0);
+   assert(dec.decrypt(&msg2[0], len2, &out[0], outlen) < 0);
+
+   // in place, the plain text starts after the header
+   unsigned char* buf = enc.getBuffer(size + enc.getOverhead());
+   memcpy(buf + enc.getHeaderSize(), &plain[0], size);
+   assert(enc.encrypt(buf + enc.getHeaderSize(), size, buf, len1) == 0);
+   assert(dec.decrypt(buf, len1, buf + dec.getHeaderSize(), outlen) == 0);
+   assert((outlen == size) && (memcmp(buf + dec.getHeaderSize(), &plain[0], size) == 0));
+
+   // any modified byte, or a cut message, is rejected, and does not stop the next message
+   assert(enc.encrypt(&plain[0], size, &msg1[0], len1) == 0);
+   msg1[len1 / 2] ^= 1;
+   assert(dec.decrypt(&msg1[0], len1, &out[0], outlen) < 0);
+   msg1[len1 / 2] ^= 1;
+   msg1[len1 - 1] ^= 0x80;
+   assert(dec.decrypt(&msg1[0], len1, &out[0], outlen) < 0);
+   msg1[len1 - 1] ^= 0x80;
+   assert(dec.decrypt(&msg1[0], 20, &out[0], outlen) < 0);
+   assert(dec.decrypt(&msg1[0], len1, &out[0], outlen) == 0);
+
+   // a different session key cannot read the message
+   assert(enc.encrypt(&plain[0], size, &msg1[0], len1) == 0);
+   Crypto other;
+   key[0] ^= 1;
+   assert(other.initDec(key, iv, cipher) == 0);
+   assert(other.decrypt(&msg1[0], len1, &out[0], outlen) < 0);
+
+   // empty messages still carry a tag
+   assert(enc.encrypt(&plain[0], 0, &msg1[0], len1) == 0);
+   assert(dec.decrypt(&msg1[0], len1, &out[0], outlen) == 0);
+   assert(outlen == 0);
+
+   return 0;
+}
+
+// negotiation falls back to Blowfish with peers that do not list other ciphers
+int test3()
+{
+   assert(Crypto::getCipherList() & (1 << CipherType::BLOWFISH));
+   assert(Crypto::negotiate(1 << CipherType::BLOWFISH) == CipherType::BLOWFISH);
+   assert(Crypto::negotiate(0) == CipherType::BLOWFISH);
+
+   int c = Crypto::negotiate(Crypto::getCipherList());
+   assert(Crypto::getCipherList() & (1 << c));
+   if (Crypto::getCipherList() & (1 << CipherType::CHACHA20))
+      assert(Crypto::negotiate((1 << CipherType::BLOWFISH) | (1 << CipherType::CHACHA20)) == CipherType::CHACHA20);
+
+   return 0;
+}
+
+// encryption throughput of each cipher, on messages of the size used by file transfers
+void bench(int cipher, const char* name)
+{
+   if ((Crypto::getCipherList() & (1 << cipher)) == 0)
+      return;
+
+   unsigned char key[16];
+   unsigned char iv[8];
+   Crypto::generateKey(key, iv);
+
+   Crypto enc, dec;
+   enc.initEnc(key, iv, cipher);
+   dec.initDec(key, iv, cipher);
+
+   const int size = 8000000;
+   const int num = 16;
+   vector<unsigned char> plain(size, 'a');
+   vector<unsigned char> msg(size + enc.getOverhead());
+   vector<unsigned char> out(size + dec.getOverhead());
+   int len = 0;
+   int outlen = 0;
+
+   uint64_t start = CTimer::getTime();
+   for (int i = 0; i < num; ++ i)
+      enc.encrypt(&plain[0], size, &msg[0], len);
+   uint64_t enc_time = CTimer::getTime() - start;
+
+   // a CBC decoder must see the messages in order, so each message is decrypted right after it is made
+   uint64_t dec_time = 0;
+   for (int i = 0; i < num; ++ i)
+   {
+      enc.encrypt(&plain[0], size, &msg[0], len);
+      start = CTimer::getTime();
+      dec.decrypt(&msg[0], len, &out[0], outlen);
+      dec_time += CTimer::getTime() - start;
+   }
+   assert(outlen == size);
+
+   cout << name << ": encrypt " << int64_t(size) * num * 8 / enc_time << " Mb/s, decrypt " << int64_t(size) * num * 8 / dec_time << " Mb/s" << endl;
+}
+
 int main()
 {
    test1();
+   test2(CipherType::AES_GCM);
+   test2(CipherType::CHACHA20);
+   test3();
+
+   bench(CipherType::BLOWFISH, "Blowfish-CBC");
+   bench(CipherType::AES_GCM, "AES-128-GCM");
+   bench(CipherType::CHACHA20, "ChaCha20-Poly1305");
 
+   cout << "crypto_unittest passed" << endl;
    return 0;
 }
@@ -300,12 +300,14 @@ int DataChn::send(const string& ip, int port, int session, const char* data, int
    }
    else
    {
-      char* tmp = new char[size + 64];
-      int len = size + 64;
-      encoder->encrypt((unsigned char*)data, size, (unsigned char*)tmp, len);
+      // the coder keeps its buffer, so that each message does not allocate a new one
+      char* tmp = (char*)encoder->getBuffer(size + encoder->getOverhead());
+      int len = 0;
+      if (encoder->encrypt((unsigned char*)data, size, (unsigned char*)tmp, len) < 0)
+         len = size = -1;
       c->m_pTrans->send((char*)&len, 4);
-      c->m_pTrans->send(tmp, len);
-      delete [] tmp;
+      if (len > 0)
+         c->m_pTrans->send(tmp, len);
    }
 
    CGuard::leaveCS(c->m_SndLock);
@@ -334,19 +336,10 @@ int DataChn::recv(const string& ip, int port, int session, char*& data, int& siz
       {
          if (session == q->m_iSession)
          {
-            if ((NULL == decoder) || self)
-            {
-               size = q->m_iSize;
-               data = q->m_pcData;
-            }
-            else
-            {
-               data = new char[q->m_iSize];
-               size = q->m_iSize;
-               decoder->decrypt((unsigned char*)q->m_pcData, q->m_iSize, (unsigned char*)data, size);
-               delete [] q->m_pcData;
-               q->m_pcData = NULL;
-            }
+            size = q->m_iSize;
+            data = q->m_pcData;
+            if (!self)
+               decrypt_(decoder, data, size);
 
             c->m_llTotalQueueSize -= q->m_iSize;
             c->m_lDataQueue.erase(q);
@@ -374,19 +367,10 @@ int DataChn::recv(const string& ip, int port, int session, char*& data, int& siz
       {
          if (session == q->m_iSession)
          {
-            if ((NULL == decoder) || self)
-            {
-               size = q->m_iSize;
-               data = q->m_pcData;
-            }
-            else
-            {
-               data = new char[q->m_iSize];
-               size = q->m_iSize;
-               decoder->decrypt((unsigned char*)q->m_pcData, q->m_iSize, (unsigned char*)data, size);
-               delete [] q->m_pcData;
-               q->m_pcData = NULL;
-            }
+            size = q->m_iSize;
+            data = q->m_pcData;
+            if (!self)
+               decrypt_(decoder, data, size);
 
             c->m_llTotalQueueSize -= q->m_iSize;
             c->m_lDataQueue.erase(q);
@@ -458,19 +442,9 @@ int DataChn::recv(const string& ip, int port, int session, char*& data, int& siz
 
       if (session == rd.m_iSession)
       {
-         if (NULL == decoder)
-         {
-            size = rd.m_iSize;
-            data = rd.m_pcData;
-         }
-         else
-         {
-            data = new char[rd.m_iSize];
-            size = rd.m_iSize;
-            decoder->decrypt((unsigned char*)rd.m_pcData, rd.m_iSize, (unsigned char*)data, size);
-            delete [] rd.m_pcData;
-            rd.m_pcData = NULL;
-         }
+         size = rd.m_iSize;
+         data = rd.m_pcData;
+         decrypt_(decoder, data, size);
 
          CGuard::leaveCS(c->m_RcvLock);
          return size;
@@ -541,20 +515,20 @@ int64_t DataChn::sendfile(const string& ip, int port, int session, fstream& ifs,
       // thus this block can be loaded into memory completely
       // also required by this datachn multiplexing
 
-      char* tmp_orig = new char[size];
-      char* tmp_enc = new char[size + 64];
-      int enc_size = size + 64;
+      // the block is read right behind the message header and encrypted in place
+      char* buf = (char*)encoder->getBuffer(size + encoder->getOverhead());
+      char* plain = buf + encoder->getHeaderSize();
+      int enc_size = 0;
 
       ifs.seekg(offset);
-      ifs.read(tmp_orig, size);
+      ifs.read(plain, size);
 
-      encoder->encrypt((unsigned char*)tmp_orig, size, (unsigned char*)tmp_enc, enc_size);
+      if (encoder->encrypt((unsigned char*)plain, size, (unsigned char*)buf, enc_size) < 0)
+         enc_size = size = -1;
 
       c->m_pTrans->send((char*)&enc_size, 4);
-      c->m_pTrans->send(tmp_enc, enc_size);
-
-      delete [] tmp_orig;
-      delete [] tmp_enc;
+      if (enc_size > 0)
+         c->m_pTrans->send(buf, enc_size);
    }
 
    CGuard::leaveCS(c->m_SndLock);
@@ -579,21 +553,13 @@ int64_t DataChn::recvfile(const string& ip, int port, int session, fstream& ofs,
       {
          if (session == q->m_iSession)
          {
-            if ((NULL == decoder) || self)
-            {
-               size = q->m_iSize;
-               ofs.seekp(offset);
-               ofs.write(q->m_pcData, size);
-            }
-            else
+            int dec_size = q->m_iSize;
+            int pos = self ? 0 : decryptInPlace_(decoder, q->m_pcData, dec_size);
+            size = dec_size;
+            if (pos >= 0)
             {
-               char* data = new char[q->m_iSize];
-               int dec_size = q->m_iSize;
-               decoder->decrypt((unsigned char*)q->m_pcData, q->m_iSize, (unsigned char*)data, dec_size);
-               size = dec_size;
                ofs.seekp(offset);
-               ofs.write(data, size);
-               delete [] data;
+               ofs.write(q->m_pcData + pos, size);
             }
 
             delete [] q->m_pcData;
@@ -622,21 +588,13 @@ int64_t DataChn::recvfile(const string& ip, int port, int session, fstream& ofs,
       {
          if (session == q->m_iSession)
          {
-            if ((NULL == decoder) || self)
-            {
-               size = q->m_iSize;
-               ofs.seekp(offset);
-               ofs.write(q->m_pcData, size);
-            }
-            else
+            int dec_size = q->m_iSize;
+            int pos = self ? 0 : decryptInPlace_(decoder, q->m_pcData, dec_size);
+            size = dec_size;
+            if (pos >= 0)
             {
-               char* data = new char[q->m_iSize];
-               int dec_size = q->m_iSize;
-               decoder->decrypt((unsigned char*)q->m_pcData, q->m_iSize, (unsigned char*)data, dec_size);
-               size = dec_size;
                ofs.seekp(offset);
-               ofs.write(data, size);
-               delete [] data;
+               ofs.write(q->m_pcData + pos, size);
             }
 
             delete [] q->m_pcData;
@@ -708,21 +666,13 @@ int64_t DataChn::recvfile(const string& ip, int port, int session, fstream& ofs,
 
       if (session == rd.m_iSession)
       {
-         if (NULL == decoder)
-         {
-            size = rd.m_iSize;
-            ofs.seekp(offset);
-            ofs.write(rd.m_pcData, size);
-         }
-         else
+         int dec_size = rd.m_iSize;
+         int pos = decryptInPlace_(decoder, rd.m_pcData, dec_size);
+         size = dec_size;
+         if (pos >= 0)
          {
-            char* data = new char[rd.m_iSize];
-            int dec_size = rd.m_iSize;
-            decoder->decrypt((unsigned char*)rd.m_pcData, rd.m_iSize, (unsigned char*)data, dec_size);
-            size = dec_size;
             ofs.seekp(offset);
-            ofs.write(data, size);
-            delete [] data;
+            ofs.write(rd.m_pcData + pos, size);
          }
 
          delete [] rd.m_pcData;
@@ -744,6 +694,38 @@ int64_t DataChn::recvfile(const string& ip, int port, int session, fstream& ofs,
    return -1;
 }
 
+int DataChn::decryptInPlace_(Crypto* decoder, char* data, int& size)
+{
+   // negative sizes are errors from the peer, see sendError, and empty messages are never encrypted
+   if ((NULL == decoder) || (size <= 0))
+      return 0;
+
+   int len = 0;
+   int pos = decoder->getHeaderSize();
+   if (decoder->decrypt((unsigned char*)data, size, (unsigned char*)data + pos, len) < 0)
+   {
+      size = -1;
+      return -1;
+   }
+
+   size = len;
+   return pos;
+}
+
+void DataChn::decrypt_(Crypto* decoder, char*& data, int& size)
+{
+   int pos = decryptInPlace_(decoder, data, size);
+   if (pos < 0)
+   {
+      delete [] data;
+      data = NULL;
+   }
+   else if (pos > 0)
+   {
+      memmove(data, data + pos, size);
+   }
+}
+
 int DataChn::recv4(const string& ip, int port, int session, int32_t& val)
 {
    char* buf = NULL;
@@ -102,6 +102,11 @@ private:
 
 private:
    ChnInfo* locate(const std::string& ip, int port);
+
+      // decrypt a received message where it is; returns the position of the plain text, or -1 if the message is rejected
+   static int decryptInPlace_(Crypto* decoder, char* data, int& size);
+      // same, and move the plain text to the beginning of the buffer; the buffer is released if the message is rejected
+   static void decrypt_(Crypto* decoder, char*& data, int& size);
 };
 
 }  // namespace sector
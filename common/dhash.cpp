@@ -20,6 +20,7 @@ written by
 *****************************************************************************/
 
 
+#include <stdio.h>
 #include <string.h>
 #include "dhash.h"
 
@@ -60,3 +61,16 @@ unsigned int DHash::hash(const char* str, int m)
 
    return (*(unsigned int*)(res + SHA_DIGEST_LENGTH - 4)) & mask;
 }
+
+std::string DHash::digest(const char* buf, const int64_t& len)
+{
+   unsigned char res[SHA_DIGEST_LENGTH];
+
+   SHA1((const unsigned char*)buf, len, res);
+
+   char hex[SHA_DIGEST_LENGTH * 2 + 1];
+   for (int i = 0; i < SHA_DIGEST_LENGTH; ++ i)
+      sprintf(hex + i * 2, "%02x", res[i]);
+
+   return std::string(hex, SHA_DIGEST_LENGTH * 2);
+}
@@ -24,6 +24,7 @@ written by
 
 #include <openssl/sha.h>
 #include <math.h>
+#include <stdint.h>
 #include <string>
 
 class DHash
@@ -36,6 +37,16 @@ public:
    unsigned int hash(const char* str);
    static unsigned int hash(const char* str, int m);
 
+      // Functionality:
+      //    compute the SHA-1 digest of a data block, used to identify a file by its content.
+      // Parameters:
+      //    1) [in] buf: data block
+      //    2) [in] len: size of the block
+      // Returned value:
+      //    40 hex digits.
+
+   static std::string digest(const char* buf, const int64_t& len);
+
 private:
    unsigned int m_im;
 };
@@ -0,0 +1,363 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include "erasure.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(WIN32)
+   #define EC_X86_SIMD
+   #include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+   // GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1
+   struct GFTables
+   {
+      unsigned char m_pcExp[512];
+      int m_piLog[256];
+      int m_iSIMD;		// 0: portable, 1: SSSE3, 2: AVX2
+
+      GFTables()
+      {
+         int x = 1;
+         for (int i = 0; i < 255; ++ i)
+         {
+            m_pcExp[i] = m_pcExp[i + 255] = (unsigned char)x;
+            m_piLog[x] = i;
+            x <<= 1;
+            if (x & 0x100)
+               x ^= 0x11D;
+         }
+         m_pcExp[510] = m_pcExp[511] = m_pcExp[0];
+         m_piLog[0] = 0;
+
+         m_iSIMD = 0;
+      #ifdef EC_X86_SIMD
+         __builtin_cpu_init();
+         if (__builtin_cpu_supports("avx2"))
+            m_iSIMD = 2;
+         else if (__builtin_cpu_supports("ssse3"))
+            m_iSIMD = 1;
+      #endif
+      }
+   };
+
+   const GFTables g_GF;
+
+   // Every product c * b is looked up as c * (b & 0x0F) ^ c * (b & 0xF0), so two 16-entry tables
+   // are enough for one coefficient. The SIMD versions do the 16 lookups at once with a byte shuffle.
+   void nibbleTables(const unsigned char& c, unsigned char* lo, unsigned char* hi)
+   {
+      for (int x = 0; x < 16; ++ x)
+      {
+         lo[x] = ErasureCode::mul(c, x);
+         hi[x] = ErasureCode::mul(c, x << 4);
+      }
+   }
+
+#ifdef EC_X86_SIMD
+   __attribute__((target("ssse3")))
+   int mulAddSSSE3(const unsigned char* lo, const unsigned char* hi, const char* in, char* out, const int& len)
+   {
+      const __m128i tlo = _mm_loadu_si128((const __m128i*)lo);
+      const __m128i thi = _mm_loadu_si128((const __m128i*)hi);
+      const __m128i mask = _mm_set1_epi8(0x0F);
+
+      int i = 0;
+      for (; i + 16 <= len; i += 16)
+      {
+         __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+         __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(v, mask));
+         __m128i h = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(v, 4), mask));
+         __m128i o = _mm_loadu_si128((const __m128i*)(out + i));
+         _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(o, _mm_xor_si128(l, h)));
+      }
+      return i;
+   }
+
+   __attribute__((target("avx2")))
+   int mulAddAVX2(const unsigned char* lo, const unsigned char* hi, const char* in, char* out, const int& len)
+   {
+      const __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lo));
+      const __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hi));
+      const __m256i mask = _mm256_set1_epi8(0x0F);
+
+      int i = 0;
+      for (; i + 32 <= len; i += 32)
+      {
+         __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+         __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(v, mask));
+         __m256i h = _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask));
+         __m256i o = _mm256_loadu_si256((const __m256i*)(out + i));
+         _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(o, _mm256_xor_si256(l, h)));
+      }
+      return i;
+   }
+#endif
+}
+
+ErasureCode::ErasureCode():
+m_iK(0),
+m_iM(0),
+m_vMatrix()
+{
+}
+
+int ErasureCode::init(const int& k, const int& m)
+{
+   if ((k <= 0) || (m < 0) || (k + m > m_iMaxShards))
+      return -1;
+
+   m_iK = k;
+   m_iM = m;
+
+   // any k rows of [I; C] form an invertible matrix when C is a Cauchy matrix,
+   // C(i, j) = 1 / (x_i + y_j), with x_i = k + i and y_j = j all distinct
+   m_vMatrix.assign((k + m) * k, 0);
+   for (int i = 0; i < k; ++ i)
+      m_vMatrix[i * k + i] = 1;
+   for (int i = 0; i < m; ++ i)
+   {
+      for (int j = 0; j < k; ++ j)
+         m_vMatrix[(k + i) * k + j] = div(1, (unsigned char)((k + i) ^ j));
+   }
+
+   return 0;
+}
+
+void ErasureCode::encode(const char* const* data, char* const* parity, const int& len) const
+{
+   if (m_iM > 0)
+      matmul_(&m_vMatrix[m_iK * m_iK], m_iM, data, parity, len);
+}
+
+int ErasureCode::reconstruct(const int* src, const char* const* in, const int& num, const int* dst, char* const* out, const int& len) const
+{
+   const int n = m_iK + m_iM;
+
+   vector<unsigned char> dec(m_iK * m_iK);
+   for (int i = 0; i < m_iK; ++ i)
+   {
+      if ((src[i] < 0) || (src[i] >= n))
+         return -1;
+      memcpy(&dec[i * m_iK], &m_vMatrix[src[i] * m_iK], m_iK);
+   }
+
+   // shard = G(dst) * data = G(dst) * A^-1 * surviving shards, where A is made of the rows of the surviving shards
+   if (invert_(dec, m_iK) < 0)
+      return -1;
+
+   vector<unsigned char> rows(num * m_iK, 0);
+   for (int r = 0; r < num; ++ r)
+   {
+      if ((dst[r] < 0) || (dst[r] >= n))
+         return -1;
+
+      const unsigned char* g = &m_vMatrix[dst[r] * m_iK];
+      for (int j = 0; j < m_iK; ++ j)
+      {
+         unsigned char v = 0;
+         for (int l = 0; l < m_iK; ++ l)
+            v ^= mul(g[l], dec[l * m_iK + j]);
+         rows[r * m_iK + j] = v;
+      }
+   }
+
+   matmul_(&rows[0], num, in, out, len);
+
+   return 0;
+}
+
+unsigned char ErasureCode::mul(const unsigned char& a, const unsigned char& b)
+{
+   if ((0 == a) || (0 == b))
+      return 0;
+   return g_GF.m_pcExp[g_GF.m_piLog[a] + g_GF.m_piLog[b]];
+}
+
+unsigned char ErasureCode::div(const unsigned char& a, const unsigned char& b)
+{
+   if ((0 == a) || (0 == b))
+      return 0;
+   return g_GF.m_pcExp[g_GF.m_piLog[a] + 255 - g_GF.m_piLog[b]];
+}
+
+void ErasureCode::mulAdd(const unsigned char& c, const char* in, char* out, const int& len)
+{
+   if (0 == c)
+      return;
+
+   unsigned char lo[16];
+   unsigned char hi[16];
+   nibbleTables(c, lo, hi);
+
+   int i = 0;
+#ifdef EC_X86_SIMD
+   if (2 == g_GF.m_iSIMD)
+      i = mulAddAVX2(lo, hi, in, out, len);
+   else if (1 == g_GF.m_iSIMD)
+      i = mulAddSSSE3(lo, hi, in, out, len);
+#endif
+
+   for (; i < len; ++ i)
+   {
+      unsigned char b = in[i];
+      out[i] ^= lo[b & 0x0F] ^ hi[b >> 4];
+   }
+}
+
+void ErasureCode::matmul_(const unsigned char* rows, const int& num, const char* const* in, char* const* out, const int& len) const
+{
+   // work on segments that fit in the L1/L2 cache, so that each output segment is only loaded once for all inputs
+   const int seg = 32768;
+
+   for (int s = 0; s < len; s += seg)
+   {
+      int size = (len - s < seg) ? len - s : seg;
+      for (int r = 0; r < num; ++ r)
+      {
+         memset(out[r] + s, 0, size);
+         for (int j = 0; j < m_iK; ++ j)
+            mulAdd(rows[r * m_iK + j], in[j] + s, out[r] + s, size);
+      }
+   }
+}
+
+int ErasureCode::invert_(vector<unsigned char>& mat, const int& n)
+{
+   // Gauss-Jordan elimination on [mat | I]
+   vector<unsigned char> inv(n * n, 0);
+   for (int i = 0; i < n; ++ i)
+      inv[i * n + i] = 1;
+
+   for (int c = 0; c < n; ++ c)
+   {
+      int p = c;
+      while ((p < n) && (0 == mat[p * n + c]))
+         ++ p;
+      if (p == n)
+         return -1;
+
+      if (p != c)
+      {
+         for (int j = 0; j < n; ++ j)
+         {
+            swap(mat[p * n + j], mat[c * n + j]);
+            swap(inv[p * n + j], inv[c * n + j]);
+         }
+      }
+
+      unsigned char f = div(1, mat[c * n + c]);
+      for (int j = 0; j < n; ++ j)
+      {
+         mat[c * n + j] = mul(mat[c * n + j], f);
+         inv[c * n + j] = mul(inv[c * n + j], f);
+      }
+
+      for (int r = 0; r < n; ++ r)
+      {
+         unsigned char e = mat[r * n + c];
+         if ((r == c) || (0 == e))
+            continue;
+         for (int j = 0; j < n; ++ j)
+         {
+            mat[r * n + j] ^= mul(e, mat[c * n + j]);
+            inv[r * n + j] ^= mul(e, inv[c * n + j]);
+         }
+      }
+   }
+
+   mat.swap(inv);
+   return 0;
+}
+
+
+int ECShard::serialize(char* buf) const
+{
+   memset(buf, 0, m_iHdrSize);
+   memcpy(buf, "SECTOREC", 8);
+   *(int32_t*)(buf + 8) = m_iK;
+   *(int32_t*)(buf + 12) = m_iM;
+   *(int32_t*)(buf + 16) = m_iIndex;
+   *(int64_t*)(buf + 24) = m_llFileSize;
+   *(int64_t*)(buf + 32) = m_llTimeStamp;
+   return m_iHdrSize;
+}
+
+int ECShard::deserialize(const char* buf)
+{
+   if (memcmp(buf, "SECTOREC", 8) != 0)
+      return -1;
+
+   m_iK = *(int32_t*)(buf + 8);
+   m_iM = *(int32_t*)(buf + 12);
+   m_iIndex = *(int32_t*)(buf + 16);
+   m_llFileSize = *(int64_t*)(buf + 24);
+   m_llTimeStamp = *(int64_t*)(buf + 32);
+
+   if ((m_iK <= 0) || (m_iM < 0) || (m_iIndex < 0) || (m_iIndex >= m_iK + m_iM) || (m_llFileSize < 0))
+      return -1;
+
+   return m_iHdrSize;
+}
+
+int64_t ECShard::chunkSize(const int64_t& filesize, const int& k)
+{
+   return (filesize + k - 1) / k;
+}
+
+string ECShard::shardDir(const string& path)
+{
+   return path + ".ec";
+}
+
+string ECShard::shardName(const int& k, const int& m, const int& index)
+{
+   char name[64];
+   sprintf(name, "%d+%d.%d", k, m, index);
+   return name;
+}
+
+int ECShard::parseName(const string& name, int& k, int& m, int& index)
+{
+   char tail;
+   if (sscanf(name.c_str(), "%d+%d.%d%c", &k, &m, &index, &tail) != 3)
+      return -1;
+
+   if ((k <= 0) || (m < 0) || (index < 0) || (index >= k + m))
+      return -1;
+
+   return 0;
+}
+
+bool ECShard::isShard(const string& path)
+{
+   size_t p = path.rfind('/');
+   if ((p == string::npos) || (p < 3) || (path.compare(p - 3, 3, ".ec") != 0))
+      return false;
+
+   int k, m, index;
+   return parseName(path.substr(p + 1), k, m, index) >= 0;
+}
@@ -0,0 +1,111 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#ifndef __SECTOR_ERASURE_H__
+#define __SECTOR_ERASURE_H__
+
+#include <udt.h>
+#include <string>
+#include <vector>
+
+// Systematic Reed-Solomon code over GF(2^8). A block is split into k data shards, and m parity
+// shards are computed from them; the block can be restored from any k of the k + m shards.
+class ErasureCode
+{
+public:
+   ErasureCode();
+
+public:
+   int init(const int& k, const int& m);
+
+   int getDataShards() const {return m_iK;}
+   int getParityShards() const {return m_iM;}
+
+      // Functionality:
+      //    compute the m parity shards from the k data shards.
+      // Parameters:
+      //    1) [in] data: k data buffers
+      //    2) [out] parity: m parity buffers
+      //    3) [in] len: size of each buffer
+      // Returned value:
+      //    None.
+
+   void encode(const char* const* data, char* const* parity, const int& len) const;
+
+      // Functionality:
+      //    rebuild any shards of a block from k surviving ones.
+      // Parameters:
+      //    1) [in] src: indices of the k surviving shards, 0 to k - 1 are data shards
+      //    2) [in] in: k buffers holding the surviving shards, in the order of src
+      //    3) [in] num: number of shards to rebuild
+      //    4) [in] dst: indices of the shards to rebuild
+      //    5) [out] out: num buffers for the rebuilt shards
+      //    6) [in] len: size of each buffer
+      // Returned value:
+      //    0 on success, -1 if the indices are invalid.
+
+   int reconstruct(const int* src, const char* const* in, const int& num, const int* dst, char* const* out, const int& len) const;
+
+public:
+   static unsigned char mul(const unsigned char& a, const unsigned char& b);
+   static unsigned char div(const unsigned char& a, const unsigned char& b);
+
+      // out ^= c * in, for every byte of the buffers
+   static void mulAdd(const unsigned char& c, const char* in, char* out, const int& len);
+
+private:
+   void matmul_(const unsigned char* rows, const int& num, const char* const* in, char* const* out, const int& len) const;
+   static int invert_(std::vector<unsigned char>& mat, const int& n);
+
+private:
+   int m_iK;					// number of data shards
+   int m_iM;					// number of parity shards
+   std::vector<unsigned char> m_vMatrix;	// (k + m) x k generator matrix, identity on top of a Cauchy matrix
+
+   static const int m_iMaxShards = 255;
+};
+
+// Layout of an erasure coded file. A file "/dir/name" is stored as the shard files
+// "/dir/name.ec/<k>+<m>.<index>", each a fixed header followed by one column of the code:
+// data shard i holds bytes [i * chunk, (i + 1) * chunk) of the file, zero padded.
+struct ECShard
+{
+   int32_t m_iK;			// number of data shards
+   int32_t m_iM;			// number of parity shards
+   int32_t m_iIndex;			// index of this shard
+   int64_t m_llFileSize;		// size of the original file
+   int64_t m_llTimeStamp;		// time stamp of the original file
+
+   static const int m_iHdrSize = 64;	// space reserved for the header at the beginning of a shard
+
+   int64_t getChunkSize() const {return chunkSize(m_llFileSize, m_iK);}
+
+   int serialize(char* buf) const;
+   int deserialize(const char* buf);
+
+   static int64_t chunkSize(const int64_t& filesize, const int& k);
+   static std::string shardDir(const std::string& path);
+   static std::string shardName(const int& k, const int& m, const int& index);
+   static int parseName(const std::string& name, int& k, int& m, int& index);
+   static bool isShard(const std::string& path);
+};
+
+#endif
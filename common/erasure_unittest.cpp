@@ -0,0 +1,181 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   Yunhong Gu, last updated 10/19/2011
+*****************************************************************************/
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "erasure.h"
+
+using namespace std;
+
+// GF(2^8) arithmetic and the table driven multiply-add against a bitwise reference
+int test1()
+{
+   for (int a = 0; a < 256; ++ a)
+   {
+      for (int b = 1; b < 256; ++ b)
+      {
+         unsigned char p = ErasureCode::mul(a, b);
+         assert(ErasureCode::div(p, b) == a);
+
+         unsigned char r = 0;
+         unsigned char x = a;
+         unsigned char y = b;
+         while (y)
+         {
+            if (y & 1)
+               r ^= x;
+            x = (x & 0x80) ? ((x << 1) ^ 0x1D) : (x << 1);
+            y >>= 1;
+         }
+         assert(p == r);
+      }
+   }
+
+   // odd length, so that both the vector loop and the tail are used
+   const int len = 1000 + 37;
+   vector<char> in(len);
+   vector<char> out(len);
+   vector<char> ref(len);
+   for (int i = 0; i < len; ++ i)
+      in[i] = ref[i] = out[i] = rand();
+
+   ErasureCode::mulAdd(0x8E, &in[0], &out[0], len);
+   for (int i = 0; i < len; ++ i)
+      assert((unsigned char)out[i] == (unsigned char)(ref[i] ^ ErasureCode::mul(0x8E, in[i])));
+
+   return 0;
+}
+
+// every combination of lost shards up to m can be rebuilt
+int test2()
+{
+   const int k = 4;
+   const int m = 2;
+   const int len = 4096 + 5;
+
+   ErasureCode ec;
+   assert(ec.init(k, m) == 0);
+   assert(ec.init(200, 56) < 0);
+
+   vector<vector<char> > shard(k + m, vector<char>(len));
+   for (int i = 0; i < k; ++ i)
+   {
+      for (int j = 0; j < len; ++ j)
+         shard[i][j] = rand();
+   }
+
+   const char* data[k];
+   char* parity[m];
+   for (int i = 0; i < k; ++ i)
+      data[i] = &shard[i][0];
+   for (int i = 0; i < m; ++ i)
+      parity[i] = &shard[k + i][0];
+   ec.encode(data, parity, len);
+
+   for (int lost1 = 0; lost1 < k + m; ++ lost1)
+   {
+      for (int lost2 = lost1 + 1; lost2 < k + m; ++ lost2)
+      {
+         int src[k];
+         const char* in[k];
+         int c = 0;
+         for (int i = 0; (i < k + m) && (c < k); ++ i)
+         {
+            if ((i == lost1) || (i == lost2))
+               continue;
+            src[c] = i;
+            in[c] = &shard[i][0];
+            ++ c;
+         }
+         assert(c == k);
+
+         int dst[2] = {lost1, lost2};
+         vector<char> r1(len);
+         vector<char> r2(len);
+         char* out[2] = {&r1[0], &r2[0]};
+         assert(ec.reconstruct(src, in, 2, dst, out, len) == 0);
+         assert(memcmp(&r1[0], &shard[lost1][0], len) == 0);
+         assert(memcmp(&r2[0], &shard[lost2][0], len) == 0);
+      }
+   }
+
+   // the same shard cannot be used twice
+   int src[k] = {0, 0, 1, 2};
+   const char* in[k] = {data[0], data[0], data[1], data[2]};
+   int dst = 3;
+   vector<char> r(len);
+   char* out = &r[0];
+   assert(ec.reconstruct(src, in, 1, &dst, &out, len) < 0);
+
+   return 0;
+}
+
+// shard header and names
+int test3()
+{
+   ECShard s;
+   s.m_iK = 6;
+   s.m_iM = 3;
+   s.m_iIndex = 7;
+   s.m_llFileSize = 1000000007LL;
+   s.m_llTimeStamp = 1318000000;
+
+   char buf[ECShard::m_iHdrSize];
+   assert(s.serialize(buf) == ECShard::m_iHdrSize);
+
+   ECShard t;
+   assert(t.deserialize(buf) == ECShard::m_iHdrSize);
+   assert((t.m_iK == 6) && (t.m_iM == 3) && (t.m_iIndex == 7));
+   assert(t.m_llFileSize == s.m_llFileSize);
+   assert(t.m_llTimeStamp == s.m_llTimeStamp);
+   assert(t.getChunkSize() * 6 >= t.m_llFileSize);
+   assert((t.getChunkSize() - 1) * 6 < t.m_llFileSize);
+
+   buf[0] = 'X';
+   assert(t.deserialize(buf) < 0);
+
+   string name = ECShard::shardName(6, 3, 7);
+   int k, m, index;
+   assert(ECShard::parseName(name, k, m, index) == 0);
+   assert((k == 6) && (m == 3) && (index == 7));
+   assert(ECShard::parseName("6+3.9", k, m, index) < 0);
+   assert(ECShard::parseName("6+3.1x", k, m, index) < 0);
+
+   assert(ECShard::isShard(ECShard::shardDir("/archive/a") + "/" + name));
+   assert(!ECShard::isShard("/archive/a/" + name));
+   assert(!ECShard::isShard("/archive/a.ec/data"));
+
+   return 0;
+}
+
+int main()
+{
+   test1();
+   test2();
+   test3();
+
+   cout << "erasure_unittest passed" << endl;
+   return 0;
+}
@@ -31,6 +31,7 @@ written by
 #include <time.h>
 
 #include "common.h"
+#include "erasure.h"
 #include "index.h"
 #include "sector.h"
 
@@ -1222,6 +1223,12 @@ int Index::refreshRepSetting(const string& path, SNode & node, int default_num,
         break;
      }
   }
+  // shards of an erasure coded file are never replicated
+  if (ECShard::isShard(path))
+  {
+     node.m_iReplicaNum = 1;
+     node.m_iMaxReplicaNum = 1;
+  }
   // set replication distance
   node.m_iReplicaDist = default_dist;
   for (map<string, int>::const_iterator rd = rep_dist.begin(); rd != rep_dist.end(); ++ rd)
@@ -47,6 +47,7 @@ written by
 #include <stdexcept>
 #include <streambuf>
 #include <sys/syscall.h>
+#include <sys/time.h>
 #include <sys/timeb.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -54,7 +55,6 @@ written by
 
 namespace {
 
-#ifdef MULTITHREADED_LOGGER
   class Locker {
     public:
       Locker( pthread_mutex_t& lock ) : lock( lock ), held( true )
@@ -70,7 +70,6 @@ namespace {
       pthread_mutex_t& lock;
       bool             held;
   };
-#endif
 
   class RW_Read_Locker {
     public:
@@ -135,16 +134,6 @@ namespace {
     return 0;
   }
 
-  template< typename ResultType, typename InputType >
-  ResultType lexical_cast( const InputType& in ) {
-    std::stringstream os;
-    ResultType        out;
-
-    os << in;
-    os >> out;
-    return out;
-  }
-
   template< typename T >
   struct unowned_ptr {
       unowned_ptr() : ptr() {}
@@ -289,23 +278,26 @@ namespace logger {
   }
 
   std::string dateAndTime() {
-    struct timeb currentTime;
-    struct tm currentDateAndTime;
-
-    ftime( &currentTime );
-    localtime_r( &currentTime.time, &currentDateAndTime );
-
-    std::stringstream result;
+    // localtime_r() is only needed once per second per thread
+    static __thread time_t cachedSecond = 0;
+    static __thread char   cachedDate[64];
+
+    timeval currentTime;
+    gettimeofday( &currentTime, 0 );
+
+    if( currentTime.tv_sec != cachedSecond ) {
+      struct tm currentDateAndTime;
+      localtime_r( &currentTime.tv_sec, &currentDateAndTime );
+      snprintf( cachedDate, sizeof( cachedDate ), "%04d-%02d-%02d %02d:%02d:%02d", 1900 + currentDateAndTime.tm_year,
+        1 + currentDateAndTime.tm_mon, currentDateAndTime.tm_mday, currentDateAndTime.tm_hour,
+        currentDateAndTime.tm_min, currentDateAndTime.tm_sec );
+      cachedSecond = currentTime.tv_sec;
+    }
 
-    result << 1900 + currentDateAndTime.tm_year << '-' << std::setw( 2 ) << std::setfill( '0' )
-      << 1 + currentDateAndTime.tm_mon << '-' << std::setw( 2 ) << std::setfill( '0' )
-      << currentDateAndTime.tm_mday << ' ' << std::setw( 2 ) << std::setfill( '0' )
-      << currentDateAndTime.tm_hour << ':' << std::setw( 2 ) << std::setfill( '0' )
-      << currentDateAndTime.tm_min << ':' << std::setw( 2 ) << std::setfill( '0' )
-      << currentDateAndTime.tm_sec << '.' << std::setw( 3 ) << std::setfill( '0' )
-      << currentTime.millitm;
+    char result[80];
+    snprintf( result, sizeof( result ), "%s.%03d", cachedDate, int( currentTime.tv_usec / 1000 ) );
 
-    return result.str();
+    return result;
   }
 
 
@@ -314,14 +306,221 @@ namespace logger {
 
     { // Begin critical section
       RW_Read_Locker critSec( threadNamesLock );
-      thread_names_t::const_iterator iter = threadNames.find( syscall( SYS_gettid ) );
-      name = iter == threadNames.end() ? "TID-" + lexical_cast<std::string>( syscall( SYS_gettid ) ) : iter->second;
+      pid_t tid = syscall( SYS_gettid );
+      thread_names_t::const_iterator iter = threadNames.find( tid );
+      if( iter == threadNames.end() ) {
+        char tidName[32];
+        snprintf( tidName, sizeof( tidName ), "TID-%d", int( tid ) );
+        name = tidName;
+      } else
+        name = iter->second;
     } // End critical section
 
     return '[' + name + ']';
   }
 
 
+  void formatPrefix( std::string& line, LogLevel level, const std::string& name ) {
+    line.reserve( line.size() + 128 );
+    if( level == Screen )
+      concatenate( line, dateAndTime(), ' ', getThreadName(), ' ', name, " - " );
+    else
+      concatenate( line, levelToName( level ), ' ', dateAndTime(), ' ', getThreadName(), ' ', name, " - " );
+  }
+
+
+  // Log file output is asynchronous: threads hand finished lines to a lock-free multi-producer queue
+  // (intrusive MPSC list) and a background thread writes them to the file in batches, so no handler thread
+  // waits for the disk or for another logging thread.  Screen output stays synchronous.
+
+  struct LogNode {
+    LogNode* volatile next;
+    std::string       text;
+  };
+
+  static LogNode                   queueStub;
+  static LogNode* volatile         queueHead( &queueStub );   // last pushed node, swapped by producers
+  static LogNode*                  queueTail( &queueStub );   // next node to pop, only used by the writer
+
+  static pthread_once_t            writerOnce = PTHREAD_ONCE_INIT;
+  static pthread_t                 writerThread;
+  static pthread_mutex_t           writerLock = PTHREAD_MUTEX_INITIALIZER;
+  static pthread_cond_t            writerCond = PTHREAD_COND_INITIALIZER;
+  static volatile bool             writerIdle( false );
+  static volatile bool             writerStop( false );
+  static volatile bool             writerGone( false );       // no writer thread: write synchronously
+
+  static const size_t              maxBatchSize = 1 << 20;
+
+
+  static void pushNode( LogNode* node ) {
+    node->next = 0;
+    __sync_synchronize();
+    LogNode* prev = __sync_lock_test_and_set( &queueHead, node );
+    prev->next = node;
+  }
+
+
+  static LogNode* popNode() {
+    LogNode* tail = queueTail;
+    LogNode* next = tail->next;
+
+    if( tail == &queueStub ) {
+      if( !next )
+        return 0;
+      queueTail = tail = next;
+      next = next->next;
+    }
+
+    if( next ) {
+      queueTail = next;
+      return tail;
+    }
+
+    // a producer is between swapping the head and linking its node
+    if( tail != queueHead )
+      return 0;
+
+    pushNode( &queueStub );
+    next = tail->next;
+    if( next ) {
+      queueTail = next;
+      return tail;
+    }
+
+    return 0;
+  }
+
+
+  static void writeFile( const std::string& text ) {
+    RW_Write_Locker critSec( configurationLock );
+    if( dayHasChanged() ) {
+      reopenLogFile();
+      updateCurrentDate();
+    }
+
+    for( size_t done = 0; done < text.size(); ) {
+      ssize_t n = write( fd, text.data() + done, text.size() - done );
+      if( n <= 0 )
+        break;
+      done += n;
+    }
+  }
+
+
+  static void* writerLoop( void* ) {
+    std::string batch;
+    batch.reserve( maxBatchSize );
+
+    while( true ) {
+      batch.clear();
+      for( LogNode* node = popNode(); node; node = popNode() ) {
+        batch += node->text;
+        delete node;
+        if( batch.size() >= maxBatchSize )
+          break;
+      }
+
+      if( !batch.empty() ) {
+        writeFile( batch );
+        continue;
+      }
+
+      if( writerStop )
+        break;
+
+      // sleep until a producer finds the writer idle and signals it; the timeout covers a missed signal
+      Locker critSec( writerLock );
+      writerIdle = true;
+      __sync_synchronize();
+      if( queueHead == queueTail ) {
+        timeval now;
+        timespec timeout;
+        gettimeofday( &now, 0 );
+        timeout.tv_sec = now.tv_sec + 1;
+        timeout.tv_nsec = now.tv_usec * 1000;
+        pthread_cond_timedwait( &writerCond, &writerLock, &timeout );
+      }
+      writerIdle = false;
+    }
+
+    return 0;
+  }
+
+
+  static void stopWriter() {
+    { // Begin critical section
+      Locker critSec( writerLock );
+      writerStop = true;
+      pthread_cond_signal( &writerCond );
+    } // End critical section
+
+    pthread_join( writerThread, 0 );
+    writerGone = true;
+  }
+
+
+  static void forkedChild() {
+    // the writer thread does not exist in a forked child
+    writerGone = true;
+  }
+
+
+  static void startWriter() {
+    if( pthread_create( &writerThread, 0, writerLoop, 0 ) != 0 ) {
+      writerGone = true;
+      return;
+    }
+
+    // drain the queue when the process exits normally
+    atexit( stopWriter );
+    pthread_atfork( 0, 0, forkedChild );
+  }
+
+
+  void writeLine( LogLevel level, const std::string& line ) {
+    if( level == Screen ) {
+      std::cerr << line;
+      return;
+    }
+
+    pthread_once( &writerOnce, startWriter );
+
+    if( writerGone ) {
+      writeFile( line );
+      return;
+    }
+
+    LogNode* node = new LogNode;
+    node->text = line;
+    pushNode( node );
+
+    if( writerIdle ) {
+      Locker critSec( writerLock );
+      pthread_cond_signal( &writerCond );
+    }
+  }
+
+
+  void writeText( LogLevel level, const std::string& name, const char* text ) {
+    // one prefix per line of text, the same output as writing the text through a logger stream
+    std::string lines;
+    for( const char* p = text; *p; ) {
+      const char* eol = strchr( p, '\n' );
+      size_t len = eol ? eol - p : strlen( p );
+
+      formatPrefix( lines, level, name );
+      lines.append( p, len );
+      lines += '\n';
+
+      p += eol ? len + 1 : len;
+    }
+
+    if( !lines.empty() )
+      writeLine( level, lines );
+  }
+
+
   std::streamsize logbuf::xsputn( const char_type* __s, std::streamsize __n ) {
     if( !__s || !__n )
       return 0;
@@ -332,29 +531,13 @@ namespace logger {
 #endif
 
     for( std::streamsize i = 0; i < __n; ++i ) {
-      if( currentLine.empty() ) {
-        currentLine.reserve( 100 );
-        if( level == Screen )
-          concatenate( currentLine, dateAndTime(), ' ', getThreadName(), ' ', name, " - " );
-        else 
-          concatenate( currentLine, levelToName( level ), ' ', dateAndTime(), ' ', getThreadName(), ' ', name, " - " );
-      }
+      if( currentLine.empty() )
+        formatPrefix( currentLine, level, name );
 
       currentLine += __s[ i ];
   
       if( __s[ i ] == '\n' ) {
-        if( level == Screen ) 
-          std::cerr << currentLine;
-        else
-        { // Begin critical section
-          RW_Write_Locker critSec( configurationLock );
-          if( dayHasChanged() ) {
-            reopenLogFile();
-            updateCurrentDate();
-          }
-          write( fd, &currentLine[0], currentLine.size() );
-        } // End critical section
-  
+        writeLine( level, currentLine );
         currentLine.clear();
       }
     }
@@ -369,29 +552,13 @@ namespace logger {
     std::string& currentLine( currentLines[ syscall( SYS_gettid ) ] );
 #endif
 
-    if( currentLine.empty() && c != '\n' ) {
-      currentLine.reserve( 100 );
-      if( level == Screen )
-        concatenate( currentLine, dateAndTime(), ' ', getThreadName(), ' ', name, " - " );
-      else 
-        concatenate( currentLine, levelToName( level ), ' ', dateAndTime(), ' ', getThreadName(), ' ', name, " - " );
-    }
+    if( currentLine.empty() && c != '\n' )
+      formatPrefix( currentLine, level, name );
 
     currentLine += (char)c;
 
     if( c == '\n' ) {
-      if( level == Screen ) 
-        std::cerr << currentLine;
-      else
-      { // Begin critical section
-        RW_Write_Locker critSec( configurationLock );
-        if( dayHasChanged() ) {
-          reopenLogFile();
-          updateCurrentDate();
-        }
-        write( fd, &currentLine[0], currentLine.size() );
-      } // End critical section
-
+      writeLine( level, currentLine );
       currentLine.clear();
     }
 
@@ -494,6 +661,24 @@ namespace logger {
   }
 
 
+  void flush() {
+    pthread_once( &writerOnce, startWriter );
+
+    // the writer only goes idle after the last batch it popped has been written
+    while( !writerGone ) {
+      { // Begin critical section
+        Locker critSec( writerLock );
+        pthread_cond_signal( &writerCond );
+      } // End critical section
+
+      if( writerIdle && ( queueHead == queueTail ) )
+        break;
+
+      usleep( 1000 );
+    }
+  }
+
+
   void setThreadName( const std::string& name ) {
     RW_Write_Locker critSec( threadNamesLock );
     threadNames[ syscall( SYS_gettid ) ] = name;
@@ -518,13 +703,27 @@ m_strFunc(__func__)
 }
 
 
+namespace {
+  void deleteLine( void* line ) {
+    delete static_cast<LogString*>( line );
+  }
+
+  // SectorLog levels 0 to 4 map to the logger streams of the same index, anything else goes to debug
+  logger::LogLevel toStream( const int level ) {
+    return ( level >= 0 && level <= 4 ) ? static_cast<logger::LogLevel>( level ) : logger::Debug;
+  }
+}
+
 SectorLog::SectorLog():
-m_iLevel(1)
+m_iLevel(1),
+m_iMaxStream(logger::Info)
 {
+   pthread_key_create(&m_LineKey, deleteLine);
 }
 
 SectorLog::~SectorLog()
 {
+   pthread_key_delete(m_LineKey);
 }
 
 int SectorLog::init(const char* path)
@@ -537,6 +736,7 @@ int SectorLog::init(const char* path)
 
 void SectorLog::close()
 {
+   logger::flush();
 }
 
 void SectorLog::setLevel(const int level)
@@ -545,6 +745,7 @@ void SectorLog::setLevel(const int level)
    {
       CGuardEx lg(m_LogLock);
       m_iLevel = level;
+      m_iMaxStream = std::min(level, 5);
       log_.setLogLevel( static_cast<logger::LogLevel>( std::min( level, 5 ) ) );
    }
 }
@@ -553,26 +754,38 @@ void SectorLog::copyScreen(const bool)
 {
 }
 
-SectorLog& SectorLog::operator<<(const LogStringTag& tag)
+bool SectorLog::enabled_(const int level) const
+{
+   return toStream(level) <= m_iMaxStream;
+}
+
+LogString* SectorLog::getLine_()
 {
-   CGuardEx lg(m_LogLock);
+   LogString* ls = static_cast<LogString*>(pthread_getspecific(m_LineKey));
+   if (NULL == ls)
+   {
+      ls = new LogString;
+      ls->m_iLevel = -1;
+      ls->m_bEnabled = false;
+      pthread_setspecific(m_LineKey, ls);
+   }
+
+   return ls;
+}
 
-   pthread_t key = pthread_self();
+SectorLog& SectorLog::operator<<(const LogStringTag& tag)
+{
+   LogString* ls = getLine_();
 
    if (tag.m_iTag == LogTag::START)
    {
-      LogString ls;
-      ls.m_iLevel = tag.m_iLevel;
-      m_mStoredString[key] = ls;
+      ls->m_iLevel = tag.m_iLevel;
+      ls->m_bEnabled = enabled_(tag.m_iLevel);
+      ls->m_strLog.clear();
    }
    else if (tag.m_iTag == LogTag::END)
    {
-      ThreadIdStringMap::iterator i = m_mStoredString.find(key);
-      if (i != m_mStoredString.end())
-      {
-         insert_(i->second.m_strLog.c_str(), i->second.m_iLevel);
-         m_mStoredString.erase(i);
-      }
+      endl(*this);
    }
 
    return *this;
@@ -580,37 +793,31 @@ SectorLog& SectorLog::operator<<(const LogStringTag& tag)
 
 SectorLog& SectorLog::operator<<(const std::string& message)
 {
-   CGuardEx lg(m_LogLock);
+   LogString* ls = getLine_();
 
-   pthread_t key = pthread_self();
-
-   ThreadIdStringMap::iterator i = m_mStoredString.find(key);
-   if (i == m_mStoredString.end())
+   if (ls->m_iLevel < 0)
    {
       // no start tag, use default: level = SCREEN
-      LogString ls;
-      ls.m_iLevel = 0;
-      m_mStoredString[key] = ls;
-      i = m_mStoredString.find(key);
+      ls->m_iLevel = 0;
+      ls->m_bEnabled = enabled_(0);
+      ls->m_strLog.clear();
    }
 
-   i->second.m_strLog += message;
+   if (ls->m_bEnabled)
+      ls->m_strLog += message;
 
    return *this;
 }
 
 SectorLog& SectorLog::operator<<(const int64_t& val)
 {
-   CGuardEx lg(m_LogLock);
-
-   pthread_t key = pthread_self();
+   LogString* ls = getLine_();
 
-   ThreadIdStringMap::iterator i = m_mStoredString.find(key);
-   if (i != m_mStoredString.end())
+   if ((ls->m_iLevel >= 0) && ls->m_bEnabled)
    {
-      stringstream valstr;
-      valstr << val;
-      i->second.m_strLog += valstr.str();
+      char valstr[24];
+      snprintf(valstr, sizeof(valstr), "%lld", (long long)val);
+      ls->m_strLog += valstr;
    }
 
    return *this;
@@ -618,13 +825,15 @@ SectorLog& SectorLog::operator<<(const int64_t& val)
 
 SectorLog& SectorLog::endl(SectorLog& log)
 {
-   CGuardEx lg(log.m_LogLock);
-   pthread_t key = pthread_self();
-   ThreadIdStringMap::iterator i = log.m_mStoredString.find(key);
-   if (i != log.m_mStoredString.end())
+   LogString* ls = log.getLine_();
+
+   if (ls->m_iLevel >= 0)
    {
-      log.insert_(i->second.m_strLog.c_str(), i->second.m_iLevel);
-      log.m_mStoredString.erase(i);
+      if (ls->m_bEnabled)
+         log.insert_(ls->m_strLog.c_str(), ls->m_iLevel);
+
+      ls->m_iLevel = -1;
+      ls->m_strLog.clear();
    }
 
    return log;
@@ -632,31 +841,15 @@ SectorLog& SectorLog::endl(SectorLog& log)
 
 void SectorLog::insert(const char* text, const int level)
 {
-   CGuardEx lg(m_LogLock);
-   insert_( text, level );
+   if (enabled_(level))
+      insert_( text, level );
 }
 
 
 void SectorLog::insert_(const char* text, const int level)
 {
-   switch( level ) {
-       case 0:   log_.screen << text; break;
-       case 1:   log_.error << text; break;
-       case 2:   log_.warning << text; break;
-       case 3:   log_.info << text; break;
-       case 4:   log_.trace << text; break;
-       default:  log_.debug << text; break;
-   }
+   if (NULL == text)
+      return;
 
-   if( text && text[ strlen( text ) - 1 ] != '\n' ) {
-     switch( level ) {
-         case 0:   log_.screen << std::endl; break;
-         case 1:   log_.error << std::endl; break;
-         case 2:   log_.warning << std::endl; break;
-         case 3:   log_.info << std::endl; break;
-         case 4:   log_.trace << std::endl; break;
-         default:  log_.debug << std::endl; break;
-     }
-   }
+   logger::writeText(toStream(level), "Sector", text);
 }
-
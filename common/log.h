@@ -54,7 +54,8 @@ struct LogTag
 
 struct LogString
 {
-   int m_iLevel;
+   int m_iLevel;		// level of the line being built, -1 if there is none
+   bool m_bEnabled;		// false if the level is filtered out; the line is then not formatted at all
    std::string m_strLog;
 };
 
@@ -104,14 +105,16 @@ public:
    static SectorLog& endl(SectorLog& log);
 
 private:
+   bool enabled_(const int level) const;
+   LogString* getLine_();
    void insert_(const char* text, const int level = 1);
 
    int m_iLevel;
+   volatile int m_iMaxStream;			// most verbose logger stream enabled, 0 (screen) to 5 (debug)
 
-   CMutex m_LogLock;
+   CMutex m_LogLock;				// serializes setLevel()
 
-   typedef std::map<pthread_t, LogString> ThreadIdStringMap;
-   ThreadIdStringMap m_mStoredString;
+   pthread_key_t m_LineKey;			// per-thread LogString, the line being built by that thread
 };
 
 namespace logger {
@@ -156,6 +159,7 @@ namespace logger {
 
 
   void          config( const std::string& outputDir, const std::string& fileNamePrefix );
+  void          flush();
   LogAggregate& getLogger( const char* name = 0 );
   LogAggregate& getLogger( const std::string& name );
   void          setThreadName( const std::string& name );
@@ -0,0 +1,144 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   bdl62, last updated 05/21/2011
+*****************************************************************************/
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "common.h"
+#include "log.h"
+
+using namespace std;
+
+SectorLog g_Log;
+
+const int g_iThreads = 8;
+const int g_iLines = 20000;
+
+// the only log file written into dir
+string log_file(const string& dir)
+{
+   DIR* d = opendir(dir.c_str());
+   assert(NULL != d);
+   string name;
+   for (dirent* e = readdir(d); NULL != e; e = readdir(d))
+   {
+      if ('.' != e->d_name[0])
+         name = dir + "/" + e->d_name;
+   }
+   closedir(d);
+   return name;
+}
+
+void* writer(void* p)
+{
+   int64_t id = (int64_t)p;
+
+   for (int i = 0; i < g_iLines; ++ i)
+   {
+      g_Log << LogStart(LogLevel::LEVEL_1) << "thread " << id << " line " << i << LogEnd();
+      g_Log << LogStart(LogLevel::LEVEL_9) << "filtered " << id << LogEnd();
+   }
+
+   return NULL;
+}
+
+// concurrent writers: every enabled line arrives whole and exactly once, filtered lines never arrive
+int test1(const string& dir)
+{
+   g_Log.setLevel(3);
+
+   pthread_t t[g_iThreads];
+   int64_t start = CTimer::getTime();
+   for (int64_t i = 0; i < g_iThreads; ++ i)
+      pthread_create(&t[i], NULL, writer, (void*)i);
+   for (int i = 0; i < g_iThreads; ++ i)
+      pthread_join(t[i], NULL);
+   int64_t duration = CTimer::getTime() - start;
+
+   g_Log.insert("first\nsecond", LogLevel::LEVEL_2);
+   g_Log.close();
+
+   ifstream ifs(log_file(dir).c_str());
+   int count[g_iThreads] = {0};
+   int multi = 0;
+   string line;
+   while (getline(ifs, line))
+   {
+      assert(line.find("filtered") == string::npos);
+
+      string::size_type p = line.find(" Sector - ");
+      assert(p != string::npos);
+      string text = line.substr(p + 10);
+
+      if ((text == "first") || (text == "second"))
+      {
+         assert(line.compare(0, 4, "WRN ") == 0);
+         ++ multi;
+         continue;
+      }
+
+      assert(line.compare(0, 4, "ERR ") == 0);
+      int id, n;
+      char tail;
+      assert(sscanf(text.c_str(), "thread %d line %d%c", &id, &n, &tail) == 2);
+      assert((id >= 0) && (id < g_iThreads) && (n == count[id]));
+      ++ count[id];
+   }
+
+   for (int i = 0; i < g_iThreads; ++ i)
+      assert(count[i] == g_iLines);
+   assert(2 == multi);
+
+   cout << g_iThreads << " threads logging, one filtered line per written line: "
+        << duration * 1000 / (g_iThreads * g_iLines) << " ns per pair" << endl;
+
+   return 0;
+}
+
+int main()
+{
+   char dir[] = "/tmp/log_unittest.XXXXXX";
+   assert(NULL != mkdtemp(dir));
+
+   g_Log.init(dir);
+
+   test1(dir);
+
+   unlink(log_file(dir).c_str());
+   rmdir(dir);
+
+   return 0;
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <iomanip>
 #include "conf.h"
+#include "erasure.h"
 #include "meta.h"
 #include "osportable.h"
 #include "replica_conf.h"
@@ -125,6 +126,29 @@ bool ReplicaConfig::readConfigFile()
                configData.m_mRestrictedLoc[rp] = topo;
          }
       }
+      else if ("ERASURE_CODE" == param.m_strName)
+      {
+         for (vector<string>::iterator i = param.m_vstrValue.begin(); i != param.m_vstrValue.end(); ++ i)
+         {
+            string path;
+            int k, m;
+            if ((parseItem(*i, path, k, m) > 0) && (m > 0) && (k + m <= 255))
+            {
+               string rp = Metadata::revisePath(path);
+               if (rp.length() > 0)
+                  configData.m_mErasureCode[rp] = pair<int,int>(k, m);
+            }
+            else
+               cerr << "invalid ERASURE_CODE entry: " << *i << endl;
+         }
+      }
+      else if ("ERASURE_CODE_COLD_AGE" == param.m_strName)
+      {
+         if( !param.m_vstrValue.empty() )
+             configData.m_iErasureCodeColdAge = atoi(param.m_vstrValue[0].c_str());
+         else
+             cerr << "no value specified for ERASURE_CODE_COLD_AGE" << endl;
+      }
       else if ("REPLICATION_MAX_TRANS" == param.m_strName)
       {
          if( !param.m_vstrValue.empty() )
@@ -132,6 +156,20 @@ bool ReplicaConfig::readConfigFile()
          else
              cerr << "no value specified for REPLICATION_MAX_TRANS" << endl;
       }
+      else if ("REPLICATION_NODE_MAX_TRANS" == param.m_strName)
+      {
+         if( !param.m_vstrValue.empty() )
+             configData.m_iReplicationNodeMaxTrans = atoi(param.m_vstrValue[0].c_str());
+         else
+             cerr << "no value specified for REPLICATION_NODE_MAX_TRANS" << endl;
+      }
+      else if ("REPLICATION_NODE_BANDWIDTH" == param.m_strName)
+      {
+         if( !param.m_vstrValue.empty() )
+             configData.m_iReplicationNodeBandwidth = atoi(param.m_vstrValue[0].c_str());
+         else
+             cerr << "no value specified for REPLICATION_NODE_BANDWIDTH" << endl;
+      }
       else if ("CHECK_REPLICA_ON_SAME_IP" == param.m_strName)
       {
          if( !param.m_vstrValue.empty() )
@@ -197,9 +235,12 @@ bool ReplicaConfig::readConfigFile()
 
 
 ReplicaConfData::ReplicaConfData() :
+   m_iErasureCodeColdAge(7*24*3600),       // 7 days
    m_iReplicationStartDelay(10*60),        // 10 min
    m_iReplicationFullScanDelay(10*60),     // 10 min
    m_iReplicationMaxTrans(),               // 0 - no of slaves
+   m_iReplicationNodeMaxTrans(2),
+   m_iReplicationNodeBandwidth(),          // 0 - unlimited
    m_iDiskBalanceAggressiveness(25),       // percent
    m_bReplicateOnTransactionClose(),
    m_bCheckReplicaOnSameIp(),
@@ -215,6 +256,8 @@ std::string ReplicaConfData::toString() const
 
    buf << "Replication configuration:\n";
    buf << "REPLICATION_MAX_TRANS " << m_iReplicationMaxTrans << std::endl;
+   buf << "REPLICATION_NODE_MAX_TRANS " << m_iReplicationNodeMaxTrans << std::endl;
+   buf << "REPLICATION_NODE_BANDWIDTH " << m_iReplicationNodeBandwidth << std::endl;
    buf << "REPLICATION_START_DELAY " << m_iReplicationStartDelay << std::endl;
    buf << "REPLICATION_FULL_SCAN_DELAY " << m_iReplicationFullScanDelay << std::endl;
    buf << "DISK_BALANCE_AGGRESSIVENESS " << m_iDiskBalanceAggressiveness << std::endl;
@@ -222,6 +265,7 @@ std::string ReplicaConfData::toString() const
    buf << "CHECK_REPLICA_ON_SAME_IP " << m_bCheckReplicaOnSameIp << std::endl;
    buf << "PCT_SLAVES_TO_CONSIDER " << m_iPctSlavesToConsider << std::endl;
    buf << "CHECK_REPLICA_CLUSTER " << m_bCheckReplicaCluster << std::endl;
+   buf << "ERASURE_CODE_COLD_AGE " << m_iErasureCodeColdAge << std::endl;
    buf << "Number of replicas:\n"; 
    for( std::map<std::string, pair<int,int> >::const_iterator i = m_mReplicaNum.begin(); i != m_mReplicaNum.end(); ++i )
       buf << i->first << " => " << i->second.first << " " << i->second.second << '\n';
@@ -239,6 +283,10 @@ std::string ReplicaConfData::toString() const
       buf << "]\n";
    }
 
+   buf << "Erasure code:\n";
+   for( std::map<std::string, pair<int,int> >::const_iterator i = m_mErasureCode.begin(); i != m_mErasureCode.end(); ++i )
+      buf << i->first << " => " << i->second.first << "+" << i->second.second << '\n';
+
    buf << "End of replication configuration\n";
    return buf.str();
 }
@@ -246,6 +294,10 @@ std::string ReplicaConfData::toString() const
 
 int ReplicaConfData::getReplicaNum(const std::string& path, int default_val) const
 {
+   // the redundancy of an erasure coded file comes from its parity shards
+   if (ECShard::isShard(path))
+      return 1;
+
    for (map<string, std::pair<int,int> >::const_iterator i = m_mReplicaNum.begin(); i != m_mReplicaNum.end(); ++ i)
       if (WildCard::contain(i->first, path))
          return i->second.first;
@@ -255,6 +307,9 @@ int ReplicaConfData::getReplicaNum(const std::string& path, int default_val) con
 
 int ReplicaConfData::getMaxReplicaNum(const std::string& path, int default_val) const
 {
+   if (ECShard::isShard(path))
+      return 1;
+
    for (map<string, std::pair<int,int> >::const_iterator i = m_mReplicaNum.begin(); i != m_mReplicaNum.end(); ++ i)
       if (WildCard::contain(i->first, path))
          return i->second.second;
@@ -281,3 +336,17 @@ void ReplicaConfData::getRestrictedLoc(const std::string& path, vector<int>& loc
          loc = i->second;
 }
 
+bool ReplicaConfData::getErasureCode(const std::string& path, int& k, int& m) const
+{
+   for (map<string, pair<int,int> >::const_iterator i = m_mErasureCode.begin(); i != m_mErasureCode.end(); ++ i)
+   {
+      if (WildCard::contain(i->first, path))
+      {
+         k = i->second.first;
+         m = i->second.second;
+         return true;
+      }
+   }
+
+   return false;
+}
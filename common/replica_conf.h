@@ -15,14 +15,19 @@ struct ReplicaConfData
     int getMaxReplicaNum( const std::string& path, int default_val ) const;
     int getReplicaDist( const std::string& path, int default_val ) const;
     void getRestrictedLoc( const std::string& path, std::vector<int>& loc ) const;
+    bool getErasureCode( const std::string& path, int& k, int& m ) const;
 
   public:
     std::map<std::string, std::pair<int,int> > m_mReplicaNum;                  // number of replicas and max_replicas
     std::map<std::string, int>                 m_mReplicaDist;                 // distance of replicas
     std::map<std::string, std::vector<int> >   m_mRestrictedLoc;               // restricted locations for certain files
+    std::map<std::string, std::pair<int,int> > m_mErasureCode;                 // number of data and parity shards for cold files
+    int                                        m_iErasureCodeColdAge;          // Time in sec since last change before a file is erasure coded
     int                                        m_iReplicationStartDelay;       // Delay in sec of replcation thread start on master start
     unsigned                                   m_iReplicationFullScanDelay;    // Min time in sec between full scans by replica thread
     int                                        m_iReplicationMaxTrans;         // Max no of concurrent replications
+    int                                        m_iReplicationNodeMaxTrans;     // Max no of concurrent replication reads and writes per slave
+    int                                        m_iReplicationNodeBandwidth;    // Replication bandwidth budget per slave, MB/s, 0 - unlimited
     int                                        m_iDiskBalanceAggressiveness;   // Percent of full slave files from average free space on all slaves 
                                                                              // to be moved out
     bool                                       m_bReplicateOnTransactionClose; // Submit file into replciation queue on non-read transaction close 
@@ -63,7 +63,8 @@ m_llLastUpdateTime(0),
 m_iStatus(1),
 m_bDiskLowWarning(false),
 m_llLastVoteTime(-1),
-m_iActiveTrans(0)
+m_iActiveTrans(0),
+m_iCapability(0)
 {
 }
 
@@ -112,6 +113,12 @@ int SlaveNode::deserialize(const char* buf, int size)
       p += 24;
    }
 
+   // older slaves do not report their capabilities
+   if (p + 4 <= buf + size)
+      m_iCapability = *(int32_t*)p;
+   else
+      m_iCapability = 0;
+
    return 0;
 }
 
@@ -139,6 +146,7 @@ int Topology::init(const char* topoconf)
       tm.m_uiMask = 0;
       tm.m_viPath.push_back(0);
       m_vTopoMap.push_back(tm);
+      buildtrie_();
 
       return 0;
    }
@@ -184,6 +192,8 @@ int Topology::init(const char* topoconf)
 
    ifs.close();
 
+   buildtrie_();
+
    return m_vTopoMap.size();
 }
 
@@ -194,13 +204,11 @@ int Topology::lookup(const char* ip, vector<int>& path)
       return -1;
    uint32_t digitip = ntohl(addr.s_addr);
 
-   for (vector<TopoMap>::iterator i = m_vTopoMap.begin(); i != m_vTopoMap.end(); ++ i)
+   int entry = searchtrie_(digitip);
+   if (entry >= 0)
    {
-      if ((digitip & i->m_uiMask) == (i->m_uiIP & i->m_uiMask))
-      {
-         path = i->m_viPath;
-         return 0;
-      }
+      path = m_vTopoMap[entry].m_viPath;
+      return 0;
    }
 
    for (unsigned int i = 0; i < m_uiLevel; ++ i)
@@ -337,6 +345,8 @@ int Topology::deserialize(const char* buf, const int& size)
          *j = *p ++;
    }
 
+   buildtrie_();
+
    return 0;
 }
 
@@ -384,12 +394,73 @@ int Topology::parseIPRange(const char* ip, uint32_t& digit, uint32_t& mask)
       return -1;
    }
 
-   mask <<= (32 - bit);
+   // shifting a 32-bit value by 32 is undefined, handle /0 explicitly
+   mask = (0 == bit) ? 0 : (mask << (32 - bit));
 
    delete [] buf;
    return 0;
 }
 
+void Topology::buildtrie_()
+{
+   m_vTrie.clear();
+
+   TrieNode root;
+   root.m_piChild[0] = root.m_piChild[1] = -1;
+   root.m_iEntry = -1;
+   m_vTrie.push_back(root);
+
+   for (int e = 0, n = m_vTopoMap.size(); e < n; ++ e)
+   {
+      uint32_t ip = m_vTopoMap[e].m_uiIP;
+      uint32_t mask = m_vTopoMap[e].m_uiMask;
+
+      // masks from parseIPRange are contiguous, so the prefix is the leading 1 bits
+      int node = 0;
+      for (int b = 31; (b >= 0) && ((mask >> b) & 1); -- b)
+      {
+         int bit = (ip >> b) & 1;
+         if (m_vTrie[node].m_piChild[bit] < 0)
+         {
+            TrieNode tn;
+            tn.m_piChild[0] = tn.m_piChild[1] = -1;
+            tn.m_iEntry = -1;
+            m_vTrie.push_back(tn);
+            m_vTrie[node].m_piChild[bit] = m_vTrie.size() - 1;
+         }
+         node = m_vTrie[node].m_piChild[bit];
+      }
+
+      // a duplicated prefix never wins over the earlier line
+      if (m_vTrie[node].m_iEntry < 0)
+         m_vTrie[node].m_iEntry = e;
+   }
+}
+
+int Topology::searchtrie_(const uint32_t& ip) const
+{
+   // The topology file is matched in order, first match wins. Every prefix matching "ip" lies on
+   // the trie path of "ip", so the result is the smallest entry index found along that path.
+
+   if (m_vTrie.empty())
+      return -1;
+
+   int entry = m_vTrie[0].m_iEntry;
+   int node = 0;
+   for (int b = 31; b >= 0; -- b)
+   {
+      node = m_vTrie[node].m_piChild[(ip >> b) & 1];
+      if (node < 0)
+         break;
+
+      int e = m_vTrie[node].m_iEntry;
+      if ((e >= 0) && ((entry < 0) || (e < entry)))
+         entry = e;
+   }
+
+   return entry;
+}
+
 int Topology::parseTopo(const char* topo, vector<int>& tm)
 {
    int size = strlen(topo);
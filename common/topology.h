@@ -84,6 +84,8 @@ public:
 
    int m_iActiveTrans;					// number of active transactions
 
+   int32_t m_iCapability;				// features supported by the slave, see SlaveCapability
+
 public:
    int deserialize(const char* buf, int size);
 };
@@ -151,6 +153,10 @@ public:
    static int parseIPRange(const char* ip, uint32_t& digit, uint32_t& mask);
    static int parseTopo(const char* topo, std::vector<int>& tm);
 
+private:
+   void buildtrie_();
+   int searchtrie_(const uint32_t& ip) const;
+
 private:
    unsigned int m_uiLevel;
 
@@ -162,6 +168,14 @@ private:
    };
 
    std::vector<TopoMap> m_vTopoMap;
+
+   struct TrieNode
+   {
+      int m_piChild[2];					// index of the 0/1 child in m_vTrie, -1 if none
+      int m_iEntry;					// first entry in m_vTopoMap with this exact prefix, -1 if none
+   };
+
+   std::vector<TrieNode> m_vTrie;			// binary radix trie over the prefixes of m_vTopoMap, root at 0
 };
 
 #endif
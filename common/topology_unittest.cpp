@@ -1,4 +1,4 @@
-*****************************************************************************
+/*****************************************************************************
 Copyright 2011 VeryCloud LLC
 
 Licensed under the Apache License, Version 2.0 (the "License"); you may not
@@ -19,6 +19,174 @@ written by
    bdl62, last updated 05/21/2011
 *****************************************************************************/
 
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "common.h"
 #include "topology.h"
 
-// place holder for topology unit testing, to be added
+using namespace std;
+
+const char* topo_file = "/tmp/topology_unittest.topo";
+
+// reference: the linear first-match scan over the topology file
+struct RefEntry
+{
+   uint32_t m_uiIP;
+   uint32_t m_uiMask;
+   int m_iID;
+};
+
+int ref_lookup(const vector<RefEntry>& ref, const char* ip)
+{
+   in_addr addr;
+   inet_pton(AF_INET, ip, &addr);
+   uint32_t digitip = ntohl(addr.s_addr);
+
+   for (vector<RefEntry>::const_iterator i = ref.begin(); i != ref.end(); ++ i)
+   {
+      if ((digitip & i->m_uiMask) == (i->m_uiIP & i->m_uiMask))
+         return i->m_iID;
+   }
+   return -1;
+}
+
+void add_line(ofstream& ofs, vector<RefEntry>& ref, const string& range, int id)
+{
+   ofs << range << " /" << id << "/" << id % 7 << endl;
+
+   RefEntry e;
+   Topology::parseIPRange(range.c_str(), e.m_uiIP, e.m_uiMask);
+   e.m_iID = id;
+   ref.push_back(e);
+}
+
+string random_ip()
+{
+   stringstream ip;
+   ip << 10 + rand() % 2 << "." << rand() % 256 << "." << rand() % 256 << "." << rand() % 256;
+   return ip.str();
+}
+
+// the trie returns exactly what the file-order scan returns, including
+// a general prefix listed before a more specific one
+int test1()
+{
+   vector<RefEntry> ref;
+   ofstream ofs(topo_file);
+   add_line(ofs, ref, "10.0.0.0/16", 1);
+   add_line(ofs, ref, "10.0.1.0/24", 2);
+   add_line(ofs, ref, "10.1.1.0/24", 3);
+   add_line(ofs, ref, "10.1.0.0/16", 4);
+   add_line(ofs, ref, "10.1.1.0/24", 5);
+   add_line(ofs, ref, "10.2.3.4", 6);
+   add_line(ofs, ref, "10.0.0.0/8", 7);
+   ofs.close();
+
+   Topology topo;
+   assert(topo.init(topo_file) == 7);
+   unlink(topo_file);
+
+   const char* ips[] = {"10.0.1.5", "10.1.1.5", "10.1.2.5", "10.2.3.4", "10.2.3.5", "11.0.0.1"};
+   const int expect[] = {1, 3, 4, 6, 7, -1};
+   for (int i = 0; i < 6; ++ i)
+   {
+      vector<int> path;
+      int r = topo.lookup(ips[i], path);
+      assert(ref_lookup(ref, ips[i]) == expect[i]);
+      if (expect[i] < 0)
+         assert((r < 0) && (path.size() == 2) && (path[0] == 0));
+      else
+         assert((r == 0) && (path[0] == expect[i]));
+   }
+
+   // the trie is rebuilt on the client side from the serialized map
+   char buf[1024];
+   int size = 1024;
+   assert(topo.serialize(buf, size) == 0);
+   Topology copy;
+   assert(copy.deserialize(buf, size) == 0);
+   for (int i = 0; i < 6; ++ i)
+      assert(copy.distance(ips[i], "10.0.1.5") == topo.distance(ips[i], "10.0.1.5"));
+
+   return 0;
+}
+
+// large topology file (one /24 per rack plus some /16 and /28 overrides): compare with the scan
+int test2()
+{
+   vector<RefEntry> ref;
+   ofstream ofs(topo_file);
+   int id = 1;
+   for (int i = 0; i < 256; ++ i)
+   {
+      stringstream range;
+      range << "10.0." << i << ".0/28";
+      add_line(ofs, ref, range.str(), id ++);
+   }
+   for (int i = 0; i < 8192; ++ i)
+   {
+      stringstream range;
+      range << 10 + i / 65536 << "." << (i / 256) % 256 << "." << i % 256 << ".0/24";
+      add_line(ofs, ref, range.str(), id ++);
+   }
+   for (int i = 0; i < 256; ++ i)
+   {
+      stringstream range;
+      range << "11." << i << ".0.0/16";
+      add_line(ofs, ref, range.str(), id ++);
+   }
+   ofs.close();
+
+   Topology topo;
+   assert(topo.init(topo_file) == id - 1);
+   unlink(topo_file);
+
+   const int num = 20000;
+   vector<string> ips;
+   for (int i = 0; i < num; ++ i)
+      ips.push_back(random_ip());
+
+   for (int i = 0; i < num; ++ i)
+   {
+      vector<int> path;
+      int r = topo.lookup(ips[i].c_str(), path);
+      int e = ref_lookup(ref, ips[i].c_str());
+      assert((r < 0) == (e < 0));
+      if (e > 0)
+         assert(path[0] == e);
+   }
+
+   int64_t start = CTimer::getTime();
+   int64_t found = 0;
+   for (int i = 0; i < num; ++ i)
+      found += ref_lookup(ref, ips[i].c_str());
+   int64_t scan = CTimer::getTime() - start;
+
+   start = CTimer::getTime();
+   for (int i = 0; i < num; ++ i)
+   {
+      vector<int> path;
+      found += topo.lookup(ips[i].c_str(), path);
+   }
+   int64_t trie = CTimer::getTime() - start;
+
+   cout << "topology lookup with " << id - 1 << " entries: scan " << scan * 1000 / num << " ns, trie "
+        << trie * 1000 / num << " ns per lookup (" << found << ")" << endl;
+
+   return 0;
+}
+
+int main()
+{
+   test1();
+   test2();
+
+   return 0;
+}
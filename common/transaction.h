@@ -38,6 +38,7 @@ struct TransType
    static const int SPHERE = 2;
    static const int DB = 3;
    static const int REPLICA = 4;
+   static const int ERASURE = 5;
 };
 
 namespace 
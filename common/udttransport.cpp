@@ -271,3 +271,11 @@ int UDTTransport::setTimeout(int sndtimeo, int rcvtimeo)
    m_iRcvTimeO = rcvtimeo;
    return 0;
 }
+
+int UDTTransport::setPacing(int pacing)
+{
+   // must be called after open(); accepted sockets inherit it from the listener
+   if (UDT::ERROR == UDT::setsockopt(m_Socket, 0, UDT_PACING, &pacing, sizeof(int)))
+      return -1;
+   return 0;
+}
@@ -60,6 +60,7 @@ public:
    virtual int getLocalAddr(std::string& ip, int& port);
 
    int setTimeout(int sndtimeo, int rcvtimeo);
+   int setPacing(int pacing);
 
 private:
    UDTSOCKET m_Socket;
@@ -54,6 +54,14 @@ int mr_sort_compare(const char* r1, int s1, const char* r2, int s2)
    return 0;
 }
 
+// 64-bit prefix of the key, in the same order as mr_sort_compare; the shuffler sorts the
+// prefixes and only calls mr_sort_compare for records with the same prefix
+uint64_t mr_sort_key(const char* record, int size)
+{
+   Key* k = (Key*)record;
+   return ((uint64_t)k->v1 << 32) | k->v2;
+}
+
 // for TeraSort, the reduce function does nothing
 //int mr_sort_reduce(const SInput* input, SOutput* output, SFile* file)
 //{
@@ -145,4 +145,31 @@ int mr_word_reduce(const SInput* input, SOutput* output, SFile* file)
    return 1;
 }
 
+// runs on each SPE before the shuffle: all "word doc" records of a word become one "word doc1 doc2 ..." record
+int mr_word_combine(const SInput* input, SOutput* output, SFile* file)
+{
+   char* p = input->m_pcUnit;
+   while (*p != ' ')
+      ++ p;
+   int len = p - input->m_pcUnit;
+   memcpy(output->m_pcResult, input->m_pcUnit, len);
+
+   for (int i = 0; i < input->m_iRows; ++ i)
+   {
+      char* doc = input->m_pcUnit + input->m_pllIndex[i];
+      while (*doc != ' ')
+         ++ doc;
+      int size = strlen(doc);
+      memcpy(output->m_pcResult + len, doc, size);
+      len += size;
+   }
+   output->m_pcResult[len ++] = '\0';
+
+   output->m_iRows = 1;
+   output->m_pllIndex[0] = 0;
+   output->m_pllIndex[1] = len;
+
+   return 1;
+}
+
 }
@@ -25,6 +25,9 @@ int hash(const Key* k, const int& n)
    return (k->v1 >> (32 - n));
 }
 
+// sorthash has no shared state, the SPE may call it from several threads at the same time
+int sorthash_threadsafe = 1;
+
 int sorthash(const SInput* input, SOutput* output, SFile* file)
 {
    // you may resize (delete [] and new again) the buffer of output->m_pcResult, output->m_pllIndex, and output->m_piBucketID if necessary
@@ -40,6 +40,9 @@ int main(int argc, char** /*argv*/)
       return -1;
    }
 
+   // the inverted index is text, it compresses well
+   myproc->setShuffleCompression(true);
+
    timeval t;
    gettimeofday(&t, 0);
    cout << "start time " << t.tv_sec << endl;
@@ -91,6 +94,14 @@ int main(int argc, char** /*argv*/)
    gettimeofday(&t, 0);
    cout << "mapreduce sort accomplished " << t.tv_sec << endl;
 
+   int64_t before, after;
+   myproc->getShuffleSize(before, after);
+   cout << "shuffled " << after << " bytes, " << before << " bytes before combining" << endl;
+
+   int64_t raw, compressed, usec;
+   myproc->getCompressionStat(raw, compressed, usec);
+   cout << "sent " << compressed << " bytes after compression, compression time " << usec / 1000 << " ms" << endl;
+
    cout << "SPE COMPLETED " << endl;
 
    myproc->close();
@@ -62,6 +62,7 @@ int main(int argc, char** /*argv*/)
    gettimeofday(&t, 0);
    cout << "start time " << t.tv_sec << endl;
 
+   myproc->setProcThreadNum(4);
    int result = myproc->run(s, temp, "sorthash", 1, (char*)&N, 4);
    if (result < 0)
    {
@@ -135,28 +135,37 @@ CGMP::CGMP()
    CGuard::createMutex(m_RcvQueueLock);
    CGuard::createCond(m_RcvQueueCond);
    CGuard::createMutex(m_ResQueueLock);
-   CGuard::createCond(m_ResQueueCond);
+   CGuard::createMutex(m_RPCStatLock);
    CGuard::createMutex(m_RTTLock);
    CGuard::createCond(m_RTTCond);
 
+   m_vRetransWheel.resize(m_iWheelSize);
+   m_llWheelTick = CTimer::getTime() / m_iWheelTick;
+
    m_bInit = false;
    m_bClosed = false;
 }
 
 CGMP::~CGMP()
 {
-   for (list<CMsgRecord*>::iterator i = m_lSndQueue.begin(); i != m_lSndQueue.end(); ++ i)
+   for (map<int32_t, CMsgRecord*>::iterator i = m_mSndQueue.begin(); i != m_mSndQueue.end(); ++ i)
    {
-      delete (*i)->m_pMsg;
-      delete *i;
+      delete i->second->m_pMsg;
+      delete i->second;
    }
 
    CGuard::releaseMutex(m_SndQueueLock);
    CGuard::releaseCond(m_SndQueueCond);
    CGuard::releaseMutex(m_RcvQueueLock);
    CGuard::releaseCond(m_RcvQueueCond);
+   for (map<int32_t, CMsgRecord*>::iterator i = m_mResQueue.begin(); i != m_mResQueue.end(); ++ i)
+   {
+      delete i->second->m_pMsg;
+      delete i->second;
+   }
+
    CGuard::releaseMutex(m_ResQueueLock);
-   CGuard::releaseCond(m_ResQueueCond);
+   CGuard::releaseMutex(m_RPCStatLock);
    CGuard::releaseMutex(m_RTTLock);
    CGuard::releaseCond(m_RTTCond);
 }
@@ -170,7 +179,10 @@ int CGMP::init(const int& port)
    else
       m_iPort = 0;
 
-   if ((m_UDTSocket.open(m_iPort, false, true) < 0) || (m_UDTSocket.listen() < 0))
+   if (m_UDTSocket.open(m_iPort, false, true) < 0)
+      return -1;
+
+   if (m_UDTSocket.listen() < 0)
       return -1;
 
    m_iUDTReusePort = m_iPort;
@@ -251,27 +263,26 @@ int CGMP::UDPsend(const char* ip, const int& port, int32_t& id, const char* data
    msg->pack(data, len, id);
    id = msg->m_iID;
 
-   int res = UDPsend(ip, port, msg);
-   if (res < 0)
-      return -1;
-
    if (reliable)
    {
       CMsgRecord* rec = new CMsgRecord;
       rec->m_strIP = ip;
       rec->m_iPort = port;
       rec->m_pMsg = msg;
-      rec->m_llTimeStamp = CTimer::getTime();
 
-      CGuard::enterCS(m_SndQueueLock);
-      m_lSndQueue.push_back(rec);
-      CGuard::leaveCS(m_SndQueueLock);
-   }
-   else
-   {
-      delete msg;
+      int res = queueRetrans(rec);
+      if (res < 0)
+      {
+         delete msg;
+         delete rec;
+      }
+
+      return res;
    }
 
+   int res = UDPsend(ip, port, msg);
+   delete msg;
+
    return res;
 }
 
@@ -450,47 +461,186 @@ int CGMP::recvfrom(string& ip, int& port, int32_t& id, CUserMessage* msg, const
 }
 
 int CGMP::recv(const int32_t& id, CUserMessage* msg)
+{
+   return waitResponse(id, msg, NULL);
+}
+
+int CGMP::waitResponse(const int32_t& id, CUserMessage* msg, int64_t* arrival)
 {
    CGuard::enterCS(m_ResQueueLock);
 
-   map<int32_t, CMsgRecord*>::iterator m = m_mResQueue.find(id);
+   CMsgRecord* rec = NULL;
 
-   if (m == m_mResQueue.end())
+   map<int32_t, CMsgRecord*>::iterator m = m_mResQueue.find(id);
+   if (m != m_mResQueue.end())
    {
-         timeval now;
-         timespec timeout;
-         gettimeofday(&now, 0);
-         timeout.tv_sec = now.tv_sec + 15;
-         timeout.tv_nsec = now.tv_usec * 1000;
-         pthread_cond_timedwait(&m_ResQueueCond, &m_ResQueueLock, &timeout);
+      // the response has already arrived
+      rec = m->second;
+      m_mResQueue.erase(m);
+   }
+   else if (!m_bClosed)
+   {
+      // register this request so that the receiving thread hands the response to it and wakes only this caller
+      CRPCWaiter w;
+      w.m_pRes = NULL;
+      CGuard::createCond(w.m_Cond);
+      m_mResWaiter[id] = &w;
+
+      timeval now;
+      timespec timeout;
+      gettimeofday(&now, 0);
+      timeout.tv_sec = now.tv_sec + m_llMaxResWait / 1000000;
+      timeout.tv_nsec = now.tv_usec * 1000;
+
+      while ((NULL == w.m_pRes) && !m_bClosed)
+      {
+         if (ETIMEDOUT == pthread_cond_timedwait(&w.m_Cond, &m_ResQueueLock, &timeout))
+            break;
+      }
 
-      m = m_mResQueue.find(id);
+      m_mResWaiter.erase(id);
+      CGuard::releaseCond(w.m_Cond);
+      rec = w.m_pRes;
    }
 
-   bool found = false;
+   CGuard::leaveCS(m_ResQueueLock);
 
-   if (m != m_mResQueue.end())
-   {
-      if (msg->m_iBufLength < m->second->m_pMsg->m_iLength)
-         msg->resize(m->second->m_pMsg->m_iLength);
-      msg->m_iDataLength = m->second->m_pMsg->m_iLength;
+   if (NULL == rec)
+      return -1;
 
-      if (msg->m_iDataLength > 0)
-         memcpy(msg->m_pcBuffer, m->second->m_pMsg->m_pcData, msg->m_iDataLength);
+   if (msg->m_iBufLength < rec->m_pMsg->m_iLength)
+      msg->resize(rec->m_pMsg->m_iLength);
+   msg->m_iDataLength = rec->m_pMsg->m_iLength;
 
-      delete m->second->m_pMsg;
-      delete m->second;
-      m_mResQueue.erase(m);
+   if (msg->m_iDataLength > 0)
+      memcpy(msg->m_pcBuffer, rec->m_pMsg->m_pcData, msg->m_iDataLength);
+
+   if (NULL != arrival)
+      *arrival = rec->m_llTimeStamp;
+
+   delete rec->m_pMsg;
+   delete rec;
+
+   return msg->m_iDataLength;
+}
+
+void CGMP::storeResponse(CMsgRecord* rec)
+{
+   rec->m_llTimeStamp = CTimer::getTime();
+
+   CGuard::enterCS(m_ResQueueLock);
 
-      found = true;
+   // Note: m_iInfo of a response is the ID of the request it answers.
+   map<int32_t, CRPCWaiter*>::iterator w = m_mResWaiter.find(rec->m_pMsg->m_iInfo);
+   if ((w != m_mResWaiter.end()) && (NULL == w->second->m_pRes))
+   {
+      w->second->m_pRes = rec;
+      pthread_cond_signal(&w->second->m_Cond);
+   }
+   else
+   {
+      map<int32_t, CMsgRecord*>::iterator m = m_mResQueue.find(rec->m_pMsg->m_iInfo);
+      if (m != m_mResQueue.end())
+      {
+         delete m->second->m_pMsg;
+         delete m->second;
+      }
+      m_mResQueue[rec->m_pMsg->m_iInfo] = rec;
    }
 
    CGuard::leaveCS(m_ResQueueLock);
+}
+
+int CGMP::queueRetrans(CMsgRecord* rec)
+{
+   // send and queue under the same lock, so that the ACK cannot be processed before the message is queued
+   CGuard::enterCS(m_SndQueueLock);
 
-   if (!found)
+   rec->m_llTimeStamp = CTimer::getTime();
+
+   int res = UDPsend(rec->m_strIP.c_str(), rec->m_iPort, rec->m_pMsg);
+   if (res < 0)
+   {
+      CGuard::leaveCS(m_SndQueueLock);
       return -1;
+   }
 
-   return msg->m_iDataLength;
+   bool idle = m_mSndQueue.empty();
+
+   m_mSndQueue[rec->m_pMsg->m_iID] = rec;
+   rec->m_iRetrans = 0;
+   scheduleRetrans(rec);
+
+   // the sending thread sleeps for long when nothing is waiting for ACK
+   if (idle)
+      pthread_cond_signal(&m_SndQueueCond);
+
+   CGuard::leaveCS(m_SndQueueLock);
+
+   return res;
+}
+
+void CGMP::scheduleRetrans(CMsgRecord* rec)
+{
+   // the first timeout is derived from the peer RTT, later ones back off exponentially
+   if (0 == rec->m_iRetrans)
+   {
+      int rtt = m_PeerHistory.getRTT(rec->m_strIP);
+      rec->m_iRTO = (rtt > 0) ? rtt * 4 : m_iInitRTO;
+   }
+   else
+      rec->m_iRTO *= 2;
+
+   if (rec->m_iRTO < m_iMinRTO)
+      rec->m_iRTO = m_iMinRTO;
+   else if (rec->m_iRTO > m_iMaxRTO)
+      rec->m_iRTO = m_iMaxRTO;
+
+   rec->m_llRetryTime = CTimer::getTime() + rec->m_iRTO;
+
+   // use the first slot that starts at or after the retransmission time, so the entry is due when visited;
+   // a timeout longer than the wheel goes around it and checkRetrans() skips the entry until then
+   int64_t tick = (rec->m_llRetryTime + m_iWheelTick - 1) / m_iWheelTick;
+   if (tick <= m_llWheelTick)
+      tick = m_llWheelTick + 1;
+   m_vRetransWheel[tick % m_iWheelSize].push_back(rec->m_pMsg->m_iID);
+}
+
+void CGMP::checkRetrans(const int64_t& now)
+{
+   // must be called with m_SndQueueLock held
+
+   int64_t tick = now / m_iWheelTick;
+   if (tick - m_llWheelTick > m_iWheelSize)
+      m_llWheelTick = tick - m_iWheelSize;
+
+   for (; m_llWheelTick < tick; ++ m_llWheelTick)
+   {
+      list<int32_t>& slot = m_vRetransWheel[(m_llWheelTick + 1) % m_iWheelSize];
+
+      for (list<int32_t>::iterator i = slot.begin(); i != slot.end();)
+      {
+         map<int32_t, CMsgRecord*>::iterator m = m_mSndQueue.find(*i);
+
+         // already acknowledged, or not due in this round of the wheel
+         if (m == m_mSndQueue.end())
+         {
+            i = slot.erase(i);
+            continue;
+         }
+         if (m->second->m_llRetryTime > now)
+         {
+            ++ i;
+            continue;
+         }
+
+         i = slot.erase(i);
+
+         UDPsend(m->second->m_strIP.c_str(), m->second->m_iPort, m->second->m_pMsg);
+         ++ m->second->m_iRetrans;
+         scheduleRetrans(m->second);
+      }
+   }
 }
 
 void* CGMP::sndHandler(void* s)
@@ -499,31 +649,47 @@ void* CGMP::sndHandler(void* s)
 
    while (!self->m_bClosed)
    {
+      // tick the retransmission timer wheel while any message is waiting for ACK, otherwise sleep until one is queued
          timespec timeout;
          timeval now;
          gettimeofday(&now, 0);
-         timeout.tv_sec = now.tv_sec + 15;
-         timeout.tv_nsec = now.tv_usec * 1000;
          pthread_mutex_lock(&self->m_SndQueueLock);
+         if (self->m_mSndQueue.empty())
+         {
+            timeout.tv_sec = now.tv_sec + 15;
+            timeout.tv_nsec = now.tv_usec * 1000;
+         }
+         else
+         {
+            int64_t usec = now.tv_usec + m_iWheelTick;
+            timeout.tv_sec = now.tv_sec + usec / 1000000;
+            timeout.tv_nsec = (usec % 1000000) * 1000;
+         }
          pthread_cond_timedwait(&self->m_SndQueueCond, &self->m_SndQueueLock, &timeout);
          pthread_mutex_unlock(&self->m_SndQueueLock);
 
+      int64_t ts = CTimer::getTime();
+
       CGuard::enterCS(self->m_SndQueueLock);
+      self->checkRetrans(ts);
+      CGuard::leaveCS(self->m_SndQueueLock);
 
-      int64_t ts = CTimer::getTime();
+      // drop responses that nobody has claimed, e.g., those arriving after the caller gave up
+      CGuard::enterCS(self->m_ResQueueLock);
 
-      for (list<CMsgRecord*>::iterator i = self->m_lSndQueue.begin(); i != self->m_lSndQueue.end();)
+      for (map<int32_t, CMsgRecord*>::iterator i = self->m_mResQueue.begin(); i != self->m_mResQueue.end();)
       {
-         int64_t diff = ts - (*i)->m_llTimeStamp;
+         map<int32_t, CMsgRecord*>::iterator j = i ++;
 
-         if (diff > 15 * 1000000)
-            self->UDPsend((*i)->m_strIP.c_str(), (*i)->m_iPort, (*i)->m_pMsg);
-
-         // check next msg
-         ++ i;
+         if (ts - j->second->m_llTimeStamp > 15 * 60000000LL)
+         {
+            delete j->second->m_pMsg;
+            delete j->second;
+            self->m_mResQueue.erase(j);
+         }
       }
 
-      CGuard::leaveCS(self->m_SndQueueLock);
+      CGuard::leaveCS(self->m_ResQueueLock);
    }
 
    return NULL;
@@ -574,23 +740,26 @@ void* CGMP::rcvHandler(void* s)
          case 1: // ACK
             CGuard::enterCS(self->m_SndQueueLock);
 
-            for (list<CMsgRecord*>::iterator i = self->m_lSndQueue.begin(); i != self->m_lSndQueue.end(); ++ i)
             {
-               if (id == (*i)->m_pMsg->m_iID)
+               map<int32_t, CMsgRecord*>::iterator i = self->m_mSndQueue.find(id);
+               if (i != self->m_mSndQueue.end())
                {
-                  int rtt = int(CTimer::getTime() - (*i)->m_llTimeStamp);
-
-                     char ip[64];
-                     if (NULL != inet_ntop(AF_INET, &(addr.sin_addr), ip, 64))
-                      self->m_PeerHistory.insert(ip, ntohs(addr.sin_port), CGMPMessage::g_iSession, -1, rtt, info);
-
-                     pthread_cond_signal(&self->m_RTTCond);
-
-                  delete (*i)->m_pMsg;
-                  delete (*i);
-                  self->m_lSndQueue.erase(i);
-
-                  break;
+                  // do not take an RTT sample from a retransmitted message, the ACK may belong to any copy
+                  int rtt = -1;
+                  if (0 == i->second->m_iRetrans)
+                     rtt = int(CTimer::getTime() - i->second->m_llTimeStamp);
+
+                  // the peer is still recorded and waiting RTT queries are woken up, a negative RTT is not sampled
+                  char ip[64];
+                  if (NULL != inet_ntop(AF_INET, &(addr.sin_addr), ip, 64))
+                     self->m_PeerHistory.insert(ip, ntohs(addr.sin_port), CGMPMessage::g_iSession, -1, rtt, info);
+
+                  pthread_cond_signal(&self->m_RTTCond);
+
+                  // the ID left in the timer wheel is dropped when its slot is visited
+                  delete i->second->m_pMsg;
+                  delete i->second;
+                  self->m_mSndQueue.erase(i);
                }
             }
 
@@ -660,12 +829,7 @@ void* CGMP::rcvHandler(void* s)
             pthread_cond_signal(&self->m_RcvQueueCond);
       }
       else
-      {
-            pthread_mutex_lock(&self->m_ResQueueLock);
-            self->m_mResQueue[info] = rec;
-            pthread_mutex_unlock(&self->m_ResQueueLock);
-            pthread_cond_signal(&self->m_ResQueueCond);
-      }
+         self->storeResponse(rec);
 
       ack[2] = id;
       ack[3] = qsize; // flow control
@@ -675,7 +839,12 @@ void* CGMP::rcvHandler(void* s)
    delete [] buf;
 
       pthread_cond_signal(&self->m_RcvQueueCond);
-      pthread_cond_signal(&self->m_ResQueueCond);
+
+      // wake up all callers waiting for a response
+      CGuard::enterCS(self->m_ResQueueLock);
+      for (map<int32_t, CRPCWaiter*>::iterator i = self->m_mResWaiter.begin(); i != self->m_mResWaiter.end(); ++ i)
+         pthread_cond_signal(&i->second->m_Cond);
+      CGuard::leaveCS(self->m_ResQueueLock);
 
    return NULL;
 }
@@ -759,30 +928,32 @@ void* CGMP::udtRcvHandler(void* s)
             pthread_cond_signal(&self->m_RcvQueueCond);
       }
       else
-      {
-            pthread_mutex_lock(&self->m_ResQueueLock);
-            self->m_mResQueue[header[3]] = rec;
-            pthread_mutex_unlock(&self->m_ResQueueLock);
-            pthread_cond_signal(&self->m_ResQueueCond);
-      }
+         self->storeResponse(rec);
    }
 
       pthread_cond_signal(&self->m_RcvQueueCond);
-      pthread_cond_signal(&self->m_ResQueueCond);
+
+      // wake up all callers waiting for a response
+      CGuard::enterCS(self->m_ResQueueLock);
+      for (map<int32_t, CRPCWaiter*>::iterator i = self->m_mResWaiter.begin(); i != self->m_mResWaiter.end(); ++ i)
+         pthread_cond_signal(&i->second->m_Cond);
+      CGuard::leaveCS(self->m_ResQueueLock);
 
    return NULL;
 }
 
 int CGMP::rpc(const string& ip, const int& port, CUserMessage* req, CUserMessage* res)
 {
+   uint64_t t = CTimer::getTime();
+
    int32_t id = 0;
    if (sendto(ip, port, id, req) < 0)
       return -1;
 
-   uint64_t t = CTimer::getTime();
    int errcount = 0;
+   int64_t arrival = 0;
 
-   while (recv(id, res) < 0)
+   while (waitResponse(id, res, &arrival) < 0)
    {
       if (rtt(ip, port, true) < 0)
          errcount ++;
@@ -795,54 +966,77 @@ int CGMP::rpc(const string& ip, const int& port, CUserMessage* req, CUserMessage
          return -1;
    }
 
+   addRPCStat(ip, port, arrival - t);
+
    return 0;
 }
 
 int CGMP::multi_rpc(const vector<Address>& dest, CUserMessage* req, vector<CUserMessage*>* res)
 {
+   vector<CUserMessage*> reqs(dest.size(), req);
+   return multi_rpc(dest, reqs, res);
+}
+
+int CGMP::multi_rpc(const vector<Address>& dest, const vector<CUserMessage*>& req, vector<CUserMessage*>* res)
+{
+   // send all requests first, then collect the responses under a single deadline,
+   // so the total latency is bounded by the slowest peer rather than the sum of all RTTs.
+   // a response whose m_iDataLength is 0 means the peer failed to respond.
+
    unsigned int tn = dest.size();
 
    if (0 == tn)
       return 0;
 
-   if ((NULL != res) && (res->size() != tn))
+   if ((req.size() != tn) || ((NULL != res) && (res->size() != tn)))
       return -1;
 
    vector<int> ids;
    ids.resize(tn);
+   vector<int64_t> sendtime;
+   sendtime.resize(tn);
    vector<int>::iterator n = ids.begin();
+   vector<int64_t>::iterator st = sendtime.begin();
+   vector<CUserMessage*>::const_iterator q = req.begin();
    for (vector<Address>::const_iterator i = dest.begin(); i != dest.end(); ++ i)
    {
+      *st = CTimer::getTime();
+
       int id = 0;
-      if (sendto(i->m_strIP, i->m_iPort, id, req) < 0)
+      if (sendto(i->m_strIP, i->m_iPort, id, *q) < 0)
          id = 0;
 
       *n = id;
       ++ n;
+      ++ st;
+      ++ q;
    }
 
    vector<CUserMessage*>::iterator m;
    if (NULL != res)
       m = res->begin();
    n = ids.begin();
+   st = sendtime.begin();
    vector<Address>::const_iterator a = dest.begin();
    uint64_t start_time = CTimer::getTime();
    int fail_num = tn;
 
    for (; n != ids.end(); ++ n)
    {
+      CUserMessage tmp;
+      CUserMessage* msg;
+      if ((NULL != res) && (NULL != *m))
+         msg = *m;
+      else
+         msg = &tmp;
+
       if (0 != *n)
       {
          int errcount = 0;
          bool found = true;
-         CUserMessage tmp;
-         CUserMessage* msg;
-         if ((NULL != res) && (NULL != *m))
-            msg = *m;
-         else
-            msg = &tmp;
+         int64_t arrival = 0;
 
-         while (recv(*n, msg) < 0)
+         while (waitResponse(*n, msg, &arrival) < 0)
          {
             if (rtt(a->m_strIP, a->m_iPort, true) < 0)
                errcount ++;
@@ -857,11 +1051,17 @@ int CGMP::multi_rpc(const vector<Address>& dest, CUserMessage* req, vector<CUser
          }
 
          if (found)
+         {
+            addRPCStat(a->m_strIP, a->m_iPort, arrival - *st);
             fail_num --;
+         }
       }
+      else
+         msg->m_iDataLength = 0;
 
       if (NULL != res)
          ++ m;
+      ++ st;
       ++ a;
    }
 
@@ -882,17 +1082,20 @@ int CGMP::rtt(const string& ip, const int& port, const bool& clear)
    CGMPMessage* msg = new CGMPMessage;
    msg->pack(2, 0);
 
-   if (UDPsend(ip.c_str(), port, msg) < 0)
+   CMsgRecord* rec = new CMsgRecord;
+   rec->m_strIP = ip;
+   rec->m_iPort = port;
+   rec->m_pMsg = msg;
+
+   if (queueRetrans(rec) < 0)
    {
       delete msg;
+      delete rec;
       return -1;
    }
 
-   CMsgRecord* rec = new CMsgRecord;
-   rec->m_strIP = ip;
-   rec->m_iPort = port;
-   rec->m_pMsg = msg;
-   rec->m_llTimeStamp = CTimer::getTime();
+   // m_RTTCond is signalled by the ACK of any message, keep waiting until this peer has an RTT
+   int r = -1;
 
       timeval now;
       timespec timeout;
@@ -900,8 +1103,71 @@ int CGMP::rtt(const string& ip, const int& port, const bool& clear)
       timeout.tv_sec = now.tv_sec + 15;
       timeout.tv_nsec = now.tv_usec * 1000;
       pthread_mutex_lock(&m_RTTLock);
-      pthread_cond_timedwait(&m_RTTCond, &m_RTTLock, &timeout);
+      while (((r = m_PeerHistory.getRTT(ip)) < 0) && !m_bClosed)
+      {
+         if (ETIMEDOUT == pthread_cond_timedwait(&m_RTTCond, &m_RTTLock, &timeout))
+            break;
+      }
       pthread_mutex_unlock(&m_RTTLock);
 
-   return m_PeerHistory.getRTT(ip);
+   return r;
+}
+
+int CGMP::getRPCStat(map<Address, CRPCStat, AddrComp>& stat)
+{
+   CGuard::enterCS(m_RPCStatLock);
+   stat = m_mRPCStat;
+   CGuard::leaveCS(m_RPCStatLock);
+
+   return stat.size();
+}
+
+void CGMP::addRPCStat(const string& ip, const int& port, const int64_t& usecs)
+{
+   Address addr;
+   addr.m_strIP = ip;
+   addr.m_iPort = port;
+
+   CGuard::enterCS(m_RPCStatLock);
+   m_mRPCStat[addr].add(usecs);
+   CGuard::leaveCS(m_RPCStatLock);
+}
+
+CRPCStat::CRPCStat():
+m_llCount(0),
+m_llTotalTime(0)
+{
+   for (int i = 0; i < m_iBuckets; ++ i)
+      m_pllHist[i] = 0;
+}
+
+void CRPCStat::add(const int64_t& usecs)
+{
+   int b = 0;
+   for (int64_t v = usecs; (v > 1) && (b < m_iBuckets - 1); v >>= 1)
+      ++ b;
+
+   ++ m_pllHist[b];
+   ++ m_llCount;
+   m_llTotalTime += (usecs > 0) ? usecs : 0;
+}
+
+int64_t CRPCStat::percentile(const double& p) const
+{
+   if (0 == m_llCount)
+      return 0;
+
+   int64_t target = int64_t(m_llCount * p);
+   if (target >= m_llCount)
+      target = m_llCount - 1;
+
+   int64_t sum = 0;
+   for (int i = 0; i < m_iBuckets; ++ i)
+   {
+      sum += m_pllHist[i];
+      if (sum > target)
+         return 1LL << (i + 1);
+   }
+
+   return 1LL << m_iBuckets;
 }
@@ -114,6 +114,28 @@ struct CMsgRecord
    int m_iPort;
    CGMPMessage* m_pMsg;
    int64_t m_llTimeStamp;
+   int64_t m_llRetryTime;	// next retransmission time, for messages waiting for ACK
+   int m_iRTO;			// current retransmission timeout, in microseconds
+   int m_iRetrans;		// number of retransmissions so far
+};
+
+struct CRPCWaiter
+{
+   CMsgRecord* m_pRes;		// the response, NULL until it arrives
+   pthread_cond_t m_Cond;	// signalled by the receiving thread when m_pRes is set
+};
+
+struct CRPCStat
+{
+   static const int m_iBuckets = 32;
+
+   int64_t m_llCount;		// number of completed RPCs
+   int64_t m_llTotalTime;	// sum of their latencies, in microseconds
+   int64_t m_pllHist[m_iBuckets];	// bucket i counts latencies in [2^i, 2^(i+1)) microseconds
+
+   CRPCStat();
+   void add(const int64_t& usecs);
+   int64_t percentile(const double& p) const;	// upper bound of the bucket holding the p-th fraction of calls
 };
 
 struct CFMsgRec
@@ -161,9 +183,27 @@ public:
    int recv(const int32_t& id, CUserMessage* msg);
    int rpc(const std::string& ip, const int& port, CUserMessage* req, CUserMessage* res);
    int multi_rpc(const std::vector<Address>& dest, CUserMessage* req, std::vector<CUserMessage*>* res = NULL);
+   int multi_rpc(const std::vector<Address>& dest, const std::vector<CUserMessage*>& req, std::vector<CUserMessage*>* res = NULL);
 
    int rtt(const std::string& ip, const int& port, const bool& clear = false);
 
+      // Functionality:
+      //    retrieve the RPC latency histogram of every peer this node has called.
+      // Parameters:
+      //    0) [out] stat: RPC statistics of each peer address.
+      // Returned value:
+      //    number of peers.
+
+   int getRPCStat(std::map<Address, CRPCStat, AddrComp>& stat);
+
+private:
+   void storeResponse(CMsgRecord* rec);
+   int queueRetrans(CMsgRecord* rec);
+   void scheduleRetrans(CMsgRecord* rec);
+   void checkRetrans(const int64_t& now);
+   int waitResponse(const int32_t& id, CUserMessage* msg, int64_t* arrival);
+   void addRPCStat(const std::string& ip, const int& port, const int64_t& usecs);
+
 private:
    pthread_t m_SndThread;
    pthread_t m_RcvThread;
@@ -183,7 +223,7 @@ private:
    pthread_mutex_t m_RcvQueueLock;
    pthread_cond_t m_RcvQueueCond;
    pthread_mutex_t m_ResQueueLock;
-   pthread_cond_t m_ResQueueCond;
+   pthread_mutex_t m_RPCStatLock;
    pthread_mutex_t m_RTTLock;
    pthread_cond_t m_RTTCond;
 
@@ -200,9 +240,13 @@ private:
    int m_iUDTReusePort;
    int m_iUDTEPollID;
 
-   std::list<CMsgRecord*> m_lSndQueue;
+   std::map<int32_t, CMsgRecord*> m_mSndQueue;		// messages waiting for ACK, by message ID
+   std::vector< std::list<int32_t> > m_vRetransWheel;	// IDs of messages in m_mSndQueue, hashed by retransmission time
+   int64_t m_llWheelTick;				// last tick processed by the timer wheel
    std::queue<CMsgRecord*> m_qRcvQueue;
-   std::map<int32_t, CMsgRecord*> m_mResQueue;
+   std::map<int32_t, CMsgRecord*> m_mResQueue;		// responses that arrived before anyone waited for them
+   std::map<int32_t, CRPCWaiter*> m_mResWaiter;		// requests being waited for, by request ID
+   std::map<Address, CRPCStat, AddrComp> m_mRPCStat;	// RPC latency of each peer
    CPeerManagement m_PeerHistory;
 
    volatile bool m_bInit;
@@ -210,6 +254,13 @@ private:
 
 private:
    static const int m_iMaxUDPMsgSize = 1456;
+   static const int64_t m_llMaxResWait = 15 * 1000000;	// how long recv() waits for a response, in microseconds
+
+   static const int m_iWheelSize = 512;			// number of slots in the retransmission timer wheel
+   static const int m_iWheelTick = 1000;			// time covered by each slot, in microseconds
+   static const int m_iMinRTO = 10000;			// lower bound of the retransmission timeout, in microseconds
+   static const int m_iMaxRTO = 15000000;		// upper bound of the retransmission timeout, in microseconds
+   static const int m_iInitRTO = 1000000;		// retransmission timeout when the peer RTT is unknown
 };
 
 #endif
@@ -41,6 +41,7 @@ written by
 #ifndef WIN32
    #include <sys/time.h>
    #include <time.h>
+   #include <arpa/inet.h>
 #else
    #include <windows.h>
 #endif
@@ -63,6 +64,172 @@ m_UDTSocket(UDT::INVALID_SOCK)
 {
 }
 
+
+CRecordTable::CRecordTable():
+m_pEntry(NULL),
+m_uiSize(0),
+m_uiCount(0),
+m_iHead(-1),
+m_iTail(-1)
+{
+   resize_(m_uiInitSize);
+}
+
+CRecordTable::~CRecordTable()
+{
+   delete [] m_pEntry;
+}
+
+int CRecordTable::find(const uint64_t& key1, const uint64_t& key2) const
+{
+   unsigned int mask = m_uiSize - 1;
+
+   for (unsigned int i = home_(key1, key2); m_pEntry[i].m_bUsed; i = (i + 1) & mask)
+   {
+      if ((key1 == m_pEntry[i].m_ullKey1) && (key2 == m_pEntry[i].m_ullKey2))
+         return i;
+   }
+
+   return -1;
+}
+
+int CRecordTable::insert(const uint64_t& key1, const uint64_t& key2, const int64_t& ts, CPeerRecord* data)
+{
+   // keep the load factor at or below 1/2 so that probe sequences stay short
+   if ((m_uiCount + 1) * 2 > m_uiSize)
+      resize_(m_uiSize * 2);
+
+   unsigned int mask = m_uiSize - 1;
+   unsigned int i = home_(key1, key2);
+   while (m_pEntry[i].m_bUsed)
+      i = (i + 1) & mask;
+
+   m_pEntry[i].m_ullKey1 = key1;
+   m_pEntry[i].m_ullKey2 = key2;
+   m_pEntry[i].m_llTimeStamp = ts;
+   m_pEntry[i].m_pData = data;
+   m_pEntry[i].m_bUsed = true;
+   append_(i);
+   ++ m_uiCount;
+
+   return i;
+}
+
+void CRecordTable::erase(const int& pos)
+{
+   unlink_(pos);
+   -- m_uiCount;
+
+   // backward shift deletion: move later entries of the same probe sequence into the hole, so no tombstones are needed
+   unsigned int mask = m_uiSize - 1;
+   unsigned int hole = pos;
+   for (unsigned int j = (hole + 1) & mask; m_pEntry[j].m_bUsed; j = (j + 1) & mask)
+   {
+      unsigned int h = home_(m_pEntry[j].m_ullKey1, m_pEntry[j].m_ullKey2);
+
+      // the entry stays if its home slot lies cyclically in (hole, j]
+      if ((hole < j) ? ((hole < h) && (h <= j)) : ((hole < h) || (h <= j)))
+         continue;
+
+      m_pEntry[hole] = m_pEntry[j];
+
+      if (m_pEntry[hole].m_iPrev >= 0)
+         m_pEntry[m_pEntry[hole].m_iPrev].m_iNext = hole;
+      else
+         m_iHead = hole;
+      if (m_pEntry[hole].m_iNext >= 0)
+         m_pEntry[m_pEntry[hole].m_iNext].m_iPrev = hole;
+      else
+         m_iTail = hole;
+
+      hole = j;
+   }
+
+   m_pEntry[hole].m_bUsed = false;
+}
+
+void CRecordTable::touch(const int& pos, const int64_t& ts)
+{
+   m_pEntry[pos].m_llTimeStamp = ts;
+   unlink_(pos);
+   append_(pos);
+}
+
+void CRecordTable::clear()
+{
+   for (unsigned int i = 0; i < m_uiSize; ++ i)
+      m_pEntry[i].m_bUsed = false;
+
+   m_uiCount = 0;
+   m_iHead = m_iTail = -1;
+}
+
+unsigned int CRecordTable::home_(const uint64_t& key1, const uint64_t& key2) const
+{
+   // 64-bit mix (splitmix64 finalizer) of both words
+   uint64_t h = key1 * 0x9E3779B97F4A7C15ULL ^ key2;
+   h ^= h >> 30;
+   h *= 0xBF58476D1CE4E5B9ULL;
+   h ^= h >> 27;
+   h *= 0x94D049BB133111EBULL;
+   h ^= h >> 31;
+
+   return (unsigned int)h & (m_uiSize - 1);
+}
+
+void CRecordTable::resize_(unsigned int size)
+{
+   Entry* old = m_pEntry;
+   int head = m_iHead;
+
+   m_pEntry = new Entry[size];
+   m_uiSize = size;
+   clear();
+
+   // re-insert in list order, so the LRU order is preserved
+   for (int i = head; i >= 0; i = old[i].m_iNext)
+   {
+      unsigned int mask = m_uiSize - 1;
+      unsigned int j = home_(old[i].m_ullKey1, old[i].m_ullKey2);
+      while (m_pEntry[j].m_bUsed)
+         j = (j + 1) & mask;
+
+      m_pEntry[j] = old[i];
+      append_(j);
+      ++ m_uiCount;
+   }
+
+   delete [] old;
+}
+
+void CRecordTable::unlink_(const int& pos)
+{
+   Entry& e = m_pEntry[pos];
+
+   if (e.m_iPrev >= 0)
+      m_pEntry[e.m_iPrev].m_iNext = e.m_iNext;
+   else
+      m_iHead = e.m_iNext;
+
+   if (e.m_iNext >= 0)
+      m_pEntry[e.m_iNext].m_iPrev = e.m_iPrev;
+   else
+      m_iTail = e.m_iPrev;
+}
+
+void CRecordTable::append_(const int& pos)
+{
+   m_pEntry[pos].m_iPrev = m_iTail;
+   m_pEntry[pos].m_iNext = -1;
+
+   if (m_iTail >= 0)
+      m_pEntry[m_iTail].m_iNext = pos;
+   else
+      m_iHead = pos;
+
+   m_iTail = pos;
+}
+
 CPeerManagement::CPeerManagement()
 {
    CGuard::createMutex(m_PeerRecLock);
@@ -76,6 +243,9 @@ CPeerManagement::~CPeerManagement()
 
 void CPeerManagement::insert(const string& ip, const int& port, const int& session, const int32_t& id, const int& rtt, const int& fw)
 {
+   uint64_t addr = packAddr(ip, port);
+   int64_t ts = CTimer::getTime();
+
    CGuard recguard(m_PeerRecLock);
 
    if (rtt > 0)
@@ -87,72 +257,46 @@ void CPeerManagement::insert(const string& ip, const int& port, const int& sessi
          m_mRTT[ip] = rtt;
    }
 
-   CPeerRecord* pr = new CPeerRecord;
-   pr->m_strIP = ip;
-   pr->m_iPort = port;
-   pr->m_iSession = session;
-   pr->m_iID = id;
-   pr->m_llTimeStamp = CTimer::getTime();
-   pr->m_iFlowWindow = fw;
-
    //insert the message record to the recent records list, so to avoid repeated messages
-   addRecentPR(*pr);
+   if (id > 0)
+      addRecentPR(addr, session, id, ts);
 
-   set<CPeerRecord*, CFPeerRec>::iterator i = m_sPeerRec.find(pr);
-   map<string, int>::iterator t = m_mRTT.find(ip);
+   int p = m_PeerRec.find(addr, (uint32_t)session);
 
-   if (i != m_sPeerRec.end())
+   if (p >= 0)
    {
-      if (id > (*i)->m_iID)
-         (*i)->m_iID = id;
-      (*i)->m_iFlowWindow = fw;
+      CPeerRecord* pr = m_PeerRec.getData(p);
+      if (id > pr->m_iID)
+         pr->m_iID = id;
+      pr->m_iFlowWindow = fw;
 
       // adjust last updated time
-      m_sPeerRecByTS.erase(*i);
-      (*i)->m_llTimeStamp = CTimer::getTime();
-      m_sPeerRecByTS.insert(*i);
-
-      delete pr;
+      pr->m_llTimeStamp = ts;
+      m_PeerRec.touch(p, ts);
    }
    else
    {
-      if (id > 0)
-         pr->m_iID = id;
-      else
-         pr->m_iID = -1;
+      CPeerRecord* pr = new CPeerRecord;
+      pr->m_strIP = ip;
+      pr->m_iPort = port;
+      pr->m_iSession = session;
+      pr->m_iID = (id > 0) ? id : -1;
+      pr->m_llTimeStamp = ts;
+      pr->m_iFlowWindow = fw;
 
-      m_sPeerRec.insert(pr);
-      m_sPeerRecByTS.insert(pr);
+      m_PeerRec.insert(addr, (uint32_t)session, ts, pr);
 
-      if (m_sPeerRecByTS.size() > m_uiRecLimit)
+      if (m_PeerRec.size() > m_uiRecLimit)
       {
          // delete oldest record
-         set<CPeerRecord*, CFPeerRecByTS>::iterator j = m_sPeerRecByTS.begin();
-
-         CPeerRecord* t = *j;
+         int o = m_PeerRec.oldest();
+         CPeerRecord* t = m_PeerRec.getData(o);
 
          // close the UDT connection if necessary
          if (t->m_UDTSocket != UDT::INVALID_SOCK)
             UDT::close(t->m_UDTSocket);
 
-         m_sPeerRec.erase(t);
-         m_sPeerRecByTS.erase(j);
-
-         // BUG: when set reaches limit, this cause busy CPU loop
-         /*
-         bool delip = true;
-         for (set<CPeerRecord*, CFPeerRec>::iterator k = m_sPeerRec.begin(); k != m_sPeerRec.end(); ++ k)
-         {
-            if ((*k)->m_strIP == t->m_strIP)
-            {
-               delip = false;
-               break;
-            }
-         }
-
-         if (delip)
-         */
-
+         m_PeerRec.erase(o);
          m_mRTT.erase(t->m_strIP);
 
          delete t;
@@ -179,18 +323,21 @@ void CPeerManagement::clearRTT(const string& ip)
 
 int CPeerManagement::flowControl(const string& ip, const int& port, const int& session)
 {
-   CPeerRecord pr;
-   pr.m_strIP = ip;
-   pr.m_iPort = port;
-   pr.m_iSession = session;
+   uint64_t addr = packAddr(ip, port);
+   int thresh;
 
-   CGuard recguard(m_PeerRecLock);
+   {
+      CGuard recguard(m_PeerRecLock);
 
-   set<CPeerRecord*, CFPeerRec>::iterator i = m_sPeerRec.find(&pr);
-   if (i == m_sPeerRec.end())
-      return 0;
+      int p = m_PeerRec.find(addr, (uint32_t)session);
+      if (p < 0)
+         return 0;
 
-   int thresh = (*i)->m_iFlowWindow - int((CTimer::getTime() - (*i)->m_llTimeStamp) / 1000);
+      CPeerRecord* pr = m_PeerRec.getData(p);
+      thresh = pr->m_iFlowWindow - int((CTimer::getTime() - pr->m_llTimeStamp) / 1000);
+   }
+
+   // do not hold the lock while sleeping, the receiving threads need it for every message
 
    if (thresh > 100)
    {
@@ -215,35 +362,32 @@ int CPeerManagement::flowControl(const string& ip, const int& port, const int& s
    return 0;
 }
 
-int32_t CPeerManagement::hash(const string& ip, const int& port, const int& session, const int32_t& id)
+uint64_t CPeerManagement::packAddr(const string& ip, const int& port)
 {
-   char tmp[1024];
-   sprintf(tmp, "%s%d%d%d", ip.c_str(), port, session, id);
+   // GMP runs over IPv4 only; anything else falls back to a 32-bit SHA1 of the string
+   in_addr a;
+   uint32_t v;
+   if (inet_pton(AF_INET, ip.c_str(), &a) > 0)
+      v = ntohl(a.s_addr);
+   else
+      v = DHash::hash(ip.c_str(), 32);
 
-   return DHash::hash(tmp, m_uiHashSpace);
+   return (uint64_t(v) << 32) | uint32_t(port);
 }
 
-int CPeerManagement::addRecentPR(const CPeerRecord& pr)
+int CPeerManagement::addRecentPR(const uint64_t& addr, const int& session, const int32_t& id, const int64_t& ts)
 {
-   int key = hash(pr.m_strIP, pr.m_iPort, pr.m_iSession, pr.m_iID);
-   map<int, list<CPeerRecord> >::iterator i = m_mRecentRec.find(key);
-   if (i == m_mRecentRec.end())
-   {
-      m_mRecentRec[key].clear();
-      m_mRecentRec[key].push_back(pr);
-   }
+   // records are appended in time order, so the expired ones are always at the head of the list
+   for (int o = m_RecentRec.oldest(); (o >= 0) && (ts - m_RecentRec.getTimeStamp(o) >= m_llRecentWindow); o = m_RecentRec.oldest())
+      m_RecentRec.erase(o);
+
+   uint64_t msg = (uint64_t(uint32_t(session)) << 32) | uint32_t(id);
+
+   int p = m_RecentRec.find(addr, msg);
+   if (p >= 0)
+      m_RecentRec.touch(p, ts);
    else
-   {
-      int64_t ts = CTimer::getTime();
-      while (!i->second.empty())
-      {
-         CPeerRecord& p = i->second.front();
-         if (ts - p.m_llTimeStamp < 10 * 1000000)
-            break;
-         i->second.pop_front();
-      }
-      i->second.push_back(pr);
-   }
+      m_RecentRec.insert(addr, msg, ts);
 
    return 0;
 }
@@ -252,61 +396,46 @@ void CPeerManagement::clearPR()
 {
    CGuard recguard(m_PeerRecLock);
 
-   for (map<int, list<CPeerRecord> >::iterator i = m_mRecentRec.begin(); i != m_mRecentRec.end(); ++ i)
-   {
-      i->second.clear();
-   }
-   m_mRecentRec.clear();
+   m_RecentRec.clear();
 
-   for (set<CPeerRecord*, CFPeerRecByTS>::iterator i = m_sPeerRecByTS.begin(); i !=  m_sPeerRecByTS.end(); ++ i)
+   for (int i = m_PeerRec.oldest(); i >= 0; i = m_PeerRec.oldest())
    {
-      delete *i;
+      delete m_PeerRec.getData(i);
+      m_PeerRec.erase(i);
    }
-   m_sPeerRecByTS.clear();
-
-   m_sPeerRec.clear();
 }
 
 bool CPeerManagement::hit(const string& ip, const int& port, const int& session, const int32_t& id)
 {
-   CGuard recguard(m_PeerRecLock);
-
-   int key = hash(ip, port, session, id);
+   uint64_t addr = packAddr(ip, port);
+   uint64_t msg = (uint64_t(uint32_t(session)) << 32) | uint32_t(id);
 
-   map<int, list<CPeerRecord> >::iterator i = m_mRecentRec.find(key);
-   if (i != m_mRecentRec.end())
-   {
-      for (list<CPeerRecord>::iterator pr = i->second.begin(); pr != i->second.end(); ++ pr)
-      {
-         if ((ip == pr->m_strIP) && (port == pr->m_iPort) && (session == pr->m_iSession) && (id == pr->m_iID))
-            return true;
-      }
-   }
+   CGuard recguard(m_PeerRecLock);
 
-   return false;
+   return m_RecentRec.find(addr, msg) >= 0;
 }
 
 int CPeerManagement::setUDTSocket(const std::string& ip, const int& port, const UDTSOCKET& usock)
 {
-   CGuard recguard(m_PeerRecLock);
+   uint64_t addr = packAddr(ip, port);
 
-   CPeerRecord pr;
-   pr.m_strIP = ip;
-   pr.m_iPort = port;
+   CGuard recguard(m_PeerRecLock);
 
-   set<CPeerRecord*, CFPeerRec>::iterator i = m_sPeerRec.find(&pr);
+   int p = m_PeerRec.find(addr, 0);
 
-   if (i != m_sPeerRec.end())
+   if (p >= 0)
    {
-      (*i)->m_UDTSocket = usock;
+      m_PeerRec.getData(p)->m_UDTSocket = usock;
    }
    else
    {
-      pr.m_llTimeStamp = CTimer::getTime();
-      pr.m_UDTSocket = usock;
+      CPeerRecord* pr = new CPeerRecord;
+      pr->m_strIP = ip;
+      pr->m_iPort = port;
+      pr->m_llTimeStamp = CTimer::getTime();
+      pr->m_UDTSocket = usock;
 
-      m_sPeerRec.insert(&pr);
-      m_sPeerRecByTS.insert(&pr);
+      m_PeerRec.insert(addr, 0, pr->m_llTimeStamp, pr);
    }
 
    return 0;
@@ -314,24 +443,24 @@ int CPeerManagement::setUDTSocket(const std::string& ip, const int& port, const
 
 int CPeerManagement::getUDTSocket(const std::string& ip, const int& port, UDTSOCKET& usock)
 {
-   CGuard recguard(m_PeerRecLock);
+   uint64_t addr = packAddr(ip, port);
 
-   CPeerRecord pr;
-   pr.m_strIP = ip;
-   pr.m_iPort = port;
+   CGuard recguard(m_PeerRecLock);
 
-   set<CPeerRecord*, CFPeerRec>::iterator i = m_sPeerRec.find(&pr);
+   int p = m_PeerRec.find(addr, 0);
 
-   if (i != m_sPeerRec.end())
+   if (p >= 0)
    {
-      usock = (*i)->m_UDTSocket;
+      CPeerRecord* pr = m_PeerRec.getData(p);
+
+      usock = pr->m_UDTSocket;
       if (usock == UDT::INVALID_SOCK)
          return -1;
 
       // check current state; maybe the peer has closed this connection
       if (UDT::getsockstate(usock) != CONNECTED)
       {
-         (*i)->m_UDTSocket = usock = UDT::INVALID_SOCK;
+         pr->m_UDTSocket = usock = UDT::INVALID_SOCK;
          return -1;
       }
 
@@ -70,36 +70,53 @@ struct CPeerRecord
    UDTSOCKET m_UDTSocket;
 };
 
-struct CFPeerRec
+// Open addressing (linear probing) hash table keyed by two packed 64-bit words, with an intrusive
+// list that keeps the entries in the order they were last touched, oldest first.
+// Positions returned by find() and insert() are invalidated by the next insert() or erase().
+
+class CRecordTable
 {
-   bool operator()(const CPeerRecord* p1, const CPeerRecord* p2) const
-   {
-      if (p1->m_strIP == p2->m_strIP)
-      {
-         if (p1->m_iPort == p2->m_iPort)
-            return (p1->m_iSession > p2->m_iSession);
+public:
+   CRecordTable();
+   ~CRecordTable();
 
-         return (p1->m_iPort > p2->m_iPort);
-      }
+public:
+   int find(const uint64_t& key1, const uint64_t& key2) const;
+   int insert(const uint64_t& key1, const uint64_t& key2, const int64_t& ts, CPeerRecord* data = NULL);
+   void erase(const int& pos);
+   void touch(const int& pos, const int64_t& ts);
+   void clear();
 
-      return (p1->m_strIP > p2->m_strIP);
-   }
-};
+   int oldest() const {return m_iHead;}
+   unsigned int size() const {return m_uiCount;}
+   int64_t getTimeStamp(const int& pos) const {return m_pEntry[pos].m_llTimeStamp;}
+   CPeerRecord* getData(const int& pos) const {return m_pEntry[pos].m_pData;}
 
-struct CFPeerRecByIP
-{
-   bool operator()(const CPeerRecord* p1, const CPeerRecord* p2) const
+private:
+   struct Entry
    {
-      return (p1->m_strIP > p2->m_strIP);
-   }
-};
+      uint64_t m_ullKey1;
+      uint64_t m_ullKey2;
+      int64_t m_llTimeStamp;
+      CPeerRecord* m_pData;
+      int m_iPrev;			// previous (older) entry in the list, -1 for the head
+      int m_iNext;			// next (newer) entry in the list, -1 for the tail
+      bool m_bUsed;
+   };
+
+   unsigned int home_(const uint64_t& key1, const uint64_t& key2) const;
+   void resize_(unsigned int size);
+   void unlink_(const int& pos);
+   void append_(const int& pos);
 
-struct CFPeerRecByTS
-{
-   bool operator()(const CPeerRecord* p1, const CPeerRecord* p2) const
-   {      
-      return (p1->m_llTimeStamp > p2->m_llTimeStamp);
-   }
+private:
+   Entry* m_pEntry;			// slots, m_uiSize is a power of 2
+   unsigned int m_uiSize;
+   unsigned int m_uiCount;
+   int m_iHead;				// least recently touched entry
+   int m_iTail;				// most recently touched entry
+
+   static const unsigned int m_uiInitSize = 1024;
 };
 
 class CPeerManagement
@@ -114,25 +131,22 @@ public:
    void clearRTT(const std::string& ip);
    int flowControl(const std::string& ip, const int& port, const int& session);
 
-   int32_t hash(const std::string& ip, const int& port, const int& session, const int32_t& id);
    bool hit(const std::string& ip, const int& port, const int& session, const int32_t& id);
 
    int setUDTSocket(const std::string& ip, const int& port, const UDTSOCKET& usock);
    int getUDTSocket(const std::string& ip, const int& port, UDTSOCKET& usock);
 
 private:
-   int addRecentPR(const CPeerRecord& pr);
+   static uint64_t packAddr(const std::string& ip, const int& port);
+   int addRecentPR(const uint64_t& addr, const int& session, const int32_t& id, const int64_t& ts);
    void clearPR();
 
 private:
-   //TODO: use hash table and linked list to implement the record cache
-
-   std::set<CPeerRecord*, CFPeerRec> m_sPeerRec;
-   std::set<CPeerRecord*, CFPeerRecByTS> m_sPeerRecByTS;
+   CRecordTable m_PeerRec;			// peer records by (IP, port, session), in LRU order
+   CRecordTable m_RecentRec;			// messages received in the last m_llRecentWindow, by (IP, port, session, ID)
    std::map<std::string, int> m_mRTT;
 
-   static const unsigned int m_uiHashSpace = 20;
-   std::map<int, std::list<CPeerRecord> > m_mRecentRec;
+   static const int64_t m_llRecentWindow = 10000000;	// how long a message ID is remembered for duplicate detection, in microseconds
 
    pthread_mutex_t m_PeerRecLock;
 
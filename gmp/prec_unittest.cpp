@@ -0,0 +1,174 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   bdl62, last updated 05/21/2011
+*****************************************************************************/
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "common.h"
+#include "prec.h"
+
+using namespace std;
+
+// CRecordTable against std::map under random insert/erase, and the LRU order
+int test1()
+{
+   CRecordTable t;
+   map<pair<uint64_t, uint64_t>, int64_t> ref;
+
+   for (int64_t ts = 1; ts <= 50000; ++ ts)
+   {
+      uint64_t k1 = rand() % 64;
+      uint64_t k2 = rand() % 512;
+      pair<uint64_t, uint64_t> k(k1, k2);
+
+      int p = t.find(k1, k2);
+      assert((p >= 0) == (ref.find(k) != ref.end()));
+
+      if (p < 0)
+      {
+         t.insert(k1, k2, ts);
+         ref[k] = ts;
+      }
+      else if (rand() % 2)
+      {
+         t.touch(p, ts);
+         ref[k] = ts;
+      }
+      else
+      {
+         t.erase(p);
+         ref.erase(k);
+      }
+
+      // expire the oldest entries now and then, which also exercises erase() across wrapped probe sequences
+      if (0 == ts % 1000)
+      {
+         while ((t.oldest() >= 0) && (t.getTimeStamp(t.oldest()) < ts - 5000))
+         {
+            int o = t.oldest();
+            int64_t old = t.getTimeStamp(o);
+            for (map<pair<uint64_t, uint64_t>, int64_t>::iterator i = ref.begin(); i != ref.end(); ++ i)
+               assert(i->second >= old);
+            t.erase(o);
+
+            for (map<pair<uint64_t, uint64_t>, int64_t>::iterator i = ref.begin(); i != ref.end(); ++ i)
+            {
+               if (i->second == old)
+               {
+                  ref.erase(i);
+                  break;
+               }
+            }
+         }
+      }
+
+      assert(t.size() == ref.size());
+   }
+
+   for (map<pair<uint64_t, uint64_t>, int64_t>::iterator i = ref.begin(); i != ref.end(); ++ i)
+   {
+      int p = t.find(i->first.first, i->first.second);
+      assert((p >= 0) && (t.getTimeStamp(p) == i->second));
+   }
+
+   return 0;
+}
+
+// duplicate detection and per-peer records through CPeerManagement
+int test2()
+{
+   CPeerManagement pm;
+
+   assert(!pm.hit("10.0.0.1", 6000, 7, 100));
+   pm.insert("10.0.0.1", 6000, 7, 100);
+   assert(pm.hit("10.0.0.1", 6000, 7, 100));
+   assert(!pm.hit("10.0.0.1", 6000, 7, 101));
+   assert(!pm.hit("10.0.0.1", 6001, 7, 100));
+   assert(!pm.hit("10.0.0.1", 6000, 8, 100));
+   assert(!pm.hit("10.0.0.2", 6000, 7, 100));
+
+   // ACKs carry the RTT and the flow window of the peer
+   assert(pm.getRTT("10.0.0.1") < 0);
+   pm.insert("10.0.0.1", 6000, 7, -1, 800, 0);
+   pm.insert("10.0.0.1", 6000, 7, -1, 1600, 0);
+   assert(pm.getRTT("10.0.0.1") == 900);
+   assert(pm.flowControl("10.0.0.1", 6000, 7) == 0);
+
+   return 0;
+}
+
+// hit() + insert() throughput, the work done for every message received
+int test3()
+{
+   const int peers = 1024;
+   const int num = 1000000;
+
+   vector<string> ips;
+   for (int i = 0; i < peers; ++ i)
+   {
+      stringstream ip;
+      ip << "10.0." << i / 256 << "." << i % 256;
+      ips.push_back(ip.str());
+   }
+
+   CPeerManagement pm;
+
+   int64_t start = CTimer::getTime();
+   int dup = 0;
+   for (int i = 0; i < num; ++ i)
+   {
+      const string& ip = ips[i % peers];
+      int id = i / peers + 1;
+      if (pm.hit(ip, 6000, 1, id))
+         ++ dup;
+      else
+         pm.insert(ip, 6000, 1, id);
+   }
+   int64_t t = CTimer::getTime() - start;
+   assert(0 == dup);
+
+   cout << "hit + insert with " << peers << " peers: " << t * 1000 / num << " ns per message" << endl;
+
+   return 0;
+}
+
+int main()
+{
+   srand(1);
+
+   test1();
+   test2();
+   test3();
+
+   return 0;
+}
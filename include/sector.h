@@ -51,6 +51,12 @@ written by
 const int32_t SectorVersion = 2006031;
 const std::string SectorVersionString = "Sector SVN version 869 build Fri Apr 13 10:59:06 CDT 2012";
 
+// Optional features reported by a slave in its status report, so that they are only used on slaves that have them.
+struct SlaveCapability
+{
+   static const int32_t MERGED_DS = 1;		// an SPE can process a DS made of several small files
+};
+
 
 struct Address
 {
@@ -104,6 +110,12 @@ public:
    int64_t m_llTotalFileNum;
    int64_t m_llUnderReplicated;
 
+   int64_t m_llRecoveryPending;		// bytes waiting to be re-replicated, including transfers in flight
+   int64_t m_llRecoveryDone;		// bytes re-replicated since the current recovery started
+   int64_t m_llRecoveryRate;		// recovery throughput, bytes per second
+   int64_t m_llRecoveryETA;		// estimated seconds to complete the recovery, -1 if unknown
+   int64_t m_llRecoveryTrans;		// replica transfers in flight
+
    int64_t m_llTotalSlaves;
 
    struct MasterStat
@@ -239,7 +251,7 @@ public:
    int64_t write(const char* buf, const int64_t& offset, const int64_t& size, const int64_t& buffer = 0);
    int64_t read(char* buf, const int64_t& size);
    int64_t write(const char* buf, const int64_t& size);
-   int64_t download(const char* localpath, const bool& cont = false);
+   int64_t download(const char* localpath, const bool& cont = false, const int& streams = 1);
    int64_t upload(const char* localpath, const bool& cont = false);
    int flush();
    int close();
@@ -335,10 +347,19 @@ public:
    int checkReduceProgress();
    int waitForCompletion();
 
+   // map output size before and after the map side combiner (<op>_combine)
+   int getShuffleSize(int64_t& before, int64_t& after);
+
+   // bytes sent to the buckets before and after compression, and the compression CPU time in microseconds
+   int getCompressionStat(int64_t& raw, int64_t& compressed, int64_t& usec);
+
    void setMinUnitSize(int size);
    void setMaxUnitSize(int size);
    void setProcNumPerNode(int num);
+   void setProcThreadNum(int num);	// threads per SPE for UDFs that export "int <op>_threadsafe = 1;"
    void setDataMoveAttr(bool move);
+   void setShuffleCompression(bool compress);
+   void setSpeculation(bool speculate);	// duplicate straggling data segments near the end of the job, off by default
 
 public:
    int m_iID;
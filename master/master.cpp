@@ -27,6 +27,8 @@ written by
 #include <stack>
 
 #include "common.h"
+#include "crypto.h"
+#include "erasure.h"
 #include "master.h"
 #include "replica_conf.h"
 #include "ssltransport.h"
@@ -57,6 +59,7 @@ namespace
 }
 
 Master::Master():
+m_llSyncSeq(0),
 m_iDfTs(0),
 m_iDfTimeout(30),
 m_bDfBeingEvaluated(false),
@@ -232,6 +235,11 @@ int Master::init()
    pthread_t repserver;
    pthread_create(&repserver, NULL, replica, this);
    pthread_detach(repserver);
+
+   // start metadata sync thread
+   pthread_t syncserver;
+   pthread_create(&syncserver, NULL, syncHandler, this);
+   pthread_detach(syncserver);
 #else
     DWORD ThreadID = 0;
     HANDLE hThread = NULL;
@@ -255,6 +263,11 @@ int Master::init()
     hThread = CreateThread(NULL, 0, replica, this, NULL, &ThreadID);
     if (hThread)
        CloseHandle(hThread);
+
+    // start metadata sync thread
+    hThread = CreateThread(NULL, 0, syncHandler, this, NULL, &ThreadID);
+    if (hThread)
+       CloseHandle(hThread);
 #endif
 
    m_llStartTime = time(NULL);
@@ -1333,6 +1346,30 @@ int Master::processSysCmd(const string& ip, const int port, const User* user, co
          }
       }
 
+      // a directory copy may complete partially; the files that failed are listed after the new ones
+      if (SectorMsg::m_iHdrSize + pos + 4 <= msg->m_iDataLength)
+      {
+         int fnum = *(int32_t*)(msg->getData() + pos);
+         pos += 4;
+         for (int i = 0; (i < fnum) && (SectorMsg::m_iHdrSize + pos + 4 <= msg->m_iDataLength); ++ i)
+         {
+            int size = *(int32_t*)(msg->getData() + pos);
+            if ((size <= 0) || (SectorMsg::m_iHdrSize + pos + 4 + size > msg->m_iDataLength))
+               break;
+            string path(msg->getData() + pos + 4, strnlen(msg->getData() + pos + 4, size));
+            pos += size + 4;
+
+            m_SectorLog << LogStart(LogLevel::LEVEL_9) << "TID " << transid << ":" << t.m_iType << " File failed on " << ip << ":" << port << " " << path << LogEnd();
+
+            if (change == FileChangeType::FILE_UPDATE_REPLICA)
+            {
+               m_ReplicaLock.acquire();
+               m_sstrOnReplicate.erase(Metadata::revisePath(path));
+               m_ReplicaLock.release();
+            }
+         }
+      }
+
       if (num > 0)
       {
          // send file changes to all other masters
@@ -1347,6 +1384,22 @@ int Master::processSysCmd(const string& ip, const int port, const User* user, co
          }
       }
 
+      if (t.m_iType == TransType::REPLICA)
+         m_Recovery.finish(transid, (change == FileChangeType::FILE_UPDATE_REPLICA) || (change == FileChangeType::FILE_UPDATE_NEW));
+
+      if (t.m_iType == TransType::ERASURE)
+      {
+         // one shard of an erasure coded file has been written, or has failed
+         m_TransManager.updateSlave(transid, slaveid);
+         m_SlaveManager.decActTrans(slaveid);
+         m_Recovery.finish(transid, change == FileChangeType::FILE_UPDATE_NEW);
+
+         ErasureMgmt::Job job;
+         int res = m_ErasureMgmt.finish(transid, change == FileChangeType::FILE_UPDATE_NEW, job);
+         if (res != 0)
+            completeErasure(job, res);
+      }
+
       if ((t.m_iType == TransType::FILE) || (t.m_iType == TransType::REPLICA))
       {
          //TODO: slave should send another trans status report
@@ -1650,6 +1703,11 @@ int Master::processSysCmd(const string& ip, const int port, const User* user, co
       sbuf << "Write locks            \t" << writeLocks << std::endl;
       sbuf << "Read locks             \t" << readLocks << std::endl;
       sbuf << "User sessions          \t" << sesCount << std::endl;
+      int64_t syncLagRecords = 0;
+      int64_t syncLagTime = 0;
+      int syncLogSize = getSyncLag(syncLagRecords, syncLagTime);
+      sbuf << "Master sync log size   \t" << syncLogSize << std::endl;
+      sbuf << "Master sync lag        \t" << syncLagRecords << " changes, " << syncLagTime / 1000 << " ms" << std::endl;
 
       if (user->m_strName != "root")
       {
@@ -1723,7 +1781,18 @@ int Master::processSysCmd(const string& ip, const int port, const User* user, co
       m_SlaveManager.getListActTrans(lats);
       for (map<int, int>::const_iterator sl = lats.begin(); sl != lats.end(); ++sl)
       {
-        sbuf << "Slave " << sl->first << " transactions " << sl->second << std::endl; 
+        sbuf << "Slave " << sl->first << " transactions " << sl->second << std::endl;
+      }
+
+      sbuf << std::endl;
+      sbuf << "RPC latency per peer (calls, mean, p50, p99, microseconds):" << std::endl;
+      map<Address, CRPCStat, AddrComp> rpcstat;
+      m_GMP.getRPCStat(rpcstat);
+      for (map<Address, CRPCStat, AddrComp>::const_iterator r = rpcstat.begin(); r != rpcstat.end(); ++ r)
+      {
+        sbuf << r->first.m_strIP << ":" << r->first.m_iPort << "\t" << r->second.m_llCount << "\t"
+             << r->second.m_llTotalTime / r->second.m_llCount << "\t" << r->second.percentile(0.5) << "\t"
+             << r->second.percentile(0.99) << std::endl;
       }
 
       }
@@ -1790,6 +1859,57 @@ int Master::processSysCmd(const string& ip, const int port, const User* user, co
       m_GMP.sendto(ip, port, id, msg);
       break;
    }
+
+   case 13: // a slave found a replica that does not match its checksums
+   {
+      Address addr;
+      addr.m_strIP = ip;
+      addr.m_iPort = port;
+      if (m_SlaveManager.getSlaveID(addr) < 0)
+      {
+         reject(ip, port, id, SectorError::E_SECURITY);
+         break;
+      }
+
+      int64_t block = *(int64_t*)msg->getData();
+      string path = msg->getData() + 8;
+
+      SNode attr;
+      if ((m_pMetadata->lookup(path, attr) < 0) || (attr.m_sLocation.find(addr) == attr.m_sLocation.end()))
+      {
+         reject(ip, port, id, SectorError::E_NOEXIST);
+         break;
+      }
+
+      // a corrupted copy is still better than none, keep it if no other replica is left
+      if (attr.m_sLocation.size() <= 1)
+      {
+         m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Corrupted block " << block << " in the last replica of " << path
+                     << " on " << ip << ":" << port << LogEnd();
+         reject(ip, port, id, SectorError::E_NOREPLICA);
+         break;
+      }
+
+      m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Corrupted block " << block << " in " << path << " on " << ip << ":" << port
+                  << ", dropping the replica" << LogEnd();
+
+      m_pMetadata->removeReplica(path, addr);
+
+      msg->m_iDataLength = SectorMsg::m_iHdrSize;
+      m_GMP.sendto(ip, port, id, msg);
+
+      // make a new replica from a good copy right away
+      m_ReplicaLock.acquire();
+      ReplicaJob job;
+      job.m_strSource = job.m_strDest = path;
+      job.m_iPriority = BACKGROUND;
+      m_ReplicaMgmt.insert(job);
+      m_ReplicaCond.signal();
+      m_ReplicaLock.release();
+
+      break;
+   }
+
    default:
       reject(ip, port, id, SectorError::E_UNKNOWN);
       return -1;
@@ -2295,18 +2415,56 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
       vector<string> filelist;
       m_pMetadata->list_r(src.c_str(), filelist);
 
-      m_ReplicaLock.acquire();
+      // a directory tree is split into batches limited in size and number of files; each batch is placed
+      // on its own slave, which copies the files in parallel, so that a large tree is spread over many slaves
+      vector<ReplicaJob> jobs;
+      ReplicaJob batch;
       for (vector<string>::iterator i = filelist.begin(); i != filelist.end(); ++ i)
       {
-         string target = *i;
-         target.replace(0, rep.length(), dst);
-         ReplicaJob job;
-         job.m_strSource = *i;
-         job.m_strDest = target;
-         // cp has a higher priority than regular replication.
-         job.m_iPriority = COPY;
-         m_ReplicaMgmt.insert(job);
+         if (!as.m_bIsDir)
+         {
+            string target = *i;
+            target.replace(0, rep.length(), dst);
+            ReplicaJob job;
+            job.m_strSource = *i;
+            job.m_strDest = target;
+            // cp has a higher priority than regular replication.
+            job.m_iPriority = COPY;
+            jobs.push_back(job);
+            continue;
+         }
+
+         // empty and .nosplit directories are listed as a whole
+         SNode s;
+         if (m_pMetadata->lookup(i->c_str(), s) < 0)
+            continue;
+
+         if (!batch.m_vstrBatch.empty()
+             && ((int(batch.m_vstrBatch.size()) >= m_iCopyBatchFiles) || (batch.m_llSize + s.m_llSize > m_llCopyBatchSize)))
+         {
+            jobs.push_back(batch);
+            batch.m_vstrBatch.clear();
+         }
+
+         if (batch.m_vstrBatch.empty())
+         {
+            string target = src;
+            target.replace(0, rep.length(), dst);
+            batch.m_strSource = src;
+            batch.m_strDest = target;
+            batch.m_iPriority = COPY;
+            batch.m_llSize = 0;
+         }
+
+         batch.m_vstrBatch.push_back(i->substr(src.length()) + (s.m_bIsDir ? "/" : ""));
+         batch.m_llSize += s.m_llSize;
       }
+      if (!batch.m_vstrBatch.empty())
+         jobs.push_back(batch);
+
+      m_ReplicaLock.acquire();
+      for (vector<ReplicaJob>::iterator i = jobs.begin(); i != jobs.end(); ++ i)
+         m_ReplicaMgmt.insert(*i);
       logUserActivity(user, "copy", (src + "->" + dst).c_str(), 0, NULL, LogLevel::LEVEL_9);
       m_ReplicaCond.signal();
       m_ReplicaLock.release();
@@ -2378,6 +2536,11 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
       string path = Metadata::revisePath(msg->getData() + 12);
       int32_t opt_len = *(int32_t*)(msg->getData() + 12 + name_len);
 
+      // ciphers the client can use for a secure transfer, older clients do not send them
+      int32_t ciphers = 1 << CipherType::BLOWFISH;
+      if (msg->m_iDataLength >= SectorMsg::m_iHdrSize + 16 + name_len + opt_len + 4)
+         ciphers = *(int32_t*)(msg->getData() + 16 + name_len + opt_len);
+
       string str_ip = user->m_strIP;
       uint64_t key = user->m_iKey;
 
@@ -2420,6 +2583,15 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
             break;
          }
 
+         // an erasure coded file is read only; it can only be removed and written again
+         SNode ec;
+         if (m_pMetadata->lookup(ECShard::shardDir(path), ec) >= 0)
+         {
+            logUserActivity(user, "open file", path.c_str(), SectorError::E_PERMISSION, NULL, LogLevel::LEVEL_8);
+            reject(ip, port, id, SectorError::E_PERMISSION);
+            break;
+         }
+
          // otherwise, create a new file for write
          // choose a slave node for the new file
          set<Address, AddrComp> candidates;
@@ -2504,33 +2676,63 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
       msg->setData(148, (char*)user->m_pcKey, 16);
       msg->setData(164, (char*)user->m_pcIV, 8);
       msg->setData(172, path.c_str(), path.length() + 1);
+      msg->setData(172 + path.length() + 1, (char*)&ciphers, 4);
+      msg->m_iDataLength = SectorMsg::m_iHdrSize + 172 + path.length() + 1 + 4;
 
-      //TODO: optimize with multi_rpc
+      // send the open request to all replica nodes at once and wait for them together
+      vector<Address> dest;
+      vector<SectorMsg> response(addr.size());
+      vector<CUserMessage*> res;
       for (vector<SlaveNode>::iterator i = addr.begin(); i != addr.end(); ++ i)
       {
-         SectorMsg response;
-         if (m_GMP.rpc(i->m_strIP.c_str(), i->m_iPort, msg, &response) >= 0)
-         {
-            if (response.getType() > 0)
-            {
-               m_TransManager.addSlave(transid, i->m_iNodeID);
-               m_SlaveManager.incActTrans(i->m_iNodeID);
-            }
-            else
-            {
-               //TODO: roll back 
-               m_SectorLog << LogStart(LogLevel::LEVEL_1) << "TID " << transid << " UID " << user->m_iKey << " " <<
-                   user->m_strIP << " open PATH " << path << " failed response from slave " <<
-                   i->m_strIP << ":" << i->m_iPort << LogEnd();
-            }
-         }
-         else 
+         Address a;
+         a.m_strIP = i->m_strIP;
+         a.m_iPort = i->m_iPort;
+         dest.push_back(a);
+         res.push_back(&response[res.size()]);
+      }
+      m_GMP.multi_rpc(dest, msg, &res);
+
+      vector<SlaveNode> opened;
+      vector<int32_t> accepted;
+      for (unsigned int i = 0; i < addr.size(); ++ i)
+      {
+         if ((response[i].m_iDataLength > 0) && (response[i].getType() > 0))
          {
-            //TODO: remove this slave
-            m_SectorLog << LogStart(LogLevel::LEVEL_1) << "TID " << transid << " UID " << user->m_iKey << " " <<
-               user->m_strIP << " open PATH " << path << " failed communication with slave " <<
-               i->m_strIP << ":" << i->m_iPort << LogEnd();
+            m_TransManager.addSlave(transid, addr[i].m_iNodeID);
+            m_SlaveManager.incActTrans(addr[i].m_iNodeID);
+            opened.push_back(addr[i]);
+
+            // the cipher chosen by the slave; older slaves only use Blowfish
+            int32_t cipher = CipherType::BLOWFISH;
+            if (response[i].m_iDataLength >= SectorMsg::m_iHdrSize + 4)
+               cipher = *(int32_t*)response[i].getData();
+            accepted.push_back(cipher);
+            continue;
          }
+
+         m_SectorLog << LogStart(LogLevel::LEVEL_1) << "TID " << transid << " UID " << user->m_iKey << " " <<
+            user->m_strIP << " open PATH " << path << ((response[i].m_iDataLength > 0) ? " failed response from slave " : " failed communication with slave ") <<
+            addr[i].m_strIP << ":" << addr[i].m_iPort << LogEnd();
+
+         // roll back: a new file must not keep a location that was never created;
+         // the delete request to the slave is sent asynchronously
+         if (r < 0)
+            removeReplica(path, dest[i]);
+      }
+      addr.swap(opened);
+
+      if (addr.empty())
+      {
+         // no replica node accepted the request, release the transaction and the file lock
+         m_TransManager.updateSlave(transid, -1);
+         m_pMetadata->unlock(path.c_str(), key, rwx);
+         if (r < 0)
+            m_pMetadata->remove(path.c_str());
+
+         logUserActivity(user, "open file", path.c_str(), SectorError::E_RESOURCE, NULL, LogLevel::LEVEL_8);
+         reject(ip, port, id, SectorError::E_RESOURCE);
+         break;
       }
 
       // send the connection information back to the client
@@ -2548,6 +2750,13 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
          msg->setData(offset + 64, (char*)&i->m_iDataPort, 4);
          offset += 68;
       }
+
+      // followed by the cipher of each replica node
+      for (vector<int32_t>::iterator i = accepted.begin(); i != accepted.end(); ++ i)
+      {
+         msg->setData(offset, (char*)&*i, 4);
+         offset += 4;
+      }
       msg->m_iDataLength = SectorMsg::m_iHdrSize + offset;
 
 
@@ -2562,6 +2771,9 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
    {
       int32_t transid = *(int32_t*)msg->getData();
       int32_t dataport = *(int32_t*)(msg->getData() + 4);
+      int32_t ciphers = 1 << CipherType::BLOWFISH;
+      if (msg->m_iDataLength >= SectorMsg::m_iHdrSize + 12)
+         ciphers = *(int32_t*)(msg->getData() + 8);
 
       Transaction t;
       if ((m_TransManager.retrieve(transid, t) < 0) || (key != t.m_iUserKey))
@@ -2613,12 +2825,15 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
       msg->setData(148, (char*)user->m_pcKey, 16);
       msg->setData(164, (char*)user->m_pcIV, 8);
       msg->setData(172, t.m_strFile.c_str(), t.m_strFile.length() + 1);
+      msg->setData(172 + t.m_strFile.length() + 1, (char*)&ciphers, 4);
+      msg->m_iDataLength = SectorMsg::m_iHdrSize + 172 + t.m_strFile.length() + 1 + 4;
 
       SectorMsg response;
       if ((m_GMP.rpc(addr.begin()->m_strIP.c_str(), addr.begin()->m_iPort, msg, &response) < 0) || (response.getType() < 0))
       {
          logUserActivity(user, "re-open", t.m_strFile.c_str(), SectorError::E_RESOURCE, NULL, LogLevel::LEVEL_8);
          reject(ip, port, id, SectorError::E_RESOURCE);
+         break;
       }
 
       m_TransManager.addSlave(transid, addr.begin()->m_iNodeID);
@@ -2628,7 +2843,11 @@ int Master::processFSCmd(const string& ip, const int port,  const User* user, co
       msg->setType(112);
       msg->setData(0, addr.begin()->m_strIP.c_str(), addr.begin()->m_strIP.length() + 1);
       msg->setData(64, (char*)&(addr.begin()->m_iDataPort), 4);
-      msg->m_iDataLength = SectorMsg::m_iHdrSize + 68;
+      int32_t cipher = CipherType::BLOWFISH;
+      if (response.m_iDataLength >= SectorMsg::m_iHdrSize + 4)
+         cipher = *(int32_t*)response.getData();
+      msg->setData(68, (char*)&cipher, 4);
+      msg->m_iDataLength = SectorMsg::m_iHdrSize + 72;
 
       logUserActivity(user, "re-open", t.m_strFile.c_str(), SectorError::E_RESOURCE, addr.begin()->m_strIP.c_str(), LogLevel::LEVEL_9);
       m_GMP.sendto(ip, port, id, msg);
@@ -2717,9 +2936,10 @@ int Master::processDCCmd(const string& ip, const int port,  const User* user, co
       int c = 0;
       for (vector<SlaveNode>::iterator i = sl.begin(); i != sl.end(); ++ i)
       {
-         msg->setData(c * 72, i->m_strIP.c_str(), i->m_strIP.length() + 1);
-         msg->setData(c * 72 + 64, (char*)&(i->m_iPort), 4);
-         msg->setData(c * 72 + 68, (char*)&(i->m_iDataPort), 4);
+         msg->setData(c * 76, i->m_strIP.c_str(), i->m_strIP.length() + 1);
+         msg->setData(c * 76 + 64, (char*)&(i->m_iPort), 4);
+         msg->setData(c * 76 + 68, (char*)&(i->m_iDataPort), 4);
+         msg->setData(c * 76 + 72, (char*)&(i->m_iCapability), 4);
          c ++;
       }
 
@@ -2815,6 +3035,83 @@ int Master::processDCCmd(const string& ip, const int port,  const User* user, co
       break;
    }
 
+   case 205: // cancel a data segment on an SPE
+   {
+      Address addr;
+      addr.m_strIP = msg->getData();
+      addr.m_iPort = *(int32_t*)(msg->getData() + 64);
+      int transid = *(int32_t*)(msg->getData() + 68);
+
+      // only the client that started the SPE can cancel its work
+      Transaction t;
+      if (!user->m_bExec || (m_TransManager.retrieve(transid, t) < 0) || (t.m_iUserKey != key))
+      {
+         logUserActivity(user, "cancel SPE", NULL, SectorError::E_PERMISSION, NULL, LogLevel::LEVEL_8);
+         reject(ip, port, id, SectorError::E_PERMISSION);
+         break;
+      }
+
+      if ((m_GMP.rpc(addr.m_strIP.c_str(), addr.m_iPort, msg, msg) < 0) || (msg->getType() < 0))
+      {
+         logUserActivity(user, "cancel SPE", NULL, SectorError::E_RESOURCE, NULL, LogLevel::LEVEL_8);
+         reject(ip, port, id, SectorError::E_RESOURCE);
+         break;
+      }
+
+      msg->m_iDataLength = SectorMsg::m_iHdrSize;
+      logUserActivity(user, "cancel SPE", NULL, 0, addr.m_strIP.c_str(), LogLevel::LEVEL_9);
+      m_GMP.sendto(ip, port, id, msg);
+
+      break;
+   }
+
+   case 206: // send a cached UDF library from one slave to another
+   {
+      Address addr;
+      addr.m_strIP = msg->getData();
+      addr.m_iPort = *(int32_t*)(msg->getData() + 64);
+      int transid = *(int32_t*)(msg->getData() + 68);
+
+      // the library can only be sent to an SPE or shuffler started by the same client
+      Transaction t;
+      bool valid = user->m_bExec && (msg->m_iDataLength - SectorMsg::m_iHdrSize > 140) &&
+                   (m_TransManager.retrieve(transid, t) >= 0) && (t.m_iUserKey == key) && (m_SlaveManager.getSlaveID(addr) >= 0);
+
+      // and only to the data port of a slave in that transaction
+      bool dst_valid = false;
+      if (valid)
+      {
+         string dst_ip(msg->getData() + 72, strnlen(msg->getData() + 72, 64));
+         int dst_port = *(int32_t*)(msg->getData() + 136);
+         for (set<int>::iterator i = t.m_siSlaveID.begin(); !dst_valid && (i != t.m_siSlaveID.end()); ++ i)
+         {
+            Address dst;
+            if (m_SlaveManager.getSlaveDataAddr(*i, dst) >= 0)
+               dst_valid = (dst.m_strIP == dst_ip) && (dst.m_iPort == dst_port);
+         }
+      }
+
+      if (!dst_valid)
+      {
+         logUserActivity(user, "send library", NULL, SectorError::E_PERMISSION, NULL, LogLevel::LEVEL_8);
+         reject(ip, port, id, SectorError::E_PERMISSION);
+         break;
+      }
+
+      if ((m_GMP.rpc(addr.m_strIP.c_str(), addr.m_iPort, msg, msg) < 0) || (msg->getType() < 0))
+      {
+         logUserActivity(user, "send library", NULL, SectorError::E_RESOURCE, NULL, LogLevel::LEVEL_8);
+         reject(ip, port, id, SectorError::E_RESOURCE);
+         break;
+      }
+
+      msg->m_iDataLength = SectorMsg::m_iHdrSize;
+      logUserActivity(user, "send library", NULL, 0, addr.m_strIP.c_str(), LogLevel::LEVEL_9);
+      m_GMP.sendto(ip, port, id, msg);
+
+      break;
+   }
+
    default:
       logUserActivity(user, "unknown", NULL, SectorError::E_UNKNOWN, NULL, LogLevel::LEVEL_7);
       reject(ip, port, id, SectorError::E_UNKNOWN);
@@ -2960,96 +3257,520 @@ int Master::processDebugCmd(const string& ip, const int port,  const User* /*use
 
 int Master::sync(const char* fileinfo, const int& size, const int& type)
 {
-   SectorMsg msg;
-   msg.setKey(0);
-   msg.setType(type);
-   msg.setData(0, fileinfo, size);
+   // file changes are logged here and streamed to all other masters in batches by syncHandler,
+   // so that the client request does not wait for other masters
 
-   // send file changes to all other masters
-   map<uint32_t, Address> al;
-   m_Routing.getListOfMasters(al);
-   for (map<uint32_t, Address>::iterator i = al.begin(); i != al.end(); ++ i)
-   {
-      if (i->first == m_iRouterKey)
-         continue;
+   if (m_Routing.getNumOfMasters() <= 1)
+      return 0;
 
-      m_GMP.rpc(i->second.m_strIP.c_str(), i->second.m_iPort, &msg, &msg);
-   }
+   SyncRecord rec;
+   rec.m_iType = type;
+   rec.m_strData.assign(fileinfo, size);
+   rec.m_llTimeStamp = CTimer::getTime();
+
+   CGuardEx sg(m_SyncLock);
+   rec.m_llSeq = ++ m_llSyncSeq;
+   m_qSyncLog.push_back(rec);
+   m_SyncCond.signal();
 
    return 0;
 }
 
-int Master::processSyncCmd(const string& ip, const int port,  const User* /*user*/, const int32_t /*key*/, int id, SectorMsg* msg)
+#ifndef WIN32
+   void* Master::syncHandler(void* s)
+#else
+   DWORD WINAPI Master::syncHandler(void* s)
+#endif
 {
-   switch (msg->getType())
-   {
-   case 1100: // file change
+   Master* self = (Master*)s;
+
+   // sequence numbers restart when this master restarts; the start time tells other masters to reset
+   int64_t epoch = CTimer::getTime();
+   bool failed = false;
+
+   while (self->m_Status == RUNNING)
    {
-      int change = *(int32_t*)msg->getData();
-      Address addr;
-      addr.m_strIP = msg->getData() + 4;
-      addr.m_iPort = *(int32_t*)(msg->getData() + 68);
+      self->m_SyncLock.acquire();
+      if (self->m_qSyncLog.empty() || failed)
+         self->m_SyncCond.wait(self->m_SyncLock, 1000);
+      self->m_SyncLock.release();
 
-      int num = *(int32_t*)(msg->getData() + 72);
-      int pos = 76;
-      for (int i = 0; i < num; ++ i)
-      {
-         int size = *(int32_t*)(msg->getData() + pos);
-         string fileinfo = msg->getData() + pos + 4;
-         pos += size + 4;
+      map<uint32_t, Address> al;
+      self->m_Routing.getListOfMasters(al);
+      al.erase(self->m_iRouterKey);
 
-         // restore file information
-         SNode sn;
-         sn.deserialize(fileinfo.c_str());
-         sn.m_sLocation.insert(addr);
+      // prepare one batch of unacknowledged changes for each other master
+      vector<uint32_t> peers;
+      vector<Address> dest;
+      vector<SectorMsg> batch(al.size());
+      vector<int64_t> last;
+      vector<uint32_t> resync;
 
-         if (change == FileChangeType::FILE_UPDATE_WRITE)
+      self->m_SyncLock.acquire();
+
+      for (map<uint32_t, int64_t>::iterator i = self->m_mSyncAck.begin(); i != self->m_mSyncAck.end();)
+      {
+         // forget masters that have left
+         map<uint32_t, int64_t>::iterator tmp = i ++;
+         if (al.find(tmp->first) == al.end())
+            self->m_mSyncAck.erase(tmp);
+      }
+
+      for (map<uint32_t, Address>::iterator m = al.begin(); m != al.end(); ++ m)
+      {
+         map<uint32_t, int64_t>::iterator ack = self->m_mSyncAck.find(m->first);
+         if (ack == self->m_mSyncAck.end())
          {
-            m_pMetadata->update(sn.m_strName, sn.m_llTimeStamp, sn.m_llSize);
+            // a new master receives every change still in the log
+            int64_t start = self->m_qSyncLog.empty() ? self->m_llSyncSeq : self->m_qSyncLog.front().m_llSeq - 1;
+            ack = self->m_mSyncAck.insert(make_pair(m->first, start)).first;
          }
-         else if (change == FileChangeType::FILE_UPDATE_NEW)
+
+         if (ack->second >= self->m_llSyncSeq)
+            continue;
+
+         // the changes the master has not applied are no longer in the log
+         if (self->m_qSyncLog.empty() || (ack->second + 1 < self->m_qSyncLog.front().m_llSeq))
          {
-             m_pMetadata->create(sn);
+            resync.push_back(m->first);
+            continue;
          }
-         else if (change == FileChangeType::FILE_UPDATE_REPLICA)
+
+         SectorMsg& msg = batch[peers.size()];
+         msg.setKey(0);
+         msg.setType(1108);
+         int32_t num = 0;
+         int64_t first = ack->second + 1;
+         int offset = 24;
+         for (deque<SyncRecord>::iterator r = self->m_qSyncLog.begin() + (first - self->m_qSyncLog.front().m_llSeq);
+              (r != self->m_qSyncLog.end()) && (num < m_iMaxSyncBatch); ++ r, ++ num)
          {
-            m_pMetadata->addReplica(sn.m_strName, sn.m_llTimeStamp, sn.m_llSize, addr);
-            m_ReplicaLock.acquire();
-            m_sstrOnReplicate.erase(sn.m_strName);
-            m_ReplicaLock.release();
+            int32_t size = r->m_strData.length();
+            msg.setData(offset, (char*)&r->m_iType, 4);
+            msg.setData(offset + 4, (char*)&size, 4);
+            msg.setData(offset + 8, r->m_strData.c_str(), size);
+            offset += 8 + size;
          }
-         else if (change == FileChangeType::FILE_UPDATE_REPLICA_FAILED)
+         msg.setData(0, (char*)&self->m_iRouterKey, 4);
+         msg.setData(4, (char*)&epoch, 8);
+         msg.setData(12, (char*)&first, 8);
+         msg.setData(20, (char*)&num, 4);
+
+         peers.push_back(m->first);
+         dest.push_back(m->second);
+         last.push_back(first + num - 1);
+      }
+
+      self->m_SyncLock.release();
+
+      failed = false;
+      for (vector<uint32_t>::iterator i = resync.begin(); i != resync.end(); ++ i)
+      {
+         int64_t seq = 0;
+         if (self->resyncMaster(*i, al[*i], epoch, seq) < 0)
          {
-            m_ReplicaLock.acquire();
-            m_sstrOnReplicate.erase(sn.m_strName);
-            m_ReplicaLock.release();
+            failed = true;
+            continue;
          }
+
+         self->m_SyncLock.acquire();
+         map<uint32_t, int64_t>::iterator ack = self->m_mSyncAck.find(*i);
+         if (ack != self->m_mSyncAck.end())
+            ack->second = seq;
+         self->m_SyncLock.release();
       }
 
-      msg->m_iDataLength = SectorMsg::m_iHdrSize + 4;
-      m_GMP.sendto(ip, port, id, msg);
-      break;
-   }
+      if (!peers.empty())
+      {
+         vector<CUserMessage*> req;
+         for (unsigned int i = 0; i < peers.size(); ++ i)
+            req.push_back(&batch[i]);
+         self->m_GMP.multi_rpc(dest, req, &req);
 
-   case 1103: // mkdir
-   {
-      SNode sn;
-      sn.m_strName = msg->getData();
-      sn.m_bIsDir = true;
-      m_pMetadata->create(sn);
+         self->m_SyncLock.acquire();
+         for (unsigned int i = 0; i < peers.size(); ++ i)
+         {
+            if ((batch[i].m_iDataLength < SectorMsg::m_iHdrSize + 8) || (batch[i].getType() < 0))
+            {
+               failed = true;
+               continue;
+            }
 
-      msg->m_iDataLength = SectorMsg::m_iHdrSize + 4;
-      m_GMP.sendto(ip, port, id, msg);
-      break;
-   }
+            int64_t acked = *(int64_t*)batch[i].getData();
+            if (acked > last[i])
+               acked = last[i];
+            map<uint32_t, int64_t>::iterator ack = self->m_mSyncAck.find(peers[i]);
+            if (ack == self->m_mSyncAck.end())
+               continue;
 
-   case 1104: // mv
-   {
-      int rt = *(int32_t*)msg->getData();
-      string src = msg->getData() + 4;
+            if (acked > ack->second)
+            {
+               ack->second = acked;
+               continue;
+            }
 
-      if (rt < 0)
-      {
+            // no progress: the master has a gap before this batch, e.g., after it left and rejoined;
+            // wait a while, then resend from the last change it applied, or resync if that has been trimmed
+            failed = true;
+            if (acked < ack->second)
+               ack->second = acked;
+         }
+         self->m_SyncLock.release();
+
+         if (failed)
+            self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "Metadata sync to other masters failed, will retry." << LogEnd();
+      }
+
+      // remove changes that have been acknowledged by all masters
+      self->m_SyncLock.acquire();
+      int64_t min_ack = self->m_llSyncSeq;
+      for (map<uint32_t, int64_t>::iterator i = self->m_mSyncAck.begin(); i != self->m_mSyncAck.end(); ++ i)
+      {
+         if (i->second < min_ack)
+            min_ack = i->second;
+      }
+      while (!self->m_qSyncLog.empty() && (self->m_qSyncLog.front().m_llSeq <= min_ack))
+         self->m_qSyncLog.pop_front();
+      self->m_SyncLock.release();
+   }
+
+   return NULL;
+}
+
+int Master::resyncMaster(const uint32_t& key, const Address& addr, const int64_t& epoch, int64_t& seq)
+{
+   char peer[32];
+   sprintf(peer, "%u", key);
+   string metafile = m_strHomeDir + ".tmp/master_resync_" + peer + ".dat";
+
+   // a snapshot left by a failed resync is resumed, unless the changes after it have been trimmed from the log
+   map<uint32_t, ResyncState>::iterator r = m_mResyncOut.find(key);
+   if (r != m_mResyncOut.end())
+   {
+      CGuardEx sg(m_SyncLock);
+      if ((r->second.m_llEpoch != epoch) || ((m_llSyncSeq > r->second.m_llSeq)
+          && (m_qSyncLog.empty() || (m_qSyncLog.front().m_llSeq > r->second.m_llSeq + 1))))
+      {
+         m_mResyncOut.erase(r);
+         r = m_mResyncOut.end();
+      }
+   }
+
+   if (r == m_mResyncOut.end())
+   {
+      // changes logged from here on are sent again after the snapshot; applying them twice is harmless
+      ResyncState st;
+      st.m_llEpoch = epoch;
+      m_SyncLock.acquire();
+      st.m_llSeq = m_llSyncSeq;
+      m_SyncLock.release();
+
+      m_pMetadata->serialize("/", metafile);
+
+      SNode s;
+      if (LocalFS::stat(metafile, s) < 0)
+         return -1;
+      st.m_llSize = s.m_llSize;
+      st.m_llDone = 0;
+
+      r = m_mResyncOut.insert(make_pair(key, st)).first;
+   }
+
+   ResyncState& st = r->second;
+
+   ifstream ifs(metafile.c_str(), ios::in | ios::binary);
+   if (ifs.fail())
+   {
+      m_mResyncOut.erase(r);
+      return -1;
+   }
+
+   m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Metadata sync: sending full metadata to " << addr.m_strIP << ":" << addr.m_iPort << " from " << st.m_llDone << " of " << st.m_llSize << " bytes" << LogEnd();
+
+   // each chunk is acknowledged with the number of bytes the other master has, which is where the next chunk starts
+   vector<char> buf(m_iResyncChunk);
+   do
+   {
+      int len = (st.m_llSize - st.m_llDone < m_iResyncChunk) ? int(st.m_llSize - st.m_llDone) : m_iResyncChunk;
+      ifs.seekg(st.m_llDone);
+      ifs.read(&buf[0], len);
+
+      SectorMsg msg;
+      msg.setKey(0);
+      msg.setType(1109);
+      msg.setData(0, (char*)&m_iRouterKey, 4);
+      msg.setData(4, (char*)&epoch, 8);
+      msg.setData(12, (char*)&st.m_llSeq, 8);
+      msg.setData(20, (char*)&st.m_llDone, 8);
+      msg.setData(28, (char*)&st.m_llSize, 8);
+      msg.setData(36, &buf[0], len);
+
+      if ((m_GMP.rpc(addr.m_strIP.c_str(), addr.m_iPort, &msg, &msg) < 0) || (msg.getType() < 0) || (msg.m_iDataLength < SectorMsg::m_iHdrSize + 8))
+         return -1;
+
+      int64_t received = *(int64_t*)msg.getData();
+      if ((received < 0) || (received > st.m_llSize))
+         received = 0;
+      st.m_llDone = received;
+   } while (st.m_llDone < st.m_llSize);
+
+   ifs.close();
+
+   seq = st.m_llSeq;
+   m_mResyncOut.erase(r);
+   LocalFS::erase(metafile);
+
+   return 0;
+}
+
+int Master::getSyncLag(int64_t& records, int64_t& usecs)
+{
+   CGuardEx sg(m_SyncLock);
+
+   records = 0;
+   usecs = 0;
+
+   for (map<uint32_t, int64_t>::iterator i = m_mSyncAck.begin(); i != m_mSyncAck.end(); ++ i)
+   {
+      if (m_llSyncSeq - i->second > records)
+         records = m_llSyncSeq - i->second;
+   }
+
+   if (!m_qSyncLog.empty())
+      usecs = CTimer::getTime() - m_qSyncLog.front().m_llTimeStamp;
+
+   return m_qSyncLog.size();
+}
+
+int Master::processSyncCmd(const string& ip, const int port,  const User* /*user*/, const int32_t /*key*/, int id, SectorMsg* msg)
+{
+   switch (msg->getType())
+   {
+   case 1100: // file change
+   case 1103: // mkdir
+   case 1104: // mv
+   case 1105: // delete
+   case 1107: // utime
+   {
+      applySyncCmd(msg);
+
+      msg->m_iDataLength = SectorMsg::m_iHdrSize + 4;
+      m_GMP.sendto(ip, port, id, msg);
+      break;
+   }
+
+   case 1108: // batch of changes from syncHandler
+   {
+      uint32_t src = *(uint32_t*)msg->getData();
+      int64_t epoch = *(int64_t*)(msg->getData() + 4);
+      int64_t first = *(int64_t*)(msg->getData() + 12);
+      int32_t num = *(int32_t*)(msg->getData() + 20);
+
+      // changes are applied in order; those already applied (retransmitted batches) are skipped
+      m_SyncApplyLock.acquire();
+      pair<int64_t, int64_t>& applied = m_mSyncApplied[src];
+      if (applied.first != epoch)
+      {
+         applied.first = epoch;
+         applied.second = first - 1;
+      }
+
+      int offset = 24;
+      for (int i = 0; i < num; ++ i)
+      {
+         int32_t type = *(int32_t*)(msg->getData() + offset);
+         int32_t size = *(int32_t*)(msg->getData() + offset + 4);
+
+         if (first + i == applied.second + 1)
+         {
+            SectorMsg change;
+            change.setKey(0);
+            change.setType(type);
+            change.setData(0, msg->getData() + offset + 8, size);
+            applySyncCmd(&change);
+            ++ applied.second;
+         }
+
+         offset += 8 + size;
+      }
+
+      int64_t acked = applied.second;
+      m_SyncApplyLock.release();
+
+      msg->setData(0, (char*)&acked, 8);
+      msg->m_iDataLength = SectorMsg::m_iHdrSize + 8;
+      m_GMP.sendto(ip, port, id, msg);
+      break;
+   }
+
+   case 1109: // full metadata from another master, sent in chunks when the changes this master missed were trimmed from its log
+   {
+      if (msg->m_iDataLength < SectorMsg::m_iHdrSize + 36)
+      {
+         reject(ip, port, id, SectorError::E_INVALID);
+         break;
+      }
+
+      uint32_t src = *(uint32_t*)msg->getData();
+      int64_t epoch = *(int64_t*)(msg->getData() + 4);
+      int64_t seq = *(int64_t*)(msg->getData() + 12);
+      int64_t offset = *(int64_t*)(msg->getData() + 20);
+      int64_t total = *(int64_t*)(msg->getData() + 28);
+      int size = msg->m_iDataLength - SectorMsg::m_iHdrSize - 36;
+
+      char peer[32];
+      sprintf(peer, "%u", src);
+      string metafile = m_strHomeDir + ".tmp/master_resync_recv_" + peer + ".dat";
+
+      m_SyncApplyLock.acquire();
+
+      // a snapshot starts at offset 0; a chunk of another snapshot, or out of order, is answered with the bytes received
+      map<uint32_t, ResyncState>::iterator r = m_mResyncIn.find(src);
+      if (0 == offset)
+      {
+         ResyncState st;
+         st.m_llEpoch = epoch;
+         st.m_llSeq = seq;
+         st.m_llSize = total;
+         st.m_llDone = 0;
+         m_mResyncIn[src] = st;
+         r = m_mResyncIn.find(src);
+         fstream ofs(metafile.c_str(), ios::out | ios::trunc | ios::binary);
+         ofs.close();
+      }
+
+      int64_t received = 0;
+      if ((r != m_mResyncIn.end()) && (r->second.m_llEpoch == epoch) && (r->second.m_llSeq == seq) && (r->second.m_llSize == total))
+      {
+         if ((offset == r->second.m_llDone) && (offset + size <= total))
+         {
+            fstream ofs(metafile.c_str(), ios::out | ios::app | ios::binary);
+            ofs.write(msg->getData() + 36, size);
+            ofs.close();
+            if (!ofs.fail())
+               r->second.m_llDone += size;
+         }
+         received = r->second.m_llDone;
+      }
+
+      if ((r != m_mResyncIn.end()) && (received == total) && (r->second.m_llDone == total))
+      {
+         // the snapshot replaces the local metadata, the changes after it follow in the normal batches
+         m_pMetadata->clear();
+         m_pMetadata->deserialize("/", metafile, NULL);
+
+         // the local changes the other master has not acknowledged are not in the snapshot, apply them again
+         vector<SyncRecord> local;
+         m_SyncLock.acquire();
+         map<uint32_t, int64_t>::iterator ack = m_mSyncAck.find(src);
+         for (deque<SyncRecord>::iterator i = m_qSyncLog.begin(); i != m_qSyncLog.end(); ++ i)
+         {
+            if ((ack == m_mSyncAck.end()) || (i->m_llSeq > ack->second))
+               local.push_back(*i);
+         }
+         m_SyncLock.release();
+
+         for (vector<SyncRecord>::iterator i = local.begin(); i != local.end(); ++ i)
+         {
+            SectorMsg change;
+            change.setKey(0);
+            change.setType(i->m_iType);
+            change.setData(0, i->m_strData.c_str(), i->m_strData.length());
+            applySyncCmd(&change);
+         }
+
+         pair<int64_t, int64_t>& applied = m_mSyncApplied[src];
+         applied.first = epoch;
+         applied.second = seq;
+         m_mResyncIn.erase(r);
+         LocalFS::erase(metafile);
+
+         m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Metadata sync: full metadata received from " << ip << ":" << port << ", " << local.size() << " local changes applied again" << LogEnd();
+      }
+
+      m_SyncApplyLock.release();
+
+      msg->setData(0, (char*)&received, 8);
+      msg->m_iDataLength = SectorMsg::m_iHdrSize + 8;
+      m_GMP.sendto(ip, port, id, msg);
+      break;
+   }
+
+   default:
+      reject(ip, port, id, SectorError::E_UNKNOWN);
+      return -1;
+   }
+
+   return 0;
+}
+
+int Master::applySyncCmd(SectorMsg* msg)
+{
+   switch (msg->getType())
+   {
+   case 1100: // file change
+   {
+      int change = *(int32_t*)msg->getData();
+      Address addr;
+      addr.m_strIP = msg->getData() + 4;
+      addr.m_iPort = *(int32_t*)(msg->getData() + 68);
+
+      int num = *(int32_t*)(msg->getData() + 72);
+      int pos = 76;
+      for (int i = 0; i < num; ++ i)
+      {
+         int size = *(int32_t*)(msg->getData() + pos);
+         string fileinfo = msg->getData() + pos + 4;
+         pos += size + 4;
+
+         // restore file information
+         SNode sn;
+         sn.deserialize(fileinfo.c_str());
+         sn.m_sLocation.insert(addr);
+
+         if (change == FileChangeType::FILE_UPDATE_WRITE)
+         {
+            m_pMetadata->update(sn.m_strName, sn.m_llTimeStamp, sn.m_llSize);
+         }
+         else if (change == FileChangeType::FILE_UPDATE_NEW)
+         {
+             m_pMetadata->create(sn);
+         }
+         else if (change == FileChangeType::FILE_UPDATE_REPLICA)
+         {
+            m_pMetadata->addReplica(sn.m_strName, sn.m_llTimeStamp, sn.m_llSize, addr);
+            m_ReplicaLock.acquire();
+            m_sstrOnReplicate.erase(sn.m_strName);
+            m_ReplicaLock.release();
+         }
+         else if (change == FileChangeType::FILE_UPDATE_REPLICA_FAILED)
+         {
+            m_ReplicaLock.acquire();
+            m_sstrOnReplicate.erase(sn.m_strName);
+            m_ReplicaLock.release();
+         }
+      }
+
+      break;
+   }
+
+   case 1103: // mkdir
+   {
+      SNode sn;
+      sn.m_strName = msg->getData();
+      sn.m_bIsDir = true;
+      m_pMetadata->create(sn);
+
+      break;
+   }
+
+   case 1104: // mv
+   {
+      int rt = *(int32_t*)msg->getData();
+      string src = msg->getData() + 4;
+
+      if (rt < 0)
+      {
          string uplevel = msg->getData() + 4 + src.length() + 1;
          string newname = msg->getData() + 4 + src.length() + 1 + uplevel.length() + 1;
          m_pMetadata->move(src.c_str(), uplevel.c_str(), newname.c_str());
@@ -3060,8 +3781,6 @@ int Master::processSyncCmd(const string& ip, const int port,  const User* /*user
          m_pMetadata->move(src.c_str(), dst.c_str());
       }
 
-      msg->m_iDataLength = SectorMsg::m_iHdrSize + 4;
-      m_GMP.sendto(ip, port, id, msg);
       break;
    }
 
@@ -3069,21 +3788,16 @@ int Master::processSyncCmd(const string& ip, const int port,  const User* /*user
    {
       m_pMetadata->remove(msg->getData(), true);
 
-      msg->m_iDataLength = SectorMsg::m_iHdrSize + 4;
-      m_GMP.sendto(ip, port, id, msg);
       break;
    }
 
    case 1107: // utime
    {
       m_pMetadata->update(msg->getData() + 8, *(int64_t*)msg->getData());
-      msg->m_iDataLength = SectorMsg::m_iHdrSize + 4;
-      m_GMP.sendto(ip, port, id, msg);
       break;
    }
 
    default:
-      reject(ip, port, id, SectorError::E_UNKNOWN);
       return -1;
    }
 
@@ -3186,6 +3900,9 @@ void Master::reject(const string& ip, const int port, int id, int32_t code)
                  ReplicaJob job;
                  job.m_strSource = job.m_strDest = *i;
                  job.m_iPriority = BACKGROUND;
+                 SNode attr;
+                 if (self->m_pMetadata->lookup(*i, attr) >= 0)
+                    job.m_llSize = attr.m_llSize;
                  self->m_ReplicaMgmt.insert(job);
               }
               self->m_ReplicaLock.release();
@@ -3293,10 +4010,16 @@ void Master::reject(const string& ip, const int port, int id, int32_t code)
               }
               self->m_ReplicaLock.release();
            }
+
+           // convert cold files to erasure coded shards, and rebuild the shards lost with failed slaves
+           if (!ReplicaConfig::getCached().m_mErasureCode.empty())
+              self->checkErasureCode(maxTran);
         }
       }
         // start any replication jobs in queue
         self->m_ReplicaLock.acquire();
+      self->m_Recovery.setBudget(ReplicaConfig::getCached().m_iReplicationNodeMaxTrans, int64_t(ReplicaConfig::getCached().m_iReplicationNodeBandwidth) * 1000000);
+      int deferred = 0;
       for (ReplicaMgmt::iterator i = self->m_ReplicaMgmt.begin(); i != self->m_ReplicaMgmt.end();)
       {
          if ((ssize_t)self->m_sstrOnReplicate.size() > maxTran)
@@ -3305,11 +4028,22 @@ void Master::reject(const string& ip, const int port, int id, int32_t code)
             break;
          }
 
-         self->createReplica(*i);
+         if (self->createReplica(*i) > 0)
+         {
+            // no source or destination has budget left for this job; keep it for the next round,
+            // which starts when a transfer completes. Stop once the slaves appear to be saturated.
+            ++ i;
+            if (++ deferred >= (int)self->m_SlaveManager.getNumberOfSlaves())
+               break;
+            continue;
+         }
+
+         deferred = 0;
          ReplicaMgmt::iterator tmp = i;
          ++ i;
          self->m_ReplicaMgmt.erase(tmp);
       }
+      self->m_Recovery.update(self->m_ReplicaMgmt.getTotalSize());
       self->m_ReplicaLock.release();
    }
    return NULL;
@@ -3324,6 +4058,14 @@ int Master::createReplica(const ReplicaJob& job)
       return 0;
    }
 
+   // slaves without replication budget left are not chosen as destinations
+   set<int> busy;
+   m_Recovery.getBusyNodes(busy);
+
+   // a batch of a directory copy is placed by the size of its own files
+   const bool batch = !job.m_vstrBatch.empty();
+   const int64_t size = batch ? job.m_llSize : attr.m_llSize;
+
    SlaveNode sn;
    SNode sub_attr;
    if (attr.m_bIsDir && (job.m_strSource == job.m_strDest))
@@ -3421,10 +4163,10 @@ int Master::createReplica(const ReplicaJob& job)
                return 0;            
          }
 
-         if (m_SlaveManager.chooseReplicaNode(attr.m_sLocation, sn, attr.m_llSize, attr.m_iReplicaDist, &attr.m_viRestrictedLoc) < 0)
+         if (m_SlaveManager.chooseReplicaNode(attr.m_sLocation, sn, attr.m_llSize, attr.m_iReplicaDist, &attr.m_viRestrictedLoc, &busy) < 0)
          {
             m_SectorLog << LogStart(9) << "Replica create: error choosing replica node " << job.m_strSource << LogEnd();
-            return -1;
+            return busy.empty() ? -1 : 1;
          }
          m_SectorLog << LogStart(9) << "Replica create: dest slave " << sn.m_strIP << ":" << sn.m_iPort << " " << job.m_strSource << LogEnd();
       }
@@ -3435,10 +4177,10 @@ int Master::createReplica(const ReplicaJob& job)
             m_SectorLog << LogStart(9) << "Replica create: more or equal replicas  " << job.m_strSource << LogEnd();
             return 0;
          }
-         if (m_SlaveManager.chooseReplicaNode(sub_attr.m_sLocation, sn, attr.m_llSize, sub_attr.m_iReplicaDist, &sub_attr.m_viRestrictedLoc) < 0)
+         if (m_SlaveManager.chooseReplicaNode(sub_attr.m_sLocation, sn, attr.m_llSize, sub_attr.m_iReplicaDist, &sub_attr.m_viRestrictedLoc, &busy) < 0)
          {
             m_SectorLog << LogStart(9) << "Replica create: error choosing replica node 2 " << job.m_strSource << LogEnd();
-            return -1;
+            return busy.empty() ? -1 : 1;
          }
       }
    }
@@ -3448,12 +4190,32 @@ int Master::createReplica(const ReplicaJob& job)
       int rd = ReplicaConfig::getCached().getReplicaDist(job.m_strDest, m_SysConfig.m_iReplicaDist);
       vector<int> rl;
       ReplicaConfig::getCached().getRestrictedLoc(job.m_strDest, rl);
-      if (m_SlaveManager.chooseReplicaNode(empty, sn, attr.m_llSize, rd, &rl) < 0){
+      if (m_SlaveManager.chooseReplicaNode(empty, sn, size, rd, &rl, &busy) < 0){
          m_SectorLog << LogStart(9) << "Replica create: choose replica node 3 " << job.m_strSource << LogEnd();
-         return -1;
+         return busy.empty() ? -1 : 1;
 	}
    }
 
+   // read from the least loaded copy, so that the sources of a recovery are spread over all replicas
+   const set<Address, AddrComp>& srcloc = (attr.m_bIsDir && (job.m_strSource == job.m_strDest)) ? sub_attr.m_sLocation : attr.m_sLocation;
+   vector<int> srcid;
+   map<int, string> srcip;
+   for (set<Address, AddrComp>::const_iterator i = srcloc.begin(); i != srcloc.end(); ++ i)
+   {
+      int id = m_SlaveManager.getSlaveID(*i);
+      if (id < 0)
+         continue;
+      srcid.push_back(id);
+      srcip[id] = i->m_strIP;
+   }
+
+   int srcnode = m_Recovery.chooseSource(srcid);
+   if ((srcnode < 0) && !srcid.empty())
+   {
+      m_SectorLog << LogStart(9) << "Replica create: all sources busy " << job.m_strSource << LogEnd();
+      return 1;
+   }
+
    // Preliminary trasnaction lock check. More exact check later in slave.
 
    if (m_pMetadata->isWriteLocked(job.m_strDest)) 
@@ -3462,63 +4224,93 @@ int Master::createReplica(const ReplicaJob& job)
        return 0;
    }
 
-   int transid = m_TransManager.create(TransType::REPLICA, 0, 111, job.m_strDest, 0);
-   m_SectorLog << LogStart(9) << "Replica create: Transaction open " << transid << " " << job.m_strDest << LogEnd();
- 
-   if (job.m_strSource == job.m_strDest)
-      m_sstrOnReplicate.insert(job.m_strSource);
-
-   int32_t dir = (attr.m_bIsDir) ? 1 : 0;
+   // 0: file; 1: directory tree; 2: batch of files and directories under the source
+   int32_t dir = batch ? 2 : ((attr.m_bIsDir) ? 1 : 0);
 
-   SectorMsg msg;
-   msg.setType(111);
-   msg.setData(0, (char*)&transid, 4);
-   msg.setData(4, (char*)&dir, 4);
-   msg.setData(8, job.m_strSource.c_str(), job.m_strSource.length() + 1);
-   msg.setData(8 + job.m_strSource.length() + 1, job.m_strDest.c_str(), job.m_strDest.length() + 1);
-
-   m_SectorLog << LogStart(9) << "Replica create: message to slave file " << job.m_strSource << " on node " << sn.m_strIP << ":" << sn.m_iPort << " " << job.m_strSource << LogEnd();
-   int rc = m_GMP.rpc(sn.m_strIP.c_str(), sn.m_iPort, &msg, &msg);
-   int rcm = 0;
-   if ((rc < 0) || (rcm = msg.getData() < 0))
+   // the index file, if any, is replicated to the same location in the same round trip
+   vector<string> src;
+   vector<string> dst;
+   src.push_back(job.m_strSource);
+   dst.push_back(job.m_strDest);
+   SNode idx_attr;
+   if (!attr.m_bIsDir && (m_pMetadata->lookup((job.m_strSource + ".idx").c_str(), idx_attr) >= 0))
    {
-      m_SectorLog << LogStart(9) << "Replica create: gmp error " << rc << " msg error "<< rcm << ", stop replicating file and removing from currently replicated " << job.m_strSource << LogEnd();
-      m_sstrOnReplicate.erase(job.m_strSource);
-      return -1;
+      src.push_back(job.m_strSource + ".idx");
+      dst.push_back(job.m_strDest + ".idx");
    }
 
-   m_SectorLog << LogStart(9) << "Replica create: adding slave " << sn.m_iNodeID << job.m_strSource << LogEnd();
-   m_TransManager.addSlave(transid, sn.m_iNodeID);
-   m_SlaveManager.incActTrans(sn.m_iNodeID);
-
-   if (attr.m_bIsDir)
-      return 0;
+   vector<int> transid;
+   vector<SectorMsg> msg(src.size());
+   vector<CUserMessage*> req;
+   vector<Address> dest;
+   for (unsigned int i = 0; i < src.size(); ++ i)
+   {
+      transid.push_back(m_TransManager.create(TransType::REPLICA, 0, 111, dst[i], 0));
+      m_SectorLog << LogStart(9) << "Replica create: Transaction open " << transid[i] << " " << dst[i] << LogEnd();
+
+      if (job.m_strSource == job.m_strDest)
+         m_sstrOnReplicate.insert(src[i]);
+
+      msg[i].setType(111);
+      msg[i].setData(0, (char*)&transid[i], 4);
+      msg[i].setData(4, (char*)&dir, 4);
+      msg[i].setData(8, src[i].c_str(), src[i].length() + 1);
+      msg[i].setData(8 + src[i].length() + 1, dst[i].c_str(), dst[i].length() + 1);
+      int pos = 8 + src[i].length() + 1 + dst[i].length() + 1;
+      if ((srcnode >= 0) || batch)
+      {
+         // a batch always carries the source field, empty if any replica may be read
+         string hint = (srcnode >= 0) ? srcip[srcnode] : "";
+         msg[i].setData(pos, hint.c_str(), hint.length() + 1);
+         pos += hint.length() + 1;
+      }
+      if (batch)
+      {
+         int32_t num = job.m_vstrBatch.size();
+         msg[i].setData(pos, (char*)&num, 4);
+         pos += 4;
+         for (vector<string>::const_iterator b = job.m_vstrBatch.begin(); b != job.m_vstrBatch.end(); ++ b)
+         {
+            msg[i].setData(pos, b->c_str(), b->length() + 1);
+            pos += b->length() + 1;
+         }
+      }
+      req.push_back(&msg[i]);
 
-   // replicate index file to the same location
-   string idx = job.m_strSource + ".idx";
-   if (m_pMetadata->lookup(idx.c_str(), attr) < 0)
-      return 0;
+      Address a;
+      a.m_strIP = sn.m_strIP;
+      a.m_iPort = sn.m_iPort;
+      dest.push_back(a);
 
-   transid = m_TransManager.create(TransType::REPLICA, 0, 111, job.m_strDest + ".idx", 0);
-   if (job.m_strSource == job.m_strDest)
-      m_sstrOnReplicate.insert(idx);
+      // register the transfer before the request is sent, a small file may be reported (1104) before multi_rpc returns
+      m_TransManager.addSlave(transid[i], sn.m_iNodeID);
+      m_SlaveManager.incActTrans(sn.m_iNodeID);
+      m_Recovery.start(transid[i], srcnode, sn.m_iNodeID, (0 == i) ? size : idx_attr.m_llSize);
+   }
 
-   msg.setType(111);
-   msg.setData(0, (char*)&transid, 4);
-   msg.setData(4, (char*)&dir, 4);
-   msg.setData(8, idx.c_str(), idx.length() + 1);
-   msg.setData(8 + idx.length() + 1, (job.m_strDest + ".idx").c_str(), (job.m_strDest + ".idx").length() + 1);
+   m_SectorLog << LogStart(9) << "Replica create: message to slave file " << job.m_strSource << " on node " << sn.m_strIP << ":" << sn.m_iPort << " " << job.m_strSource << LogEnd();
+   int rc = m_GMP.multi_rpc(dest, req, &req);
 
-   if ((m_GMP.rpc(sn.m_strIP.c_str(), sn.m_iPort, &msg, &msg) < 0) || (msg.getData() < 0))
+   int result = 0;
+   for (unsigned int i = 0; i < src.size(); ++ i)
    {
-      m_sstrOnReplicate.erase(idx);
-      return 0;
-   }
+      if ((msg[i].m_iDataLength == 0) || (msg[i].getType() < 0))
+      {
+         m_SectorLog << LogStart(9) << "Replica create: gmp error " << rc << " msg error " << msg[i].getType() << ", stop replicating file and removing from currently replicated " << src[i] << LogEnd();
+         // the slave refused the transfer, give back its slot
+         m_TransManager.updateSlave(transid[i], sn.m_iNodeID);
+         m_SlaveManager.decActTrans(sn.m_iNodeID);
+         m_Recovery.finish(transid[i], false);
+         m_sstrOnReplicate.erase(src[i]);
+         if (i == 0)
+            result = -1;
+         continue;
+      }
 
-   m_TransManager.addSlave(transid, sn.m_iNodeID);
-   m_SlaveManager.incActTrans(sn.m_iNodeID);
+      m_SectorLog << LogStart(9) << "Replica create: adding slave " << sn.m_iNodeID << " " << src[i] << LogEnd();
+   }
 
-   return 0;
+   return result;
 }
 
 int Master::removeReplica(const std::string& filename, const Address& addr)
@@ -3535,6 +4327,338 @@ int Master::removeReplica(const std::string& filename, const Address& addr)
    return 0;
 }
 
+int Master::removeFile(const string& path)
+{
+   SNode attr;
+   if (m_pMetadata->lookup(path, attr) < 0)
+      return -1;
+
+   for (set<Address, AddrComp>::iterator i = attr.m_sLocation.begin(); i != attr.m_sLocation.end(); ++ i)
+      removeReplica(path, *i);
+
+   m_pMetadata->remove(path);
+   sync(path.c_str(), path.length() + 1, 1105);
+
+   return 0;
+}
+
+int Master::checkErasureCode(const int& max_jobs)
+{
+   // a job whose shards are never reported, e.g., because the master lost a report, is given up
+   // after a while; the next scan starts over from the shards that were created
+   const int64_t timeout = 6 * 3600 * 1000000LL;
+   vector<ErasureMgmt::Job> expired;
+   m_ErasureMgmt.expire(timeout, expired);
+   for (vector<ErasureMgmt::Job>::iterator i = expired.begin(); i != expired.end(); ++ i)
+   {
+      m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Erasure code: job on " << i->m_strFile << " timed out" << LogEnd();
+      completeErasure(*i, -1);
+   }
+
+   const ReplicaConfData& conf = ReplicaConfig::getCached();
+   int64_t now = time(NULL);
+   int jobs = m_ErasureMgmt.getTotalNum();
+
+   for (map<string, pair<int, int> >::const_iterator r = conf.m_mErasureCode.begin(); r != conf.m_mErasureCode.end(); ++ r)
+   {
+      vector<string> files;
+      if (m_pMetadata->list_r(r->first, files) < 0)
+         continue;
+
+      // group the shards found under this path by the file they belong to
+      map<string, map<int, SNode> > shards;
+      map<string, pair<int, int> > code;
+      vector<string> plain;
+      for (vector<string>::iterator f = files.begin(); f != files.end(); ++ f)
+      {
+         if (!ECShard::isShard(*f))
+         {
+            plain.push_back(*f);
+            continue;
+         }
+
+         SNode attr;
+         if (m_pMetadata->lookup(*f, attr) < 0)
+            continue;
+
+         int k, m, index;
+         size_t p = f->rfind('/');
+         ECShard::parseName(f->substr(p + 1), k, m, index);
+         string file = f->substr(0, p - 3);
+
+         // all shards of a file must come from the same code
+         if (code.find(file) == code.end())
+            code[file] = pair<int, int>(k, m);
+         else if (code[file] != pair<int, int>(k, m))
+            continue;
+
+         attr.m_strName = *f;
+         shards[file][index] = attr;
+      }
+
+      // convert cold files into shards, or finish the conversion of files with missing shards
+      for (vector<string>::iterator f = plain.begin(); (f != plain.end()) && (jobs < max_jobs); ++ f)
+      {
+         SNode attr;
+         if ((m_pMetadata->lookup(*f, attr) < 0) || attr.m_bIsDir || attr.m_sLocation.empty() || (attr.m_llSize == 0))
+            continue;
+         if ((now - attr.m_llTimeStamp < conf.m_iErasureCodeColdAge) || m_ErasureMgmt.isActive(*f))
+            continue;
+
+         int k = r->second.first;
+         int m = r->second.second;
+         conf.getErasureCode(*f, k, m);
+
+         // shards left by an earlier attempt are kept if they were made from the current version of the file
+         set<int> valid;
+         set<Address, AddrComp> loclist;
+         map<string, map<int, SNode> >::iterator s = shards.find(*f);
+         if (s != shards.end())
+         {
+            for (map<int, SNode>::iterator i = s->second.begin(); i != s->second.end(); ++ i)
+            {
+               if ((code[*f] == pair<int, int>(k, m)) && (i->second.m_llTimeStamp == attr.m_llTimeStamp))
+               {
+                  valid.insert(i->first);
+                  loclist.insert(i->second.m_sLocation.begin(), i->second.m_sLocation.end());
+               }
+               else
+               {
+                  removeFile(i->second.m_strName);
+               }
+            }
+            shards.erase(s);
+         }
+
+         vector<int> missing;
+         for (int i = 0; i < k + m; ++ i)
+         {
+            if (valid.find(i) == valid.end())
+               missing.push_back(i);
+         }
+
+         ErasureMgmt::Job job;
+         job.m_strFile = *f;
+         job.m_bConvert = true;
+         job.m_llTimeStamp = attr.m_llTimeStamp;
+         if (missing.empty())
+         {
+            completeErasure(job, 1);
+            continue;
+         }
+
+         // keep the file unchanged until all shards are written
+         if (m_pMetadata->lock(*f, ErasureMgmt::m_iLockKey, SF_MODE::READ) < 0)
+            continue;
+
+         if (createShards(*f, *f, attr.m_llSize, attr.m_llTimeStamp, k, m, missing, loclist, true) <= 0)
+         {
+            m_pMetadata->unlock(*f, ErasureMgmt::m_iLockKey, SF_MODE::READ);
+            continue;
+         }
+
+         m_SectorLog << LogStart(LogLevel::LEVEL_3) << "Erasure code: converting " << *f << " into " << k << "+" << m << " shards, " << missing.size() << " to create" << LogEnd();
+         ++ jobs;
+      }
+
+      // the remaining files exist as shards only; rebuild the shards lost with failed slaves
+      for (map<string, map<int, SNode> >::iterator s = shards.begin(); (s != shards.end()) && (jobs < max_jobs); ++ s)
+      {
+         string dir = ECShard::shardDir(s->first);
+         int k = code[s->first].first;
+         int m = code[s->first].second;
+         if ((int(s->second.size()) >= k + m) || m_ErasureMgmt.isActive(dir))
+            continue;
+
+         SNode tmp;
+         if (m_pMetadata->lookup(s->first, tmp) >= 0)
+            continue;
+
+         if (int(s->second.size()) < k)
+         {
+            m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Erasure code: " << s->first << " cannot be restored, only " << s->second.size() << " of " << k + m << " shards left" << LogEnd();
+            continue;
+         }
+
+         vector<int> missing;
+         set<Address, AddrComp> loclist;
+         for (int i = 0; i < k + m; ++ i)
+         {
+            map<int, SNode>::iterator i2 = s->second.find(i);
+            if (i2 == s->second.end())
+               missing.push_back(i);
+            else
+               loclist.insert(i2->second.m_sLocation.begin(), i2->second.m_sLocation.end());
+         }
+
+         // the slaves read the size and time stamp of the file from the shard headers
+         const SNode& any = s->second.begin()->second;
+         int64_t size = (any.m_llSize - ECShard::m_iHdrSize) * k;
+         if (createShards(dir, s->first, size, any.m_llTimeStamp, k, m, missing, loclist, false) <= 0)
+            continue;
+
+         m_SectorLog << LogStart(LogLevel::LEVEL_3) << "Erasure code: rebuilding " << missing.size() << " shards of " << s->first << LogEnd();
+         ++ jobs;
+      }
+   }
+
+   return jobs;
+}
+
+int Master::createShards(const string& src, const string& file, const int64_t& size, const int64_t& ts, const int& k, const int& m,
+                         const vector<int>& shards, set<Address, AddrComp>& loclist, const bool& convert)
+{
+   int64_t chunk = ECShard::chunkSize(size, k);
+   int rd = ReplicaConfig::getCached().getReplicaDist(file, m_SysConfig.m_iReplicaDist);
+   vector<int> rl;
+   ReplicaConfig::getCached().getRestrictedLoc(file, rl);
+
+   // every shard goes to a different slave, which must have recovery budget left
+   set<int> busy;
+   m_Recovery.getBusyNodes(busy);
+
+   vector<SlaveNode> node;
+   for (unsigned int i = 0; i < shards.size(); ++ i)
+   {
+      SlaveNode sn;
+      if (m_SlaveManager.chooseReplicaNode(loclist, sn, chunk + ECShard::m_iHdrSize, rd, &rl, &busy) < 0)
+      {
+         m_SectorLog << LogStart(9) << "Erasure code: not enough slaves for the shards of " << file << LogEnd();
+         return -1;
+      }
+
+      Address a;
+      a.m_strIP = sn.m_strIP;
+      a.m_iPort = sn.m_iPort;
+      loclist.insert(a);
+      node.push_back(sn);
+   }
+
+   int32_t cv = convert ? 1 : 0;
+   vector<int> transid;
+   vector<SectorMsg> msg(shards.size());
+   vector<CUserMessage*> req;
+   vector<Address> dest;
+   for (unsigned int i = 0; i < shards.size(); ++ i)
+   {
+      string dst = ECShard::shardDir(file) + "/" + ECShard::shardName(k, m, shards[i]);
+      transid.push_back(m_TransManager.create(TransType::ERASURE, 0, 115, dst, 0));
+
+      msg[i].setType(115);
+      msg[i].setData(0, (char*)&transid[i], 4);
+      msg[i].setData(4, (char*)&cv, 4);
+      msg[i].setData(8, (char*)&k, 4);
+      msg[i].setData(12, (char*)&m, 4);
+      msg[i].setData(16, (char*)&shards[i], 4);
+      msg[i].setData(20, (char*)&size, 8);
+      msg[i].setData(28, (char*)&ts, 8);
+      msg[i].setData(36, src.c_str(), src.length() + 1);
+      msg[i].setData(36 + src.length() + 1, dst.c_str(), dst.length() + 1);
+      req.push_back(&msg[i]);
+
+      Address a;
+      a.m_strIP = node[i].m_strIP;
+      a.m_iPort = node[i].m_iPort;
+      dest.push_back(a);
+
+      // register the shard before the request is sent, it may be reported (1104) before multi_rpc returns
+      m_TransManager.addSlave(transid[i], node[i].m_iNodeID);
+      m_SlaveManager.incActTrans(node[i].m_iNodeID);
+      m_Recovery.start(transid[i], -1, node[i].m_iNodeID, chunk);
+   }
+
+   ErasureMgmt::Job job;
+   job.m_strFile = convert ? file : src;
+   job.m_bConvert = convert;
+   job.m_llTimeStamp = ts;
+   m_ErasureMgmt.insert(job, transid);
+
+   m_GMP.multi_rpc(dest, req, &req);
+
+   int started = 0;
+   vector<int> refused;
+   for (unsigned int i = 0; i < shards.size(); ++ i)
+   {
+      if ((msg[i].m_iDataLength == 0) || (msg[i].getType() < 0))
+      {
+         m_SectorLog << LogStart(9) << "Erasure code: slave " << node[i].m_strIP << ":" << node[i].m_iPort << " refused shard " << shards[i] << " of " << file << LogEnd();
+         refused.push_back(i);
+      }
+      else
+         ++ started;
+   }
+
+   // a refused shard counts as a failed one; the job completes when the last shard is accounted for
+   int res = 0;
+   for (vector<int>::iterator r = refused.begin(); r != refused.end(); ++ r)
+   {
+      m_TransManager.updateSlave(transid[*r], node[*r].m_iNodeID);
+      m_SlaveManager.decActTrans(node[*r].m_iNodeID);
+      m_Recovery.finish(transid[*r], false);
+
+      int f = m_ErasureMgmt.finish(transid[*r], false, job);
+      if (f != 0)
+         res = f;
+   }
+
+   // if no shard was started, the caller releases the file
+   if (0 == started)
+      return -1;
+
+   if (res != 0)
+      completeErasure(job, res);
+
+   return started;
+}
+
+void Master::completeErasure(const ErasureMgmt::Job& job, const int& result)
+{
+   if (!job.m_bConvert)
+   {
+      m_SectorLog << LogStart(LogLevel::LEVEL_3) << "Erasure code: shard rebuild of " << job.m_strFile << ((result > 0) ? " completed" : " failed") << LogEnd();
+      return;
+   }
+
+   m_pMetadata->unlock(job.m_strFile, ErasureMgmt::m_iLockKey, SF_MODE::READ);
+
+   if (result < 0)
+   {
+      // the shards created so far are kept and completed by the next scan
+      m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Erasure code: conversion of " << job.m_strFile << " failed" << LogEnd();
+      return;
+   }
+
+   SNode attr;
+   if ((m_pMetadata->lookup(job.m_strFile, attr) < 0) || (attr.m_llTimeStamp != job.m_llTimeStamp))
+      return;
+
+   // the replicas are only removed when every shard of the current version is in place
+   string dir = ECShard::shardDir(job.m_strFile);
+   vector<string> shards;
+   m_pMetadata->list_r(dir, shards);
+   set<int> valid;
+   int k = 0;
+   int m = 0;
+   for (vector<string>::iterator i = shards.begin(); i != shards.end(); ++ i)
+   {
+      SNode s;
+      int index;
+      if ((m_pMetadata->lookup(*i, s) < 0) || (s.m_llTimeStamp != job.m_llTimeStamp))
+         continue;
+      if (ECShard::parseName(i->substr(i->rfind('/') + 1), k, m, index) >= 0)
+         valid.insert(index);
+   }
+
+   if ((k == 0) || (int(valid.size()) < k + m))
+   {
+      m_SectorLog << LogStart(LogLevel::LEVEL_1) << "Erasure code: " << job.m_strFile << " has " << valid.size() << " shards, keeping replicas" << LogEnd();
+      return;
+   }
+
+   m_SectorLog << LogStart(LogLevel::LEVEL_3) << "Erasure code: " << job.m_strFile << " converted into " << k << "+" << m << " shards, removing replicas" << LogEnd();
+   removeFile(job.m_strFile);
+}
+
 int Master::serializeSysStat(char*& buf, int& size)
 {
    char* cluster_info = NULL;
@@ -3549,7 +4673,7 @@ int Master::serializeSysStat(char*& buf, int& size)
    int slave_size = 0;
    m_SlaveManager.serializeSlaveInfo(slave_info, slave_size);
 
-   size = 40 + cluster_size + slave_size + master_size;
+   size = 40 + cluster_size + slave_size + master_size + 40;
    buf = new char[size];
 
    *(int64_t*)buf = m_llStartTime;
@@ -3569,6 +4693,16 @@ int Master::serializeSysStat(char*& buf, int& size)
 
    memcpy(p, slave_info, slave_size);
    delete [] slave_info;
+   p += slave_size;
+
+   // recovery progress is appended at the end, where older clients ignore it
+   int64_t pending, done, rate, eta, trans;
+   m_Recovery.getProgress(pending, done, rate, eta, trans);
+   *(int64_t*)p = pending;
+   *(int64_t*)(p + 8) = done;
+   *(int64_t*)(p + 16) = rate;
+   *(int64_t*)(p + 24) = eta;
+   *(int64_t*)(p + 32) = trans;
 
    return size;
 }
@@ -3578,6 +4712,9 @@ int Master::removeSlave(const int& id, const Address& addr)
    // remove the data on that node
    m_pMetadata->substract("/", addr);
 
+   // replica transfers from or to that node will never complete
+   m_Recovery.removeNode(id);
+
    //remove all associated transactions and release IO locks...
    vector<int> trans;
    m_TransManager.retrieve(id, trans);
@@ -3595,6 +4732,15 @@ int Master::removeSlave(const int& id, const Address& addr)
          processWriteResults(t.m_strFile, t.m_mResults);
          m_pMetadata->unlock(t.m_strFile.c_str(), t.m_iUserKey, t.m_iMode);
       }
+
+      // the shard that node was writing is lost
+      if (t.m_iType == TransType::ERASURE)
+      {
+         ErasureMgmt::Job job;
+         int res = m_ErasureMgmt.finish(*i, false, job);
+         if (res != 0)
+            completeErasure(job, res);
+      }
    }
 
    // send lost slave info to all existing masters
@@ -22,6 +22,7 @@ written by
 #ifndef __SECTOR_MASTER_H__
 #define __SECTOR_MASTER_H__
 
+#include <deque>
 #include <vector>
 
 #include "gmp.h"
@@ -173,6 +174,61 @@ private:
    int processMCmd(const std::string& ip, const int port,  const User* user, const int32_t key, int id, SectorMsg* msg);
    int sync(const char* fileinfo, const int& size, const int& type);
    int processSyncCmd(const std::string& ip, const int port,  const User* user, const int32_t key, int id, SectorMsg* msg);
+   int applySyncCmd(SectorMsg* msg);
+
+private: // metadata replication to other masters
+#ifndef WIN32
+   static void* syncHandler(void* s);
+#else
+   static DWORD WINAPI syncHandler(void* s);
+#endif
+
+   struct SyncRecord
+   {
+      int64_t m_llSeq;				// sequence number
+      int32_t m_iType;				// sync command, 1100+
+      std::string m_strData;			// command parameters
+      int64_t m_llTimeStamp;			// time when the change was logged
+   };
+
+   CMutex m_SyncLock;
+   CCond m_SyncCond;
+   std::deque<SyncRecord> m_qSyncLog;			// changes not yet acknowledged by all other masters
+   int64_t m_llSyncSeq;					// sequence number of the last logged change
+   std::map<uint32_t, int64_t> m_mSyncAck;		// last sequence number acknowledged by each other master
+   CMutex m_SyncApplyLock;
+   std::map<uint32_t, std::pair<int64_t, int64_t> > m_mSyncApplied;	// start time and last applied sequence number of each other master
+
+   struct ResyncState
+   {
+      int64_t m_llEpoch;			// start time of the sync thread of the sender
+      int64_t m_llSeq;				// sequence number of the last change included in the snapshot
+      int64_t m_llSize;				// snapshot size
+      int64_t m_llDone;				// bytes sent or received so far
+   };
+
+   std::map<uint32_t, ResyncState> m_mResyncOut;	// snapshot being sent to each other master, used by syncHandler only
+   std::map<uint32_t, ResyncState> m_mResyncIn;		// snapshot being received from each other master, protected by m_SyncApplyLock
+
+   int getSyncLag(int64_t& records, int64_t& usecs);
+
+      // Functionality:
+      //    send the whole metadata to another master, whose missing changes have been trimmed from the sync log.
+      //    The snapshot is sent in chunks; after a failure, the next call resumes where the other master stopped.
+      // Parameters:
+      //    1) [in] key: router key of the other master
+      //    2) [in] addr: address of the other master
+      //    3) [in] epoch: start time of the sync thread
+      //    4) [out] seq: sequence number of the last change included
+      // Returned value:
+      //    0 on success, -1 on error.
+
+   int resyncMaster(const uint32_t& key, const Address& addr, const int64_t& epoch, int64_t& seq);
+
+   static const int m_iMaxSyncBatch = 1024;		// maximum number of changes in one sync message
+   static const int m_iResyncChunk = 1000000;		// maximum snapshot bytes in one resync message
+   static const int m_iCopyBatchFiles = 1000;		// maximum number of files of a directory copy placed on one slave
+   static const int64_t m_llCopyBatchSize = 4000000000LL;	// maximum size of the files of a directory copy placed on one slave
 
 private:
    int removeSlave(const int& id, const Address& addr);
@@ -193,6 +249,7 @@ private: // replication
 
    ReplicaMgmt m_ReplicaMgmt;				// list of files to be replicated
    std::set<std::string> m_sstrOnReplicate;		// list of files currently being replicated
+   RecoveryScheduler m_Recovery;			// spreads replica transfers over slaves and tracks recovery progress
 
    int createReplica(const ReplicaJob& job);
    int removeReplica(const std::string& filename, const Address& addr);
@@ -201,6 +258,15 @@ private: // replication
 
    int chooseDataToMove(std::vector<std::string>& path, const Address& addr, const int64_t& target_size);
 
+private: // erasure coding
+   ErasureMgmt m_ErasureMgmt;				// files being converted to shards, or whose lost shards are being rebuilt
+
+   int checkErasureCode(const int& max_jobs);
+   int createShards(const std::string& src, const std::string& file, const int64_t& size, const int64_t& ts, const int& k, const int& m,
+                    const std::vector<int>& shards, std::set<Address, AddrComp>& loclist, const bool& convert);
+   void completeErasure(const ErasureMgmt::Job& job, const int& result);
+   int removeFile(const std::string& path);
+
 private:
    
    CMutex m_DfLock;
@@ -152,11 +152,19 @@ int ReplicaMgmt::erase(const ReplicaMgmt::iterator& iter)
       return -1;
 
    m_iTotalJob --;
-   m_llTotalFileSize += iter.m_ListIter->m_llSize;
+   m_llTotalFileSize -= iter.m_ListIter->m_llSize;
    m_MultiJobList[iter.m_iPriority].erase(iter.m_ListIter);
    return 0;
 }
 
+void ReplicaMgmt::clear()
+{
+   for (vector<JobList>::iterator i = m_MultiJobList.begin(); i != m_MultiJobList.end(); ++ i)
+      i->clear();
+   m_llTotalFileSize = 0;
+   m_iTotalJob = 0;
+}
+
 int ReplicaMgmt::getTotalNum() const
 {
    return m_iTotalJob;
@@ -192,3 +200,317 @@ ReplicaMgmt::ReplicaMgmt::iterator ReplicaMgmt::end()
    iter.m_ListIter = m_MultiJobList[iter.m_iPriority].end();
    return iter;
 }
+
+
+RecoveryScheduler::RecoveryScheduler():
+m_iMaxTrans(2),
+m_llBandwidth(0),
+m_bActive(false),
+m_llStartTime(0),
+m_llQueued(0),
+m_llInFlight(0),
+m_llDone(0)
+{
+}
+
+RecoveryScheduler::~RecoveryScheduler()
+{
+}
+
+void RecoveryScheduler::setBudget(const int& max_trans, const int64_t& bandwidth)
+{
+   CGuardEx rg(m_Lock);
+
+   m_iMaxTrans = (max_trans > 0) ? max_trans : 1;
+   m_llBandwidth = (bandwidth > 0) ? bandwidth : 0;
+}
+
+bool RecoveryScheduler::available_(const int& trans, const int64_t& clock, const int64_t& now) const
+{
+   if (trans >= m_iMaxTrans)
+      return false;
+
+   return (0 == m_llBandwidth) || (clock < now + m_llHorizon);
+}
+
+int64_t RecoveryScheduler::charge_(int64_t& clock, const int64_t& size, const int64_t& now) const
+{
+   if (0 == m_llBandwidth)
+      return clock;
+
+   // virtual clock: the node is busy until all bytes scheduled on it could have been sent at the budget rate
+   if (clock < now)
+      clock = now;
+   clock += size * 1000000 / m_llBandwidth;
+   return clock;
+}
+
+int RecoveryScheduler::chooseSource(const vector<int>& sources)
+{
+   CGuardEx rg(m_Lock);
+
+   int64_t now = CTimer::getTime();
+
+   // the least loaded replica within its budget; a node not seen before is idle
+   int best = -1;
+   int best_reads = 0;
+   int64_t best_clock = 0;
+   for (vector<int>::const_iterator i = sources.begin(); i != sources.end(); ++ i)
+   {
+      if (*i < 0)
+         continue;
+
+      int reads = 0;
+      int64_t clock = 0;
+      map<int, NodeLoad>::const_iterator l = m_mLoad.find(*i);
+      if (l != m_mLoad.end())
+      {
+         reads = l->second.m_iReads;
+         clock = l->second.m_llReadClock;
+      }
+
+      if (!available_(reads, clock, now))
+         continue;
+
+      if ((best < 0) || (reads < best_reads) || ((reads == best_reads) && (clock < best_clock)))
+      {
+         best = *i;
+         best_reads = reads;
+         best_clock = clock;
+      }
+   }
+
+   return best;
+}
+
+void RecoveryScheduler::getBusyNodes(set<int>& busy)
+{
+   CGuardEx rg(m_Lock);
+
+   busy.clear();
+
+   int64_t now = CTimer::getTime();
+   for (map<int, NodeLoad>::const_iterator i = m_mLoad.begin(); i != m_mLoad.end(); ++ i)
+   {
+      if (!available_(i->second.m_iWrites, i->second.m_llWriteClock, now))
+         busy.insert(i->first);
+   }
+}
+
+void RecoveryScheduler::start(const int& transid, const int& src, const int& dst, const int64_t& size)
+{
+   CGuardEx rg(m_Lock);
+
+   int64_t now = CTimer::getTime();
+
+   if (!m_bActive)
+   {
+      m_bActive = true;
+      m_llStartTime = now;
+      m_llDone = 0;
+   }
+
+   Transfer t;
+   t.m_iSrc = src;
+   t.m_iDst = dst;
+   t.m_llSize = size;
+   m_mTransfer[transid] = t;
+   m_llInFlight += size;
+
+   if (src >= 0)
+   {
+      NodeLoad& l = m_mLoad[src];
+      ++ l.m_iReads;
+      charge_(l.m_llReadClock, size, now);
+   }
+
+   NodeLoad& l = m_mLoad[dst];
+   ++ l.m_iWrites;
+   charge_(l.m_llWriteClock, size, now);
+}
+
+void RecoveryScheduler::finish(const int& transid, const bool& success)
+{
+   CGuardEx rg(m_Lock);
+
+   map<int, Transfer>::iterator t = m_mTransfer.find(transid);
+   if (t == m_mTransfer.end())
+      return;
+
+   m_llInFlight -= t->second.m_llSize;
+   if (success)
+      m_llDone += t->second.m_llSize;
+
+   // a failed transfer gives back the budget it was charged
+   int64_t refund = (success || (0 == m_llBandwidth)) ? 0 : t->second.m_llSize * 1000000 / m_llBandwidth;
+
+   map<int, NodeLoad>::iterator l = m_mLoad.find(t->second.m_iSrc);
+   if (l != m_mLoad.end())
+   {
+      -- l->second.m_iReads;
+      l->second.m_llReadClock -= refund;
+   }
+
+   l = m_mLoad.find(t->second.m_iDst);
+   if (l != m_mLoad.end())
+   {
+      -- l->second.m_iWrites;
+      l->second.m_llWriteClock -= refund;
+   }
+
+   m_mTransfer.erase(t);
+}
+
+void RecoveryScheduler::removeNode(const int& id)
+{
+   CGuardEx rg(m_Lock);
+
+   // transfers from or to the node will not report back
+   for (map<int, Transfer>::iterator t = m_mTransfer.begin(); t != m_mTransfer.end();)
+   {
+      if ((t->second.m_iSrc == id) || (t->second.m_iDst == id))
+      {
+         m_llInFlight -= t->second.m_llSize;
+         map<int, NodeLoad>::iterator l = m_mLoad.find((t->second.m_iSrc == id) ? t->second.m_iDst : t->second.m_iSrc);
+         if (l != m_mLoad.end())
+         {
+            if (t->second.m_iSrc == id)
+               -- l->second.m_iWrites;
+            else
+               -- l->second.m_iReads;
+         }
+         m_mTransfer.erase(t ++);
+      }
+      else
+         ++ t;
+   }
+
+   m_mLoad.erase(id);
+}
+
+void RecoveryScheduler::update(const int64_t& queued)
+{
+   CGuardEx rg(m_Lock);
+
+   m_llQueued = queued;
+
+   // the recovery is over when nothing is left to replicate
+   if ((0 == m_llQueued) && m_mTransfer.empty())
+      m_bActive = false;
+}
+
+void RecoveryScheduler::getProgress(int64_t& pending, int64_t& done, int64_t& rate, int64_t& eta, int64_t& trans)
+{
+   CGuardEx rg(m_Lock);
+
+   pending = m_llQueued + m_llInFlight;
+   done = m_bActive ? m_llDone : 0;
+   trans = m_mTransfer.size();
+
+   rate = 0;
+   int64_t elapsed = CTimer::getTime() - m_llStartTime;
+   if (m_bActive && (elapsed > 0))
+      rate = m_llDone * 1000000 / elapsed;
+
+   eta = -1;
+   if (0 == pending)
+      eta = 0;
+   else if (rate > 0)
+      eta = pending / rate;
+}
+
+
+ErasureMgmt::ErasureMgmt():
+m_mJobs(),
+m_mTransFile()
+{
+}
+
+ErasureMgmt::~ErasureMgmt()
+{
+}
+
+bool ErasureMgmt::isActive(const string& file)
+{
+   CGuardEx eg(m_Lock);
+
+   return m_mJobs.find(file) != m_mJobs.end();
+}
+
+void ErasureMgmt::insert(const Job& job, const vector<int>& transid)
+{
+   CGuardEx eg(m_Lock);
+
+   Job& j = m_mJobs[job.m_strFile];
+   j = job;
+   j.m_llStartTime = CTimer::getTime();
+   j.m_iPending = transid.size();
+   j.m_iFailed = 0;
+
+   for (vector<int>::const_iterator i = transid.begin(); i != transid.end(); ++ i)
+      m_mTransFile[*i] = job.m_strFile;
+}
+
+int ErasureMgmt::finish(const int& transid, const bool& success, Job& job)
+{
+   CGuardEx eg(m_Lock);
+
+   map<int, string>::iterator t = m_mTransFile.find(transid);
+   if (t == m_mTransFile.end())
+      return 0;
+
+   map<string, Job>::iterator j = m_mJobs.find(t->second);
+   m_mTransFile.erase(t);
+   if (j == m_mJobs.end())
+      return 0;
+
+   -- j->second.m_iPending;
+   if (!success)
+      ++ j->second.m_iFailed;
+
+   if (j->second.m_iPending > 0)
+      return 0;
+
+   job = j->second;
+   m_mJobs.erase(j);
+
+   return (job.m_iFailed == 0) ? 1 : -1;
+}
+
+int ErasureMgmt::expire(const int64_t& timeout, vector<Job>& expired)
+{
+   CGuardEx eg(m_Lock);
+
+   expired.clear();
+
+   // shards on slaves that were lost during the job are never reported
+   int64_t now = CTimer::getTime();
+   for (map<string, Job>::iterator i = m_mJobs.begin(); i != m_mJobs.end();)
+   {
+      if (now - i->second.m_llStartTime < timeout)
+      {
+         ++ i;
+         continue;
+      }
+
+      expired.push_back(i->second);
+      m_mJobs.erase(i ++);
+   }
+
+   for (map<int, string>::iterator i = m_mTransFile.begin(); i != m_mTransFile.end();)
+   {
+      if (m_mJobs.find(i->second) == m_mJobs.end())
+         m_mTransFile.erase(i ++);
+      else
+         ++ i;
+   }
+
+   return expired.size();
+}
+
+int ErasureMgmt::getTotalNum()
+{
+   CGuardEx eg(m_Lock);
+
+   return m_mJobs.size();
+}
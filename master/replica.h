@@ -24,10 +24,13 @@ written by
 #define __SECTOR_REPLICA_H__
 
 #include <list>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "common.h"
+#include "osportable.h"
 
 namespace sector
 {
@@ -48,6 +51,7 @@ struct ReplicaJob
    int64_t m_llTimeStamp;
    int64_t m_llSize;
    bool m_bForceReplicate;
+   std::vector<std::string> m_vstrBatch;	// paths under m_strSource copied by one slave, directories end with '/'
 };
 
 typedef std::list<ReplicaJob> JobList;
@@ -87,6 +91,7 @@ public:
 
    int insert(const ReplicaJob& rep);
    int erase(const iterator& iter);
+   void clear();
 
    int getTotalNum() const;
    int64_t getTotalSize() const;
@@ -101,6 +106,113 @@ private:
    int m_iTotalJob;
 };
 
+// Spreads replica transfers over the slaves: each slave takes a limited number of concurrent
+// reads (as a source) and writes (as a destination), and is paced by a per-node bandwidth budget.
+// It also tracks the progress of the current recovery.
+class RecoveryScheduler
+{
+public:
+   RecoveryScheduler();
+   ~RecoveryScheduler();
+
+public:
+   void setBudget(const int& max_trans, const int64_t& bandwidth);
+
+   int chooseSource(const std::vector<int>& sources);
+   void getBusyNodes(std::set<int>& busy);
+
+   void start(const int& transid, const int& src, const int& dst, const int64_t& size);
+   void finish(const int& transid, const bool& success);
+   void removeNode(const int& id);
+
+   void update(const int64_t& queued);
+   void getProgress(int64_t& pending, int64_t& done, int64_t& rate, int64_t& eta, int64_t& trans);
+
+private:
+   struct NodeLoad
+   {
+      NodeLoad(): m_iReads(0), m_iWrites(0), m_llReadClock(0), m_llWriteClock(0) {}
+
+      int m_iReads;			// transfers reading from this node
+      int m_iWrites;			// transfers writing to this node
+      int64_t m_llReadClock;		// time when the scheduled reads would be completed at the budget rate
+      int64_t m_llWriteClock;		// time when the scheduled writes would be completed at the budget rate
+   };
+
+   struct Transfer
+   {
+      int m_iSrc;
+      int m_iDst;
+      int64_t m_llSize;
+   };
+
+   bool available_(const int& trans, const int64_t& clock, const int64_t& now) const;
+   int64_t charge_(int64_t& clock, const int64_t& size, const int64_t& now) const;
+
+private:
+   std::map<int, NodeLoad> m_mLoad;		// slave ID -> replication load
+   std::map<int, Transfer> m_mTransfer;		// transaction ID -> transfer in flight
+
+   int m_iMaxTrans;				// concurrent reads and writes per node
+   int64_t m_llBandwidth;			// per-node budget, bytes per second, 0 = unlimited
+
+   static const int64_t m_llHorizon = 1000000;	// a node takes new transfers while its budget clock is less than this ahead, microseconds
+
+   bool m_bActive;				// if a recovery is in progress
+   int64_t m_llStartTime;			// when the current recovery started
+   int64_t m_llQueued;				// bytes waiting to be scheduled
+   int64_t m_llInFlight;			// bytes being transferred
+   int64_t m_llDone;				// bytes replicated by the current recovery
+
+   CMutex m_Lock;
+};
+
+// Tracks the shard transfers of the files being erasure coded, and of the erasure coded files
+// whose lost shards are being rebuilt. A job completes when every shard has been reported.
+class ErasureMgmt
+{
+public:
+   struct Job
+   {
+      std::string m_strFile;		// original file for a conversion, shard directory for a repair
+      bool m_bConvert;			// if the job converts a replicated file into shards
+      int64_t m_llTimeStamp;		// time stamp of the original file when the conversion started
+      int64_t m_llStartTime;		// when the job started
+      int m_iPending;			// shards not reported yet
+      int m_iFailed;			// shards that could not be created
+   };
+
+public:
+   ErasureMgmt();
+   ~ErasureMgmt();
+
+public:
+   bool isActive(const std::string& file);
+   void insert(const Job& job, const std::vector<int>& transid);
+
+      // Functionality:
+      //    record the report of one shard.
+      // Parameters:
+      //    1) [in] transid: transaction that created the shard
+      //    2) [in] success: if the shard was created
+      //    3) [out] job: the job, when it is complete
+      // Returned value:
+      //    1 if all shards of the job have been created, -1 if the job completed with failures, 0 otherwise.
+
+   int finish(const int& transid, const bool& success, Job& job);
+   int expire(const int64_t& timeout, std::vector<Job>& expired);
+   int getTotalNum();
+
+public:
+   static const int m_iLockKey = -1;		// user key of the read lock that keeps a file unchanged while it is converted
+
+private:
+   std::map<std::string, Job> m_mJobs;		// active jobs
+   std::map<int, std::string> m_mTransFile;	// transaction ID -> job
+
+   CMutex m_Lock;
+};
+
 } // namespace sector
 
 #endif
@@ -21,7 +21,9 @@ written by
 
 #include <cassert>
 #include <iostream>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "replica.h"
 
@@ -61,9 +63,69 @@ int test1()
    return 0;
 }
 
+int test2()
+{
+   RecoveryScheduler rs;
+   rs.setBudget(1, 0);
+
+   // sources are spread over the replicas, and a node takes one transfer in each direction
+   vector<int> src;
+   src.push_back(1);
+   src.push_back(2);
+   int s1 = rs.chooseSource(src);
+   assert((s1 == 1) || (s1 == 2));
+   rs.start(100, s1, 3, 1000);
+   int s2 = rs.chooseSource(src);
+   assert((s2 == 1) || (s2 == 2));
+   assert(s2 != s1);
+   rs.start(101, s2, 4, 1000);
+   assert(rs.chooseSource(src) < 0);
+
+   set<int> busy;
+   rs.getBusyNodes(busy);
+   assert(busy.size() == 2);
+   assert(busy.count(3) && busy.count(4));
+
+   int64_t pending, done, rate, eta, trans;
+   rs.update(3000);
+   rs.getProgress(pending, done, rate, eta, trans);
+   assert((pending == 5000) && (done == 0) && (trans == 2));
+
+   rs.finish(100, true);
+   rs.finish(101, false);
+   rs.getProgress(pending, done, rate, eta, trans);
+   assert((pending == 3000) && (done == 1000) && (trans == 0));
+   assert(rs.chooseSource(src) >= 0);
+   rs.getBusyNodes(busy);
+   assert(busy.empty());
+
+   // a lost node releases its transfers
+   rs.start(102, 1, 5, 1000);
+   rs.removeNode(5);
+   rs.getProgress(pending, done, rate, eta, trans);
+   assert(trans == 0);
+   assert(rs.chooseSource(src) >= 0);
+
+   // with a bandwidth budget, a node is paced even below the transfer limit
+   RecoveryScheduler paced;
+   paced.setBudget(8, 1000000);
+   paced.start(200, 1, 3, 10000000);
+   vector<int> one(1, 1);
+   assert(paced.chooseSource(one) < 0);
+   paced.getBusyNodes(busy);
+   assert(busy.count(3));
+
+   rs.update(0);
+   rs.getProgress(pending, done, rate, eta, trans);
+   assert((pending == 0) && (eta == 0));
+
+   return 0;
+}
+
 int main()
 {
    test1();
+   test2();
 
    return 0;
 }
@@ -28,6 +28,7 @@ written by
 
 #include <cstring>
 #include <algorithm>
+#include <functional>
 
 #include "common.h"
 #include "../common/log.h"
@@ -52,13 +53,6 @@ namespace
 
       return myLogger;
    }
-
-   struct SortByFreeSpace {
-      explicit SortByFreeSpace( const std::map<int,SlaveNode>& slaveList ) : slaveList( slaveList ) {}
-      bool operator()( int lhs, int rhs ) const { return slaveList.find( lhs )->second.m_llAvailDiskSpace > slaveList.find( rhs )->second.m_llAvailDiskSpace; }
-     private:
-      const std::map<int,SlaveNode>& slaveList;
-   };
 }
 
 
@@ -88,6 +82,11 @@ int SlaveManager::init(Topology* topo)
 
    m_pTopology = topo;
 
+   // random seed for node placement
+   timeval t;
+   gettimeofday(&t, 0);
+   srand(t.tv_usec);
+
    Cluster* pc = &m_Cluster;
 
    // insert 0/0/0/....
@@ -164,6 +163,9 @@ int SlaveManager::insert(SlaveNode& sn)
    addr.m_iPort = sn.m_iPort;
    m_mAddrList[addr] = sn.m_iNodeID;
 
+   m_mIPNodes[sn.m_strIP].insert(sn.m_iNodeID);
+   updateindex_(sn);
+
    Cluster* sc = &m_Cluster;
    map<int, Cluster>::iterator pc = sc->m_mSubCluster.end();
    for (vector<int>::iterator i = sn.m_viPath.begin(); ;)
@@ -254,6 +256,16 @@ int SlaveManager::remove(int nodeid)
       //something wrong
    }
 
+   map<string, set<int> >::iterator n = m_mIPNodes.find(sn->second.m_strIP);
+   if (n != m_mIPNodes.end())
+   {
+      n->second.erase(nodeid);
+      if (n->second.empty())
+         m_mIPNodes.erase(n);
+   }
+   sn->second.m_iStatus = SlaveStatus::DOWN;
+   updateindex_(sn->second);
+
    m_mSlaveList.erase(sn);
 
    m_llLastUpdateTime = CTimer::getTime();
@@ -318,33 +330,30 @@ bool SlaveManager::checkduplicateslave_(const string& ip, const string& path, in
    return false;
 }
 
-int SlaveManager::chooseReplicaNode(set<int>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist, const vector<int>* restrict_loc)
+int SlaveManager::chooseReplicaNode(set<int>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist, const vector<int>* restrict_loc, const set<int>* busy)
 {
    CGuardEx sg(m_SlaveLock);
-   return choosereplicanode_(loclist, sn, filesize, rep_dist, restrict_loc);
+
+   const SlaveNode* best = NULL;
+   int rc = choosereplicanode_(loclist, best, filesize, rep_dist, restrict_loc, busy);
+   if (rc > 0)
+      copynode_(*best, sn);
+
+   return rc;
 }
 
-int SlaveManager::choosereplicanode_(set<int>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist, const vector<int>* restrict_loc)
+void SlaveManager::copynode_(const SlaveNode& src, SlaveNode& dst)
 {
-   // If all source nodes are busy, we should skip the replica.
-   /*
-   bool idle = false;
-   for (set<int>::const_iterator i = loclist.begin(); i != loclist.end(); ++ i)
-   {
-      // TODO: each slave may set a capacity limit, which could be more than 2 active trasactions.
-      if (m_mSlaveList[*i].m_iActiveTrans <= 1)
-      {
-         idle = true;
-         break;
-      }
-   }
-   if (!idle)
-      return -1;
-   */
-
-   vector< set<int> > avail;
-   avail.resize(m_pTopology->m_uiLevel + 2);
+   // callers only need to know where the chosen node is, its statistics and IO maps are not copied
+   dst.m_iNodeID = src.m_iNodeID;
+   dst.m_strIP = src.m_strIP;
+   dst.m_iPort = src.m_iPort;
+   dst.m_iDataPort = src.m_iDataPort;
+   dst.m_viPath = src.m_viPath;
+}
 
+int SlaveManager::choosereplicanode_(set<int>& loclist, const SlaveNode*& sn, const int64_t& filesize, const int rep_dist, const vector<int>* restrict_loc, const set<int>* busy)
+{
    // find the topology of current replicas
    vector< vector<int> > locpath;
    set<string> usedIP;
@@ -357,162 +366,293 @@ int SlaveManager::choosereplicanode_(set<int>& loclist, SlaveNode& sn, const int
       usedIP.insert(p->second.m_strIP);
    }
 
-   // TODO: this should not be calcuated each time.
+   vector<int> no_limit;
+   vector<NodePool*> pools;
+   getpools_(no_limit, restrict_loc, pools);
+   set<NodePool*> allowed(pools.begin(), pools.end());
+   bool unrestricted = (pools.size() == 1) && (pools[0] == &m_NormalNodes);
 
-   for (map<int, SlaveNode>::iterator i = m_mSlaveList.begin(); i != m_mSlaveList.end(); ++ i)
+   // group the topology paths by their distance to the current replicas, furthest first;
+   // we want to maximize the distance to the closest replica
+   map<int, vector<NodePool*>, greater<int> > bylevel;
+   for (map<vector<int>, NodePool>::iterator p = m_mPathNodes.begin(); p != m_mPathNodes.end(); ++ p)
    {
-      // skip bad&lost slaves
-      if (i->second.m_iStatus != SlaveStatus::NORMAL)
+      if (p->second.m_viNodes.empty() || p->first.empty())
          continue;
 
-      // only nodes with more than minimum availale disk space are chosen
-      if (i->second.m_llAvailDiskSpace < (m_llSlaveMinDiskSpace + filesize))
-         continue;
+      if (!unrestricted)
+      {
+         map<int, NodePool>::iterator c = m_mClusterNodes.find(p->first.back());
+         if ((c == m_mClusterNodes.end()) || (allowed.find(&c->second) == allowed.end()))
+            continue;
+      }
 
-      // cannot replicate to a node already having the data
-      if (loclist.find(i->first) != loclist.end())
+      int level = m_pTopology->min_distance(p->first, locpath);
+
+      // if users define a replication distance, then only nodes within rep_dist can be chosen
+      // We do not want to replicate on the same node (level == 0), even if they are different slaves.
+      if ((level == 0) || ((rep_dist >= 0) && (level > rep_dist)))
          continue;
 
-      // if a location restriction is applied to the file, only limited nodes can be chosen
-      if ((NULL != restrict_loc) && (!restrict_loc->empty()))
+      bylevel[level].push_back(&p->second);
+   }
+
+   // Power of two choices within the furthest level that has eligible nodes: compare a couple of nodes
+   // sampled without replacement and keep the least busy, then the one with most free space.
+   // If most nodes of the level are not eligible (e.g., full), sampling goes through all of them.
+   for (map<int, vector<NodePool*>, greater<int> >::iterator l = bylevel.begin(); l != bylevel.end(); ++ l)
+   {
+      int total = 0;
+      for (vector<NodePool*>::iterator p = l->second.begin(); p != l->second.end(); ++ p)
+         total += (*p)->m_viNodes.size();
+
+      SlaveNode* best = NULL;
+      int found = 0;
+      map<int, int> swapped;	// sparse Fisher-Yates shuffle of the positions 0 .. total - 1
+      for (int k = 0; (k < total) && (found < m_iSampleSize); ++ k)
       {
+         int j = k + rand() % (total - k);
+         map<int, int>::iterator sj = swapped.find(j);
+         map<int, int>::iterator sk = swapped.find(k);
+         int pos = (sj == swapped.end()) ? j : sj->second;
+         swapped[j] = (sk == swapped.end()) ? k : sk->second;
+
+         int id = nodeat_(l->second, pos);
+         map<int, SlaveNode>::iterator i = m_mSlaveList.find(id);
+         if (i == m_mSlaveList.end())
+            continue;
+         SlaveNode* s = &i->second;
 
-         int clusterId = i->second.m_viPath.back();
-         if( std::find( restrict_loc->begin(), restrict_loc->end(), clusterId ) == restrict_loc->end() ) 
-         {
+         // only nodes with more than minimum availale disk space are chosen
+         if (s->m_llAvailDiskSpace < (m_llSlaveMinDiskSpace + filesize))
             continue;
-         }
+
+         // cannot replicate to a node already having the data
+         if (loclist.find(id) != loclist.end())
+            continue;
+
+         // skip nodes that have used up their replication budget
+         if ((NULL != busy) && (busy->find(id) != busy->end()))
+            continue;
+
+         // if level is 1, it is possible there is a replica on slave on same node (same IP)
+         // this can happen is several slaves started per node, one slave per volume
+         if ((l->first == 1) && (usedIP.find(s->m_strIP) != usedIP.end()))
+            continue;
+
+         ++ found;
+
+         if ((NULL == best) || (s->m_iActiveTrans < best->m_iActiveTrans) ||
+             ((s->m_iActiveTrans == best->m_iActiveTrans) && (s->m_llAvailDiskSpace > best->m_llAvailDiskSpace)))
+            best = s;
       }
 
-      // Calculate the distance from this slave node to the current replicas
-      // We want maximize the distance to closest node.
-      int level = m_pTopology->min_distance(i->second.m_viPath, locpath);
+      if (NULL != best)
+      {
+         sn = best;
+         return 1;
+      }
+   }
 
-      // if users define a replication distance, then only nodes within rep_dist can be chosen
-      if ((rep_dist >= 0) && (level > rep_dist))
-         continue;
+   return SectorError::E_NODISK;
+}
 
-      // if level is 1, it is possible there is a replica on slave on same node (same IP)
-      // we do not want to have more than 1 replica per node
-      // this can happen is several slaves started per node, one slave per volume
-      if ( level == 1 )
+int SlaveManager::choosewritenode_(const string& ip, const SlaveNode*& sn, const int64_t& reserve, const vector<int>& path_limit, const vector<int>* restrict_loc)
+{
+   vector<NodePool*> pools;
+   getpools_(path_limit, restrict_loc, pools);
+
+   // a slave on the client's own node is always the nearest
+   map<string, set<int> >::iterator local = m_mIPNodes.find(ip);
+   if (local != m_mIPNodes.end())
+   {
+      SlaveNode* best = NULL;
+      for (set<int>::iterator i = local->second.begin(); i != local->second.end(); ++ i)
       {
-        set<string>::iterator fs = usedIP.find(i->second.m_strIP);
-        if (fs != usedIP.end())
-          continue;
+         map<int, SlaveNode>::iterator s = m_mSlaveList.find(*i);
+         if ((s == m_mSlaveList.end()) || (s->second.m_iStatus != SlaveStatus::NORMAL))
+            continue;
+         if (s->second.m_llAvailDiskSpace <= (m_llSlaveMinDiskSpace + reserve))
+            continue;
+
+         bool allowed = false;
+         for (vector<NodePool*>::iterator p = pools.begin(); !allowed && (p != pools.end()); ++ p)
+            allowed = (*p)->m_mPos.find(*i) != (*p)->m_mPos.end();
+         if (!allowed)
+            continue;
+
+         if ((NULL == best) || (s->second.m_iActiveTrans < best->m_iActiveTrans))
+            best = &s->second;
       }
 
-      // level <= m_pTopology->m_uiLevel + 1.
-      // We do not want to replicate on the same node (level == 0), even if they are different slaves.
-      if (level > 0)
-         avail[level].insert(i->first);
+      if (NULL != best)
+      {
+         sn = best;
+         return 1;
+      }
    }
 
-   set<int>* candidate = NULL;
-   // choose furthest node within replica distance
-   for (int i = m_pTopology->m_uiLevel + 1; i > 0; -- i)
+   // otherwise prefer the client's cluster, then any allowed cluster
+   vector<int> client_path;
+   int client_cluster = -1;
+   if ((m_pTopology->lookup(ip.c_str(), client_path) >= 0) && !client_path.empty())
+      client_cluster = client_path.back();
+
+   vector<NodePool*> rack;
+   bool unrestricted = (pools.size() == 1) && (pools[0] == &m_NormalNodes);
+   map<int, NodePool>::iterator c = m_mClusterNodes.find(client_cluster);
+   if ((c != m_mClusterNodes.end()) && (unrestricted || (find(pools.begin(), pools.end(), &c->second) != pools.end())))
+      rack.push_back(&c->second);
+
+   for (int round = (rack.empty() ? 1 : 0); round < 2; ++ round)
    {
-      if (!avail[i].empty())
+      vector<NodePool*>& cand = (round == 0) ? rack : pools;
+      int total = 0;
+      for (vector<NodePool*>::iterator p = cand.begin(); p != cand.end(); ++ p)
+         total += (*p)->m_viNodes.size();
+      if (total == 0)
+         continue;
+
+      // Power of two choices: the least busy of two random eligible nodes, then the one with more free space.
+      SlaveNode* best = NULL;
+      int found = 0;
+      vector<int> scan;
+      for (int probe = 0; (found < m_iSampleSize) && (probe < m_iMaxProbes + total); ++ probe)
       {
-         candidate = &avail[i];
-         break;
+         int id;
+         if (probe < m_iMaxProbes)
+            id = samplenode_(cand, total);
+         else
+         {
+            if (scan.empty())
+            {
+               for (vector<NodePool*>::iterator p = cand.begin(); p != cand.end(); ++ p)
+                  scan.insert(scan.end(), (*p)->m_viNodes.begin(), (*p)->m_viNodes.end());
+            }
+            id = scan[probe - m_iMaxProbes];
+         }
+
+         map<int, SlaveNode>::iterator i = m_mSlaveList.find(id);
+         if (i == m_mSlaveList.end())
+            continue;
+         SlaveNode* s = &i->second;
+
+         // only nodes with more than minimum available disk space are chosen
+         if (s->m_llAvailDiskSpace <= (m_llSlaveMinDiskSpace + reserve))
+            continue;
+
+         ++ found;
+
+         if ((NULL == best) || (s->m_iActiveTrans < best->m_iActiveTrans) ||
+             ((s->m_iActiveTrans == best->m_iActiveTrans) && (s->m_llAvailDiskSpace > best->m_llAvailDiskSpace)))
+            best = s;
+      }
+
+      if (NULL != best)
+      {
+         sn = best;
+         return 1;
       }
    }
 
-   if (NULL == candidate)
-      return SectorError::E_NODISK;
+   return SectorError::E_NODISK;
+}
+
+void SlaveManager::NodePool::insert(const int& id)
+{
+   if (m_mPos.find(id) != m_mPos.end())
+      return;
+
+   m_mPos[id] = m_viNodes.size();
+   m_viNodes.push_back(id);
+}
 
-/*
-   int lvl = 0;
-   log().trace << "Available slaves" << std::endl;
-   for ( vector <set <int> >::const_iterator vi = avail.begin(); vi != avail.end(); ++vi)
+void SlaveManager::NodePool::remove(const int& id)
+{
+   map<int, int>::iterator p = m_mPos.find(id);
+   if (p == m_mPos.end())
+      return;
+
+   // move the last node into the vacant position
+   int last = m_viNodes.back();
+   m_viNodes[p->second] = last;
+   m_mPos[last] = p->second;
+   m_viNodes.pop_back();
+   m_mPos.erase(id);
+}
+
+void SlaveManager::updateindex_(const SlaveNode& sn)
+{
+   if (sn.m_viPath.empty())
+      return;
+
+   if (sn.m_iStatus == SlaveStatus::NORMAL)
    {
-      log().trace << "Level " << lvl << " ";
-      for ( set< int >::const_iterator si = vi->begin(); si != vi->end(); ++si)
-        log().trace << *si << ",";
-      log().trace << std::endl;
-      lvl++;
+      m_NormalNodes.insert(sn.m_iNodeID);
+      m_mClusterNodes[sn.m_viPath.back()].insert(sn.m_iNodeID);
+      m_mPathNodes[sn.m_viPath].insert(sn.m_iNodeID);
    }
-  
-   log().trace << "Candidate slaves ";
-   for (set<int>::const_iterator cs = candidate->begin(); cs != candidate->end(); ++ cs)
-     log().trace << *cs << ",";
-   log().trace << std::endl;
-*/
-/*
-   int64_t totalFreeSpaceOnCandidates = 0;
-   for( set<int>::iterator j = candidate->begin(); j != candidate->end(); ++j )
+   else
    {
-       totalFreeSpaceOnCandidates += m_mSlaveList[*j].m_llAvailDiskSpace;
+      m_NormalNodes.remove(sn.m_iNodeID);
+      map<int, NodePool>::iterator c = m_mClusterNodes.find(sn.m_viPath.back());
+      if (c != m_mClusterNodes.end())
+         c->second.remove(sn.m_iNodeID);
+      map<vector<int>, NodePool>::iterator p = m_mPathNodes.find(sn.m_viPath);
+      if (p != m_mPathNodes.end())
+         p->second.remove(sn.m_iNodeID);
    }
-   int64_t avgFreeSpaceOnCandidates = totalFreeSpaceOnCandidates / candidate->size();
-
-   for( set<int>::iterator c = candidate->begin(); c != candidate->end(); )
-       if( m_mSlaveList[*c].m_llAvailDiskSpace < avgFreeSpaceOnCandidates )
-       {
-           set<int>::iterator tmp = c++;
-           candidate->erase( tmp );
-       }
-       else
-           ++c;
-*/
-
-   std::vector<int> slavesOrderedByFreeSpace( candidate->begin(), candidate->end() );
-   std::sort( slavesOrderedByFreeSpace.begin(), slavesOrderedByFreeSpace.end(), SortByFreeSpace( m_mSlaveList ) );
-
-   slavesOrderedByFreeSpace.resize( slavesOrderedByFreeSpace.size() / 2 + slavesOrderedByFreeSpace.size() % 2 );
-   candidate->clear();
-   candidate->insert( slavesOrderedByFreeSpace.begin(), slavesOrderedByFreeSpace.end() );
-
-   // Choose a random node.
-   timeval t;
-   gettimeofday(&t, 0);
-   srand(t.tv_usec);
-   int r = int(candidate->size() * (double(rand()) / RAND_MAX));
-   set<int>::iterator n = candidate->begin();
-   for (int i = 0; i < r; ++ i)
-      n ++;
+}
 
-   // If there is no other active transaction on this node, return.
-   if( m_mSlaveList.find( *n ) == m_mSlaveList.end() )
-      log().error << __PRETTY_FUNCTION__ << ": (1) about to add new slave to list " << *n << std::endl;
+void SlaveManager::getpools_(const vector<int>& path_limit, const vector<int>* restrict_loc, vector<NodePool*>& pools)
+{
+   pools.clear();
 
-   sn = m_mSlaveList[*n];
-   if (sn.m_iActiveTrans == 0)
+   bool restricted = (NULL != restrict_loc) && !restrict_loc->empty();
+   if (path_limit.empty() && !restricted)
    {
-//      log().trace << "Choosen slave without active transactions " << sn.m_iNodeID << std::endl;
-      return 1;
+      pools.push_back(&m_NormalNodes);
+      return;
    }
 
-   // Choose node with lowest number of active transactions.
-   set<int>::iterator s = n;
-   do
+   // if both the client and the file limit the location, only clusters in both lists can be chosen
+   const vector<int>& clusters = restricted ? *restrict_loc : path_limit;
+   set<int> added;
+   for (vector<int>::const_iterator i = clusters.begin(); i != clusters.end(); ++ i)
    {
-      if (++s == candidate->end())
-         s = candidate->begin();
-      if( m_mSlaveList.find( *s ) == m_mSlaveList.end() )
-         log().error << __PRETTY_FUNCTION__ << ": (2) about to add new slave to list " << *s << std::endl;
-      if (m_mSlaveList[*s].m_iActiveTrans < sn.m_iActiveTrans)
-      {
-         sn = m_mSlaveList[*s];
-         if (sn.m_iActiveTrans == 0)
-            break;
-      }
-   } while (s != n);
+      if (restricted && !path_limit.empty() && (find(path_limit.begin(), path_limit.end(), *i) == path_limit.end()))
+         continue;
+      if (!added.insert(*i).second)
+         continue;
 
-//   log().trace << "Choosen slave with lowest no of active transactions " << sn.m_iNodeID << std::endl;
+      map<int, NodePool>::iterator c = m_mClusterNodes.find(*i);
+      if (c != m_mClusterNodes.end())
+         pools.push_back(&c->second);
+   }
+}
 
-   return 1;
+int SlaveManager::samplenode_(const vector<NodePool*>& pools, const int& total)
+{
+   return nodeat_(pools, rand() % total);
 }
- 
+
+int SlaveManager::nodeat_(const vector<NodePool*>& pools, int pos)
+{
+   for (vector<NodePool*>::const_iterator p = pools.begin(); p != pools.end(); ++ p)
+   {
+      int size = (*p)->m_viNodes.size();
+      if (pos < size)
+         return (*p)->m_viNodes[pos];
+      pos -= size;
+   }
+
+   return -1;
+}
+
 int SlaveManager::chooseIONode(set<int>& loclist, int mode, vector<SlaveNode>& sl, const SF_OPT& option, const int rep_dist, const vector<int>* restrict_loc)
 {
    CGuardEx sg(m_SlaveLock);
 
-   timeval t;
-   gettimeofday(&t, 0);
-   srand(t.tv_usec);
-
    sl.clear();
 
    if (m_mSlaveList.empty())
@@ -520,12 +660,13 @@ int SlaveManager::chooseIONode(set<int>& loclist, int mode, vector<SlaveNode>& s
 
    if (!loclist.empty())
    {
-      SlaveNode sn;
+      const SlaveNode* sn = NULL;
       int rc = findNearestNode(loclist, option.m_strHintIP, sn);
       if( rc < 0 )
           return rc;
 
-      sl.push_back(sn);
+      sl.push_back(SlaveNode());
+      copynode_(*sn, sl.back());
 
       // if this is a READ_ONLY operation, one node is enough
       if ((mode & SF_MODE::WRITE) == 0)
@@ -534,13 +675,14 @@ int SlaveManager::chooseIONode(set<int>& loclist, int mode, vector<SlaveNode>& s
       // the first node will be the closest to the client; the client writes to that node only
       for (set<int>::iterator i = loclist.begin(); i != loclist.end(); i ++)
       {
-         if (*i == sn.m_iNodeID)
+         if (*i == sn->m_iNodeID)
             continue;
 
          if( m_mSlaveList.find( *i ) == m_mSlaveList.end() ) 
             log().error << __PRETTY_FUNCTION__ << ":  about to add new slave to list " << *i << std::endl;
 
-         sl.push_back(m_mSlaveList[*i]);
+         sl.push_back(SlaveNode());
+         copynode_(m_mSlaveList[*i], sl.back());
       }
    }
    else
@@ -549,52 +691,17 @@ int SlaveManager::chooseIONode(set<int>& loclist, int mode, vector<SlaveNode>& s
       if ((mode & SF_MODE::WRITE) == 0)
          return 0;
 
-      //TODO: optimize the node selection process; no need to scan all nodes
-
-      set<int> avail;
-
       vector<int> path_limit;
       if (option.m_strCluster.c_str()[0] != '\0')
          Topology::parseTopo(option.m_strCluster.c_str(), path_limit);
 
-      for (map<int, SlaveNode>::iterator i = m_mSlaveList.begin(); i != m_mSlaveList.end(); ++ i)
-      {
-         // skip bad & lost nodes
-         if (i->second.m_iStatus != SlaveStatus::NORMAL) {
-            continue;
-         }
-
-         // if client specifies a cluster ID, then only nodes on the cluster are chosen
-         if (!path_limit.empty())
-         {
-            int clusterId = i->second.m_viPath.back();
-            if( std::find( path_limit.begin(), path_limit.end(), clusterId ) == path_limit.end() ) {
-               continue;
-            }
-         }
-
-         // if there is location restriction on the file, check path as well
-         if ((NULL != restrict_loc) && (!restrict_loc->empty()))
-         {
-            int clusterId = i->second.m_viPath.back();
-            if( std::find( restrict_loc->begin(), restrict_loc->end(), clusterId ) == restrict_loc->end() ) {
-               continue;
-            }
-         }
-
-         // only nodes with more than minimum available disk space are chosen
-         if (i->second.m_llAvailDiskSpace > (m_llSlaveMinDiskSpace + option.m_llReservedSize))
-            avail.insert(i->first);
-      }
-
-      if (avail.empty())
+      // the first node is the nearest one to the client
+      const SlaveNode* sn = NULL;
+      if (choosewritenode_(option.m_strHintIP, sn, option.m_llReservedSize, path_limit, restrict_loc) <= 0)
          return SectorError::E_NODISK;
 
-     
-      SlaveNode sn;
-      findNearestNode(avail, option.m_strHintIP, sn);
-
-      sl.push_back(sn);
+      sl.push_back(SlaveNode());
+      copynode_(*sn, sl.back());
 
       // otherwise choose more nodes for immediate replica
       for (int i = 0; i < option.m_iReplicaNum - 1; ++ i)
@@ -603,17 +710,18 @@ int SlaveManager::chooseIONode(set<int>& loclist, int mode, vector<SlaveNode>& s
          for (vector<SlaveNode>::iterator j = sl.begin(); j != sl.end(); ++ j)
             locid.insert(j->m_iNodeID);
 
-         if (choosereplicanode_(locid, sn, option.m_llReservedSize, rep_dist, restrict_loc) <= 0)
+         if (choosereplicanode_(locid, sn, option.m_llReservedSize, rep_dist, restrict_loc, NULL) <= 0)
             break;
 
-         sl.push_back(sn);
+         sl.push_back(SlaveNode());
+         copynode_(*sn, sl.back());
       }
    }
 
    return sl.size();
 }
 
-int SlaveManager::chooseReplicaNode(set<Address, AddrComp>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist, const vector<int>* restrict_loc)
+int SlaveManager::chooseReplicaNode(set<Address, AddrComp>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist, const vector<int>* restrict_loc, const set<int>* busy)
 {
    set<int> locid;
    for (set<Address, AddrComp>::iterator i = loclist.begin(); i != loclist.end(); ++ i)
@@ -621,7 +729,7 @@ int SlaveManager::chooseReplicaNode(set<Address, AddrComp>& loclist, SlaveNode&
       locid.insert(m_mAddrList[*i]);
    }
 
-   return chooseReplicaNode(locid, sn, filesize, rep_dist, restrict_loc);
+   return chooseReplicaNode(locid, sn, filesize, rep_dist, restrict_loc, busy);
 }
 
 int SlaveManager::chooseIONode(set<Address, AddrComp>& loclist, int mode, vector<SlaveNode>& sl, const SF_OPT& option, const int rep_dist, const vector<int>* restrict_loc)
@@ -767,6 +875,7 @@ int SlaveManager::updateSlaveInfo(const Address& addr, const char* info, const i
       s->second.m_iStatus = SlaveStatus::NORMAL;
       s->second.m_bDiskLowWarning = false;
    }
+   updateindex_(s->second);
 
    return 0;
 }
@@ -839,6 +948,8 @@ int SlaveManager::checkBadAndLost(map<int, SlaveNode>& bad, map<int, SlaveNode>&
          lost[i->first] = i->second;
          i->second.m_iStatus = SlaveStatus::DOWN;
       }
+
+      updateindex_(i->second);
    }
 
    return 0;
@@ -922,6 +1033,21 @@ int SlaveManager::getSlaveAddr(const int& id, Address& addr)
    return 0;
 }
 
+int SlaveManager::getSlaveDataAddr(const int& id, Address& addr)
+{
+   CGuardEx sg(m_SlaveLock);
+
+   map<int, SlaveNode>::iterator i = m_mSlaveList.find(id);
+
+   if (i == m_mSlaveList.end())
+      return -1;
+
+   addr.m_strIP = i->second.m_strIP;
+   addr.m_iPort = i->second.m_iDataPort;
+
+   return 0;
+}
+
 int SlaveManager::voteBadSlaves(const Address& voter, int num, const char* buf)
 {
    CGuardEx sg(m_SlaveLock);
@@ -1171,6 +1297,7 @@ int SlaveManager::checkStorageBalance(map<int64_t, Address>& lowdisk, bool force
       {
          i->second.m_iStatus = SlaveStatus::NORMAL;
          i->second.m_bDiskLowWarning = false;
+         updateindex_(i->second);
       }
 
       if (i->second.m_iStatus == SlaveStatus::NORMAL)
@@ -1215,6 +1342,7 @@ int SlaveManager::checkStorageBalance(map<int64_t, Address>& lowdisk, bool force
 
            i->second.m_iStatus = SlaveStatus::DISKFULL;
            i->second.m_bDiskLowWarning = true;
+           updateindex_(i->second);
 
            log().trace << "Storage balance for " << i->second.m_strIP << ":" << i->second.m_iPort 
              << " avgAvailableCluster: " << avgAvailableDiskSpacePerCluster[ i->second.m_viPath.back() ] 
@@ -1229,7 +1357,7 @@ int SlaveManager::checkStorageBalance(map<int64_t, Address>& lowdisk, bool force
    return lowdisk.size();
 }
 
-int SlaveManager::findNearestNode(std::set<int>& loclist, const std::string& ip, SlaveNode& sn)
+int SlaveManager::findNearestNode(std::set<int>& loclist, const std::string& ip, const SlaveNode*& sn)
 {
    if (loclist.empty())
       return SectorError::E_NODISK;
@@ -1259,11 +1387,11 @@ int SlaveManager::findNearestNode(std::set<int>& loclist, const std::string& ip,
 
       if( m_mSlaveList.find( n ) == m_mSlaveList.end() )
          log().error << __PRETTY_FUNCTION__ << ": (2) about to add new slave to list " << n << std::endl;
-   sn = m_mSlaveList[n];
+   sn = &m_mSlaveList[n];
 
    // choose node with least active transactions; disabled as this is dangerous to get certan nodes starved
    // re-enabled by sergey
-   if (sn.m_iActiveTrans == 0)
+   if (sn->m_iActiveTrans == 0)
       return 0;
 
    // if the chosen node already serves other transactions, choose the next one with minimum number of transactions
@@ -1273,10 +1401,10 @@ int SlaveManager::findNearestNode(std::set<int>& loclist, const std::string& ip,
 
       if( m_mSlaveList.find( dist_vec[dist][index] ) == m_mSlaveList.end() )
          log().error << __PRETTY_FUNCTION__ << ": about to add new slave to list " << dist_vec[dist][index] << std::endl;
-      if (m_mSlaveList[dist_vec[dist][index]].m_iActiveTrans < sn.m_iActiveTrans)
+      if (m_mSlaveList[dist_vec[dist][index]].m_iActiveTrans < sn->m_iActiveTrans)
       {
-         sn = m_mSlaveList[dist_vec[dist][index]];
-         if (sn.m_iActiveTrans == 0)
+         sn = &m_mSlaveList[dist_vec[dist][index]];
+         if (sn->m_iActiveTrans == 0)
             break;
       }
    }
@@ -43,10 +43,10 @@ public:
 
    bool checkDuplicateSlave(const std::string& ip, const std::string& path, int32_t& id, Address& addr);
 
-public:
-   int chooseReplicaNode(std::set<int>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist = 65536, const std::vector<int>* restrict_loc = NULL);
+public: // the chosen nodes carry only their ID, addresses and topology path
+   int chooseReplicaNode(std::set<int>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist = 65536, const std::vector<int>* restrict_loc = NULL, const std::set<int>* busy = NULL);
    int chooseIONode(std::set<int>& loclist, int mode, std::vector<SlaveNode>& sl, const SF_OPT& option, const int rep_dist = 65536, const std::vector<int>* restrict_loc = NULL);
-   int chooseReplicaNode(std::set<Address, AddrComp>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist = 65536, const std::vector<int>* restrict_loc = NULL);
+   int chooseReplicaNode(std::set<Address, AddrComp>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist = 65536, const std::vector<int>* restrict_loc = NULL, const std::set<int>* busy = NULL);
    int chooseIONode(std::set<Address, AddrComp>& loclist, int mode, std::vector<SlaveNode>& sl, const SF_OPT& option, const int rep_dist = 65536, const std::vector<int>* restrict_loc = NULL);
    int chooseSPENodes(const Address& client, std::vector<SlaveNode>& sl);
    int chooseLessReplicaNode(std::set<Address, AddrComp>& loclist, Address& addr);
@@ -61,6 +61,7 @@ public:
    int deserializeSlaveList(int num, const char* buf, int size);
    int getSlaveID(const Address& addr);
    int getSlaveAddr(const int& id, Address& addr);
+   int getSlaveDataAddr(const int& id, Address& addr);
    int voteBadSlaves(const Address& voter, int num, const char* buf);
    unsigned int getNumberOfClusters();
    unsigned int getNumberOfSlaves();
@@ -81,8 +82,33 @@ private:
    bool checkduplicateslave_(const std::string& ip, const std::string& path, int32_t& id, Address& addr);
    void updateclusterstat_(Cluster& c);
    void updateclusterio_(Cluster& c, std::map<std::string, int64_t>& data_in, std::map<std::string, int64_t>& data_out, int64_t& total);
-   int choosereplicanode_(std::set<int>& loclist, SlaveNode& sn, const int64_t& filesize, const int rep_dist, const std::vector<int>* restrict_loc);
-   int findNearestNode(std::set<int>& loclist, const std::string& ip, SlaveNode& sn);
+   int choosereplicanode_(std::set<int>& loclist, const SlaveNode*& sn, const int64_t& filesize, const int rep_dist, const std::vector<int>* restrict_loc, const std::set<int>* busy);
+   int choosewritenode_(const std::string& ip, const SlaveNode*& sn, const int64_t& reserve, const std::vector<int>& path_limit, const std::vector<int>* restrict_loc);
+   int findNearestNode(std::set<int>& loclist, const std::string& ip, const SlaveNode*& sn);
+   static void copynode_(const SlaveNode& src, SlaveNode& dst);
+
+private: // placement index
+   struct NodePool
+   {
+      std::vector<int> m_viNodes;				// slave IDs, unordered, for O(1) random sampling
+      std::map<int, int> m_mPos;				// slave ID -> position in m_viNodes
+
+      void insert(const int& id);
+      void remove(const int& id);
+   };
+
+   void updateindex_(const SlaveNode& sn);
+   void getpools_(const std::vector<int>& path_limit, const std::vector<int>* restrict_loc, std::vector<NodePool*>& pools);
+   int samplenode_(const std::vector<NodePool*>& pools, const int& total);
+   int nodeat_(const std::vector<NodePool*>& pools, int pos);
+
+   NodePool m_NormalNodes;					// all slaves in NORMAL status
+   std::map<int, NodePool> m_mClusterNodes;			// NORMAL slaves per cluster ID (last level of the topology path)
+   std::map<std::vector<int>, NodePool> m_mPathNodes;		// NORMAL slaves per topology path
+   std::map<std::string, std::set<int> > m_mIPNodes;		// slaves running on each IP address
+
+   static const int m_iSampleSize = 2;				// number of eligible candidates compared for each placement
+   static const int m_iMaxProbes = 32;				// random probes before falling back to a scan, for write nodes
 
 private:
    std::map<Address, int, AddrComp> m_mAddrList;		// list of slave addresses
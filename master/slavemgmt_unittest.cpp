@@ -20,24 +20,193 @@ written by
 *****************************************************************************/
 
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <unistd.h>
 
-#include "slavemgmt.h"
+#include "common.h"
+#include "meta.h"
+#include "sector.h"
 #include "topology.h"
+#include "slavemgmt.h"
 
 using namespace std;
-using namespace sector;
+
+// 8 clusters of 16 racks; slaves in 10.<cluster>.<rack>.0/24
+const char* topo_file = "/tmp/slavemgmt_unittest.topo";
+
+int init_topology(Topology& topo)
+{
+   ofstream ofs(topo_file);
+   for (int c = 1; c <= 8; ++ c)
+      for (int r = 1; r <= 16; ++ r)
+         ofs << "10." << c << "." << r << ".0/24 /" << r << "/" << c << endl;
+   ofs.close();
+
+   int res = topo.init(topo_file);
+   unlink(topo_file);
+   return res;
+}
+
+string slave_ip(int i, int per_ip)
+{
+   int host = i / per_ip;
+   stringstream ip;
+   ip << "10." << (host % 8) + 1 << "." << (host / 8) % 16 + 1 << "." << (host / 128) + 1;
+   return ip.str();
+}
+
+void add_slaves(SlaveManager& smgmt, int num, int per_ip)
+{
+   for (int i = 0; i < num; ++ i)
+   {
+      SlaveNode sn;
+      sn.m_iNodeID = i;
+      sn.m_strIP = slave_ip(i, per_ip);
+      sn.m_iPort = 6000 + i % per_ip;
+      stringstream path;
+      path << "/data" << i % per_ip;
+      sn.m_strStoragePath = path.str();
+      sn.m_llAvailDiskSpace = 20000000000LL + (rand() % 1000) * 1000000000LL;
+      assert(smgmt.insert(sn) > 0);
+   }
+}
 
 int test1()
 {
+   // placement of a new file and its replicas
+   Topology topo;
+   assert(init_topology(topo) > 0);
+
+   SlaveManager smgmt;
+   smgmt.init(&topo);
+   add_slaves(smgmt, 256, 2);
+   assert(smgmt.getNumberOfSlaves() == 256);
+
+   set<int> loclist;
+   vector<SlaveNode> sl;
+   SF_OPT option;
+   option.m_iReplicaNum = 3;
+
+   // a client running on a slave node writes locally first
+   option.m_strHintIP = "10.3.2.1";
+   assert(smgmt.chooseIONode(loclist, SF_MODE::WRITE, sl, option) == 3);
+   assert(sl[0].m_strIP == option.m_strHintIP);
+
+   // replicas are never placed on the same IP address
+   set<string> ips;
+   for (vector<SlaveNode>::iterator i = sl.begin(); i != sl.end(); ++ i)
+      ips.insert(i->m_strIP);
+   assert(ips.size() == 3);
+
+   // a new file cannot be opened for read
+   assert(smgmt.chooseIONode(loclist, SF_MODE::READ, sl, option) == 0);
+
+   // location restrictions are respected
+   vector<int> restrict_loc;
+   restrict_loc.push_back(5);
+   option.m_strHintIP = "192.168.0.1";
+   for (int i = 0; i < 100; ++ i)
+   {
+      assert(smgmt.chooseIONode(loclist, SF_MODE::WRITE, sl, option, 65536, &restrict_loc) > 0);
+      for (vector<SlaveNode>::iterator j = sl.begin(); j != sl.end(); ++ j)
+         assert(j->m_viPath.back() == 5);
+   }
+
+   // removed slaves are never chosen again
+   for (int i = 0; i < 255; ++ i)
+      smgmt.remove(i);
+   option.m_iReplicaNum = 1;
+   assert(smgmt.chooseIONode(loclist, SF_MODE::WRITE, sl, option) == 1);
+   assert(sl[0].m_iNodeID == 255);
+   smgmt.remove(255);
+   assert(smgmt.chooseIONode(loclist, SF_MODE::WRITE, sl, option) < 0);
+
+   return 0;
+}
+
+int test2()
+{
+   // placement throughput with 10,000 slaves
+   Topology topo;
+   assert(init_topology(topo) > 0);
+
    SlaveManager smgmt;
+   smgmt.init(&topo);
+   add_slaves(smgmt, 10000, 4);
+
+   set<int> loclist;
+   vector<SlaveNode> sl;
+   SF_OPT option;
+   option.m_iReplicaNum = 3;
+   option.m_strHintIP = "192.168.0.1";
+
+   const int num = 100000;
+   int64_t start = CTimer::getTime();
+   for (int i = 0; i < num; ++ i)
+   {
+      assert(smgmt.chooseIONode(loclist, SF_MODE::WRITE, sl, option) == 3);
+      smgmt.incActTrans(sl[0].m_iNodeID);
+   }
+   int64_t duration = CTimer::getTime() - start;
+
+   cout << "chooseIONode with 10000 slaves: " << num << " placements in " << duration / 1000 << " ms, "
+        << duration * 1000 / num << " ns per placement" << endl;
+
+   return 0;
+}
+
+int test3()
+{
+   // a new replica always goes to the furthest topology group from the existing ones
+   Topology topo;
+   assert(init_topology(topo) > 0);
+
+   SlaveManager smgmt;
+   smgmt.init(&topo);
+   add_slaves(smgmt, 1024, 2);
+
+   for (int i = 0; i < 1024; ++ i)
+   {
+      set<int> loc;
+      loc.insert(i);
+      SlaveNode sn;
+      assert(smgmt.chooseReplicaNode(loc, sn, 65536) > 0);
+      assert(sn.m_iNodeID != i);
+   }
 
-   // init topology
+   for (int n = 0; n < 1000; ++ n)
+   {
+      set<int> loc;
+      vector< vector<int> > locpath;
+      for (int r = 0; r < 2; ++ r)
+      {
+         int id = rand() % 1024;
+         loc.insert(id);
+         vector<int> path;
+         assert(topo.lookup(slave_ip(id, 2).c_str(), path) >= 0);
+         locpath.push_back(path);
+      }
 
-   SlaveNode sn;
-   sn
+      unsigned int maxdist = 0;
+      for (int i = 0; i < 1024; ++ i)
+      {
+         vector<int> path;
+         topo.lookup(slave_ip(i, 2).c_str(), path);
+         unsigned int d = topo.min_distance(path, locpath);
+         if (d > maxdist)
+            maxdist = d;
+      }
 
+      SlaveNode sn;
+      assert(smgmt.chooseReplicaNode(loc, sn, 65536) > 0);
+      assert(loc.find(sn.m_iNodeID) == loc.end());
+      assert(topo.min_distance(sn.m_viPath, locpath) == maxdist);
+   }
 
    return 0;
 }
@@ -45,6 +214,8 @@ int test1()
 int main()
 {
    test1();
+   test2();
+   test3();
 
    return 0;
 }
@@ -26,6 +26,88 @@ written by
 using namespace std;
 
 
+PathTrie::PathTrie()
+{
+   clear();
+}
+
+void PathTrie::clear()
+{
+   m_vNodes.clear();
+   m_vNodes.resize(1);
+   m_vNodes[0].m_bEnd = false;
+}
+
+void PathTrie::insert(const string& dir)
+{
+   // "/" covers everything. Otherwise every '/' separated component, empty ones included, is a
+   // level, so "/a/b" covers "/a/b" and "/a/b/..." but not "/a/bc", same as a prefix comparison
+   // that stops at a '/' boundary.
+
+   int node = 0;
+
+   if (dir.length() > 1)
+   {
+      string::size_type s = (dir[0] == '/') ? 1 : 0;
+      while (true)
+      {
+         string::size_type t = dir.find('/', s);
+         string name = (t == string::npos) ? dir.substr(s) : dir.substr(s, t - s);
+
+         map<string, int>::iterator c = m_vNodes[node].m_mChild.find(name);
+         if (c == m_vNodes[node].m_mChild.end())
+         {
+            m_vNodes.push_back(Node());
+            m_vNodes.back().m_bEnd = false;
+            c = m_vNodes[node].m_mChild.insert(make_pair(name, int(m_vNodes.size() - 1))).first;
+         }
+         node = c->second;
+
+         if (t == string::npos)
+            break;
+         s = t + 1;
+      }
+   }
+
+   m_vNodes[node].m_bEnd = true;
+}
+
+bool PathTrie::match(const string& path) const
+{
+   if (m_vNodes[0].m_bEnd)
+      return true;
+
+   if (path.empty() || (path[0] != '/'))
+      return false;
+
+   string name;
+   string::size_type s = 1;
+   int node = 0;
+
+   while (true)
+   {
+      string::size_type t = path.find('/', s);
+      if (t == string::npos)
+         name.assign(path, s, string::npos);
+      else
+         name.assign(path, s, t - s);
+
+      map<string, int>::const_iterator c = m_vNodes[node].m_mChild.find(name);
+      if (c == m_vNodes[node].m_mChild.end())
+         return false;
+      node = c->second;
+
+      if (m_vNodes[node].m_bEnd)
+         return true;
+
+      if (t == string::npos)
+         break;
+      s = t + 1;
+   }
+
+   return false;
+}
+
 int User::deserialize(vector<string>& dirs, const string& buf)
 {
    unsigned int s = 0;
@@ -48,33 +130,26 @@ bool User::match(const string& path, int32_t rwx) const
    // check read flag bit 1 and write flag bit 2
    rwx &= 3;
 
-   if ((rwx & 1) != 0)
-   {
-      for (vector<string>::const_iterator i = m_vstrReadList.begin(); i != m_vstrReadList.end(); ++ i)
-      {
-         if ((path.length() >= i->length()) && (path.substr(0, i->length()) == *i) && ((path.length() == i->length()) || (path.c_str()[i->length()] == '/') || (*i == "/")))
-         {
-            rwx ^= 1;
-            break;
-         }
-      }
-   }
+   if (((rwx & 1) != 0) && m_ReadACL.match(path))
+      rwx ^= 1;
 
-   if ((rwx & 2) != 0)
-   {
-      for (vector<string>::const_iterator i = m_vstrWriteList.begin(); i != m_vstrWriteList.end(); ++ i)
-      {
-         if ((path.length() >= i->length()) && (path.substr(0, i->length()) == *i) && ((path.length() == i->length()) || (path.c_str()[i->length()] == '/') || (*i == "/")))
-         {
-            rwx ^= 2;
-            break;
-         }
-      }
-   }
+   if (((rwx & 2) != 0) && m_WriteACL.match(path))
+      rwx ^= 2;
 
    return (rwx == 0);
 }
 
+void User::compileACL()
+{
+   m_ReadACL.clear();
+   for (vector<string>::const_iterator i = m_vstrReadList.begin(); i != m_vstrReadList.end(); ++ i)
+      m_ReadACL.insert(*i);
+
+   m_WriteACL.clear();
+   for (vector<string>::const_iterator i = m_vstrWriteList.begin(); i != m_vstrWriteList.end(); ++ i)
+      m_WriteACL.insert(*i);
+}
+
 void User::incUseCount()
 {
    ++m_iUseCount;
@@ -199,6 +274,7 @@ int UserManager::insert(User* u)
 {
    CGuardEx ug(m_Lock);
 
+   u->compileACL();
    m_mActiveUsers[u->m_iKey] = u;
    return 0;
 }
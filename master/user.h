@@ -29,11 +29,48 @@ written by
 #include <stdint.h>
 #include <osportable.h>
 
+class PathTrie
+{
+public:
+   PathTrie();
+
+public:
+   void clear();
+
+      // Functionality:
+      //    add a directory; it covers itself and everything below it. "/" covers all paths.
+      // Parameters:
+      //    0) [in] dir: directory name, starting with "/"
+      // Returned value:
+      //    None.
+
+   void insert(const std::string& dir);
+
+      // Functionality:
+      //    check if a path is covered by any directory inserted so far.
+      // Parameters:
+      //    0) [in] path: file or directory name
+      // Returned value:
+      //    true if covered, otherwise false.
+
+   bool match(const std::string& path) const;
+
+private:
+   struct Node
+   {
+      std::map<std::string, int> m_mChild;	// path component -> child node index
+      bool m_bEnd;				// an inserted directory ends here
+   };
+
+   std::vector<Node> m_vNodes;			// node 0 is the root "/"
+};
+
 class User
 {
 public:
    int deserialize(std::vector<std::string>& dirs, const std::string& buf);
    bool match(const std::string& path, int rwx) const;
+   void compileACL();
 
    void incUseCount();
    bool decUseCount();
@@ -60,6 +97,8 @@ public:
    int64_t m_llLastRefreshTime;			// timestamp of last activity
    std::vector<std::string> m_vstrReadList;	// readable directories
    std::vector<std::string> m_vstrWriteList;	// writable directories
+   PathTrie m_ReadACL;				// compiled m_vstrReadList, see compileACL()
+   PathTrie m_WriteACL;				// compiled m_vstrWriteList
    bool m_bExec;				// permission to run Sphere application
    
    int m_iUseCount;
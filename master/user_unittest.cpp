@@ -0,0 +1,116 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+/*****************************************************************************
+written by
+   bdl62, last updated 05/21/2011
+*****************************************************************************/
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "common.h"
+#include "user.h"
+
+using namespace std;
+
+// reference: the prefix scan User::match used before the ACLs were compiled
+bool ref_match(const vector<string>& list, const string& path)
+{
+   for (vector<string>::const_iterator i = list.begin(); i != list.end(); ++ i)
+   {
+      if ((path.length() >= i->length()) && (path.substr(0, i->length()) == *i) && ((path.length() == i->length()) || (path.c_str()[i->length()] == '/') || (*i == "/")))
+         return true;
+   }
+   return false;
+}
+
+int test1()
+{
+   User u;
+   u.m_vstrReadList.push_back("/a/b");
+   u.m_vstrReadList.push_back("/c/");
+   u.m_vstrWriteList.push_back("/a/b/w");
+   u.compileACL();
+
+   const char* paths[] = {"/a/b", "/a/b/x", "/a/bc", "/a", "/", "/c", "/c/", "/c/x", "/c//x", "/a/b/w/1", "/a/b/wx", "a/b"};
+   for (int i = 0; i < 12; ++ i)
+   {
+      assert(u.match(paths[i], SF_MODE::READ) == ref_match(u.m_vstrReadList, paths[i]));
+      assert(u.match(paths[i], SF_MODE::WRITE) == ref_match(u.m_vstrWriteList, paths[i]));
+      assert(u.match(paths[i], SF_MODE::READ | SF_MODE::WRITE) == (ref_match(u.m_vstrReadList, paths[i]) && ref_match(u.m_vstrWriteList, paths[i])));
+   }
+
+   // "/" grants everything
+   u.m_vstrReadList.push_back("/");
+   u.compileACL();
+   assert(u.match("/x/y/z", SF_MODE::READ));
+   assert(!u.match("/x/y/z", SF_MODE::WRITE));
+
+   return 0;
+}
+
+// large ACL list: compare with the prefix scan
+int test2()
+{
+   User u;
+   for (int i = 0; i < 2000; ++ i)
+   {
+      stringstream dir;
+      dir << "/project" << i % 200 << "/user" << i;
+      u.m_vstrReadList.push_back(dir.str());
+   }
+   u.compileACL();
+
+   const int num = 20000;
+   vector<string> paths;
+   for (int i = 0; i < num; ++ i)
+   {
+      stringstream path;
+      path << "/project" << rand() % 220 << "/user" << rand() % 2200 << "/data/file" << i;
+      paths.push_back(path.str());
+   }
+
+   for (int i = 0; i < num; ++ i)
+      assert(u.match(paths[i], SF_MODE::READ) == ref_match(u.m_vstrReadList, paths[i]));
+
+   int64_t start = CTimer::getTime();
+   int found = 0;
+   for (int i = 0; i < num; ++ i)
+      found += ref_match(u.m_vstrReadList, paths[i]);
+   int64_t scan = CTimer::getTime() - start;
+
+   start = CTimer::getTime();
+   for (int i = 0; i < num; ++ i)
+      found += u.match(paths[i], SF_MODE::READ);
+   int64_t trie = CTimer::getTime() - start;
+
+   cout << "ACL match with " << u.m_vstrReadList.size() << " directories: scan " << scan * 1000 / num << " ns, trie "
+        << trie * 1000 / num << " ns per check (" << found << ")" << endl;
+
+   return 0;
+}
+
+int main()
+{
+   test1();
+   test2();
+
+   return 0;
+}
@@ -50,8 +50,14 @@ written by
    << LogEnd(); \
 }
 
+#define DBG_CPY( msg ) \
+{\
+  m_SectorLog << LogStart(LogLevel::LEVEL_9) << "file " << src << " " <<  msg << LogEnd(); \
+}
+
 #include "slave.h"
 #include "writelog.h"
+#include "erasure.h"
 
 using namespace std;
 using namespace sector;
@@ -74,6 +80,7 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
    unsigned char crypto_iv[8];
    memcpy(crypto_key, ((Param2*)p)->crypto_key, 16);
    memcpy(crypto_iv, ((Param2*)p)->crypto_iv, 8);
+   int cipher = ((Param2*)p)->cipher;
    string master_ip = ((Param2*)p)->master_ip;
    int master_port = ((Param2*)p)->master_port;
    delete (Param2*)p;
@@ -120,9 +127,9 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
    if (bSecure)
    {
       encoder = new Crypto;
-      encoder->initEnc(crypto_key, crypto_iv);
+      encoder->initEnc(crypto_key, crypto_iv, cipher);
       decoder = new Crypto;
-      decoder->initDec(crypto_key, crypto_iv);      
+      decoder->initDec(crypto_key, crypto_iv, cipher);
    }
 
    //create a new directory or file in case it does not exist
@@ -163,6 +170,13 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
    if (!fhandle) 
       ERR_MSG("Error opening file");
 
+   // reads are checked against the block checksums, until the file is written in this session
+   BlockChecksum checksum;
+   bool verify = bRead && self->loadChecksum(sname, checksum);
+   bool corrupted = false;
+   int64_t bad_block = -1;
+   WriteLog changes;
+
    // a file session is successful only if the client issue a close() request
    bool success = true;
    bool run = true;
@@ -199,6 +213,14 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
                response = -1;
             }
 
+            // a corrupted block is never sent; the client will read from another replica
+            if ((response == 0) && verify && (checksum.verify(fhandle, offset, size, bad_block) < 0))
+            {
+               ERR_MSG("Checksum mismatch in block " << bad_block);
+               corrupted = true;
+               response = -1;
+            }
+
             if (response == -1)
                ERR_MSG("Sending response -1");
 
@@ -289,6 +311,8 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
 
             // update write log
             writelog.insert(offset, size);
+            changes.insert(offset, size);
+            verify = false;
             file_change = true;
             if (writes < 4) // logging first 3 writes
                DBG_MSG("Write offset " << offset << " size " << size);    
@@ -332,6 +356,14 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
             while (tosend > 0)
             {
                int64_t block = (tosend < unit) ? tosend : unit;
+               if (verify && (checksum.verify(fhandle, offset + sent, block, bad_block) < 0))
+               {
+                  ERR_MSG("Checksum mismatch in block " << bad_block);
+                  corrupted = true;
+                  success = false;
+                  break;
+               }
+
                if (self->m_DataChn.sendfile(client_ip, client_port, transid, fhandle, offset + sent, block, encoder) < 0)
                {
                   success = false;
@@ -424,6 +456,8 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
 
             // update write log
             writelog.insert(0, size);
+            changes.insert(0, recd);
+            verify = false;
             file_change = true;
 
             break;
@@ -559,6 +593,18 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
       utime(filename.c_str(), &ut);
    }
 
+   // bring the checksums up to date while the file is still locked, so that no other writer can interfere
+   if (bWrite)
+   {
+      SNode s;
+      LocalFS::stat(filename, s);
+      if (file_change || (s.m_llSize != orig_size) || (s.m_llTimeStamp != orig_ts))
+      {
+         if (self->updateChecksum(sname, bTrunc ? -1 : orig_size, orig_ts, &changes) < 0)
+            ERR_MSG("Error updating checksums");
+      }
+   }
+
    gettimeofday(&t2, 0);
    int duration = t2.tv_sec - t1.tv_sec;
    double avgRS = 0;
@@ -619,6 +665,9 @@ DWORD WINAPI Slave::fileHandler(LPVOID p)
       self->m_DataChn.sendError(client_ip, client_port, transid);
    }
 
+   if (corrupted)
+      self->reportBadReplica(master_ip, master_port, sname, bad_block);
+
    return NULL;
 }
 
@@ -628,14 +677,16 @@ void* Slave::copy(void* p)
 DWORD WINAPI Slave::copy(LPVOID p)
 #endif
 {
-   int rc;
    Slave* self = ((Param3*)p)->serv_instance;
    int transid = ((Param3*)p)->transid;
    int dir = ((Param3*)p)->dir;
    string src = ((Param3*)p)->src;
    string dst = ((Param3*)p)->dst;
+   string src_ip = ((Param3*)p)->src_ip;
    string master_ip = ((Param3*)p)->master_ip;
    int master_port = ((Param3*)p)->master_port;
+   vector<string> batch;
+   batch.swap(((Param3*)p)->batch);
    delete (Param3*)p;
 
    if (src.c_str()[0] == '\0')
@@ -645,303 +696,662 @@ DWORD WINAPI Slave::copy(LPVOID p)
 
    DBG_REP(" Replication start");
 
-   bool success = true;
+   // replicas keep the time stamp of the original copy; files created by "cp" have new time stamps
+   bool replica = (src == dst);
 
-   queue<string> tr;	// files to be replicated
-   queue<string> td;	// directories to be explored
+   // list the whole source tree first, then copy the files in parallel
+   vector<CopyJob> files;
+   vector<string> dirs;
+   vector<string> failed;
+   bool listed = true;
+   if (2 == dir)
+   {
+      // a batch of a directory copy; the other files of the tree are copied by other slaves
+      for (vector<string>::iterator i = batch.begin(); i != batch.end(); ++ i)
+      {
+         if (!i->empty() && ('/' == (*i)[i->length() - 1]))
+         {
+            string path = i->substr(0, i->length() - 1);
+            if (self->listTree(src + path, dst + path, files, dirs) < 0)
+            {
+               DBG_REP("Error listing directory " << src + path);
+               failed.push_back(dst + path);
+            }
+         }
+         else
+         {
+            CopyJob job;
+            job.m_strSource = src + *i;
+            job.m_strDest = dst + *i;
+            job.m_bSuccess = false;
+            files.push_back(job);
+         }
+      }
+   }
+   else if (dir > 0)
+   {
+      if (self->listTree(src, dst, files, dirs) < 0)
+      {
+         DBG_REP("Error listing directory " << src);
+         listed = false;
+      }
+   }
+   else
+   {
+      CopyJob job;
+      job.m_strSource = src;
+      job.m_strDest = dst;
+      job.m_bSuccess = false;
+      files.push_back(job);
+   }
+
+   if (listed && !files.empty())
+   {
+      ThreadJobQueue jobs;
+      for (vector<CopyJob>::iterator i = files.begin(); i != files.end(); ++ i)
+         jobs.push(&*i);
+
+      int workers = self->m_SysConfig.m_iCopyThreads;
+      if (workers > int(files.size()))
+         workers = files.size();
+      if (workers < 1)
+         workers = 1;
+      jobs.release(workers);
+
+      DBG_REP("Copying " << files.size() << " files with " << workers << " threads");
+
+      CopyTask task;
+      task.m_pSlave = self;
+      task.m_pJobs = &jobs;
+      task.m_strSourceIP = src_ip;
+      task.m_strMasterIP = master_ip;
+      task.m_iMasterPort = master_port;
+      task.m_bReplica = replica;
+
+      vector<pthread_t> handler(workers);
+      for (int i = 0; i < workers; ++ i)
+      {
+#ifndef WIN32
+         pthread_create(&handler[i], NULL, copyWorker, &task);
+#else
+         handler[i] = CreateThread(NULL, 0, copyWorker, &task, 0, NULL);
+#endif
+      }
+
+      for (int i = 0; i < workers; ++ i)
+      {
+#ifndef WIN32
+         pthread_join(handler[i], NULL);
+#else
+         WaitForSingleObject(handler[i], INFINITE);
+#endif
+      }
+   }
 
-   if (dir > 0)
-      td.push(src);
+   // move each completed file from the temporary dir to the real dir
+   vector<string> done;
+   if (listed)
+   {
+      for (vector<string>::iterator i = dirs.begin(); i != dirs.end(); ++ i)
+      {
+         if (self->createDir(*i) >= 0)
+            done.push_back(*i);
+      }
+
+      for (vector<CopyJob>::iterator i = files.begin(); i != files.end(); ++ i)
+      {
+         if (i->m_bSuccess)
+         {
+            self->createDir(i->m_strDest.substr(0, i->m_strDest.rfind('/')));
+            if (LocalFS::rename(self->m_strHomeDir + ".tmp" + i->m_strDest, self->m_strHomeDir + i->m_strDest) < 0)
+            {
+               DBG_REP("Error moving copied file from tmp " << i->m_strDest);
+               i->m_bSuccess = false;
+            }
+            else if (self->updateChecksum(i->m_strDest) < 0)
+            {
+               DBG_REP("Error computing checksums " << i->m_strDest);
+            }
+         }
+
+         if (i->m_bSuccess)
+            done.push_back(i->m_strDest);
+         else
+            failed.push_back(i->m_strDest);
+      }
+   }
    else
-      tr.push(src);
+   {
+      failed.push_back(dst);
+   }
 
-   while (!td.empty())
+   // remove what is left in the temporary dir: failed files, and the directory tree;
+   // other batches of the same tree may be staged there, so a batch only removes its own paths
+   if (2 == dir)
    {
-      // FIXME: The logic in this function just doesn't handle the case where there are
-      //        multiple files to be replicated and some fail while others succeed.
-      DBG_REP( "BUG: attempt to replicate whole directory; this DOES NOT WORK, skipping" );
-      success = false;
-      break;
+      for (vector<string>::iterator i = failed.begin(); i != failed.end(); ++ i)
+         LocalFS::erase(self->m_strHomeDir + ".tmp" + *i);
+      for (vector<string>::iterator i = batch.begin(); i != batch.end(); ++ i)
+      {
+         if (!i->empty() && ('/' == (*i)[i->length() - 1]))
+            LocalFS::erase(self->m_strHomeDir + ".tmp" + dst + i->substr(0, i->length() - 1));
+      }
+   }
+   else
+      LocalFS::erase(self->m_strHomeDir + ".tmp" + dst);
+
+   // the results of all files are reported at once; failures are listed separately if some files are done
+   int rc = 0;
+   if (!done.empty())
+   {
+      DBG_REP("Updating master with " << done.size() << " completed and " << failed.size() << " failed");
+      rc = self->report(master_ip, master_port, transid, done, replica ? +FileChangeType::FILE_UPDATE_REPLICA : +FileChangeType::FILE_UPDATE_NEW, &failed);
+   }
+   else
+   {
+      DBG_REP("Failed, no file is copied");
+      rc = self->report(master_ip, master_port, transid, failed, replica ? +FileChangeType::FILE_UPDATE_REPLICA_FAILED : +FileChangeType::FILE_UPDATE_NEW_FAILED);
+   }
+   if (rc < 0)
+      DBG_REP("Error reporting to master");
+
+   // clear this transaction
+   self->m_TransManager.updateSlave(transid, self->m_iSlaveID);
 
-      // If the file to be replicated is a directory, recursively list all files first
+   DBG_REP("Replication complete");
+
+   return NULL;
+}
 
+#ifndef WIN32
+void* Slave::copyWorker(void* p)
+#else
+DWORD WINAPI Slave::copyWorker(LPVOID p)
+#endif
+{
+   CopyTask* task = (CopyTask*)p;
+   Slave* self = task->m_pSlave;
+
+   while (true)
+   {
+      CopyJob* job = (CopyJob*)task->m_pJobs->pop();
+      if (NULL == job)
+         break;
+
+      job->m_bSuccess = self->copyFile(job->m_strSource, job->m_strDest, task->m_strSourceIP, task->m_strMasterIP, task->m_iMasterPort, task->m_bReplica) >= 0;
+      if (!job->m_bSuccess)
+         self->m_SectorLog << LogStart(LogLevel::LEVEL_9) << "file " << job->m_strSource << " copy failed" << LogEnd();
+   }
+
+   return NULL;
+}
+
+int Slave::listTree(const string& src, const string& dst, vector<CopyJob>& files, vector<string>& dirs)
+{
+   queue<string> td;	// directories to be explored
+   td.push(src);
+
+   while (!td.empty())
+   {
       string src_path = td.front();
       td.pop();
 
-      // try list this path
+      // list the directory on the master, without replica locations
       SectorMsg msg;
-      msg.setType(101);
+      msg.setType(114);
       msg.setKey(0);
       msg.setData(0, src_path.c_str(), src_path.length() + 1);
 
       Address addr;
-      self->m_Routing.lookup(src_path, addr);
+      m_Routing.lookup(src_path, addr);
+
+      if ((m_GMP.rpc(addr.m_strIP.c_str(), addr.m_iPort, &msg, &msg) < 0) || (msg.getType() < 0))
+         return -1;
+
+      string dst_path = dst + src_path.substr(src.length());
+      dirs.push_back(dst_path);
 
-      if (self->m_GMP.rpc(addr.m_strIP.c_str(), addr.m_iPort, &msg, &msg) < 0)
+      string filelist = msg.getData();
+      unsigned int s = 0;
+      while (s < filelist.length())
       {
-         success = false;
-         break;
+         int t = filelist.find(';', s);
+         SNode sn;
+         sn.deserialize(filelist.substr(s, t - s).c_str());
+         if (sn.m_bIsDir)
+            td.push(src_path + "/" + sn.m_strName);
+         else
+         {
+            CopyJob job;
+            job.m_strSource = src_path + "/" + sn.m_strName;
+            job.m_strDest = dst_path + "/" + sn.m_strName;
+            job.m_bSuccess = false;
+            files.push_back(job);
+         }
+         s = t + 1;
+      }
+   }
+
+   return files.size();
+}
+
+int Slave::copyFile(const string& src, const string& dst, const string& src_ip, const string& master_ip, const int& master_port, const bool& replica)
+{
+   //copy to .tmp first, then move to real location
+   if (createDir(string(".tmp") + dst.substr(0, dst.rfind('/'))) < 0)
+   {
+      DBG_CPY("Error creating temp dir");
+      return -1;
+   }
+
+   string tmp = m_strHomeDir + ".tmp" + dst;
+
+   SNode local;
+   if (m_pLocalFile->lookup(src.c_str(), local) >= 0)
+   {
+      //if file is local, copy directly
+
+      //IMPORTANT!!!
+      //local files must be read directly from local disk, and cannot be read via datachn due to its limitation
+      DBG_CPY("Local copy " << src);
+
+      // never copy a corrupted replica
+      int64_t bad = -1;
+      if (checkFile(src, 0, bad) < 0)
+      {
+         DBG_CPY("Checksum mismatch in block " << bad);
+         reportBadReplica(master_ip, master_port, src, bad);
+         return -1;
       }
 
-      // the master only returns positive if this is a directory
-      if (msg.getType() >= 0)
+      int rc = LocalFS::copy(m_strHomeDir + src, tmp);
+      if (rc < 0)
       {
-         // if this is a directory, create it, and put all files and sub-directories into the queue of files to be copied
+         DBG_CPY("Error in copy " << rc);
+         LocalFS::erase(tmp);
+         return -1;
+      }
+
+      if (replica)
+      {
+         utimbuf ut;
+         ut.actime = local.m_llTimeStamp;
+         ut.modtime = local.m_llTimeStamp;
+         utime(tmp.c_str(), &ut);
+      }
 
-         // create a local dir
-         string dst_path = dst;
-         if (src != src_path)
-            dst_path += "/" + src_path.substr(src.length() + 1, src_path.length() - src.length() - 1);
+      return 0;
+   }
 
-         //create at .tmp first, then move to real location
-         self->createDir(string(".tmp") + dst_path);
+   // open the file and copy it to local
+   SectorMsg msg;
+   msg.setType(110);
+   msg.setKey(0);
+
+   int32_t mode = SF_MODE::READ;
+   msg.setData(0, (char*)&mode, 4);
+   int32_t localport = m_DataChn.getPort();
+   msg.setData(4, (char*)&localport, 4);
+   int32_t len_name = src.length() + 1;
+   msg.setData(8, (char*)&len_name, 4);
+   msg.setData(12, src.c_str(), len_name);
+
+   // the master may ask to read from a particular replica, to spread the load of a recovery
+   int32_t len_opt = 0;
+   string opt_buf;
+   if (!src_ip.empty())
+   {
+      SF_OPT option;
+      option.m_strHintIP = src_ip;
+      option.serialize(opt_buf);
+      len_opt = opt_buf.length() + 1;
+   }
+   msg.setData(12 + len_name, (char*)&len_opt, 4);
+   if (len_opt > 0)
+      msg.setData(16 + len_name, opt_buf.c_str(), len_opt);
 
-         string filelist = msg.getData();
-         unsigned int s = 0;
-         while (s < filelist.length())
-         {
-            int t = filelist.find(';', s);
-            SNode sn;
-            sn.deserialize(filelist.substr(s, t - s).c_str());
-            if (sn.m_bIsDir)
-               td.push(src_path + "/" + sn.m_strName);
-            else
-               tr.push(src_path + "/" + sn.m_strName);
-            s = t + 1;
-         }
+   Address addr;
+   m_Routing.lookup(src, addr);
+
+   if ((m_GMP.rpc(addr.m_strIP.c_str(), addr.m_iPort, &msg, &msg) < 0) || (msg.getType() < 0))
+   {
+      DBG_CPY("Error opening file in slave");
+      return -1;
+   }
+
+   int32_t session = *(int32_t*)msg.getData();
+   int64_t size = *(int64_t*)(msg.getData() + 4);
+   time_t ts = *(int64_t*)(msg.getData() + 12);
+   string ip = msg.getData() + 24;
+   int32_t port = *(int32_t*)(msg.getData() + 64 + 24);
+
+   bool success = true;
 
-         continue;
+   DBG_CPY("Creating replica from " << ip << ":" << port);
+   if (!m_DataChn.isConnected(ip, port))
+   {
+      DBG_CPY("Not connected to slave - connect " << ip << ":" << port);
+      if (m_DataChn.connect(ip, port) < 0)
+      {
+         DBG_CPY("Failed to connect to slave " << ip << ":" << port);
+         success = false;
       }
    }
 
-   // FIXME: The logic in this function just doesn't handle the case where there are
-   //        multiple files to be replicated and some fail while others succeed.
-   if( tr.size() > 1 )
-      DBG_REP( "BUG: attempt to replicate multiple files; good luck if only some succeed." );
+   // download command: 3
+   int32_t cmd = 3;
+   if (success && (m_DataChn.send(ip, port, session, (char*)&cmd, 4) < 0))
+   {
+      DBG_CPY("Error sending download command");
+      success = false;
+   }
+
+   int64_t offset = 0;
+   if (success && (m_DataChn.send(ip, port, session, (char*)&offset, 8) < 0))
+   {
+      DBG_CPY("Error sending download command offset");
+      success = false;
+   }
 
-   while (!tr.empty())
+   int response = -1;
+   if (success && ((m_DataChn.recv4(ip, port, session, response) < 0) || (-1 == response)))
    {
-      string src_path = tr.front();
-      tr.pop();
+      DBG_CPY("Error receiving download response");
+      success = false;
+   }
 
-      SNode tmp;
-      if (self->m_pLocalFile->lookup(src_path.c_str(), tmp) >= 0)
+   fstream ofs;
+   if (success)
+   {
+      ofs.open(tmp.c_str(), ios::out | ios::binary | ios::trunc);
+      if (ofs.fail())
       {
-         //if file is local, copy directly
-         //note that in this case, src != dst, therefore this is a regular "cp" command, not a system replication
-
-         //IMPORTANT!!!
-         //local files must be read directly from local disk, and cannot be read via datachn due to its limitation
-         DBG_REP("Local copy");
-         string dst_path = dst;
-         if (src != src_path)
-            dst_path += "/" + src_path.substr(src.length() + 1, src_path.length() - src.length() - 1);
-
-         //copy to .tmp first, then move to real location
-         self->createDir(string(".tmp") + dst_path.substr(0, dst_path.rfind('/')));
-         rc = LocalFS::copy(self->m_strHomeDir + src_path, self->m_strHomeDir + ".tmp" + dst_path);
-         if (rc < 0 )
-           DBG_REP("Error in copy " << rc);
+         DBG_CPY("Error creating opening file");
+         success = false;
       }
-      else
+   }
+
+   if (success)
+   {
+      int64_t unit = 64000000; //send 64MB each time
+      int64_t torecv = size;
+      int64_t recd = 0;
+      while (torecv > 0)
       {
-         // open the file and copy it to local
-         SectorMsg msg;
-         msg.setType(110);
-         msg.setKey(0);
-
-         int32_t mode = SF_MODE::READ;
-         msg.setData(0, (char*)&mode, 4);
-         int32_t localport = self->m_DataChn.getPort();
-         msg.setData(4, (char*)&localport, 4);
-         int32_t len_name = src_path.length() + 1;
-         msg.setData(8, (char*)&len_name, 4);
-         msg.setData(12, src_path.c_str(), len_name);
-         int32_t len_opt = 0;
-         msg.setData(12 + len_name, (char*)&len_opt, 4);
-
-         Address addr;
-         self->m_Routing.lookup(src_path, addr);
-
-         if ((self->m_GMP.rpc(addr.m_strIP.c_str(), addr.m_iPort, &msg, &msg) < 0) || (msg.getType() < 0))
+         int64_t block = (torecv < unit) ? torecv : unit;
+         if (m_DataChn.recvfile(ip, port, session, ofs, offset + recd, block) < 0)
          {
-            DBG_REP("Error opening file in slave");
+            DBG_CPY("Error receiving block of data");
             success = false;
+            break;
          }
 
-         int32_t session;
-         int64_t size;
-         time_t ts;
-         string ip;
-         int32_t port;
+         recd += block;
+         torecv -= block;
+      }
 
-         if( success )
-         {
-             session = *(int32_t*)msg.getData();
-             size = *(int64_t*)(msg.getData() + 4);
-             ts = *(int64_t*)(msg.getData() + 12);
-             ip = msg.getData() + 24;
-             port = *(int32_t*)(msg.getData() + 64 + 24);
-
-             DBG_REP("Creating replica from " << ip << ":" << port);
-             if (!self->m_DataChn.isConnected(ip, port))
-             {
-                DBG_REP("Not connected to slave - connect " << ip << ":" << port);
-                if (self->m_DataChn.connect(ip, port) < 0)
-                {
-                   DBG_REP("Failed to connect to slave " << ip << ":" << port);
-                   success = false;
-                }
-             }
-         }
+      // update total received data size
+      m_SlaveStat.updateIO(ip, recd, +SlaveStat::SYS_IN);
+   }
 
-         // download command: 3
-         int32_t cmd = 3;
-         int rc = 0;
-         if( success )
-         {
-             rc = self->m_DataChn.send(ip, port, session, (char*)&cmd, 4);
-             if (rc < 0) 
-             {
-                 DBG_REP("Error sending download command");
-                 success = false;
-             }
-         }
+   ofs.close();
 
-         int64_t offset = 0;
-         if( success )
-         {
-             rc = self->m_DataChn.send(ip, port, session, (char*)&offset, 8);
-             if (rc < 0)
-             {
-                 DBG_REP("Error sending download command offset");
-                 success = false;
-             }
-         }
+   // FIXME: the next two commands can fail, but should failure mean the replication failed, or not?
+   //        Technically, we got the whole file;  it's just the source slave's state hasn't been
+   //        updated.  Right now, we're assuming success.
+   cmd = 5;
+   if (m_DataChn.send(ip, port, session, (char*)&cmd, 4) < 0)
+      DBG_CPY("Error sending close command");
+   if (m_DataChn.recv4(ip, port, session, cmd) < 0)
+      DBG_CPY("Error receiving close confirmation");
+
+   if (!success)
+   {
+      LocalFS::erase(tmp);
+      return -1;
+   }
+
+   if (replica)
+   {
+      //utime: update timestamp according to the original copy
+      utimbuf ut;
+      ut.actime = ts;
+      ut.modtime = ts;
+      utime(tmp.c_str(), &ut);
+   }
 
-         int response = -1;
-         if( success )
+   return 0;
+}
+
+#ifndef WIN32
+void* Slave::createShard(void* p)
+#else
+DWORD WINAPI Slave::createShard(LPVOID p)
+#endif
+{
+   Slave* self = ((Param6*)p)->serv_instance;
+   int transid = ((Param6*)p)->transid;
+   bool convert = ((Param6*)p)->convert;
+   int k = ((Param6*)p)->k;
+   int m = ((Param6*)p)->m;
+   int index = ((Param6*)p)->index;
+   int64_t size = ((Param6*)p)->size;
+   int64_t ts = ((Param6*)p)->timestamp;
+   string src = ((Param6*)p)->src;
+   string dst = ((Param6*)p)->dst;
+   string master_ip = ((Param6*)p)->master_ip;
+   int master_port = ((Param6*)p)->master_port;
+   delete (Param6*)p;
+
+   DBG_REP("Creating shard " << dst);
+
+   bool success = true;
+
+   ErasureCode ec;
+   if (ec.init(k, m) < 0)
+   {
+      DBG_REP("Invalid erasure code " << k << "+" << m);
+      success = false;
+   }
+
+   // convert: the k data columns are read from the original file
+   // rebuild: any k other shards of the file are read, and the file size and time stamp come from their headers
+   vector<SectorInput*> input;
+   vector<int> from;
+   if (success && convert)
+   {
+      input.push_back(new SectorInput);
+      if ((self->openSectorFile(src, *input[0]) < 0) || (input[0]->m_llSize != size))
+      {
+         DBG_REP("Error opening the original file");
+         success = false;
+      }
+   }
+   else if (success)
+   {
+      for (int i = 0; (i < k + m) && (int(from.size()) < k); ++ i)
+      {
+         if (i == index)
+            continue;
+
+         SectorInput* in = new SectorInput;
+         char buf[ECShard::m_iHdrSize];
+         ECShard hdr;
+         if ((self->openSectorFile(src + "/" + ECShard::shardName(k, m, i), *in) < 0)
+            || (self->readSectorFile(*in, 0, ECShard::m_iHdrSize, buf) < 0)
+            || (hdr.deserialize(buf) < 0) || (hdr.m_iK != k) || (hdr.m_iM != m) || (hdr.m_iIndex != i)
+            || (!from.empty() && ((hdr.m_llFileSize != size) || (hdr.m_llTimeStamp != ts))))
          {
-             if ((self->m_DataChn.recv4(ip, port, session, response) < 0) || (-1 == response))
-             {
-                DBG_REP("Error receiving download response");
-                success = false;
-             }
+            self->closeSectorFile(*in);
+            delete in;
+            continue;
          }
 
-         string dst_path = dst;
-         if (src != src_path)
-            dst_path += "/" + src_path.substr(src.length() + 1, src_path.length() - src.length() - 1);
+         size = hdr.m_llFileSize;
+         ts = hdr.m_llTimeStamp;
+         input.push_back(in);
+         from.push_back(i);
+      }
+
+      if (int(from.size()) < k)
+      {
+         DBG_REP("Only " << from.size() << " shards readable, " << k << " needed");
+         success = false;
+      }
+   }
 
-         if( success )
+   string dir = dst.substr(0, dst.rfind('/'));
+   fstream ofs;
+   if (success)
+   {
+      //write to .tmp first, then move to real location
+      if (self->createDir(string(".tmp") + dir) < 0)
+      {
+         DBG_REP("Error creating temp dir");
+         success = false;
+      }
+      else
+      {
+         ofs.open((self->m_strHomeDir + ".tmp" + dst).c_str(), ios::out | ios::binary | ios::trunc);
+         if (ofs.fail())
          {
-             //copy to .tmp first, then move to real location
-             rc = self->createDir(string(".tmp") + dst_path.substr(0, dst_path.rfind('/')));
-             if (rc < 0) 
-             {
-                 DBG_REP("Error creating temp dir");
-                 success = false;
-             }
+            DBG_REP("Error opening shard file");
+            success = false;
          }
+      }
+   }
 
-         fstream ofs;
-         if( success )
+   if (success)
+   {
+      ECShard hdr;
+      hdr.m_iK = k;
+      hdr.m_iM = m;
+      hdr.m_iIndex = index;
+      hdr.m_llFileSize = size;
+      hdr.m_llTimeStamp = ts;
+      char buf[ECShard::m_iHdrSize];
+      hdr.serialize(buf);
+      ofs.write(buf, ECShard::m_iHdrSize);
+
+      if (convert)
+      {
+         for (int i = 0; i < k; ++ i)
+            from.push_back(i);
+      }
+
+      // process the columns in blocks, so that a shard can be computed from k streams in bounded memory
+      const int64_t chunk = hdr.getChunkSize();
+      const int unit = 1024 * 1024;
+      vector<char> block(int64_t(k) * unit);
+      vector<char> result(unit);
+      vector<const char*> in(k);
+      for (int i = 0; i < k; ++ i)
+         in[i] = &block[int64_t(i) * unit];
+      char* out = &result[0];
+
+      for (int64_t off = 0; (off < chunk) && success; off += unit)
+      {
+         int len = (chunk - off < unit) ? int(chunk - off) : unit;
+
+         if (convert)
          {
-             ofs.open((self->m_strHomeDir + ".tmp" + dst_path).c_str(), ios::out | ios::binary | ios::trunc);
-             if (ofs.fail()) 
-             {
-                  DBG_REP("Error creating opening file");
+            // a data shard only needs its own column; the tail of the last columns is zero padded
+            int first = (index < k) ? index : 0;
+            int last = (index < k) ? index : k - 1;
+            for (int i = first; (i <= last) && success; ++ i)
+            {
+               char* b = &block[int64_t(i) * unit];
+               int64_t pos = i * chunk + off;
+               int64_t avail = size - pos;
+               if (avail > len)
+                  avail = len;
+               if (avail < 0)
+                  avail = 0;
+               memset(b + avail, 0, len - avail);
+               if ((avail > 0) && (self->readSectorFile(*input[0], pos, avail, b) < 0))
                   success = false;
-             }
-         }
+            }
 
-         if( success ) 
-         {
-         int64_t unit = 64000000; //send 64MB each time
-         int64_t torecv = size;
-         int64_t recd = 0;
-         while (torecv > 0)
+            if (index < k)
+               out = &block[int64_t(index) * unit];
+            else
+               ec.reconstruct(&from[0], &in[0], 1, &index, &out, len);
+         }
+         else
          {
-            int64_t block = (torecv < unit) ? torecv : unit;
-            if (self->m_DataChn.recvfile(ip, port, session, ofs, offset + recd, block) < 0)
+            for (int i = 0; (i < k) && success; ++ i)
             {
-               DBG_REP("Error receiving block of data");
-               success = false;
-               break;
+               if (self->readSectorFile(*input[i], ECShard::m_iHdrSize + off, len, &block[int64_t(i) * unit]) < 0)
+                  success = false;
             }
 
-            recd += block;
-            torecv -= block;
-         }
+            if (success)
+               ec.reconstruct(&from[0], &in[0], 1, &index, &out, len);
          }
 
-         // update total received data size
-         self->m_SlaveStat.updateIO(ip, size, +SlaveStat::SYS_IN);
-
-         ofs.close();
-
-         // FIXME: the next two commands can fail, but should failure mean the replication failed, or not?
-         //        Technically, we got the whole file;  it's just the source slave's state hasn't been
-         //        updated.  Right now, we're assuming success.
-         cmd = 5;
-         rc = self->m_DataChn.send(ip, port, session, (char*)&cmd, 4);
-         if (rc < 0) 
-             DBG_REP("Error sending close command");
-         rc = self->m_DataChn.recv4(ip, port, session, cmd);
-         if (rc < 0)
-             DBG_REP("Error receiving close confirmation");
+         if (!success)
+         {
+            DBG_REP("Error reading block at " << off);
+            break;
+         }
 
-         if( success )
+         ofs.write(out, len);
+         if (ofs.fail())
          {
-             if (src == dst)
-             {
-                //utime: update timestamp according to the original copy, for replica only; files created by "cp" have new timestamp
-                utimbuf ut;
-                ut.actime = ts;
-                ut.modtime = ts;
-                utime((self->m_strHomeDir + ".tmp" + dst_path).c_str(), &ut);
-             }
+            DBG_REP("Error writing shard file");
+            success = false;
          }
       }
+
+      ofs.close();
+   }
+
+   for (vector<SectorInput*>::iterator i = input.begin(); i != input.end(); ++ i)
+   {
+      self->closeSectorFile(**i);
+      delete *i;
    }
 
    if (success)
    {
-      // move from temporary dir to the real dir when the copy is completed
-      self->createDir(dst.substr(0, dst.rfind('/')));
-      rc = LocalFS::rename(self->m_strHomeDir + ".tmp" + dst, self->m_strHomeDir + dst);
-      if (rc < 0 ) 
+      // the shard carries the time stamp of the original file, so that the master can match them
+      utimbuf ut;
+      ut.actime = ts;
+      ut.modtime = ts;
+      utime((self->m_strHomeDir + ".tmp" + dst).c_str(), &ut);
+
+      self->createDir(dir);
+      if (LocalFS::rename(self->m_strHomeDir + ".tmp" + dst, self->m_strHomeDir + dst) < 0)
       {
-         DBG_REP("Error moving copied file from tmp");
+         DBG_REP("Error moving shard from tmp");
          success = false;
       }
+      else
+      {
+         self->updateChecksum(dst);
+      }
    }
 
-   if( success )
+   if (success)
    {
-      // if the file has been modified during the replication, remove this replica
-      int32_t type = (src == dst) ? +FileChangeType::FILE_UPDATE_REPLICA : +FileChangeType::FILE_UPDATE_NEW;
       DBG_REP("Updating master with success");
-      if (self->report(master_ip, master_port, transid, dst, type) < 0)
+      if (self->report(master_ip, master_port, transid, dst, +FileChangeType::FILE_UPDATE_NEW) < 0)
       {
-         DBG_REP("File was updated during replication, remove replica");
+         DBG_REP("Shard rejected by master, remove it");
          LocalFS::erase(self->m_strHomeDir + dst);
       }
    }
    else
    {
-      DBG_REP("Failed, remove all temporary files");
-      // failed, remove all temporary files
-      rc = LocalFS::erase(self->m_strHomeDir + ".tmp" + dst);
-      if (rc < 0) DBG_REP ("Error deleting temp file");
-      rc = self->report(master_ip, master_port, transid, std::vector<std::string>(1, dst), (src == dst) ? +FileChangeType::FILE_UPDATE_REPLICA_FAILED : +FileChangeType::FILE_UPDATE_NEW_FAILED);
-      if (rc < 0) DBG_REP ("Error reporting to master");
+      LocalFS::erase(self->m_strHomeDir + ".tmp" + dst);
+      if (self->report(master_ip, master_port, transid, std::vector<std::string>(1, dst), +FileChangeType::FILE_UPDATE_NEW_FAILED) < 0)
+         DBG_REP("Error reporting to master");
    }
 
    // clear this transaction
    self->m_TransManager.updateSlave(transid, self->m_iSlaveID);
 
-   DBG_REP("Replication complete");
+   DBG_REP("Shard creation complete");
 
    return NULL;
 }
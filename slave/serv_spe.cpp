@@ -21,11 +21,18 @@ written by
 
 #ifndef WIN32
    #include <dlfcn.h>
+   #include <utime.h>
+#else
+   #include <sys/types.h>
+   #include <sys/utime.h>
 #endif
 #include <algorithm>
+#include <climits>
 
 #include "slave.h"
 #include "sphere.h"
+#include "compress.h"
+#include "dhash.h"
 
 #ifdef WIN32
    #define snprintf sprintf_s
@@ -34,6 +41,16 @@ written by
 using namespace std;
 using namespace sector;
 
+namespace
+{
+   // normalized key prefix of a record and its position, sorted instead of the records themselves
+   struct MRKeyPos
+   {
+      uint64_t m_llKey;
+      int m_iPos;
+   };
+}
+
 SPEResult::~SPEResult()
 {
    for (vector<int64_t*>::iterator i = m_vIndex.begin(); i != m_vIndex.end(); ++ i)
@@ -132,12 +149,84 @@ void SPEResult::clear()
    m_llTotalDataSize = 0;
 }
 
+void SPEResult::swap(SPEResult& r)
+{
+   std::swap(m_iBucketNum, r.m_iBucketNum);
+   m_vIndexLen.swap(r.m_vIndexLen);
+   m_vIndex.swap(r.m_vIndex);
+   m_vIndexPhyLen.swap(r.m_vIndexPhyLen);
+   m_vDataLen.swap(r.m_vDataLen);
+   m_vData.swap(r.m_vData);
+   m_vDataPhyLen.swap(r.m_vDataPhyLen);
+   std::swap(m_llTotalDataSize, r.m_llTotalDataSize);
+}
+
+void SPEResult::append(const SPEResult& r)
+{
+   for (int b = 0; (b < m_iBucketNum) && (b < r.m_iBucketNum); ++ b)
+   {
+      int rows = r.m_vIndexLen[b] - 1;
+      if (rows <= 0)
+         continue;
+
+      // grow the buffers once for all the records
+      if (m_vIndexLen[b] + rows + 1 > m_vIndexPhyLen[b])
+      {
+         // an empty bucket has no index yet, its first entry is added below
+         int phylen = ((m_vIndexLen[b] > 0) ? m_vIndexLen[b] : 1) + rows + 256;
+         int64_t* tmp = new int64_t[phylen];
+
+         if (NULL != m_vIndex[b])
+         {
+            memcpy((char*)tmp, (char*)m_vIndex[b], m_vIndexLen[b] * 8);
+            delete [] m_vIndex[b];
+         }
+         else
+         {
+            tmp[0] = 0;
+            m_vIndexLen[b] = 1;
+         }
+         m_vIndex[b] = tmp;
+         m_vIndexPhyLen[b] = phylen;
+      }
+
+      int64_t base = m_vIndex[b][m_vIndexLen[b] - 1] - r.m_vIndex[b][0];
+      for (int i = 1; i <= rows; ++ i)
+         m_vIndex[b][m_vIndexLen[b] ++] = r.m_vIndex[b][i] + base;
+
+      int len = r.m_vDataLen[b];
+      if (m_vDataLen[b] + len > m_vDataPhyLen[b])
+      {
+         int inc_size = (len / 65536 + 1) * 65536;
+         char* tmp = new char[m_vDataPhyLen[b] + inc_size];
+
+         if (NULL != m_vData[b])
+         {
+            memcpy(tmp, m_vData[b], m_vDataLen[b]);
+            delete [] m_vData[b];
+         }
+         m_vData[b] = tmp;
+         m_vDataPhyLen[b] += inc_size;
+      }
+
+      memcpy(m_vData[b] + m_vDataLen[b], r.m_vData[b] + r.m_vIndex[b][0], len);
+      m_vDataLen[b] += len;
+      m_llTotalDataSize += len;
+   }
+}
+
 SPEDestination::SPEDestination():
 m_piSArray(NULL),
 m_piRArray(NULL),
 m_iLocNum(0),
 m_pcOutputLoc(NULL),
-m_piLocID(NULL)
+m_piLocID(NULL),
+m_llRawSize(0),
+m_iCompression(0),
+m_iSPEID(-1),
+m_iDSID(-1),
+m_llWireSize(0),
+m_llCompressTime(0)
 {
 }
 
@@ -175,6 +264,10 @@ void SPEDestination::reset(const int& buckets)
    }
    else
       m_piSArray[0] = m_piRArray[0] = 0;
+
+   m_llRawSize = 0;
+   m_llWireSize = 0;
+   m_llCompressTime = 0;
 }
 
 #ifndef WIN32
@@ -195,6 +288,8 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
    const char* param = ((Param4*)p)->param;
    const int psize = ((Param4*)p)->psize;
    const int type = ((Param4*)p)->type;
+   const int compress = ((Param4*)p)->compress;
+   const int threads = ((Param4*)p)->threads;
    const string master_ip = ((Param4*)p)->master_ip;
    const int master_port = ((Param4*)p)->master_port;
    delete (Param4*)p;
@@ -237,6 +332,8 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
       dest.m_strLocalFile = dest.m_pcOutputLoc;
    }
    dest.init(buckets);
+   dest.m_iCompression = compress;
+   dest.m_iSPEID = speid;
 
 
    // initialize processing function
@@ -244,6 +341,8 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
    SPHERE_PROCESS process = NULL;
    MR_MAP map = NULL;
    MR_PARTITION partition = NULL;
+   MRCombiner combiner;
+   const MRCombiner* combine = NULL;
    void* lh = NULL;
    self->openLibrary(key, function, lh);
    if (NULL == lh)
@@ -261,12 +360,32 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
    {
       if (self->getMapFunc(lh, function, map, partition) < 0)
          init_success = false;
+
+      // the combiner is optional; map output is combined locally before it is sent to the buckets
+      combiner.m_pcParam = param;
+      combiner.m_iPSize = psize;
+      if ((buckets > 0) && (self->getCombineFunc(lh, function, combiner.m_pCompare, combiner.m_pCombine) >= 0))
+      {
+         self->getKeyFunc(lh, function, combiner.m_pKey);
+         combine = &combiner;
+      }
    }
    else
    {
       init_success = false;
    }
 
+   // the units of a data segment are processed by several threads if the library allows it
+   // the number of threads comes from the client, cap it by the slave configuration
+   int udfthreads = 1;
+   if ((threads > 1) && (rows > 0) && self->isThreadSafe(lh, function))
+   {
+      udfthreads = min(threads, self->m_SysConfig.m_iUDFThreads);
+      if (udfthreads < 1)
+         udfthreads = 1;
+      self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "UDF " << function << " runs on " << udfthreads << " threads" << LogEnd();
+   }
+
    timeval t1, t2, t3, t4;
    gettimeofday(&t1, 0);
 
@@ -294,9 +413,26 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
       int32_t dsid = *(int32_t*)(dataseg + 16);
       string datafile = dataseg + 20;
       sprintf(dest.m_pcLocalFileID, ".%d", dsid);
+      dest.m_iDSID = dsid;
+
+      // small files merged into this segment follow the first one, each as {number of records, file name}
+      vector<DataPart> parts(1);
+      parts[0].m_strFile = datafile;
+      parts[0].m_llOffset = offset;
+      parts[0].m_llRows = totalrows;
+      for (int p = 20 + datafile.length() + 1; p + 8 < size; )
+      {
+         DataPart part;
+         part.m_llRows = *(int64_t*)(dataseg + p);
+         part.m_strFile = dataseg + p + 8;
+         part.m_llOffset = 0;
+         p += 8 + part.m_strFile.length() + 1;
+         totalrows += part.m_llRows;
+         parts.push_back(part);
+      }
       delete [] dataseg;
 
-      self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "new job " << datafile << " " << offset << " " << totalrows << LogEnd();
+      self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "new job " << datafile << " " << offset << " " << totalrows << " " << parts.size() << LogEnd();
 
       int64_t* index = NULL;
       if ((totalrows > 0) && (rows != 0))
@@ -309,7 +445,7 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
       if (0 != rows)
       {
          size = 0;
-         if (self->SPEReadData(datafile, offset, size, index, totalrows, block) <= 0)
+         if (self->SPEReadData(parts, size, index, block) <= 0)
          {
             delete [] index;
             delete [] block;
@@ -337,11 +473,9 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
       input.m_pcParam = (char*)param;
       input.m_iPSize = psize;
       SOutput output;
-      output.m_iBufSize = (size < 64000000) ? 64000000 : size;
-      output.m_pcResult = new char[output.m_iBufSize];
-      output.m_iIndSize = (totalrows < 640000) ? 640000 : totalrows + 2;
-      output.m_pllIndex = new int64_t[output.m_iIndSize];
-      output.m_piBucketID = new int[output.m_iIndSize];
+      output.m_pcResult = NULL;
+      output.m_pllIndex = NULL;
+      output.m_piBucketID = NULL;
       SFile file;
       file.m_strHomeDir = self->m_strHomeDir;
       char path[64];
@@ -357,20 +491,69 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
       int deliverystatus = 0;
       int processstatus = 0;
 
+      UDFTask* udf = NULL;
+      if ((udfthreads > 1) && (totalrows > unitrows))
+      {
+         // each thread processes one unit at a time, size its buffers by the largest unit;
+         // the default minimum of a single thread is split among the threads
+         int64_t span = 0;
+         for (int64_t i = 0; i < totalrows; i += unitrows)
+            span = max(span, index[min(i + unitrows, totalrows)] - index[i]);
+
+         udf = new UDFTask;
+         udf->m_pSlave = self;
+         udf->m_pcBlock = block;
+         udf->m_pllIndex = index;
+         udf->m_llTotalRows = totalrows;
+         udf->m_iUnitRows = unitrows;
+         udf->m_Input = input;
+         udf->m_File = file;
+         udf->m_iBufSize = max(span, (int64_t)64000000 / udfthreads);
+         udf->m_iIndSize = max(unitrows + 2, 640000 / udfthreads);
+         udf->m_iBuckets = buckets;
+         udf->m_pProcess = process;
+         udf->m_pMap = map;
+         udf->m_pPartition = partition;
+         if (self->startUDFThreads(*udf, udfthreads) == 0)
+         {
+            // no thread could be started, process the units on this thread
+            self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "failed to start UDF threads, running " << function << " on one thread" << LogEnd();
+            self->stopUDFThreads(*udf, file);
+            delete udf;
+            udf = NULL;
+         }
+      }
+
+      // the result buffers of this thread are only needed if it runs the UDF itself
+      if (NULL == udf)
+      {
+         output.m_iBufSize = (size < 64000000) ? 64000000 : size;
+         output.m_pcResult = new char[output.m_iBufSize];
+         output.m_iIndSize = (totalrows < 640000) ? 640000 : totalrows + 2;
+         output.m_pllIndex = new int64_t[output.m_iIndSize];
+         output.m_piBucketID = new int[output.m_iIndSize];
+      }
+
       // process data segments
       for (int i = 0; i < totalrows; i += unitrows)
       {
          if (unitrows > totalrows - i)
             unitrows = totalrows - i;
 
-         input.m_pcUnit = block + index[i] - index[0];
-         input.m_iRows = unitrows;
-         input.m_pllIndex = index + i;
-         output.m_iResSize = 0;
-         output.m_iRows = 0;
          output.m_strError = "";
 
-         processstatus = self->processData(input, output, file, result, buckets, process, map, partition);
+         if (NULL == udf)
+         {
+            input.m_pcUnit = block + index[i] - index[0];
+            input.m_iRows = unitrows;
+            input.m_pllIndex = index + i;
+            output.m_iResSize = 0;
+            output.m_iRows = 0;
+
+            processstatus = self->processData(input, output, file, result, buckets, process, map, partition);
+         }
+         else
+            processstatus = self->nextUDFUnit(*udf, result, output.m_strError);
          if (processstatus < 0)
          {
             progress = SectorError::E_SPEPROC;
@@ -383,7 +566,7 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
          srand(seed);
          int ds_thresh = 32000000 * ((rand() % 7) + 1);
          if ((result.m_llTotalDataSize >= ds_thresh) && (buckets != 0))
-            deliverystatus = self->deliverResult(buckets, result, dest);
+            deliverystatus = self->deliverResult(buckets, result, dest, combine);
 
          if (deliverystatus < 0)
          {
@@ -394,6 +577,13 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
          gettimeofday(&t4, 0);
          if (t4.tv_sec - t3.tv_sec > 1)
          {
+            // a speculative copy of this data segment has completed
+            if (self->checkCancel(transid, dsid))
+            {
+               progress = SectorError::E_CANCELED;
+               break;
+            }
+
             progress = i * 100 / totalrows;
             msg.setData(4, (char*)&progress, 4);
             msg.m_iDataLength = SectorMsg::m_iHdrSize + 8;
@@ -404,6 +594,12 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
          }
       }
 
+      if (NULL != udf)
+      {
+         self->stopUDFThreads(*udf, file);
+         delete udf;
+      }
+
       // process files
       if (0 == unitrows)
       {
@@ -436,7 +632,7 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
             srand(seed);
             int ds_thresh = 32000000 * ((rand() % 7) + 1);
             if ((result.m_llTotalDataSize >= ds_thresh) && (buckets != 0))
-               deliverystatus = self->deliverResult(buckets, result, dest);
+               deliverystatus = self->deliverResult(buckets, result, dest, combine);
 
             if (deliverystatus < 0)
             {
@@ -444,6 +640,12 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
                break;
             }
 
+            if (self->checkCancel(transid, dsid))
+            {
+               progress = SectorError::E_CANCELED;
+               break;
+            }
+
             if (output.m_llOffset > 0)
             {
                progress = output.m_llOffset * 100LL / filesize;
@@ -457,11 +659,11 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
 
       // if buckets = 0, send back to clients, otherwise deliver to local or network locations
       if ((buckets != 0) && (progress >= 0))
-         deliverystatus = self->deliverResult(buckets, result, dest);
+         deliverystatus = self->deliverResult(buckets, result, dest, combine);
 
       if (deliverystatus < 0)
          progress = SectorError::E_SPEWRITE;
-      else
+      else if (SectorError::E_CANCELED != progress)
          progress = 100;
 
       self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "SPE completed " << progress << " " << ip << " " << ctrlport << LogEnd();
@@ -470,7 +672,21 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
 
       if (100 == progress)
       {
-         msg.m_iDataLength = SectorMsg::m_iHdrSize + 8;
+         // shuffle statistics: data size before and after the combiner
+         int64_t shuffled = 0;
+         for (int b = 0; b < buckets; ++ b)
+            shuffled += dest.m_piSArray[b];
+         msg.setData(8, (char*)&dest.m_llRawSize, 8);
+         msg.setData(16, (char*)&shuffled, 8);
+         msg.setData(24, (char*)&dest.m_llWireSize, 8);
+         msg.setData(32, (char*)&dest.m_llCompressTime, 8);
+         msg.m_iDataLength = SectorMsg::m_iHdrSize + 40;
+
+         if (NULL != combine)
+            self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "combined " << dest.m_llRawSize << " to " << shuffled << " bytes" << LogEnd();
+         if (dest.m_iCompression > 0)
+            self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "compressed " << shuffled << " to " << dest.m_llWireSize << " bytes in " << dest.m_llCompressTime << " us" << LogEnd();
+
          int id = 0;
          self->m_GMP.sendto(ip.c_str(), ctrlport, id, &msg);
 
@@ -484,6 +700,22 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
          self->report(master_ip, master_port, transid, filelist, +FileChangeType::FILE_UPDATE_NEW);
          self->reportMO(master_ip, master_port, transid);
       }
+      else if (SectorError::E_CANCELED == progress)
+      {
+         // the other copy is kept, remove what has been written by this one
+         result.clear();
+         dest.reset(buckets);
+         if (buckets == -1)
+         {
+            LocalFS::erase(self->m_strHomeDir + dest.m_strLocalFile + dest.m_pcLocalFileID);
+            LocalFS::erase(self->m_strHomeDir + dest.m_strLocalFile + dest.m_pcLocalFileID + ".idx");
+         }
+
+         msg.setData(8, (char*)&processstatus, 4);
+         msg.m_iDataLength = SectorMsg::m_iHdrSize + 12;
+         int id = 0;
+         self->m_GMP.sendto(ip.c_str(), ctrlport, id, &msg);
+      }
       else
       {
          msg.setData(8, (char*)&processstatus, 4);
@@ -507,12 +739,22 @@ DWORD WINAPI Slave::SPEHandler(LPVOID p)
       delete [] output.m_piBucketID;
       index = NULL;
       block = NULL;
+
+      self->checkCancel(transid, dsid, true);
    }
 
    gettimeofday(&t2, 0);
    int duration = t2.tv_sec - t1.tv_sec;
    self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "comp server closed " << ip << " " << ctrlport << " " << duration << LogEnd();
 
+   // forget the cancel requests that arrived after their data segments were completed
+   {
+      CGuardEx cg(self->m_CancelLock);
+      set<pair<int, int> >::iterator i = self->m_sCancelledDS.lower_bound(pair<int, int>(transid, INT_MIN));
+      while ((i != self->m_sCancelledDS.end()) && (i->first == transid))
+         self->m_sCancelledDS.erase(i ++);
+   }
+
    delete [] param;
 
    vector<Address> bad;
@@ -630,6 +872,17 @@ DWORD WINAPI Slave::SPEShuffler(LPVOID p)
          Bucket b;
          b.totalnum = -1;
          b.totalsize = 0;
+         b.dsid = -1;
+         b.speid = -1;
+
+         // data segments that were processed twice, and the SPE whose output is kept
+         if ((r > 0) && (msg.m_iDataLength >= SectorMsg::m_iHdrSize + 8))
+         {
+            int num = *(int32_t*)(msg.getData() + 4);
+            for (int i = 0; (i < num) && (msg.m_iDataLength >= SectorMsg::m_iHdrSize + 16 + i * 8); ++ i)
+               b.winner[*(int32_t*)(msg.getData() + 8 + i * 8)] = *(int32_t*)(msg.getData() + 12 + i * 8);
+         }
+
          bqlock->acquire();
          bq->push(b);
          bqcond->signal();
@@ -657,6 +910,13 @@ DWORD WINAPI Slave::SPEShuffler(LPVOID p)
          b.src_ip = speip;
          b.src_dataport = *(int32_t*)msg.getData();
          b.session = *(int32_t*)(msg.getData() + 4);
+         b.dsid = -1;
+         b.speid = -1;
+         if (msg.m_iDataLength >= SectorMsg::m_iHdrSize + 24)
+         {
+            b.dsid = *(int32_t*)(msg.getData() + 16);
+            b.speid = *(int32_t*)(msg.getData() + 20);
+         }
 
          gmp->sendto(speip, speport, msgid, &msg);
 
@@ -739,9 +999,29 @@ DWORD WINAPI Slave::SPEShufflerEx(LPVOID p)
       LocalFS::erase(tmp);
       snprintf(tmp, size, "%s.%d.idx", (self->m_strHomeDir + path + "/" + localfile).c_str(), i);
       LocalFS::erase(tmp);
+      snprintf(tmp, size, "%s.%d.blk", (self->m_strHomeDir + path + "/" + localfile).c_str(), i);
+      LocalFS::erase(tmp);
       delete [] tmp;
    }
 
+   // MapReduce buckets are sorted after the shuffle
+   void* lh = NULL;
+   MR_COMPARE comp = NULL;
+   MR_REDUCE reduce = NULL;
+   MR_KEY keyfunc = NULL;
+   if (type == 1)
+   {
+      self->openLibrary(key, function, lh);
+      self->getReduceFunc(lh, function, comp, reduce);
+      self->getKeyFunc(lh, function, keyfunc);
+   }
+
+   // Compressed record blocks are decoded as they arrive, unless the bucket is going to be sorted:
+   // then they are kept compressed in <bucket>.blk, and decoded by the sort.
+   const bool spool = (NULL != comp);
+   set<int> compressed;
+   int64_t decodetime = 0;
+
    // index file initial offset
    vector<int64_t> offset;
    offset.resize(bucketnum);
@@ -749,6 +1029,13 @@ DWORD WINAPI Slave::SPEShufflerEx(LPVOID p)
       *i = 0;
    set<int> fileid;
 
+   // where each transfer is stored, so that the output of a data segment processed twice can be removed
+   map<int, vector<ShuffleChunk> > chunks;
+   vector<int64_t> rowcount(bucketnum, 0);
+   vector<int64_t> blkoffset(bucketnum, 0);
+   ShuffleChunk chunk;
+   map<int, int> winner;
+
    while (true)
    {
       bqlock->acquire();
@@ -760,7 +1047,13 @@ DWORD WINAPI Slave::SPEShufflerEx(LPVOID p)
       bqlock->release();
 
       if (b.totalnum == -1)
+      {
+         winner.swap(b.winner);
          break;
+      }
+
+      chunk.m_iDSID = b.dsid;
+      chunk.m_iSPEID = b.speid;
 
       string speip = b.src_ip;
       int dataport = b.src_dataport;
@@ -772,6 +1065,78 @@ DWORD WINAPI Slave::SPEShufflerEx(LPVOID p)
          if (self->m_DataChn.recv4(speip, dataport, session, bucket) < 0)
             continue;
 
+         if (bucket < 0)
+         {
+            bucket = -bucket - 1;
+            int32_t len;
+            char* block = NULL;
+            if (self->m_DataChn.recv(speip, dataport, session, block, len) < 0)
+               continue;
+
+            fileid.insert(bucket);
+
+            char* tmp = new char[self->m_strHomeDir.length() + path.length() + localfile.length() + 64];
+            if (spool)
+            {
+               sprintf(tmp, "%s.%d.blk", (self->m_strHomeDir + path + "/" + localfile).c_str(), bucket);
+               fstream blockfile(tmp, ios::out | ios::binary | ios::app);
+               blockfile.write(block, len);
+               blockfile.close();
+               compressed.insert(bucket);
+
+               int rows, rawsize;
+               RecordBlock::parse(block, len, rows, rawsize);
+               chunk.m_llOffset = blkoffset[bucket];
+               chunk.m_llSize = len;
+               chunk.m_llRowStart = rowcount[bucket];
+               chunk.m_llRows = rows;
+               chunks[bucket].push_back(chunk);
+               blkoffset[bucket] += len;
+               rowcount[bucket] += rows;
+            }
+            else
+            {
+               int64_t t = CTimer::getTime();
+               int rows, rawsize;
+               if (RecordBlock::parse(block, len, rows, rawsize) > 0)
+               {
+                  char* data = new char[rawsize];
+                  int64_t* index = new int64_t[rows + 1];
+                  int64_t start = offset[bucket];
+                  index[0] = start;
+                  if (RecordBlock::decode(block, len, data, index + 1, start) > 0)
+                  {
+                     sprintf(tmp, "%s.%d", (self->m_strHomeDir + path + "/" + localfile).c_str(), bucket);
+                     fstream datafile(tmp, ios::out | ios::binary | ios::app);
+                     datafile.write(data, rawsize);
+                     datafile.close();
+                     sprintf(tmp, "%s.%d.idx", (self->m_strHomeDir + path + "/" + localfile).c_str(), bucket);
+                     fstream indexfile(tmp, ios::out | ios::binary | ios::app);
+                     if (0 == start)
+                        indexfile.write((char*)index, (rows + 1) * 8);
+                     else
+                        indexfile.write((char*)(index + 1), rows * 8);
+                     indexfile.close();
+                     offset[bucket] = index[rows];
+
+                     chunk.m_llOffset = start;
+                     chunk.m_llSize = rawsize;
+                     chunk.m_llRowStart = rowcount[bucket];
+                     chunk.m_llRows = rows;
+                     chunks[bucket].push_back(chunk);
+                     rowcount[bucket] += rows;
+                  }
+                  delete [] data;
+                  delete [] index;
+               }
+               decodetime += CTimer::getTime() - t;
+            }
+            delete [] tmp;
+            delete [] block;
+
+            continue;
+         }
+
          fileid.insert(bucket);
 
          char* tmp = new char[self->m_strHomeDir.length() + path.length() + localfile.length() + 64];
@@ -801,6 +1166,13 @@ DWORD WINAPI Slave::SPEShufflerEx(LPVOID p)
          indexfile.write(tmp, len);
          delete [] tmp;
 
+         chunk.m_llOffset = start;
+         chunk.m_llSize = offset[bucket] - start;
+         chunk.m_llRowStart = rowcount[bucket];
+         chunk.m_llRows = len / 8;
+         chunks[bucket].push_back(chunk);
+         rowcount[bucket] += len / 8;
+
          datafile.close();
          indexfile.close();
       }
@@ -809,33 +1181,38 @@ DWORD WINAPI Slave::SPEShufflerEx(LPVOID p)
       self->m_SlaveStat.updateIO(speip, b.totalsize, +SlaveStat::SYS_IN);
    }
 
-   // sort and reduce
-   if (type == 1)
-   {
-      void* lh = NULL;
-      self->openLibrary(key, function, lh);
+   if (decodetime > 0)
+      self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "decompressed shuffle data in " << decodetime << " us" << LogEnd();
 
-      if (NULL != lh)
+   // remove the output of the speculative copies that lost
+   if (!winner.empty())
+   {
+      char* tmp = new char[self->m_strHomeDir.length() + path.length() + localfile.length() + 64];
+      for (map<int, vector<ShuffleChunk> >::iterator i = chunks.begin(); i != chunks.end(); ++ i)
       {
-         MR_COMPARE comp = NULL;
-         MR_REDUCE reduce = NULL;
-         self->getReduceFunc(lh, function, comp, reduce);
-
-         if (NULL != comp)
-         {
-            char* tmp = new char[self->m_strHomeDir.length() + path.length() + localfile.length() + 64];
-            for (set<int>::iterator i = fileid.begin(); i != fileid.end(); ++ i)
-            {
-               sprintf(tmp, "%s.%d", (self->m_strHomeDir + path + "/" + localfile).c_str(), *i);
-               self->sort(tmp, comp, reduce);
-            }
-            delete [] tmp;
-         }
+         sprintf(tmp, "%s.%d", (self->m_strHomeDir + path + "/" + localfile).c_str(), i->first);
+         int n = self->dropChunks(tmp, compressed.find(i->first) != compressed.end(), i->second, winner);
+         if (n > 0)
+            self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "dropped " << n << " duplicated transfers from " << tmp << LogEnd();
+      }
+      delete [] tmp;
+   }
 
-         self->closeLibrary(lh);
+   // sort and reduce
+   if (NULL != comp)
+   {
+      char* tmp = new char[self->m_strHomeDir.length() + path.length() + localfile.length() + 64];
+      for (set<int>::iterator i = fileid.begin(); i != fileid.end(); ++ i)
+      {
+         sprintf(tmp, "%s.%d", (self->m_strHomeDir + path + "/" + localfile).c_str(), *i);
+         self->sort(tmp, comp, reduce, keyfunc, compressed.find(*i) != compressed.end());
       }
+      delete [] tmp;
    }
 
+   if (NULL != lh)
+      self->closeLibrary(lh);
+
    // report sphere output files
    char* tmp = new char[path.length() + localfile.length() + 64];
    vector<string> filelist;
@@ -853,7 +1230,7 @@ DWORD WINAPI Slave::SPEShufflerEx(LPVOID p)
    return NULL;
 }
 
-int Slave::SPEReadData(const string& datafile, const int64_t& offset, int& size, int64_t* index, const int64_t& totalrows, char*& block)
+int Slave::SPEReadIndex(const string& datafile, const int64_t& offset, int64_t* index, const int64_t& totalrows)
 {
    SNode sn;
    string idxfile = datafile + ".idx";
@@ -875,8 +1252,12 @@ int Slave::SPEReadData(const string& datafile, const int64_t& offset, int& size,
          return -1;
    }
 
-   size = index[totalrows] - index[0];
-   block = new char[size];
+   return 0;
+}
+
+int Slave::SPEReadBlock(const string& datafile, const int64_t& offset, const int& size, char* block)
+{
+   SNode sn;
 
    // read data file
    if (m_pLocalFile->lookup(datafile.c_str(), sn) >= 0)
@@ -885,19 +1266,71 @@ int Slave::SPEReadData(const string& datafile, const int64_t& offset, int& size,
       ifs.open((m_strHomeDir + datafile).c_str(), ios::in | ios::binary);
       if (ifs.bad() || ifs.fail())
          return -1;
-      ifs.seekg(index[0]);
+      ifs.seekg(offset);
       ifs.read(block, size);
       ifs.close();
    }
    else
    {
-      if (readSectorFile(datafile, index[0], size, block) < 0)
+      if (readSectorFile(datafile, offset, size, block) < 0)
          return -1;
    }
 
+   return 0;
+}
+
+int Slave::SPEReadData(const string& datafile, const int64_t& offset, int& size, int64_t* index, const int64_t& totalrows, char*& block)
+{
+   if (SPEReadIndex(datafile, offset, index, totalrows) < 0)
+      return -1;
+
+   size = index[totalrows] - index[0];
+   block = new char[size];
+
+   if (SPEReadBlock(datafile, index[0], size, block) < 0)
+      return -1;
+
    return totalrows;
 }
 
+int Slave::SPEReadData(const vector<DataPart>& parts, int& size, int64_t* index, char*& block)
+{
+   if (parts.size() == 1)
+      return SPEReadData(parts[0].m_strFile, parts[0].m_llOffset, size, index, parts[0].m_llRows, block);
+
+   // read the indexes of all files first, so that the records are read once into a single block;
+   // the index continues from one file to the next, the last entry of a file is the first of the next one
+   vector<int64_t> start(parts.size());
+   vector<int> psize(parts.size());
+   size = 0;
+   block = NULL;
+   int64_t rows = 0;
+   for (unsigned int p = 0; p < parts.size(); ++ p)
+   {
+      if (SPEReadIndex(parts[p].m_strFile, parts[p].m_llOffset, index + rows, parts[p].m_llRows) < 0)
+         return -1;
+
+      start[p] = index[rows];
+      psize[p] = index[rows + parts[p].m_llRows] - start[p];
+      for (int64_t r = 0; r <= parts[p].m_llRows; ++ r)
+         index[rows + r] += size - start[p];
+
+      size += psize[p];
+      rows += parts[p].m_llRows;
+   }
+
+   block = new char[size];
+   int64_t pos = 0;
+   for (unsigned int p = 0; p < parts.size(); ++ p)
+   {
+      if (SPEReadBlock(parts[p].m_strFile, start[p], psize[p], block + pos) < 0)
+         return -1;
+      pos += psize[p];
+   }
+
+   return rows;
+}
+
 int Slave::sendResultToFile(const SPEResult& result, const string& localfile, const int64_t& offset)
 {
    fstream datafile, idxfile;
@@ -945,11 +1378,25 @@ int Slave::sendResultToClient(const int& buckets, const int* sarray, const int*
    return 0;
 }
 
-int Slave::sendResultToBuckets(const int& buckets, const SPEResult& result, const SPEDestination& dest)
+int Slave::sendResultToBuckets(const int& buckets, const SPEResult& result, SPEDestination& dest)
 {
    map<int, set<int> > ResByLoc;
    map<int, int> SizeByLoc;
 
+   // with compression, each bucket is sent as one record block instead of the data and the index
+   vector<char*> block(buckets, (char*)NULL);
+   vector<int> blocksize(buckets, 0);
+   if (dest.m_iCompression > 0)
+   {
+      int64_t t = CTimer::getTime();
+      for (int r = 0; r < buckets; ++ r)
+      {
+         if (0 != result.m_vDataLen[r])
+            blocksize[r] = RecordBlock::encode(result.m_vData[r], result.m_vIndex[r], result.m_vIndexLen[r] - 1, block[r]);
+      }
+      dest.m_llCompressTime += CTimer::getTime() - t;
+   }
+
    for (int i = 0; i < dest.m_iLocNum; ++ i)
    {
       ResByLoc[i].clear();
@@ -963,10 +1410,14 @@ int Slave::sendResultToBuckets(const int& buckets, const SPEResult& result, cons
       if (0 != result.m_vDataLen[r])
       {
          ResByLoc[i].insert(r);
-         SizeByLoc[i] += result.m_vDataLen[r] + (result.m_vIndexLen[r] - 1) * 8;
+         if (NULL != block[r])
+            SizeByLoc[i] += blocksize[r];
+         else
+            SizeByLoc[i] += result.m_vDataLen[r] + (result.m_vIndexLen[r] - 1) * 8;
       }
    }
 
+   int ret = 1;
    unsigned int tn = 0;
    map<int, set<int> >::iterator p = ResByLoc.begin();
 
@@ -998,12 +1449,17 @@ int Slave::sendResultToBuckets(const int& buckets, const SPEResult& result, cons
       msg.setData(8, (char*)&totalnum, 4);
       int totalsize = SizeByLoc[i];
       msg.setData(12, (char*)&totalsize, 4);
-      msg.m_iDataLength = SectorMsg::m_iHdrSize + 16;
+      msg.setData(16, (char*)&dest.m_iDSID, 4);
+      msg.setData(20, (char*)&dest.m_iSPEID, 4);
+      msg.m_iDataLength = SectorMsg::m_iHdrSize + 24;
 
       // request to send results to the slave node
       msg.setType(1);
       if (m_GMP.rpc(dstip, shufflerport, &msg, &msg) < 0)
-         return -1;
+      {
+         ret = -1;
+         break;
+      }
 
       if (msg.getType() < 0)
       {
@@ -1023,13 +1479,25 @@ int Slave::sendResultToBuckets(const int& buckets, const SPEResult& result, cons
       if (!m_DataChn.isConnected(dstip, dstport))
       {
          if (m_DataChn.connect(dstip, dstport) < 0)
-            return -1;
+         {
+            ret = -1;
+            break;
+         }
       }
 
       // send results for one bucket a time
       for (set<int>::iterator r = ResByLoc[i].begin(); r != ResByLoc[i].end(); ++ r)
       {
          int32_t id = *r;
+         if (NULL != block[id])
+         {
+            // a negative ID tells the shuffler that a record block follows
+            int32_t bid = -(id + 1);
+            m_DataChn.send(dstip, dstport, session, (char*)&bid, 4);
+            m_DataChn.send(dstip, dstport, session, block[id], blocksize[id]);
+            continue;
+         }
+
          m_DataChn.send(dstip, dstport, session, (char*)&id, 4);
          m_DataChn.send(dstip, dstport, session, result.m_vData[id], result.m_vDataLen[id]);
          m_DataChn.send(dstip, dstport, session, (char*)(result.m_vIndex[id] + 1), (result.m_vIndexLen[id] - 1) * 8);
@@ -1037,12 +1505,16 @@ int Slave::sendResultToBuckets(const int& buckets, const SPEResult& result, cons
 
       // update total sent data
       m_SlaveStat.updateIO(dstip, SizeByLoc[i], +SlaveStat::SYS_OUT);
+      dest.m_llWireSize += SizeByLoc[i];
 
       ResByLoc.erase(i);
       SizeByLoc.erase(i);
    }
 
-   return 1;
+   for (vector<char*>::iterator b = block.begin(); b != block.end(); ++ b)
+      delete [] *b;
+
+   return ret;
 }
 
 int Slave::acceptLibrary(const int& key, const string& ip, int port, int session)
@@ -1054,30 +1526,91 @@ int Slave::acceptLibrary(const int& key, const string& ip, int port, int session
    {
       char* lib = NULL;
       int size = 0;
-      m_DataChn.recv(ip, port, session, lib, size);
+      if (m_DataChn.recv(ip, port, session, lib, size) < 0)
+         break;
+      char* hash = NULL;
+      if (m_DataChn.recv(ip, port, session, hash, size) < 0)
+      {
+         delete [] lib;
+         break;
+      }
+
+      // libraries are cached by content, a library used by an earlier session is not transferred again
+      string cache_file = m_strHomeDir + ".sphere/cache/" + hash;
       char* buf = NULL;
-      m_DataChn.recv(ip, port, session, buf, size);
+      size = 0;
+      SNode s;
+      int32_t cached = 0;
+      if ((strlen(hash) == 40) && (strspn(hash, "0123456789abcdef") == 40) && (LocalFS::stat(cache_file, s) >= 0))
+      {
+         ifstream ifs(cache_file.c_str(), ios::in | ios::binary);
+         buf = new char[s.m_llSize];
+         ifs.read(buf, s.m_llSize);
+         if (!ifs.fail())
+         {
+            size = s.m_llSize;
+            cached = 1;
+         }
+         ifs.close();
 
-      int buflen = m_strHomeDir.length() + 64;
-      char* path = new char[buflen];
-      snprintf(path, buflen, "%s/.sphere/%d", m_strHomeDir.c_str(), key);
+         // keep recently used libraries out of the cache cleanup
+         if (1 == cached)
+            utime(cache_file.c_str(), NULL);
+      }
+      m_DataChn.send(ip, port, session, (char*)&cached, 4);
 
-      SNode s;
-      string lib_file = string(path) + "/" + lib;
-      if (LocalFS::stat(lib_file, s) < 0)
+      if (0 == cached)
       {
-         LocalFS::mkdir(path);
+         delete [] buf;
+         buf = NULL;
+
+         // the client either sends the library itself, or names another slave that has it in its cache
+         int32_t src = 0;
+         m_DataChn.recv4(ip, port, session, src);
+         if (1 == src)
+         {
+            char* peer_ip = NULL;
+            int32_t peer_port = 0;
+            m_DataChn.recv(ip, port, session, peer_ip, size);
+            m_DataChn.recv4(ip, port, session, peer_port);
+
+            int32_t result = fetchLibrary(hash, peer_ip, peer_port, session, buf, size);
+            delete [] peer_ip;
+
+            // if the transfer failed, the client will send the library
+            m_DataChn.send(ip, port, session, (char*)&result, 4);
+            if (result < 0)
+               src = 0;
+         }
 
-         fstream ofs(lib_file.c_str(), ios::out | ios::trunc | ios::binary);
-         ofs.write(buf, size);
-         ofs.close();
+         if (0 == src)
+            m_DataChn.recv(ip, port, session, buf, size);
 
-         ::chmod(lib_file.c_str(), S_IRWXU);
+         if ((NULL != buf) && (DHash::digest(buf, size) == hash))
+         {
+            // write to a temporary file first, another SPE may be reading the same cache file
+            string tmp_file = m_strHomeDir + ".tmp/" + hash;
+            fstream ofs(tmp_file.c_str(), ios::out | ios::trunc | ios::binary);
+            ofs.write(buf, size);
+            ofs.close();
+            LocalFS::rename(tmp_file, cache_file);
+
+            cleanLibraryCache();
+         }
+         else
+         {
+            m_SectorLog << LogStart(LogLevel::LEVEL_2) << "library " << lib << " does not match its hash " << hash << LogEnd();
+            delete [] buf;
+            buf = NULL;
+         }
       }
 
+      if (NULL != buf)
+         installLibrary(key, lib, hash, buf, size);
+
       delete [] lib;
+      delete [] hash;
       delete [] buf;
-      delete [] path;
    }
 
    if (num > 0)
@@ -1089,69 +1622,184 @@ int Slave::acceptLibrary(const int& key, const string& ip, int port, int session
    return 0;
 }
 
-int Slave::openLibrary(const int& key, const string& lib, void*& lh)
+int Slave::fetchLibrary(const string& hash, const string& ip, int port, int session, char*& buf, int& size)
 {
-   char path[64];
-   sprintf(path, "%d", key);
+   buf = NULL;
+   size = 0;
 
-#ifndef WIN32
-   lh = dlopen((m_strHomeDir + ".sphere/" + path + "/" + lib + ".so").c_str(), RTLD_LAZY);
-   if (NULL == lh)
+   if (!m_DataChn.isConnected(ip, port))
    {
-      // if no user uploaded lib, check permanent lib
-      lh = dlopen((m_strHomeDir + ".sphere/perm/" + lib + ".so").c_str(), RTLD_LAZY);
-
-      if (NULL == lh)
-      {
-         m_SectorLog << LogStart(LogLevel::LEVEL_2) << "Open Library Error: " << dlerror() << LogEnd();
+      if (m_DataChn.connect(ip, port) < 0)
          return -1;
-      }
    }
 
-   return 0;
-#else
-   return -1;
-#endif
-}
-
-int Slave::getSphereFunc(void* lh, const string& function, SPHERE_PROCESS& process)
-{
-#ifndef WIN32
-   if (NULL == lh)
+   if (m_DataChn.recv(ip, port, session, buf, size) < 0)
       return -1;
 
-   process = (SPHERE_PROCESS)dlsym(lh, function.c_str());
-   if (NULL == process)
+   if (DHash::digest(buf, size) != hash)
    {
-      m_SectorLog << LogStart(LogLevel::LEVEL_2) << "Open Library Error: " << dlerror() << LogEnd();
+      delete [] buf;
+      buf = NULL;
       return -1;
    }
 
+   m_SlaveStat.updateIO(ip, size, +SlaveStat::SYS_IN);
+
    return 0;
-#else
-   return -1;
-#endif
 }
 
-int Slave::getMapFunc(void* lh, const string& function, MR_MAP& map, MR_PARTITION& partition)
+int Slave::installLibrary(const int& key, const string& lib, const string& hash, const char* buf, const int& size)
 {
-#ifndef WIN32
-   if (NULL == lh)
-      return -1;
-
-   map = (MR_MAP)dlsym(lh, (function + "_map").c_str());
+   char path[64];
+   sprintf(path, "%d", key);
+   string lib_dir = m_strHomeDir + ".sphere/" + path;
+   string lib_file = lib_dir + "/" + lib;
 
-   partition = (MR_PARTITION)dlsym(lh, (function + "_partition").c_str());
-   if (NULL == partition)
+   // keep the installed copy if it has the same content, replace it otherwise
+   SNode s;
+   if ((LocalFS::stat(lib_file, s) >= 0) && (s.m_llSize == size))
    {
-      m_SectorLog << LogStart(LogLevel::LEVEL_2) << "Open Library Error: " << dlerror() << LogEnd();
-      return -1;
+      ifstream ifs(lib_file.c_str(), ios::in | ios::binary);
+      char* old = new char[size];
+      ifs.read(old, size);
+      bool same = !ifs.fail() && (DHash::digest(old, size) == hash);
+      ifs.close();
+      delete [] old;
+
+      if (same)
+         return 0;
    }
 
-   return 0;
-#else
-   return -1;
-#endif
+   LocalFS::mkdir(lib_dir);
+
+   // an SPE of the same user may have the old library open, replace the file instead of overwriting it
+   string tmp_file = lib_file + ".tmp";
+   fstream ofs(tmp_file.c_str(), ios::out | ios::trunc | ios::binary);
+   ofs.write(buf, size);
+   ofs.close();
+   ::chmod(tmp_file.c_str(), S_IRWXU);
+
+   return LocalFS::rename(tmp_file, lib_file);
+}
+
+#ifndef WIN32
+void* Slave::libraryHandler(void* p)
+#else
+DWORD WINAPI Slave::libraryHandler(LPVOID p)
+#endif
+{
+   Slave* self = ((Param7*)p)->serv_instance;
+   string hash = ((Param7*)p)->hash;
+   string dst_ip = ((Param7*)p)->dst_ip;
+   int dst_port = ((Param7*)p)->dst_data_port;
+   int session = ((Param7*)p)->session;
+   delete (Param7*)p;
+
+   string cache_file = self->m_strHomeDir + ".sphere/cache/" + hash;
+   SNode s;
+   char* buf = NULL;
+   if (LocalFS::stat(cache_file, s) >= 0)
+   {
+      ifstream ifs(cache_file.c_str(), ios::in | ios::binary);
+      buf = new char[s.m_llSize];
+      ifs.read(buf, s.m_llSize);
+      if (ifs.fail())
+      {
+         delete [] buf;
+         buf = NULL;
+      }
+      else
+         utime(cache_file.c_str(), NULL);
+      ifs.close();
+   }
+
+   if (!self->m_DataChn.isConnected(dst_ip, dst_port) && (self->m_DataChn.connect(dst_ip, dst_port) < 0))
+   {
+      self->m_SectorLog << LogStart(LogLevel::LEVEL_2) << "failed to connect to " << dst_ip << " for library " << hash << LogEnd();
+   }
+   else if (NULL == buf)
+   {
+      // let the receiver fall back to the client
+      self->m_DataChn.sendError(dst_ip, dst_port, session);
+   }
+   else
+   {
+      self->m_DataChn.send(dst_ip, dst_port, session, buf, s.m_llSize);
+      self->m_SlaveStat.updateIO(dst_ip, s.m_llSize, +SlaveStat::SYS_OUT);
+   }
+
+   delete [] buf;
+
+#ifndef WIN32
+   return NULL;
+#else
+   return 0;
+#endif
+}
+
+int Slave::openLibrary(const int& key, const string& lib, void*& lh)
+{
+   char path[64];
+   sprintf(path, "%d", key);
+
+#ifndef WIN32
+   lh = dlopen((m_strHomeDir + ".sphere/" + path + "/" + lib + ".so").c_str(), RTLD_LAZY);
+   if (NULL == lh)
+   {
+      // if no user uploaded lib, check permanent lib
+      lh = dlopen((m_strHomeDir + ".sphere/perm/" + lib + ".so").c_str(), RTLD_LAZY);
+
+      if (NULL == lh)
+      {
+         m_SectorLog << LogStart(LogLevel::LEVEL_2) << "Open Library Error: " << dlerror() << LogEnd();
+         return -1;
+      }
+   }
+
+   return 0;
+#else
+   return -1;
+#endif
+}
+
+int Slave::getSphereFunc(void* lh, const string& function, SPHERE_PROCESS& process)
+{
+#ifndef WIN32
+   if (NULL == lh)
+      return -1;
+
+   process = (SPHERE_PROCESS)dlsym(lh, function.c_str());
+   if (NULL == process)
+   {
+      m_SectorLog << LogStart(LogLevel::LEVEL_2) << "Open Library Error: " << dlerror() << LogEnd();
+      return -1;
+   }
+
+   return 0;
+#else
+   return -1;
+#endif
+}
+
+int Slave::getMapFunc(void* lh, const string& function, MR_MAP& map, MR_PARTITION& partition)
+{
+#ifndef WIN32
+   if (NULL == lh)
+      return -1;
+
+   map = (MR_MAP)dlsym(lh, (function + "_map").c_str());
+
+   partition = (MR_PARTITION)dlsym(lh, (function + "_partition").c_str());
+   if (NULL == partition)
+   {
+      m_SectorLog << LogStart(LogLevel::LEVEL_2) << "Open Library Error: " << dlerror() << LogEnd();
+      return -1;
+   }
+
+   return 0;
+#else
+   return -1;
+#endif
 }
 
 int Slave::getReduceFunc(void* lh, const string& function, MR_COMPARE& compare, MR_REDUCE& reduce)
@@ -1175,46 +1823,76 @@ int Slave::getReduceFunc(void* lh, const string& function, MR_COMPARE& compare,
 #endif
 }
 
-int Slave::closeLibrary(void* lh)
+int Slave::getCombineFunc(void* lh, const string& function, MR_COMPARE& compare, MR_REDUCE& combine)
 {
 #ifndef WIN32
    if (NULL == lh)
       return -1;
 
-   return dlclose(lh);
+   // no error is logged, most jobs do not have a combiner
+   combine = (MR_REDUCE)dlsym(lh, (function + "_combine").c_str());
+   compare = (MR_COMPARE)dlsym(lh, (function + "_compare").c_str());
+   if ((NULL == combine) || (NULL == compare))
+      return -1;
+
+   return 0;
 #else
    return -1;
 #endif
 }
 
-int Slave::sort(const string& bucket, MR_COMPARE comp, MR_REDUCE red)
+int Slave::getKeyFunc(void* lh, const string& function, MR_KEY& key)
 {
-   fstream ifs(bucket.c_str(), ios::in | ios::binary);
-   if (ifs.fail())
+#ifndef WIN32
+   key = NULL;
+   if (NULL == lh)
       return -1;
 
-   ifs.seekg(0, ios::end);
-   int size = ifs.tellg();
-   ifs.seekg(0, ios::beg);
-   char* rec = new char[size];
-   ifs.read(rec, size);
-   ifs.close();
+   // optional, records are sorted with the compare function only if there is no key function
+   key = (MR_KEY)dlsym(lh, (function + "_key").c_str());
+   if (NULL == key)
+      return -1;
 
-   ifs.open((bucket + ".idx").c_str());
-   if (ifs.fail())
-   {
-      delete [] rec;
+   return 0;
+#else
+   key = NULL;
+   return -1;
+#endif
+}
+
+bool Slave::isThreadSafe(void* lh, const string& function)
+{
+#ifndef WIN32
+   if (NULL == lh)
+      return false;
+
+   // the library declares "int <op>_threadsafe = 1;" if the UDF can be called by several threads at the same time
+   int* flag = (int*)dlsym(lh, (function + "_threadsafe").c_str());
+   return (NULL != flag) && (0 != *flag);
+#else
+   return false;
+#endif
+}
+
+int Slave::closeLibrary(void* lh)
+{
+#ifndef WIN32
+   if (NULL == lh)
       return -1;
-   }
 
-   ifs.seekg(0, ios::end);
-   size = ifs.tellg();
-   ifs.seekg(0, ios::beg);
-   int64_t* idx = new int64_t[size / 8];
-   ifs.read((char*)idx, size);
-   ifs.close();
+   return dlclose(lh);
+#else
+   return -1;
+#endif
+}
 
-   size = size / 8 - 1;
+int Slave::sort(const string& bucket, MR_COMPARE comp, MR_REDUCE red, MR_KEY key, const bool& compressed)
+{
+   char* rec = NULL;
+   int64_t* idx = NULL;
+   int size = 0;
+   if (readBucket(bucket, compressed, rec, idx, size) < 0)
+      return -1;
 
    vector<MRRecord> vr;
    vr.resize(size);
@@ -1227,27 +1905,33 @@ int Slave::sort(const string& bucket, MR_COMPARE comp, MR_REDUCE red)
       offset ++;
    }
 
-   std::sort(vr.begin(), vr.end(), ltrec());
+   sortRecords(vr, key);
 
    if (red != NULL)
    {
+      // if reduced, no need to store these intermediate files
       reduce(vr, bucket, red, NULL, 0);
    }
    else
    {
-      // if reduced, no need to store these intermediate files
-
-      fstream sorted((bucket + ".sorted").c_str(), ios::out | ios::binary | ios::trunc);
-      fstream sortedidx((bucket + ".sorted.idx").c_str(), ios::out | ios::binary | ios::trunc);
+      // write the records in sorted order through their views, the bucket is not copied in memory
+      const int wbsize = 4000000;
+      vector<char> wbuf(wbsize);
+      fstream sorted;
+      sorted.rdbuf()->pubsetbuf(&wbuf[0], wbsize);
+      sorted.open((bucket + ".sorted").c_str(), ios::out | ios::binary | ios::trunc);
       offset = 0;
-      sortedidx.write((char*)&offset, 8);
-      for (vector<MRRecord>::iterator i = vr.begin(); i != vr.end(); ++ i)
+      idx[0] = 0;
+      for (int i = 0; i < size; ++ i)
       {
-         sorted.write(i->m_pcData, i->m_iSize);
-         offset += i->m_iSize;
-         sortedidx.write((char*)&offset, 8);
+         sorted.write(vr[i].m_pcData, vr[i].m_iSize);
+         offset += vr[i].m_iSize;
+         idx[i + 1] = offset;
       }
       sorted.close();
+
+      fstream sortedidx((bucket + ".sorted.idx").c_str(), ios::out | ios::binary | ios::trunc);
+      sortedidx.write((char*)idx, (size + 1) * 8);
       sortedidx.close();
    }
 
@@ -1257,6 +1941,169 @@ int Slave::sort(const string& bucket, MR_COMPARE comp, MR_REDUCE red)
    return 0;
 }
 
+int Slave::readBucket(const string& bucket, const bool& compressed, char*& rec, int64_t*& idx, int& rows)
+{
+   if (!compressed)
+   {
+      fstream ifs(bucket.c_str(), ios::in | ios::binary);
+      if (ifs.fail())
+         return -1;
+
+      ifs.seekg(0, ios::end);
+      int size = ifs.tellg();
+      ifs.seekg(0, ios::beg);
+      rec = new char[size];
+      ifs.read(rec, size);
+      ifs.close();
+
+      ifs.open((bucket + ".idx").c_str());
+      if (ifs.fail())
+      {
+         delete [] rec;
+         return -1;
+      }
+
+      ifs.seekg(0, ios::end);
+      size = ifs.tellg();
+      ifs.seekg(0, ios::beg);
+      idx = new int64_t[size / 8];
+      ifs.read((char*)idx, size);
+      ifs.close();
+
+      rows = size / 8 - 1;
+      return 0;
+   }
+
+   // the bucket is a sequence of record blocks
+   fstream ifs((bucket + ".blk").c_str(), ios::in | ios::binary);
+   if (ifs.fail())
+      return -1;
+
+   ifs.seekg(0, ios::end);
+   int size = ifs.tellg();
+   ifs.seekg(0, ios::beg);
+   char* blocks = new char[size];
+   ifs.read(blocks, size);
+   ifs.close();
+
+   int64_t t = CTimer::getTime();
+
+   int64_t rawsize = 0;
+   rows = 0;
+   for (int p = 0; p < size;)
+   {
+      int n, len;
+      int bs = RecordBlock::parse(blocks + p, size - p, n, len);
+      if (bs < 0)
+      {
+         delete [] blocks;
+         return -1;
+      }
+      rows += n;
+      rawsize += len;
+      p += bs;
+   }
+
+   rec = new char[rawsize];
+   idx = new int64_t[rows + 1];
+   idx[0] = 0;
+   int r = 0;
+   for (int p = 0; p < size;)
+   {
+      int n, len;
+      int bs = RecordBlock::parse(blocks + p, size - p, n, len);
+      if (RecordBlock::decode(blocks + p, size - p, rec + idx[r], idx + r + 1, idx[r]) < 0)
+      {
+         delete [] blocks;
+         delete [] rec;
+         delete [] idx;
+         return -1;
+      }
+      r += n;
+      p += bs;
+   }
+   delete [] blocks;
+
+   m_SectorLog << LogStart(LogLevel::LEVEL_3) << "decompressed " << bucket << " " << size << " to " << rawsize << " bytes in " << CTimer::getTime() - t << " us" << LogEnd();
+
+   // the bucket files are part of the job output
+   fstream ofs(bucket.c_str(), ios::out | ios::binary | ios::trunc);
+   ofs.write(rec, rawsize);
+   ofs.close();
+   ofs.open((bucket + ".idx").c_str(), ios::out | ios::binary | ios::trunc);
+   ofs.write((char*)idx, (rows + 1) * 8);
+   ofs.close();
+
+   LocalFS::erase(bucket + ".blk");
+
+   return 0;
+}
+
+void Slave::sortRecords(vector<MRRecord>& vr, MR_KEY key)
+{
+   if (NULL == key)
+   {
+      std::sort(vr.begin(), vr.end(), ltrec());
+      return;
+   }
+
+   // The key function maps each record to an unsigned 64-bit prefix that orders the records
+   // the same way as the compare function. The (prefix, position) pairs are sorted by an LSD
+   // radix sort, one byte per pass, and the compare function is only called on equal prefixes.
+   const int n = vr.size();
+   vector<MRKeyPos> kp(n);
+   vector<MRKeyPos> tmp(n);
+   vector<int> count(8 * 256, 0);
+   for (int i = 0; i < n; ++ i)
+   {
+      uint64_t k = key(vr[i].m_pcData, vr[i].m_iSize);
+      kp[i].m_llKey = k;
+      kp[i].m_iPos = i;
+      for (int b = 0; b < 8; ++ b)
+         ++ count[b * 256 + ((k >> (b * 8)) & 0xFF)];
+   }
+
+   for (int b = 0; b < 8; ++ b)
+   {
+      int* c = &count[b * 256];
+
+      // skip the bytes that are the same in all prefixes, e.g., unused low bytes of a short key
+      bool same = false;
+      for (int d = 0; (d < 256) && !same; ++ d)
+         same = (c[d] == n);
+      if (same)
+         continue;
+
+      int pos = 0;
+      for (int d = 0; d < 256; ++ d)
+      {
+         int t = c[d];
+         c[d] = pos;
+         pos += t;
+      }
+
+      for (int i = 0; i < n; ++ i)
+         tmp[c[(kp[i].m_llKey >> (b * 8)) & 0xFF] ++] = kp[i];
+      kp.swap(tmp);
+   }
+
+   vector<MRRecord> sorted(n);
+   for (int i = 0; i < n; ++ i)
+      sorted[i] = vr[kp[i].m_iPos];
+
+   for (int s = 0; s < n;)
+   {
+      int e = s + 1;
+      while ((e < n) && (kp[e].m_llKey == kp[s].m_llKey))
+         ++ e;
+      if (e - s > 1)
+         std::sort(sorted.begin() + s, sorted.begin() + e, ltrec());
+      s = e;
+   }
+
+   vr.swap(sorted);
+}
+
 int Slave::reduce(vector<MRRecord>& vr, const string& bucket, MR_REDUCE red, void* param, int psize)
 {
    SInput input;
@@ -1264,16 +2111,34 @@ int Slave::reduce(vector<MRRecord>& vr, const string& bucket, MR_REDUCE red, voi
    input.m_pcParam = (char*)param;
    input.m_iPSize = psize;
 
+   // a group is passed to the UDF in chunks of at most this many rows or bytes
+   const int max_rows = 1000000;
+   const int64_t max_size = 256000000;
 
    int rdsize = 256000000;
    int risize = 1000000;
 
    SOutput output;
-   output.m_pcResult = new char[rdsize];
+   output.m_pcResult = NULL;
+   output.m_pllIndex = NULL;
+   output.m_piBucketID = NULL;
+
+   try
+   {
+      output.m_pcResult = new char[rdsize];
+      output.m_pllIndex = new int64_t[risize];
+      output.m_piBucketID = new int[risize];
+   }
+   catch (...)
+   {
+      delete [] output.m_pcResult;
+      delete [] output.m_pllIndex;
+      delete [] output.m_piBucketID;
+      return -1;
+   }
+
    output.m_iBufSize = rdsize;
-   output.m_pllIndex = new int64_t[risize];
    output.m_iIndSize = risize;
-   output.m_piBucketID = new int[risize];
    output.m_llOffset = 0;
 
    SFile file;
@@ -1282,64 +2147,179 @@ int Slave::reduce(vector<MRRecord>& vr, const string& bucket, MR_REDUCE red, voi
    file.m_strTempDir = m_strHomeDir + ".tmp/";
    file.m_pInMemoryObjects = &m_InMemoryObjects;
 
-   char* idata = NULL;
-   int64_t* iidx = NULL;
+   // the reduce results are usually many small rows, write them through large buffers
+   const int wbsize = 4000000;
+   vector<char> wbuf(wbsize);
+   vector<char> wibuf(wbsize);
+   fstream reduced;
+   reduced.rdbuf()->pubsetbuf(&wbuf[0], wbsize);
+   reduced.open((bucket + ".reduced").c_str(), ios::out | ios::binary | ios::trunc);
+   fstream reducedidx;
+   reducedidx.rdbuf()->pubsetbuf(&wibuf[0], wbsize);
+   reducedidx.open((bucket + ".reduced.idx").c_str(), ios::out | ios::binary | ios::trunc);
+   int64_t roff = 0;
 
-   try
+   // a chunk whose records are not adjacent in the bucket is gathered here; it grows to the largest such chunk
+   vector<char> unit;
+   vector<int64_t> uindex;
+
+   const int n = vr.size();
+   for (int s = 0; s < n;)
    {
-      idata = new char[256000000];
-      iidx = new int64_t[1000000];
+      // find the end of the key group, or of the chunk if the group is too large
+      int e = s + 1;
+      int64_t usize = vr[s].m_iSize;
+      bool adjacent = true;
+      while ((e < n) && (e - s < max_rows) && (usize + vr[e].m_iSize <= max_size)
+             && (vr[s].m_pCompRoutine(vr[s].m_pcData, vr[s].m_iSize, vr[e].m_pcData, vr[e].m_iSize) == 0))
+      {
+         adjacent = adjacent && (vr[e - 1].m_pcData + vr[e - 1].m_iSize == vr[e].m_pcData);
+         usize += vr[e].m_iSize;
+         ++ e;
+      }
+
+      uindex.resize(e - s + 1);
+      uindex[0] = 0;
+      for (int p = s; p < e; ++ p)
+         uindex[p - s + 1] = uindex[p - s] + vr[p].m_iSize;
+
+      // the UDF reads the records in place if they are already in order in the bucket, e.g., a single record
+      if (adjacent)
+         input.m_pcUnit = vr[s].m_pcData;
+      else
+      {
+         // one more byte, so that a chunk of empty records still has a valid address
+         if ((int64_t)unit.size() <= usize)
+            unit.resize(usize + 1);
+         for (int p = s; p < e; ++ p)
+            memcpy(&unit[uindex[p - s]], vr[p].m_pcData, vr[p].m_iSize);
+         input.m_pcUnit = &unit[0];
+      }
+
+      input.m_pllIndex = &uindex[0];
+      input.m_iRows = e - s;
+      output.m_iResSize = 0;
+      output.m_iRows = 0;
+      red(&input, &output, &file);
+
+      if (output.m_iRows > 0)
+      {
+         reduced.write(output.m_pcResult + output.m_pllIndex[0], output.m_pllIndex[output.m_iRows] - output.m_pllIndex[0]);
+         for (int r = 0; r < output.m_iRows; ++ r)
+         {
+            roff += output.m_pllIndex[r + 1] - output.m_pllIndex[r];
+            reducedidx.write((char*)&roff, 8);
+         }
+      }
+
+      s = e;
    }
-   catch (...)
+
+   reduced.close();
+   reducedidx.close();
+
+   delete [] output.m_pcResult;
+   delete [] output.m_pllIndex;
+   delete [] output.m_piBucketID;
+
+   return 0;
+}
+
+int Slave::combine(SPEResult& result, const MRCombiner& combiner)
+{
+   // buffers for the largest bucket; the output of a group is not expected to be larger than the group
+   int maxsize = 0;
+   int maxrows = 0;
+   for (int b = 0; b < result.m_iBucketNum; ++ b)
    {
-      delete [] idata;
-      delete [] iidx;
-      return -1;
+      if (result.m_vDataLen[b] > maxsize)
+         maxsize = result.m_vDataLen[b];
+      if (result.m_vIndexLen[b] - 1 > maxrows)
+         maxrows = result.m_vIndexLen[b] - 1;
    }
+   if (0 == maxsize)
+      return 0;
 
-   fstream reduced((bucket + ".reduced").c_str(), ios::out | ios::binary | ios::trunc);
-   fstream reducedidx((bucket + ".reduced.idx").c_str(), ios::out | ios::binary | ios::trunc);
-   int64_t roff = 0;
+   SInput input;
+   input.m_pcParam = (char*)combiner.m_pcParam;
+   input.m_iPSize = combiner.m_iPSize;
+
+   SOutput output;
+   output.m_iBufSize = maxsize + 65536;
+   output.m_pcResult = new char[output.m_iBufSize];
+   output.m_iIndSize = maxrows + 2;
+   output.m_pllIndex = new int64_t[output.m_iIndSize];
+   output.m_piBucketID = new int[output.m_iIndSize];
+   output.m_llOffset = 0;
 
-   for (vector<MRRecord>::iterator i = vr.begin(); i != vr.end();)
+   SFile file;
+   file.m_strHomeDir = m_strHomeDir;
+   file.m_strTempDir = m_strHomeDir + ".tmp/";
+   file.m_iSlaveID = m_iSlaveID;
+   file.m_pInMemoryObjects = &m_InMemoryObjects;
+
+   vector<char> gdata(maxsize);
+   vector<int64_t> gidx(maxrows + 1);
+
+   SPEResult combined;
+   combined.init(result.m_iBucketNum);
+
+   int ret = 0;
+   for (int b = 0; (b < result.m_iBucketNum) && (ret >= 0); ++ b)
    {
-      iidx[0] = 0;
-      vector<MRRecord>::iterator curr = i;
-      memcpy(idata, i->m_pcData, i->m_iSize);
-      iidx[1] = i->m_iSize;
-      int offset = 1;
+      if (0 == result.m_vDataLen[b])
+         continue;
 
-      i ++;
-      while ((i != vr.end()) && (i->m_pCompRoutine(curr->m_pcData, curr->m_iSize, i->m_pcData, i->m_iSize) == 0))
+      // records of a bucket stay in the same bucket, the combiner must not change the keys
+      vector<MRRecord> vr(result.m_vIndexLen[b] - 1);
+      const int64_t* idx = result.m_vIndex[b];
+      for (unsigned int r = 0; r < vr.size(); ++ r)
       {
-         memcpy(idata + iidx[offset], i->m_pcData, i->m_iSize);
-         iidx[offset + 1] = iidx[offset] + i->m_iSize;
-         offset ++;
-         i ++;
+         vr[r].m_pcData = result.m_vData[b] + idx[r];
+         vr[r].m_iSize = idx[r + 1] - idx[r];
+         vr[r].m_pCompRoutine = combiner.m_pCompare;
       }
 
-      input.m_pcUnit = idata;
-      input.m_pllIndex = iidx;
-      input.m_iRows = offset;
-      red(&input, &output, &file);
+      sortRecords(vr, combiner.m_pKey);
 
-      for (int r = 0; r < output.m_iRows; ++ r)
+      for (vector<MRRecord>::iterator i = vr.begin(); i != vr.end();)
       {
-         reduced.write(output.m_pcResult + output.m_pllIndex[r], output.m_pllIndex[r + 1] - output.m_pllIndex[r]);
-         roff += output.m_pllIndex[r + 1] - output.m_pllIndex[r];
-         reducedidx.write((char*)&roff, 8);
+         vector<MRRecord>::iterator curr = i;
+         int rows = 0;
+         gidx[0] = 0;
+         do
+         {
+            memcpy(&gdata[0] + gidx[rows], i->m_pcData, i->m_iSize);
+            gidx[rows + 1] = gidx[rows] + i->m_iSize;
+            ++ rows;
+            ++ i;
+         } while ((i != vr.end()) && (combiner.m_pCompare(curr->m_pcData, curr->m_iSize, i->m_pcData, i->m_iSize) == 0));
+
+         input.m_pcUnit = &gdata[0];
+         input.m_pllIndex = &gidx[0];
+         input.m_iRows = rows;
+         output.m_iResSize = 0;
+         output.m_iRows = 0;
+         if (combiner.m_pCombine(&input, &output, &file) < 0)
+         {
+            ret = -1;
+            break;
+         }
+
+         for (int r = 0; r < output.m_iRows; ++ r)
+            combined.addData(b, output.m_pcResult + output.m_pllIndex[r], output.m_pllIndex[r + 1] - output.m_pllIndex[r]);
       }
    }
 
-   reduced.close();
-   reducedidx.close();
-
    delete [] output.m_pcResult;
    delete [] output.m_pllIndex;
    delete [] output.m_piBucketID;
-   delete [] idata;
-   delete [] iidx;
 
+   // if the combiner fails, the original map output is delivered
+   if (ret < 0)
+      return -1;
+
+   result.swap(combined);
    return 0;
 }
 
@@ -1396,10 +2376,176 @@ int Slave::processData(SInput& input, SOutput& output, SFile& file, SPEResult& r
    return 0;
 }
 
-int Slave::deliverResult(const int& buckets, SPEResult& result, SPEDestination& dest)
+int Slave::startUDFThreads(UDFTask& task, const int& threads)
+{
+   task.m_bStop = false;
+   task.m_llNextRow = 0;
+
+   // two units per thread are queued, so that no thread waits while the results are merged
+   for (int i = 0; i < threads * 2; ++ i)
+      pushUDFUnit(task);
+
+   // only the threads that have been started are kept
+   for (int i = 0; i < threads; ++ i)
+   {
+      pthread_t t;
+#ifndef WIN32
+      if (pthread_create(&t, NULL, UDFWorker, &task) != 0)
+         break;
+#else
+      t = CreateThread(NULL, 0, UDFWorker, &task, 0, NULL);
+      if (NULL == t)
+         break;
+#endif
+      task.m_vThreads.push_back(t);
+   }
+
+   return task.m_vThreads.size();
+}
+
+void Slave::pushUDFUnit(UDFTask& task)
+{
+   if (task.m_llNextRow >= task.m_llTotalRows)
+      return;
+
+   UDFJob* job = new UDFJob;
+   job->m_llRow = task.m_llNextRow;
+   job->m_iRows = (task.m_llTotalRows - task.m_llNextRow > task.m_iUnitRows) ? task.m_iUnitRows : task.m_llTotalRows - task.m_llNextRow;
+   job->m_Result.init(task.m_iBuckets);
+   job->m_iStatus = 0;
+   job->m_bDone = false;
+   task.m_llNextRow += job->m_iRows;
+
+   task.m_qPending.push_back(job);
+   task.m_Jobs.push(job);
+}
+
+int Slave::nextUDFUnit(UDFTask& task, SPEResult& result, string& error)
+{
+   if (task.m_qPending.empty())
+      return -1;
+
+   UDFJob* job = task.m_qPending.front();
+   task.m_qPending.pop_front();
+
+   {
+      CGuardEx cg(task.m_Lock);
+      while (!job->m_bDone)
+         task.m_Cond.wait(task.m_Lock);
+   }
+
+   pushUDFUnit(task);
+
+   // results are merged in the order of the units, the same as on a single thread
+   result.append(job->m_Result);
+   error = job->m_strError;
+   int status = job->m_iStatus;
+   delete job;
+
+   return status;
+}
+
+void Slave::stopUDFThreads(UDFTask& task, SFile& file)
+{
+   {
+      CGuardEx cg(task.m_Lock);
+      task.m_bStop = true;
+   }
+
+   task.m_Jobs.release(task.m_vThreads.size());
+
+   for (vector<pthread_t>::iterator i = task.m_vThreads.begin(); i != task.m_vThreads.end(); ++ i)
+   {
+#ifndef WIN32
+      pthread_join(*i, NULL);
+#else
+      WaitForSingleObject(*i, INFINITE);
+#endif
+   }
+   task.m_vThreads.clear();
+
+   // units left when processing stops early
+   for (deque<UDFJob*>::iterator i = task.m_qPending.begin(); i != task.m_qPending.end(); ++ i)
+      delete *i;
+   task.m_qPending.clear();
+
+   file.m_sstrFiles.insert(task.m_sstrFiles.begin(), task.m_sstrFiles.end());
+}
+
+#ifndef WIN32
+void* Slave::UDFWorker(void* p)
+#else
+DWORD WINAPI Slave::UDFWorker(LPVOID p)
+#endif
+{
+   UDFTask* task = (UDFTask*)p;
+   Slave* self = task->m_pSlave;
+
+   // each thread has its own output buffers, UDF environment and copy of the index;
+   // processData() rebases the index in place and the units share their boundary rows
+   SOutput output;
+   output.m_iBufSize = task->m_iBufSize;
+   output.m_pcResult = new char[output.m_iBufSize];
+   output.m_iIndSize = task->m_iIndSize;
+   output.m_pllIndex = new int64_t[output.m_iIndSize];
+   output.m_piBucketID = new int[output.m_iIndSize];
+   SFile file = task->m_File;
+   file.m_sstrFiles.clear();
+   vector<int64_t> index;
+
+   while (true)
+   {
+      UDFJob* job = (UDFJob*)task->m_Jobs.pop();
+      if (NULL == job)
+         break;
+
+      bool stop;
+      {
+         CGuardEx cg(task->m_Lock);
+         stop = task->m_bStop;
+      }
+
+      if (!stop)
+      {
+         index.assign(task->m_pllIndex + job->m_llRow, task->m_pllIndex + job->m_llRow + job->m_iRows + 1);
+
+         SInput input = task->m_Input;
+         input.m_pcUnit = (char*)task->m_pcBlock + index[0] - task->m_pllIndex[0];
+         input.m_iRows = job->m_iRows;
+         input.m_pllIndex = &index[0];
+         output.m_iResSize = 0;
+         output.m_iRows = 0;
+         output.m_strError = "";
+
+         job->m_iStatus = self->processData(input, output, file, job->m_Result, task->m_iBuckets, task->m_pProcess, task->m_pMap, task->m_pPartition);
+         job->m_strError = output.m_strError;
+      }
+
+      CGuardEx cg(task->m_Lock);
+      job->m_bDone = true;
+      task->m_Cond.broadcast();
+   }
+
+   {
+      CGuardEx cg(task->m_Lock);
+      task->m_sstrFiles.insert(file.m_sstrFiles.begin(), file.m_sstrFiles.end());
+   }
+
+   delete [] output.m_pcResult;
+   delete [] output.m_pllIndex;
+   delete [] output.m_piBucketID;
+
+   return NULL;
+}
+
+int Slave::deliverResult(const int& buckets, SPEResult& result, SPEDestination& dest, const MRCombiner* combiner)
 {
    int ret = 0;
 
+   dest.m_llRawSize += result.m_llTotalDataSize;
+   if ((NULL != combiner) && (buckets > 0))
+      combine(result, *combiner);
+
    if (buckets == -1)
       ret = sendResultToFile(result, dest.m_strLocalFile + dest.m_pcLocalFileID, dest.m_piSArray[0]);
    else if (buckets > 0)
@@ -1418,6 +2564,84 @@ int Slave::deliverResult(const int& buckets, SPEResult& result, SPEDestination&
    return ret;
 }
 
+int Slave::dropChunks(const string& bucket, const bool& spooled, const vector<ShuffleChunk>& chunks, const map<int, int>& winner)
+{
+   vector<ShuffleChunk> keep;
+   for (vector<ShuffleChunk>::const_iterator c = chunks.begin(); c != chunks.end(); ++ c)
+   {
+      map<int, int>::const_iterator w = winner.find(c->m_iDSID);
+      if ((w == winner.end()) || (w->second == c->m_iSPEID))
+         keep.push_back(*c);
+   }
+
+   if (keep.size() == chunks.size())
+      return 0;
+
+   // copy the chunks that are kept; spooled buckets have no index, the record blocks carry their own
+   string datafile = spooled ? bucket + ".blk" : bucket;
+   fstream ifs(datafile.c_str(), ios::in | ios::binary);
+   if (ifs.fail())
+      return -1;
+   ifs.seekg(0, ios::end);
+   int64_t size = ifs.tellg();
+   ifs.seekg(0, ios::beg);
+   vector<char> data(size + 1);
+   ifs.read(&data[0], size);
+   ifs.close();
+
+   vector<int64_t> idx;
+   if (!spooled)
+   {
+      ifs.open((bucket + ".idx").c_str(), ios::in | ios::binary);
+      if (ifs.fail())
+         return -1;
+      ifs.seekg(0, ios::end);
+      int64_t isize = ifs.tellg();
+      ifs.seekg(0, ios::beg);
+      idx.resize(isize / 8 + 1);
+      ifs.read((char*)&idx[0], isize);
+      ifs.close();
+   }
+
+   fstream ofs(datafile.c_str(), ios::out | ios::binary | ios::trunc);
+   vector<int64_t> nidx(1, 0);
+   for (vector<ShuffleChunk>::iterator c = keep.begin(); c != keep.end(); ++ c)
+   {
+      ofs.write(&data[0] + c->m_llOffset, c->m_llSize);
+
+      if (spooled)
+         continue;
+
+      int64_t base = nidx.back() - c->m_llOffset;
+      for (int64_t r = c->m_llRowStart; r < c->m_llRowStart + c->m_llRows; ++ r)
+         nidx.push_back(idx[r + 1] + base);
+   }
+   ofs.close();
+
+   if (!spooled)
+   {
+      ofs.open((bucket + ".idx").c_str(), ios::out | ios::binary | ios::trunc);
+      ofs.write((char*)&nidx[0], nidx.size() * 8);
+      ofs.close();
+   }
+
+   return chunks.size() - keep.size();
+}
+
+bool Slave::checkCancel(const int& transid, const int& dsid, const bool& clear)
+{
+   CGuardEx cg(m_CancelLock);
+
+   set<pair<int, int> >::iterator i = m_sCancelledDS.find(pair<int, int>(transid, dsid));
+   if (i == m_sCancelledDS.end())
+      return false;
+
+   if (clear)
+      m_sCancelledDS.erase(i);
+
+   return true;
+}
+
 int Slave::checkBadDest(multimap<int64_t, Address>& sndspd, vector<Address>& bad)
 {
    bad.clear();
@@ -1447,8 +2671,39 @@ int Slave::checkBadDest(multimap<int64_t, Address>& sndspd, vector<Address>& bad
 
 int Slave::readSectorFile(const string& filename, const int64_t& offset, const int64_t& size, char* buf)
 {
+   SectorInput input;
+   if (openSectorFile(filename, input) < 0)
+      return -1;
+
+   int r = readSectorFile(input, offset, size, buf);
+   closeSectorFile(input);
+
+   return r;
+}
+
+int Slave::openSectorFile(const string& filename, SectorInput& input)
+{
+   input.m_strFile = filename;
+   input.m_bLocal = false;
+   input.m_iSession = -1;
+   input.m_llSize = 0;
+
+   // local files must be read directly from local disk, the data channel cannot connect to itself
+   SNode attr;
+   if (m_pLocalFile->lookup(filename.c_str(), attr) >= 0)
+   {
+      input.m_LocalFile.open((m_strHomeDir + filename).c_str(), ios::in | ios::binary);
+      if (!input.m_LocalFile.fail())
+      {
+         input.m_bLocal = true;
+         input.m_llSize = attr.m_llSize;
+         return 0;
+      }
+      input.m_LocalFile.clear();
+   }
+
    SectorMsg msg;
-   msg.setType(110); // open the index file
+   msg.setType(110); // open the file
    msg.setKey(0);
 
    int32_t mode = 1;
@@ -1469,17 +2724,45 @@ int Slave::readSectorFile(const string& filename, const int64_t& offset, const i
    if (msg.getType() < 0)
       return -1;
 
-   int32_t session = *(int32_t*)msg.getData();
-   string srcip = msg.getData() + 24;
-   int32_t srcport = *(int32_t*)(msg.getData() + 64 + 24);
+   input.m_iSession = *(int32_t*)msg.getData();
+   input.m_llSize = *(int64_t*)(msg.getData() + 4);
+   input.m_strIP = msg.getData() + 24;
+   input.m_iPort = *(int32_t*)(msg.getData() + 64 + 24);
 
    // connect to the slave node with the file.
-   if (!m_DataChn.isConnected(srcip, srcport))
+   if (!m_DataChn.isConnected(input.m_strIP, input.m_iPort))
+   {
+      if (m_DataChn.connect(input.m_strIP, input.m_iPort) < 0)
+      {
+         input.m_iSession = -1;
+         return -1;
+      }
+   }
+
+   return 0;
+}
+
+int Slave::readSectorFile(SectorInput& input, const int64_t& offset, const int64_t& size, char* buf)
+{
+   if (input.m_bLocal)
    {
-      if (m_DataChn.connect(srcip, srcport) < 0)
+      input.m_LocalFile.seekg(offset);
+      input.m_LocalFile.read(buf, size);
+      if (input.m_LocalFile.gcount() != size)
+      {
+         input.m_LocalFile.clear();
          return -1;
+      }
+      return size;
    }
 
+   if (input.m_iSession < 0)
+      return -1;
+
+   const string& srcip = input.m_strIP;
+   const int srcport = input.m_iPort;
+   const int32_t session = input.m_iSession;
+
    int32_t cmd = 1;
    m_DataChn.send(srcip, srcport, session, (char*)&cmd, 4);
 
@@ -1501,11 +2784,6 @@ int Slave::readSectorFile(const string& filename, const int64_t& offset, const i
       memcpy(buf, tmp, size);
    delete [] tmp;
 
-   // file close command: 5
-   cmd = 5;
-   m_DataChn.send(srcip, srcport, session, (char*)&cmd, 4);
-   m_DataChn.recv4(srcip, srcport, session, response);
-
    // update total received data
    m_SlaveStat.updateIO(srcip, size, +SlaveStat::SYS_IN);
 
@@ -1514,3 +2792,23 @@ int Slave::readSectorFile(const string& filename, const int64_t& offset, const i
 
    return size;
 }
+
+void Slave::closeSectorFile(SectorInput& input)
+{
+   if (input.m_bLocal)
+   {
+      input.m_LocalFile.close();
+      return;
+   }
+
+   if (input.m_iSession < 0)
+      return;
+
+   // file close command: 5
+   int32_t cmd = 5;
+   m_DataChn.send(input.m_strIP, input.m_iPort, input.m_iSession, (char*)&cmd, 4);
+   int response;
+   m_DataChn.recv4(input.m_strIP, input.m_iPort, input.m_iSession, response);
+
+   input.m_iSession = -1;
+}
@@ -132,6 +132,9 @@ int Slave::init(const string* base, const SlaveConf* global_conf)
    m_SectorLog.setLevel(m_SysConfig.m_iLogLevel);
    m_SectorLog.copyScreen(m_SysConfig.m_bVerbose);
 
+   // the cache may have outgrown its limit, e.g., if the limit has been lowered
+   cleanLibraryCache();
+
    //copy permanent sphere libraries
    vector<SNode> filelist;
    LocalFS::list_dir(m_strBase + "/slave/sphere", filelist);
@@ -370,6 +373,18 @@ void Slave::run()
    DWORD ThreadID;
    HANDLE delete_worker_thread = CreateThread(NULL, 0, deleteWorker, this, 0, &ThreadID);
 #endif
+
+   if (m_SysConfig.m_iScrubRate > 0)
+   {
+#ifndef WIN32
+      pthread_t scrubber_thread;
+      pthread_create(&scrubber_thread, NULL, scrubber, this);
+      pthread_detach(scrubber_thread);
+#else
+      HANDLE scrubber_thread = CreateThread(NULL, 0, scrubber, this, 0, &ThreadID);
+#endif
+   }
+
    while (m_bRunning)
    {
       if (m_GMP.recvfrom(ip, port, id, msg) < 0)
@@ -495,6 +510,10 @@ int Slave::processFSCmd(const string& ip, const int port, int id, SectorMsg* msg
        if (r < 0 )
           ERR_MSG("Error moving file/directory " << m_strHomeDir + src << " " << m_strHomeDir + dst + newname);
 
+      // checksums follow their files
+      createDir(".checksum" + dst);
+      LocalFS::rename(BlockChecksum::sidecar(m_strHomeDir, src), BlockChecksum::sidecar(m_strHomeDir, dst + newname));
+
       // TODO: check return value and acknowledge error to master.
 
       DBG_MSG( "Dir/file moved from " << src << " to " << dst << "/" << newname);
@@ -510,6 +529,7 @@ int Slave::processFSCmd(const string& ip, const int port, int id, SectorMsg* msg
       DBG_MSG( "Delete enqueued - " << path);
       m_deleteLock.acquire();
       m_deleteQueue.push_back( m_strHomeDir + path );
+      m_deleteQueue.push_back( BlockChecksum::sidecar(m_strHomeDir, path) );
       m_deleteCond.signal();
       m_deleteLock.release();
 
@@ -520,11 +540,21 @@ int Slave::processFSCmd(const string& ip, const int port, int id, SectorMsg* msg
    {
       char* path = msg->getData();
 
+      // the checksums are still valid for the new time stamp if they were for the old one
+      BlockChecksum checksum;
+      bool restamp = loadChecksum(path, checksum);
+
       utimbuf ut;
       ut.actime = *(int64_t*)(msg->getData() + strlen(path) + 1);
       ut.modtime = *(int64_t*)(msg->getData() + strlen(path) + 1);;
       utime((m_strHomeDir + path).c_str(), &ut);
 
+      if (restamp)
+      {
+         checksum.m_llTimeStamp = ut.modtime;
+         checksum.save(BlockChecksum::sidecar(m_strHomeDir, path));
+      }
+
       DBG_MSG( "Dir/file " << path << " timestamp changed ");
 
       break;
@@ -543,6 +573,14 @@ int Slave::processFSCmd(const string& ip, const int port, int id, SectorMsg* msg
       memcpy(p->crypto_iv, msg->getData() + 164, 8);
       p->filename = msg->getData() + 172;
 
+      // choose a cipher from those the client can use, older masters do not send the list
+      int cipher_pos = 172 + p->filename.length() + 1;
+      int32_t ciphers = 1 << CipherType::BLOWFISH;
+      if (msg->m_iDataLength >= SectorMsg::m_iHdrSize + cipher_pos + 4)
+         ciphers = *(int32_t*)(msg->getData() + cipher_pos);
+      p->cipher = Crypto::negotiate(ciphers);
+      int32_t cipher = p->cipher;
+
       p->master_ip = ip;
       p->master_port = port;
 
@@ -570,7 +608,8 @@ int Slave::processFSCmd(const string& ip, const int port, int id, SectorMsg* msg
       HANDLE file_handler = CreateThread(NULL, 0, fileHandler, p, NULL, &ThreadID);
 #endif
 
-      msg->m_iDataLength = SectorMsg::m_iHdrSize;
+      msg->setData(0, (char*)&cipher, 4);
+      msg->m_iDataLength = SectorMsg::m_iHdrSize + 4;
       m_GMP.sendto(ip, port, id, msg);
 
       break;
@@ -584,6 +623,24 @@ int Slave::processFSCmd(const string& ip, const int port, int id, SectorMsg* msg
       p->dir = *(int32_t*)(msg->getData() + 4);
       p->src = msg->getData() + 8;
       p->dst = msg->getData() + 8 + p->src.length() + 1;
+      int hint = 8 + p->src.length() + 1 + p->dst.length() + 1;
+      if (msg->m_iDataLength > SectorMsg::m_iHdrSize + hint)
+         p->src_ip = msg->getData() + hint;
+
+      // a batch of a directory copy lists its paths after the source
+      if (2 == p->dir)
+      {
+         int pos = SectorMsg::m_iHdrSize + hint + p->src_ip.length() + 1;
+         int num = (pos + 4 <= msg->m_iDataLength) ? *(int32_t*)(msg->getData() + pos - SectorMsg::m_iHdrSize) : 0;
+         pos += 4;
+         for (int i = 0; (i < num) && (pos < msg->m_iDataLength); ++ i)
+         {
+            const char* path = msg->getData() + pos - SectorMsg::m_iHdrSize;
+            int len = strnlen(path, msg->m_iDataLength - pos);
+            p->batch.push_back(string(path, len));
+            pos += len + 1;
+         }
+      }
 
       p->master_ip = ip;
       p->master_port = port;
@@ -606,6 +663,40 @@ int Slave::processFSCmd(const string& ip, const int port, int id, SectorMsg* msg
       break;
    }
 
+   case 115: // create a shard of an erasure coded file to local
+   {
+      Param6* p = new Param6;
+      p->serv_instance = this;
+      p->transid = *(int32_t*)msg->getData();
+      p->convert = *(int32_t*)(msg->getData() + 4) != 0;
+      p->k = *(int32_t*)(msg->getData() + 8);
+      p->m = *(int32_t*)(msg->getData() + 12);
+      p->index = *(int32_t*)(msg->getData() + 16);
+      p->size = *(int64_t*)(msg->getData() + 20);
+      p->timestamp = *(int64_t*)(msg->getData() + 28);
+      p->src = msg->getData() + 36;
+      p->dst = msg->getData() + 36 + p->src.length() + 1;
+      p->master_ip = ip;
+      p->master_port = port;
+
+      DBG_MSG("TID " << p->transid << " Creating shard " << p->dst << " from " << p->src);
+
+      m_TransManager.addSlave(p->transid, m_iSlaveID);
+
+#ifndef WIN32
+      pthread_t shard_handler;
+      pthread_create(&shard_handler, NULL, createShard, p);
+      pthread_detach(shard_handler);
+#else
+      DWORD ThreadID;
+      HANDLE shard_handler = CreateThread(NULL, 0, createShard, p, NULL, &ThreadID);
+#endif
+
+      m_GMP.sendto(ip, port, id, msg);
+
+      break;
+   }
+
    default:
       return -1;
    }
@@ -637,7 +728,17 @@ int Slave::processDCCmd(const string& ip, const int port, int id, SectorMsg* msg
       }
       else
          p->param = NULL;
-      p->type = *(int32_t*)(msg->getData() + msg->m_iDataLength - SectorMsg::m_iHdrSize - 8);
+      offset += 4 + 8 + p->psize;
+      p->type = *(int32_t*)(msg->getData() + offset);
+      // older clients do not send the shuffle compression option
+      if (msg->m_iDataLength - SectorMsg::m_iHdrSize >= offset + 12)
+         p->compress = *(int32_t*)(msg->getData() + offset + 4);
+      else
+         p->compress = 0;
+      if (msg->m_iDataLength - SectorMsg::m_iHdrSize >= offset + 16)
+         p->threads = *(int32_t*)(msg->getData() + offset + 8);
+      else
+         p->threads = 1;
       p->transid = *(int32_t*)(msg->getData() + msg->m_iDataLength - SectorMsg::m_iHdrSize - 4);
 
       p->master_ip = ip;
@@ -713,6 +814,60 @@ int Slave::processDCCmd(const string& ip, const int port, int id, SectorMsg* msg
       break;
    }
 
+   case 205: // cancel a data segment, another copy has completed it
+   {
+      int transid = *(int32_t*)(msg->getData() + 68);
+      int dsid = *(int32_t*)(msg->getData() + 72);
+
+      CGuardEx cg(m_CancelLock);
+      m_sCancelledDS.insert(pair<int, int>(transid, dsid));
+
+      m_SectorLog << LogStart(LogLevel::LEVEL_3) << "cancel data segment " << dsid << " " << transid << LogEnd();
+
+      msg->m_iDataLength = SectorMsg::m_iHdrSize;
+      m_GMP.sendto(ip, port, id, msg);
+
+      break;
+   }
+
+   case 206: // send a cached library to another slave
+   {
+      string hash = msg->getData() + 140;
+
+      SNode s;
+      // the hash names a file in the cache directory, accept hex digits only
+      if ((hash.length() != 40) || (hash.find_first_not_of("0123456789abcdef") != string::npos) || (LocalFS::stat(m_strHomeDir + ".sphere/cache/" + hash, s) < 0))
+      {
+         msg->setType(-msg->getType());
+         msg->m_iDataLength = SectorMsg::m_iHdrSize;
+         m_GMP.sendto(ip, port, id, msg);
+         break;
+      }
+
+      Param7* p = new Param7;
+      p->serv_instance = this;
+      p->hash = hash;
+      p->dst_ip = msg->getData() + 72;
+      p->dst_data_port = *(int32_t*)(msg->getData() + 136);
+      p->session = *(int32_t*)(msg->getData() + 68);
+
+      m_SectorLog << LogStart(LogLevel::LEVEL_3) << "send library " << hash << " to " << p->dst_ip << LogEnd();
+
+#ifndef WIN32
+      pthread_t lib_handler;
+      pthread_create(&lib_handler, NULL, libraryHandler, p);
+      pthread_detach(lib_handler);
+#else
+      DWORD ThreadID;
+      HANDLE lib_handler = CreateThread(NULL, 0, libraryHandler, p, NULL, &ThreadID);
+#endif
+
+      msg->m_iDataLength = SectorMsg::m_iHdrSize;
+      m_GMP.sendto(ip, port, id, msg);
+
+      break;
+   }
+
    default:
       return -1;
    }
@@ -837,7 +992,7 @@ int Slave::getFileList(const string& path, vector<string>& filelist)
    return filelist.size();
 }
 
-int Slave::report(const string& master_ip, const int& master_port, const int32_t& transid, const vector<string>& filelist, const int32_t& change)
+int Slave::report(const string& master_ip, const int& master_port, const int32_t& transid, const vector<string>& filelist, const int32_t& change, const vector<string>* failed)
 {
    vector<string> serlist;
    if( change != FileChangeType::FILE_UPDATE_NO && change != FileChangeType::FILE_UPDATE_NEW_FAILED && change != FileChangeType::FILE_UPDATE_WRITE_FAILED && change != FileChangeType::FILE_UPDATE_REPLICA_FAILED )
@@ -906,6 +1061,21 @@ int Slave::report(const string& master_ip, const int& master_port, const int32_t
       pos += bufsize + 4;
    }
 
+   // files of the same transaction that could not be created, e.g., in a partially failed directory copy
+   if ((NULL != failed) && !failed->empty())
+   {
+      int32_t fnum = failed->size();
+      msg.setData(pos, (char*)&fnum, 4);
+      pos += 4;
+      for (vector<string>::const_iterator i = failed->begin(); i != failed->end(); ++ i)
+      {
+         int32_t bufsize = i->length() + 1;
+         msg.setData(pos, (char*)&bufsize, 4);
+         msg.setData(pos + 4, i->c_str(), bufsize);
+         pos += bufsize + 4;
+      }
+   }
+
    //TODO: if the current master is down, try a different master
    if (m_GMP.rpc(master_ip.c_str(), master_port, &msg, &msg) < 0)
       return -1;
@@ -1027,6 +1197,38 @@ int Slave::createDir(const string& path)
    return 1;
 }
 
+int Slave::cleanLibraryCache()
+{
+   vector<SNode> filelist;
+   if (LocalFS::list_dir(m_strHomeDir + ".sphere/cache", filelist) < 0)
+      return -1;
+
+   // a library is touched whenever it is used, so the oldest timestamp is the least recently used one
+   multimap<int64_t, SNode> lru;
+   int64_t total = 0;
+   for (vector<SNode>::iterator i = filelist.begin(); i != filelist.end(); ++ i)
+   {
+      lru.insert(pair<int64_t, SNode>(i->m_llTimeStamp, *i));
+      total += i->m_llSize;
+   }
+
+   int removed = 0;
+   for (multimap<int64_t, SNode>::iterator i = lru.begin(); (i != lru.end()) && (total > m_SysConfig.m_llLibCacheSize); ++ i)
+   {
+      // an SPE reading the file keeps it open, others will fetch the library again
+      if (LocalFS::erase(m_strHomeDir + ".sphere/cache/" + i->second.m_strName) < 0)
+         continue;
+
+      total -= i->second.m_llSize;
+      ++ removed;
+   }
+
+   if (removed > 0)
+      m_SectorLog << LogStart(LogLevel::LEVEL_3) << "removed " << removed << " libraries from the cache" << LogEnd();
+
+   return removed;
+}
+
 int Slave::createSysDir()
 {
    // check local directory
@@ -1061,11 +1263,17 @@ int Slave::createSysDir()
    //LocalFS::clean_dir(m_strHomeDir + ".sphere");
    if (LocalFS::mkdir(m_strHomeDir + ".sphere/perm") < 0)
       return -1;
+   // UDF libraries by content hash, kept across client sessions
+   if (LocalFS::mkdir(m_strHomeDir + ".sphere/cache") < 0)
+      return -1;
 
    if (LocalFS::mkdir(m_strHomeDir + ".tmp") < 0)
       return -1;
    LocalFS::clean_dir(m_strHomeDir + ".tmp");
 
+   if (LocalFS::mkdir(m_strHomeDir + ".checksum") < 0)
+      return -1;
+
    if (LocalFS::mkdir(m_strHomeDir + ".attic") < 0)
       return -1;
    //TODO: check slave.conf option to decide if to clean .attic
@@ -1307,6 +1515,9 @@ DWORD WINAPI Slave::worker(LPVOID param)
       msg.setData(56, buf, size);
       delete [] buf;
 
+      int32_t capability = SlaveCapability::MERGED_DS;
+      msg.setData(56 + size, (char*)&capability, 4);
+
       map<uint32_t, Address> al;
       self->m_Routing.getListOfMasters(al);
 
@@ -1362,3 +1573,195 @@ DWORD WINAPI Slave::deleteWorker(LPVOID param)
    return NULL;
 }
 
+bool Slave::loadChecksum(const string& path, BlockChecksum& checksum)
+{
+   SNode s;
+   if (LocalFS::stat(m_strHomeDir + path, s) < 0)
+      return false;
+
+   // checksums made for another version of the file are useless; the file may have been changed outside Sector
+   return (checksum.load(BlockChecksum::sidecar(m_strHomeDir, path)) >= 0) && checksum.match(s.m_llSize, s.m_llTimeStamp);
+}
+
+int Slave::updateChecksum(const string& path, const int64_t& orig_size, const int64_t& orig_ts, const WriteLog* changes)
+{
+   SNode s;
+   if ((LocalFS::stat(m_strHomeDir + path, s) < 0) || s.m_bIsDir)
+      return -1;
+
+   ifstream data((m_strHomeDir + path).c_str(), ios::in | ios::binary);
+   if (data.fail())
+      return -1;
+
+   string sidecar = BlockChecksum::sidecar(m_strHomeDir, path);
+
+   // only the written blocks are computed again, if the old checksums were made for the file before the writes
+   BlockChecksum checksum;
+   bool incremental = (NULL != changes) && !changes->m_vListOfWrites.empty()
+                      && (checksum.load(sidecar) >= 0) && checksum.match(orig_size, orig_ts);
+
+   int r = 0;
+   if (incremental)
+   {
+      for (vector<WriteEntry>::const_iterator i = changes->m_vListOfWrites.begin(); (i != changes->m_vListOfWrites.end()) && (r >= 0); ++ i)
+         r = checksum.compute(data, s.m_llSize, i->m_llOffset, i->m_llSize);
+   }
+   else
+   {
+      checksum = BlockChecksum();
+      r = checksum.compute(data, s.m_llSize);
+   }
+   data.close();
+
+   if (r < 0)
+   {
+      LocalFS::erase(sidecar);
+      return -1;
+   }
+
+   checksum.m_llTimeStamp = s.m_llTimeStamp;
+   createDir(".checksum" + path.substr(0, path.rfind('/')));
+   return checksum.save(sidecar);
+}
+
+int Slave::checkFile(const string& path, const int& rate, int64_t& bad)
+{
+   // files being written are checked in a later pass
+   if (m_pLocalFile->isWriteLocked(path))
+      return 0;
+
+   string filename = m_strHomeDir + path;
+   SNode s;
+   if ((LocalFS::stat(filename, s) < 0) || s.m_bIsDir)
+      return 0;
+
+   ifstream data(filename.c_str(), ios::in | ios::binary);
+   if (data.fail())
+      return 0;
+
+   // files written before checksums were kept, or changed outside Sector, get checksums from their current content
+   BlockChecksum checksum;
+   bool create = !loadChecksum(path, checksum);
+   if (create)
+      checksum = BlockChecksum();
+
+   // read a few blocks at a time, and pause between them to keep within the scrub rate
+   const int64_t unit = BlockChecksum::m_iBlockSize * 16;
+   int64_t start = CTimer::getTime();
+   for (int64_t off = 0; (off < s.m_llSize) && m_bRunning; off += unit)
+   {
+      if (create)
+      {
+         // pretend the file grows by one unit at a time, so that only the new blocks are computed
+         int64_t size = (s.m_llSize - off < unit) ? s.m_llSize : off + unit;
+         if (checksum.compute(data, size, off, unit) < 0)
+            return 0;
+      }
+      else if (checksum.verify(data, off, unit, bad) < 0)
+      {
+         // a file that is rewritten during the check is not corrupted
+         SNode now;
+         if ((LocalFS::stat(filename, now) < 0) || !checksum.match(now.m_llSize, now.m_llTimeStamp) || m_pLocalFile->isWriteLocked(path))
+            return 0;
+         return -1;
+      }
+
+      int64_t due = (rate > 0) ? (off + unit) * 1000000 / (int64_t(rate) * 1024 * 1024) - (CTimer::getTime() - start) : 0;
+      if (due > 0)
+      {
+#ifndef WIN32
+         usleep(due);
+#else
+         Sleep(due / 1000);
+#endif
+      }
+   }
+
+   if (create)
+   {
+      SNode now;
+      if ((LocalFS::stat(filename, now) < 0) || (now.m_llSize != s.m_llSize) || (now.m_llTimeStamp != s.m_llTimeStamp) || !m_bRunning)
+         return 0;
+      checksum.m_llTimeStamp = s.m_llTimeStamp;
+      createDir(".checksum" + path.substr(0, path.rfind('/')));
+      checksum.save(BlockChecksum::sidecar(m_strHomeDir, path));
+   }
+
+   return 1;
+}
+
+int Slave::reportBadReplica(const string& master_ip, const int& master_port, const string& path, const int64_t& block)
+{
+   ERR_MSG("Checksum mismatch in block " << block << " of " << path);
+
+   SectorMsg msg;
+   msg.setType(13);
+   msg.setKey(0);
+   msg.setData(0, (char*)&block, 8);
+   msg.setData(8, path.c_str(), path.length() + 1);
+
+   if (m_GMP.rpc(master_ip.c_str(), master_port, &msg, &msg) < 0)
+      return -1;
+
+   // the master refuses if this is the last replica, which is better kept than lost
+   if (msg.getType() < 0)
+      return *(int32_t*)msg.getData();
+
+   // the master has dropped this replica and will make a new one; keep the bad copy aside, like conflicting files on startup
+   m_pLocalFile->remove(path);
+   string dst_file = ".attic" + path;
+   createDir(dst_file.substr(0, dst_file.rfind('/')));
+   LocalFS::rename(m_strHomeDir + path, m_strHomeDir + dst_file);
+   LocalFS::erase(BlockChecksum::sidecar(m_strHomeDir, path));
+
+   INFO_MSG("Corrupted replica " << path << " moved to " << dst_file);
+
+   return 0;
+}
+
+#ifndef WIN32
+void* Slave::scrubber(void* param)
+#else
+DWORD WINAPI Slave::scrubber(LPVOID param)
+#endif
+{
+   Slave* self = (Slave*)param;
+
+   // a full pass over the local files at most once a day
+   const int64_t period = 24 * 3600 * 1000000LL;
+   int64_t last_pass = 0;
+
+   while (self->m_bRunning)
+   {
+      self->m_RunLock.acquire();
+      self->m_RunCond.wait(self->m_RunLock, 60 * 1000);
+      self->m_RunLock.release();
+
+      if (CTimer::getTime() - last_pass < period)
+         continue;
+      last_pass = CTimer::getTime();
+
+      vector<string> files;
+      self->m_pLocalFile->list_r("/", files);
+
+      int checked = 0;
+      int corrupted = 0;
+      for (vector<string>::iterator i = files.begin(); (i != files.end()) && self->m_bRunning; ++ i)
+      {
+         int64_t bad = -1;
+         int r = self->checkFile(*i, self->m_SysConfig.m_iScrubRate, bad);
+         if (r > 0)
+            ++ checked;
+         else if (r < 0)
+         {
+            ++ corrupted;
+            self->reportBadReplica(self->m_strMasterIP, self->m_iMasterPort, *i, bad);
+         }
+      }
+
+      self->m_SectorLog << LogStart(LogLevel::LEVEL_3) << "Scrub pass completed, " << checked << " files verified, "
+                        << corrupted << " corrupted" << LogEnd();
+   }
+
+   return NULL;
+}
@@ -32,6 +32,10 @@ written by
 #include <routing.h>
 #include <transaction.h>
 #include <osportable.h>
+#include <checksum.h>
+#include <writelog.h>
+#include <threadpool.h>
+#include <fstream>
 
 
 namespace sector
@@ -42,6 +46,7 @@ typedef int (*MR_MAP)(const SInput*, SOutput*, SFile*);
 typedef int (*MR_PARTITION)(const char*, int, void*, int);
 typedef int (*MR_COMPARE)(const char*, int, const char*, int);
 typedef int (*MR_REDUCE)(const SInput*, SOutput*, SFile*);
+typedef uint64_t (*MR_KEY)(const char*, int);
 
 
 class SPEResult
@@ -53,6 +58,8 @@ public:
    void init(const int& n);
    void addData(const int& bucketid, const char* data, const int64_t& len);
    void clear();
+   void swap(SPEResult& r);
+   void append(const SPEResult& r);
 
 public:
    int m_iBucketNum;				// number of buckets
@@ -87,6 +94,14 @@ public:
 
    std::string m_strLocalFile;		// local destination file name prefix, if result is to be written to local disk
    char m_pcLocalFileID[64];		// local file id: file name = prefix + . + id
+
+   int64_t m_llRawSize;			// output size before the combiner, for the current data segment
+
+   int m_iCompression;			// shuffle compression: 0, none; 1, LZ4 blocks
+   int m_iSPEID;			// SPE ID, sent with the data so that the buckets can drop duplicates
+   int m_iDSID;				// data segment being processed
+   int64_t m_llWireSize;		// bytes sent to the buckets, for the current data segment
+   int64_t m_llCompressTime;		// time spent on compression, microseconds
 };
 
 struct MRRecord
@@ -105,6 +120,34 @@ struct ltrec
    }
 };
 
+struct MRCombiner
+{
+   MR_COMPARE m_pCompare;	// <op>_compare, groups equal keys
+   MR_REDUCE m_pCombine;	// <op>_combine, same signature as reduce
+   MR_KEY m_pKey;		// <op>_key, optional key prefix for sorting
+   const char* m_pcParam;	// job parameter
+   int m_iPSize;		// parameter size
+};
+
+// part of a bucket file received in one transfer, used to drop the output of a duplicated data segment
+struct ShuffleChunk
+{
+   int m_iDSID;			// source data segment
+   int m_iSPEID;		// source SPE
+   int64_t m_llOffset;		// start of the chunk in the bucket (or block) file
+   int64_t m_llSize;		// size of the chunk
+   int64_t m_llRowStart;	// first record of the chunk
+   int64_t m_llRows;		// number of records
+};
+
+// records of one input file in a data segment; small files are merged into one segment
+struct DataPart
+{
+   std::string m_strFile;	// input file
+   int64_t m_llOffset;		// first record
+   int64_t m_llRows;		// number of records
+};
+
 class SlaveStat
 {
 public:
@@ -160,6 +203,10 @@ public:
    MetaForm m_MetaType;         // form of metadata
    int m_iLogLevel;		// level of log output
    bool m_bVerbose;		// copy logs to screen output
+   int m_iScrubRate;		// disk bandwidth of the background checksum verification, MB/s; 0 disables it
+   int m_iCopyThreads;		// number of files copied in parallel for a directory copy or replication
+   int m_iUDFThreads;		// maximum number of threads of a thread safe UDF in one SPE
+   int64_t m_llLibCacheSize;	// maximum total size of the cached UDF libraries, in bytes
 };
 
 
@@ -204,6 +251,7 @@ private:
 
       unsigned char crypto_key[16];
       unsigned char crypto_iv[8];
+      int cipher;		// CipherType of a secure transfer
    };
 
    struct Param3
@@ -212,9 +260,28 @@ private:
       std::string master_ip;
       int master_port;
       int transid;		// transaction id
-      int dir;			// if the source is a directory
+      int dir;			// 0: file; 1: directory tree; 2: batch of paths under the source directory
       std::string src;		// source file
       std::string dst;		// destination file
+      std::string src_ip;	// replica to read from, empty for the nearest one
+      std::vector<std::string> batch;	// paths relative to src and dst, directories end with '/'
+   };
+
+   struct CopyJob
+   {
+      std::string m_strSource;	// source file
+      std::string m_strDest;	// destination file
+      bool m_bSuccess;		// if the file has been copied to the temporary dir
+   };
+
+   struct CopyTask
+   {
+      Slave* m_pSlave;		// self
+      ThreadJobQueue* m_pJobs;	// CopyJob queue shared by the copy threads
+      std::string m_strSourceIP;	// replica to read from, empty for the nearest one
+      std::string m_strMasterIP;
+      int m_iMasterPort;
+      bool m_bReplica;		// keep the original time stamps
    };
 
    struct Param4
@@ -237,6 +304,45 @@ private:
       char* param;		// SPE parameter
       int psize;		// parameter size
       int type;			// process type
+      int compress;		// shuffle compression: 0, none; 1, LZ4 blocks
+      int threads;		// threads running a thread safe UDF over the units of a data segment
+   };
+
+   struct UDFJob
+   {
+      int64_t m_llRow;		// first row of the unit in the data segment
+      int m_iRows;		// number of rows in the unit
+      SPEResult m_Result;	// UDF output of the unit
+      int m_iStatus;		// processData() result
+      std::string m_strError;	// error text from the UDF
+      bool m_bDone;		// if the unit has been processed
+   };
+
+   struct UDFTask
+   {
+      Slave* m_pSlave;		// self
+      ThreadJobQueue m_Jobs;	// UDFJob queue shared by the UDF threads
+      CMutex m_Lock;
+      CCond m_Cond;		// signaled when a unit is done
+      bool m_bStop;		// skip the units left in the queue
+
+      const char* m_pcBlock;	// data segment
+      const int64_t* m_pllIndex;	// record index of the data segment
+      int64_t m_llTotalRows;	// number of rows in the data segment
+      int m_iUnitRows;		// number of rows per UDF call
+      SInput m_Input;		// UDF input, except the unit itself
+      SFile m_File;		// UDF environment
+      int m_iBufSize;		// result buffer size of each thread
+      int m_iIndSize;		// result index size of each thread
+      int m_iBuckets;
+      SPHERE_PROCESS m_pProcess;
+      MR_MAP m_pMap;
+      MR_PARTITION m_pPartition;
+
+      int64_t m_llNextRow;		// first row of the next unit to be queued
+      std::deque<UDFJob*> m_qPending;	// queued units, in order; accessed by the SPE thread only
+      std::vector<pthread_t> m_vThreads;	// UDF threads
+      std::set<std::string> m_sstrFiles;	// files created by all UDF threads
    };
 
    struct Bucket
@@ -246,6 +352,9 @@ private:
       std::string src_ip;	// source IP address
       int src_dataport;		// source data port
       int session;		// DataChn session ID
+      int dsid;			// source data segment, -1 if unknown
+      int speid;		// source SPE
+      std::map<int, int> winner;	// with the close request: SPE whose copy of each duplicated data segment is kept
    };
 
    struct Param5
@@ -276,41 +385,112 @@ private:
       int64_t* pending;		// pending incoming data size
    };
 
+   struct Param6
+   {
+      Slave* serv_instance;	// self
+      std::string master_ip;
+      int master_port;
+      int transid;		// transaction id
+      bool convert;		// read from the original file if true, otherwise from the other shards
+      int k;			// number of data shards
+      int m;			// number of parity shards
+      int index;		// shard to create
+      int64_t size;		// size of the original file
+      int64_t timestamp;	// time stamp of the original file
+      std::string src;		// original file or shard directory
+      std::string dst;		// shard file
+   };
+
+   struct Param7
+   {
+      Slave* serv_instance;	// self
+      std::string hash;		// content hash of the library
+      std::string dst_ip;	// slave waiting for the library
+      int dst_data_port;	// data port of that slave
+      int session;		// data channel session of the receiving SPE or shuffler
+   };
+
 #ifndef WIN32
    static void* fileHandler(void* p2);
    static void* copy(void* p3);
+   static void* copyWorker(void* task);
+   static void* UDFWorker(void* task);
+   static void* createShard(void* p6);
    static void* SPEHandler(void* p4);
    static void* SPEShuffler(void* p5);
    static void* SPEShufflerEx(void* p5);
+   static void* libraryHandler(void* p7);
 #else
    static DWORD WINAPI fileHandler(LPVOID p2);
    static DWORD WINAPI copy(LPVOID p3);
+   static DWORD WINAPI copyWorker(LPVOID task);
+   static DWORD WINAPI UDFWorker(LPVOID task);
+   static DWORD WINAPI createShard(LPVOID p6);
    static DWORD WINAPI SPEHandler(LPVOID p4);
    static DWORD WINAPI SPEShuffler(LPVOID p5);
    static DWORD WINAPI SPEShufflerEx(LPVOID p5);
+   static DWORD WINAPI libraryHandler(LPVOID p7);
 #endif
 
+private: // bulk copy
+   int listTree(const std::string& src, const std::string& dst, std::vector<CopyJob>& files, std::vector<std::string>& dirs);
+   int copyFile(const std::string& src, const std::string& dst, const std::string& src_ip, const std::string& master_ip, const int& master_port, const bool& replica);
+
 private: // Sphere operations
+   int SPEReadIndex(const std::string& datafile, const int64_t& offset, int64_t* index, const int64_t& totalrows);
+   int SPEReadBlock(const std::string& datafile, const int64_t& offset, const int& size, char* block);
    int SPEReadData(const std::string& datafile, const int64_t& offset, int& size, int64_t* index, const int64_t& totalrows, char*& block);
+   int SPEReadData(const std::vector<DataPart>& parts, int& size, int64_t* index, char*& block);
    int sendResultToFile(const SPEResult& result, const std::string& localfile, const int64_t& offset);
-   int sendResultToBuckets(const int& buckets, const SPEResult& result, const SPEDestination& dest);
+   int sendResultToBuckets(const int& buckets, const SPEResult& result, SPEDestination& dest);
    int sendResultToClient(const int& buckets, const int* sarray, const int* rarray, const SPEResult& result, const std::string& clientip, int clientport, int session);
 
    int acceptLibrary(const int& key, const std::string& ip, int port, int session);
+   int fetchLibrary(const std::string& hash, const std::string& ip, int port, int session, char*& buf, int& size);
+   int installLibrary(const int& key, const std::string& lib, const std::string& hash, const char* buf, const int& size);
+   int cleanLibraryCache();
    int openLibrary(const int& key, const std::string& lib, void*& lh);
    int getSphereFunc(void* lh, const std::string& function, SPHERE_PROCESS& process);
    int getMapFunc(void* lh, const std::string& function, MR_MAP& map, MR_PARTITION& partition);
    int getReduceFunc(void* lh, const std::string& function, MR_COMPARE& compare, MR_REDUCE& reduce);
+   int getCombineFunc(void* lh, const std::string& function, MR_COMPARE& compare, MR_REDUCE& combine);
+   int getKeyFunc(void* lh, const std::string& function, MR_KEY& key);
+   bool isThreadSafe(void* lh, const std::string& function);
    int closeLibrary(void* lh);
 
-   int sort(const std::string& bucket, MR_COMPARE comp, MR_REDUCE red);
+   int sort(const std::string& bucket, MR_COMPARE comp, MR_REDUCE red, MR_KEY key = NULL, const bool& compressed = false);
+   int readBucket(const std::string& bucket, const bool& compressed, char*& rec, int64_t*& idx, int& rows);
+   static void sortRecords(std::vector<MRRecord>& vr, MR_KEY key);
    int reduce(std::vector<MRRecord>& vr, const std::string& bucket, MR_REDUCE red, void* param, int psize);
+   int combine(SPEResult& result, const MRCombiner& combiner);
 
    int processData(SInput& input, SOutput& output, SFile& file, SPEResult& result, int buckets, SPHERE_PROCESS process, MR_MAP map, MR_PARTITION partition);
-   int deliverResult(const int& buckets, SPEResult& result, SPEDestination& dest);
+   int startUDFThreads(UDFTask& task, const int& threads);
+   void pushUDFUnit(UDFTask& task);
+   int nextUDFUnit(UDFTask& task, SPEResult& result, std::string& error);
+   void stopUDFThreads(UDFTask& task, SFile& file);
+   int deliverResult(const int& buckets, SPEResult& result, SPEDestination& dest, const MRCombiner* combiner = NULL);
+   bool checkCancel(const int& transid, const int& dsid, const bool& clear = false);
+   int dropChunks(const std::string& bucket, const bool& spooled, const std::vector<ShuffleChunk>& chunks, const std::map<int, int>& winner);
 
    int readSectorFile(const std::string& filename, const int64_t& offset, const int64_t& size, char* buf);
 
+private: // reading Sector files from a slave
+   struct SectorInput
+   {
+      std::string m_strFile;		// Sector file name
+      bool m_bLocal;			// if the file is read from the local disk
+      std::ifstream m_LocalFile;	// local copy of the file
+      std::string m_strIP;		// slave serving the file
+      int m_iPort;			// data port of that slave
+      int32_t m_iSession;		// data channel session, -1 if not opened
+      int64_t m_llSize;			// file size
+   };
+
+   int openSectorFile(const std::string& filename, SectorInput& input);
+   int readSectorFile(SectorInput& input, const int64_t& offset, const int64_t& size, char* buf);
+   void closeSectorFile(SectorInput& input);
+
 private: // SpaceDB operations
    int createTable(const std::string& name);
    int addTableAttribute(const std::string& name, const std::string& attr);
@@ -321,9 +501,15 @@ private: // local FS operations
    int createDir(const std::string& path);
    int createSysDir();
 
+private: // block checksums
+   bool loadChecksum(const std::string& path, BlockChecksum& checksum);
+   int updateChecksum(const std::string& path, const int64_t& orig_size = -1, const int64_t& orig_ts = -1, const WriteLog* changes = NULL);
+   int checkFile(const std::string& path, const int& rate, int64_t& bad);
+   int reportBadReplica(const std::string& master_ip, const int& master_port, const std::string& path, const int64_t& block);
+
 private: // local FS status
    int report(const std::string& master_ip, const int& master_port, const int32_t& transid, const std::string& path, const int32_t& change = 0);
-   int report(const std::string& master_ip, const int& master_port, const int32_t& transid, const std::vector<std::string>& filelist, const int32_t& change = 0);
+   int report(const std::string& master_ip, const int& master_port, const int32_t& transid, const std::vector<std::string>& filelist, const int32_t& change = 0, const std::vector<std::string>* failed = NULL);
    int reportMO(const std::string& master_ip, const int& master_port, const int32_t& transid);
    int reportSphere(const std::string& master_ip, const int& master_port, const int32_t& transid, const std::vector<Address>* bad = NULL);
 
@@ -335,9 +521,11 @@ private: // worker thread, report status, garbage collection, etc.
 #ifndef WIN32
    static void* worker(void* param);
    static void* deleteWorker(void* param);
+   static void* scrubber(void* param);
 #else
    static DWORD WINAPI worker(LPVOID param);
    static DWORD WINAPI deleteWorker(LPVOID param);
+   static DWORD WINAPI scrubber(LPVOID param);
 #endif
 
 private:
@@ -369,6 +557,9 @@ private:
 
    TransManager m_TransManager;         // transaction management
 
+   std::set<std::pair<int, int> > m_sCancelledDS;	// data segments cancelled by the client: (transaction ID, DS ID)
+   CMutex m_CancelLock;
+
 private: //slave status
    bool m_bRunning;			// slave running status; used to terminate the slave when set to false
 
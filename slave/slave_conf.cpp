@@ -41,7 +41,11 @@ m_strPublicIP(),
 m_iClusterID(0),
 m_MetaType(DEFAULT),
 m_iLogLevel(0),
-m_bVerbose(false)
+m_bVerbose(false),
+m_iScrubRate(-1),
+m_iCopyThreads(-1),
+m_iUDFThreads(-1),
+m_llLibCacheSize(-1)
 {
 }
 
@@ -55,6 +59,10 @@ int SlaveConf::init(const string& path)
    m_iMaxServiceNum = 64;
    m_MetaType = MEMORY;
    m_iLogLevel = 1;
+   m_iScrubRate = 8;
+   m_iCopyThreads = 4;
+   m_iUDFThreads = 8;
+   m_llLibCacheSize = 1024LL * 1024 * 1024;
 
    ConfParser parser;
    Param param;
@@ -110,6 +118,22 @@ int SlaveConf::init(const string& path)
       {
          m_iLogLevel = atoi(param.m_vstrValue[0].c_str());
       }
+      else if ("SCRUB_RATE" == param.m_strName)
+      {
+         m_iScrubRate = atoi(param.m_vstrValue[0].c_str());
+      }
+      else if ("COPY_THREADS" == param.m_strName)
+      {
+         m_iCopyThreads = atoi(param.m_vstrValue[0].c_str());
+      }
+      else if ("UDF_THREADS" == param.m_strName)
+      {
+         m_iUDFThreads = atoi(param.m_vstrValue[0].c_str());
+      }
+      else if ("LIB_CACHE_SIZE" == param.m_strName)
+      {
+         m_llLibCacheSize = atoll(param.m_vstrValue[0].c_str()) * 1024 * 1024;
+      }
       else
       {
          cerr << "unrecongnized system parameter: " << param.m_strName << endl;
@@ -156,5 +180,17 @@ int SlaveConf::set(const SlaveConf* global)
    if (global->m_iLogLevel > 0)
       m_iLogLevel = global->m_iLogLevel;
 
+   if (global->m_iScrubRate >= 0)
+      m_iScrubRate = global->m_iScrubRate;
+
+   if (global->m_iCopyThreads >= 0)
+      m_iCopyThreads = global->m_iCopyThreads;
+
+   if (global->m_iUDFThreads >= 0)
+      m_iUDFThreads = global->m_iUDFThreads;
+
+   if (global->m_llLibCacheSize >= 0)
+      m_llLibCacheSize = global->m_llLibCacheSize;
+
    return 0;
 }
@@ -0,0 +1,134 @@
+/*****************************************************************************
+Copyright 2011 VeryCloud LLC
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not
+use this file except in compliance with the License. You may obtain a copy of
+the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+License for the specific language governing permissions and limitations under
+the License.
+*****************************************************************************/
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "slave.h"
+
+using namespace std;
+using namespace sector;
+
+// the buckets of two results must hold the same records
+void check(const SPEResult& r1, const SPEResult& r2)
+{
+   assert(r1.m_iBucketNum == r2.m_iBucketNum);
+   assert(r1.m_llTotalDataSize == r2.m_llTotalDataSize);
+   for (int b = 0; b < r1.m_iBucketNum; ++ b)
+   {
+      int rows1 = (r1.m_vIndexLen[b] > 0) ? r1.m_vIndexLen[b] - 1 : 0;
+      int rows2 = (r2.m_vIndexLen[b] > 0) ? r2.m_vIndexLen[b] - 1 : 0;
+      assert(rows1 == rows2);
+      assert(r1.m_vDataLen[b] == r2.m_vDataLen[b]);
+      assert(r1.m_vIndexLen[b] <= r1.m_vIndexPhyLen[b]);
+      assert(r1.m_vDataLen[b] <= r1.m_vDataPhyLen[b]);
+      for (int i = 0; i < rows1; ++ i)
+      {
+         int64_t len1 = r1.m_vIndex[b][i + 1] - r1.m_vIndex[b][i];
+         int64_t len2 = r2.m_vIndex[b][i + 1] - r2.m_vIndex[b][i];
+         assert(len1 == len2);
+         assert(memcmp(r1.m_vData[b] + r1.m_vIndex[b][i], r2.m_vData[b] + r2.m_vIndex[b][i], len1) == 0);
+      }
+   }
+}
+
+void add(SPEResult& r, SPEResult& all, const int& bucket, const int& id)
+{
+   string rec = "record " + string(id % 97, 'x');
+   r.addData(bucket, rec.c_str(), rec.length());
+   all.addData(bucket, rec.c_str(), rec.length());
+}
+
+// appending the results of several units gives the same buckets as one result of all the units
+int test1()
+{
+   const int buckets = 4;
+   SPEResult all;
+   all.init(buckets);
+   SPEResult merged;
+   merged.init(buckets);
+
+   int id = 0;
+   for (int u = 0; u < 10; ++ u)
+   {
+      SPEResult unit;
+      unit.init(buckets);
+
+      // bucket 3 is empty in every other unit, and the units grow the buffers of the merged result
+      for (int i = 0; i < 100 * u; ++ i, ++ id)
+      {
+         int b = id % buckets;
+         if ((b == 3) && (u % 2 == 0))
+            continue;
+         add(unit, all, b, id);
+      }
+
+      merged.append(unit);
+      check(merged, all);
+   }
+
+   // the buffers are kept by clear() and the index restarts from the first entry
+   merged.clear();
+   all.clear();
+   SPEResult unit;
+   unit.init(buckets);
+   for (int i = 0; i < 1000; ++ i)
+      add(unit, all, i % buckets, i);
+   merged.append(unit);
+   check(merged, all);
+
+   cout << "SPEResult append testing passed.\n";
+   return 0;
+}
+
+// the index of an empty bucket is allocated by append() and then filled to its physical length
+int test2()
+{
+   SPEResult all;
+   all.init(1);
+   SPEResult merged;
+   merged.init(1);
+
+   int id = 0;
+   SPEResult unit;
+   unit.init(1);
+   for (int i = 0; i < 10; ++ i, ++ id)
+      add(unit, all, 0, id);
+   merged.append(unit);
+
+   unit.clear();
+   for (int i = 0; i < 255; ++ i, ++ id)
+      add(unit, all, 0, id);
+   merged.append(unit);
+   check(merged, all);
+
+   // addData() continues from the index left by append()
+   add(merged, all, 0, id);
+   check(merged, all);
+
+   cout << "SPEResult index growth testing passed.\n";
+   return 0;
+}
+
+int main()
+{
+   test1();
+   test2();
+
+   return 0;
+}
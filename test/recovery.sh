@@ -49,5 +49,23 @@ test_1() {
 }
 run_test 1 "make sure the recovery daemon can replicate the file during slave failove "
 
+test_2() {
+        # replica.conf must list "/ec 2 1" under ERASURE_CODE, with a small ERASURE_CODE_COLD_AGE and REPLICATION_FULL_SCAN_DELAY
+        local slave_id
+        dd if=/dev/urandom of=$TMP/$tfile bs=1000 count=3001 2> /dev/null
+        $MKDIR /ec
+        $UPLOAD $TMP/$tfile /ec/
+        for i in `seq 1 60`; do
+                $LS /ec/$tfile | grep $tfile || break
+                sleep 10
+        done
+        $LS /ec/$tfile.ec | grep "2+1.2" || error "failed: $tfile was not converted into shards"
+        slave_id=`get_slave_id 1`
+        fail $slave_id
+        $DOWNLOAD /ec/$tfile $TMP/${tfile}_download
+        diff $TMP/$tfile $TMP/${tfile}_download || error "download from shards got different file!"
+}
+run_test 2 "erasure code a cold file, fail a slave, and read the file back from its shards"
+
 cleanup
 
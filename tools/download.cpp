@@ -33,6 +33,7 @@ written by
 #include <fstream>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <iostream>
@@ -60,10 +61,10 @@ namespace
 
 void help(const char* argv0)
 {
-   cout << argv0 << " sector_file/dir local_dir [--e (will encrypt) |--smart (skip download if file is same/ resume download if file is smaller, based purely on size)]" << endl;
+   cout << argv0 << " sector_file/dir local_dir [-p num_of_streams (download each file over parallel streams from multiple replicas)] [--e (will encrypt) |--smart (skip download if file is same/ resume download if file is smaller, based purely on size)]" << endl;
 }
 
-int download(const char* file, const char* dest, Sector& client, bool encryption)
+int download(const char* file, const char* dest, Sector& client, bool encryption, int streams)
 {
    #ifndef WIN32
       timeval t1, t2;
@@ -134,7 +135,7 @@ int download(const char* file, const char* dest, Sector& client, bool encryption
       localpath = string(dest) + string(file + sn + 1);
 
    log().debug << "Downloading " << file << " to " << localpath << std::endl;
-   int64_t result = f->download(localpath.c_str(), true);
+   int64_t result = f->download(localpath.c_str(), true, streams);
 
    f->close();
    client.releaseSectorFile(f);
@@ -219,6 +220,22 @@ int main(int argc, char** argv)
 
    bool encryption = false;
    bool resume = false;
+   int streams = 1;  // parallel streams per file
+
+   for (map<string, string>::const_iterator i = clp.m_mDFlags.begin(); i != clp.m_mDFlags.end(); ++ i)
+   {
+      if (i->first == "p")
+         streams = atoi(i->second.c_str());
+      else
+      {
+         help(argv[0]);
+         log().error << "Invalid command-line syntax, exiting with rc = -1" << std::endl;
+         return -1;
+      }
+   }
+
+   if (streams < 1)
+      streams = 1;
 
    for (vector<string>::const_iterator i = clp.m_vSFlags.begin(); i != clp.m_vSFlags.end(); ++ i)
    {
@@ -384,7 +401,7 @@ int main(int argc, char** argv)
             }
          }
 
-         if (download(i->c_str(), localdir.c_str(), client, encryption) < 0)
+         if (download(i->c_str(), localdir.c_str(), client, encryption, streams) < 0)
          {
             // calculate total available disk size
             int64_t availdisk = 0;
@@ -196,6 +196,15 @@ void print(const SysStat& s, bool address = false)
    cout << "Available Disk Size:         " << formatSize(s.m_llAvailDiskSpace)<< endl;
    cout << "Total File Size:             " << formatSize(s.m_llTotalFileSize) << endl;
    cout << "Total Number of Files:       " << s.m_llTotalFileNum << " (" << s.m_llUnderReplicated << " under replicated)" << endl;
+   if ((s.m_llRecoveryPending > 0) || (s.m_llRecoveryTrans > 0))
+   {
+      cout << "Re-replication in Progress:  " << formatSize(s.m_llRecoveryPending) << " left, " << formatSize(s.m_llRecoveryDone) << " done at "
+           << formatSize(s.m_llRecoveryRate) << "/s, " << s.m_llRecoveryTrans << " transfers, ETA ";
+      if (s.m_llRecoveryETA < 0)
+         cout << "unknown" << endl;
+      else
+         cout << s.m_llRecoveryETA / 3600 << "h " << s.m_llRecoveryETA % 3600 / 60 << "m" << endl;
+   }
    cout << "Total Number of Slave Nodes: " << s.m_llTotalSlaves;
 
    vector<int> slave_count(4);
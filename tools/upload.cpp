@@ -38,7 +38,7 @@ using namespace std;
 
 void help()
 {
-   cerr << "usage: sector_upload <src file/dir> <dst dir> [-n num_of_replicas] [-a ip_address] [-c cluster_id] [--e(ncryption)] --smart" << endl;
+   cerr << "usage: sector_upload <src file/dir> <dst dir> [-n num_of_replicas] [-a ip_address] [-c cluster_id] [-p num_of_concurrent_files] [--e(ncryption)] --smart" << endl;
 }
 
 int upload(const char* file, const char* dst, Sector& client, const int rep_num, const string& ip, const string& cid, const bool secure, const bool smart)
@@ -111,6 +111,65 @@ int upload(const char* file, const char* dst, Sector& client, const int rep_num,
    return 0;
 }
 
+// files waiting to be uploaded, shared by concurrent upload threads
+struct UploadQueue
+{
+   Sector* m_pClient;
+   int m_iReplicaNum;
+   string m_strIP;
+   string m_strCluster;
+   bool m_bSecure;
+   bool m_bSmart;
+
+   vector< pair<string, string> > m_vFiles;	// source file and destination path
+   unsigned int m_iNext;			// next file to upload
+   bool m_bFailed;				// stop after the first failed file
+   pthread_mutex_t m_Lock;
+};
+
+int uploadFile(const string& src, const string& dst, UploadQueue& q)
+{
+   int result = upload(src.c_str(), dst.c_str(), *q.m_pClient, q.m_iReplicaNum, q.m_strIP, q.m_strCluster, q.m_bSecure, q.m_bSmart);
+   if ((result == SectorError::E_CONNECTION) ||
+       (result == SectorError::E_BROKENPIPE))
+   {
+      // connection fail, retry once.
+      result = upload(src.c_str(), dst.c_str(), *q.m_pClient, q.m_iReplicaNum, q.m_strIP, q.m_strCluster, q.m_bSecure, q.m_bSmart);
+   }
+
+   // failed, remove the file in Sector.
+   if (result < 0)
+      q.m_pClient->remove(dst);
+
+   return result;
+}
+
+void* uploadHandler(void* param)
+{
+   UploadQueue* q = (UploadQueue*)param;
+
+   while (true)
+   {
+      pthread_mutex_lock(&q->m_Lock);
+      if (q->m_bFailed || (q->m_iNext >= q->m_vFiles.size()))
+      {
+         pthread_mutex_unlock(&q->m_Lock);
+         break;
+      }
+      pair<string, string> f = q->m_vFiles[q->m_iNext ++];
+      pthread_mutex_unlock(&q->m_Lock);
+
+      if (uploadFile(f.first, f.second, *q) < 0)
+      {
+         pthread_mutex_lock(&q->m_Lock);
+         q->m_bFailed = true;
+         pthread_mutex_unlock(&q->m_Lock);
+      }
+   }
+
+   return NULL;
+}
+
 int getFileList(const string& path, vector<string>& fl)
 {
    fl.push_back(path);
@@ -222,7 +281,18 @@ int main(int argc, char** argv)
       return -1;
    }
 
-   bool success = true;
+   if (parallel < 1)
+      parallel = 1;
+
+   UploadQueue queue;
+   queue.m_pClient = &client;
+   queue.m_iReplicaNum = replica_num;
+   queue.m_strIP = ip;
+   queue.m_strCluster = cluster;
+   queue.m_bSecure = encryption;
+   queue.m_bSmart = smart;
+   queue.m_iNext = 0;
+   queue.m_bFailed = false;
 
    // upload multiple files/dirs
    for (vector<string>::const_iterator param = clp.m_vParams.begin(); param != clp.m_vParams.end(); ++ param)
@@ -307,29 +377,29 @@ int main(int argc, char** argv)
 
          if (s.m_bIsDir)
             client.mkdir(dst);
-         else
+         else if ((i->length() >= 9) && (i->substr(i->length() - 9) == "/.nosplit"))
          {
-   
-            int result = upload(i->c_str(), dst.c_str(), client, replica_num, ip, cluster, encryption, smart);
-            if ((result == SectorError::E_CONNECTION) ||
-                (result == SectorError::E_BROKENPIPE))
-            {
-               // connection fail, retry once.
-               result = upload(i->c_str(), dst.c_str(), client, replica_num, ip, cluster, encryption, smart);
-            }
- 
-            if (result < 0)
+            // the rest of the directory is placed next to ".nosplit", so it must exist before they are opened
+            if (uploadFile(*i, dst, queue) < 0)
             {
-               // failed, remove the file in Sector.
-               client.remove(dst);
-               success = false;
                Utility::logout(client);
                return -1;
             }
          }
+         else
+            queue.m_vFiles.push_back(pair<string, string>(*i, dst));
       }
    }
 
+   // upload files concurrently, each on its own session
+   pthread_mutex_init(&queue.m_Lock, NULL);
+   vector<pthread_t> handler(parallel);
+   for (int i = 0; i < parallel; ++ i)
+      pthread_create(&handler[i], NULL, uploadHandler, &queue);
+   for (int i = 0; i < parallel; ++ i)
+      pthread_join(handler[i], NULL);
+   pthread_mutex_destroy(&queue.m_Lock);
+
    Utility::logout(client);
-   return success ? 0 : -1;
+   return queue.m_bFailed ? -1 : 0;
 }
@@ -66,12 +66,25 @@ written by
    #define NET_ERROR WSAGetLastError()
 #endif
 
+// sendmmsg/recvmmsg (Linux 3.0, glibc 2.14); UDP_SEGMENT (Linux 4.18) where the headers define it
+#if defined(LINUX) && defined(MSG_WAITFORONE)
+   #define UDT_MMSG
+   #include <netinet/udp.h>
+   #ifdef UDP_SEGMENT
+      #define UDT_GSO
+      #ifndef SOL_UDP
+         #define SOL_UDP 17
+      #endif
+   #endif
+#endif
+
 
 CChannel::CChannel():
 m_iIPversion(AF_INET),
 m_iSocket(),
 m_iSndBufSize(65536),
-m_iRcvBufSize(65536)
+m_iRcvBufSize(65536),
+m_bGSO(false)
 {
 }
 
@@ -79,7 +92,8 @@ CChannel::CChannel(const int& version):
 m_iIPversion(version),
 m_iSocket(),
 m_iSndBufSize(65536),
-m_iRcvBufSize(65536)
+m_iRcvBufSize(65536),
+m_bGSO(false)
 {
 }
 
@@ -177,6 +191,13 @@ void CChannel::setUDPSockOpt()
       if (0 != setsockopt(m_iSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(timeval)))
          throw CUDTException(1, 3, NET_ERROR);
    #endif
+
+   #ifdef UDT_GSO
+      // the option is readable only if the kernel supports segmentation offload for UDP
+      int gso = 0;
+      socklen_t gsolen = sizeof(int);
+      m_bGSO = (0 == getsockopt(m_iSocket, SOL_UDP, UDP_SEGMENT, (char *)&gso, &gsolen));
+   #endif
 }
 
 void CChannel::close() const
@@ -338,3 +359,189 @@ int CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
 
    return packet.getLength();
 }
+
+int CChannel::sendto(const sockaddr* const* addr, CPacket* const* packet, const int& num) const
+{
+   #ifndef UDT_MMSG
+      int sent = 0;
+      for (int i = 0; i < num; ++ i)
+      {
+         if (sendto(addr[i], *packet[i]) >= 0)
+            ++ sent;
+      }
+      return sent;
+   #else
+      int n = (num < m_iMaxBatch) ? num : m_iMaxBatch;
+
+      for (int i = 0; i < n; ++ i)
+      {
+         CPacket& pkt = *packet[i];
+         if (pkt.getFlag())
+            for (int j = 0, l = pkt.getLength() / 4; j < l; ++ j)
+               *((uint32_t *)pkt.m_pcData + j) = htonl(*((uint32_t *)pkt.m_pcData + j));
+         for (int j = 0; j < 4; ++ j)
+            pkt.m_nHeader[j] = htonl(pkt.m_nHeader[j]);
+      }
+
+      mmsghdr msg[m_iMaxBatch];
+      iovec iov[m_iMaxBatch * 2];
+      int segs[m_iMaxBatch];
+      #ifdef UDT_GSO
+         char ctrl[m_iMaxBatch][CMSG_SPACE(sizeof(uint16_t))];
+      #endif
+
+      // Build one message per packet, except that with GSO a run of data packets of the same size to the
+      // same destination (the last one may be shorter) is sent as one message and split by the kernel.
+      int m = 0;
+      for (int i = 0; i < n; ++ m)
+      {
+         int seg = CPacket::m_iPktHdrSize + packet[i]->getLength();
+         int k = 1;
+         #ifdef UDT_GSO
+            if (m_bGSO && (0 == packet[i]->getFlag()))
+            {
+               int total = seg;
+               while ((i + k < n) && (k < 64) && (addr[i + k] == addr[i]) && (0 == packet[i + k]->getFlag()))
+               {
+                  int size = CPacket::m_iPktHdrSize + packet[i + k]->getLength();
+                  if ((size > seg) || (total + size > 65000))
+                     break;
+                  total += size;
+                  ++ k;
+                  if (size < seg)
+                     break;
+               }
+            }
+         #endif
+
+         msghdr& mh = msg[m].msg_hdr;
+         mh.msg_name = (sockaddr*)addr[i];
+         mh.msg_namelen = (AF_INET == m_iIPversion) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+         mh.msg_iov = iov + i * 2;
+         mh.msg_iovlen = k * 2;
+         mh.msg_control = NULL;
+         mh.msg_controllen = 0;
+         mh.msg_flags = 0;
+         msg[m].msg_len = 0;
+         for (int j = 0; j < k; ++ j)
+         {
+            iov[(i + j) * 2] = packet[i + j]->m_PacketVector[0];
+            iov[(i + j) * 2 + 1] = packet[i + j]->m_PacketVector[1];
+         }
+
+         #ifdef UDT_GSO
+            if (k > 1)
+            {
+               mh.msg_control = ctrl[m];
+               mh.msg_controllen = sizeof(ctrl[m]);
+               cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+               cm->cmsg_level = SOL_UDP;
+               cm->cmsg_type = UDP_SEGMENT;
+               cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+               *(uint16_t*)CMSG_DATA(cm) = seg;
+            }
+         #endif
+
+         segs[m] = k;
+         i += k;
+      }
+
+      // UDP is unreliable anyway: a message that cannot be sent is skipped, as a failed sendmsg was before
+      int sent = 0;
+      for (int i = 0; i < m; )
+      {
+         int res = sendmmsg(m_iSocket, msg + i, m - i, 0);
+         if (res > 0)
+         {
+            for (int j = i; j < i + res; ++ j)
+               sent += segs[j];
+            i += res;
+            continue;
+         }
+
+         #ifdef UDT_GSO
+            // the NIC may not be able to checksum segmented packets, fall back to one packet per message
+            if ((segs[i] > 1) && (EIO == NET_ERROR))
+               m_bGSO = false;
+         #endif
+         ++ i;
+      }
+
+      for (int i = 0; i < n; ++ i)
+      {
+         CPacket& pkt = *packet[i];
+         for (int j = 0; j < 4; ++ j)
+            pkt.m_nHeader[j] = ntohl(pkt.m_nHeader[j]);
+         if (pkt.getFlag())
+            for (int j = 0, l = pkt.getLength() / 4; j < l; ++ j)
+               *((uint32_t *)pkt.m_pcData + j) = ntohl(*((uint32_t *)pkt.m_pcData + j));
+      }
+
+      return sent;
+   #endif
+}
+
+int CChannel::recvfrom(sockaddr* const* addr, CPacket* const* packet, const int& num) const
+{
+   #ifndef UDT_MMSG
+      if (recvfrom(addr[0], *packet[0]) < 0)
+         return -1;
+      return 1;
+   #else
+      int n = (num < m_iMaxBatch) ? num : m_iMaxBatch;
+
+      mmsghdr msg[m_iMaxBatch];
+      for (int i = 0; i < n; ++ i)
+      {
+         msghdr& mh = msg[i].msg_hdr;
+         mh.msg_name = addr[i];
+         mh.msg_namelen = (AF_INET == m_iIPversion) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+         mh.msg_iov = packet[i]->m_PacketVector;
+         mh.msg_iovlen = 2;
+         mh.msg_control = NULL;
+         mh.msg_controllen = 0;
+         mh.msg_flags = 0;
+         msg[i].msg_len = 0;
+      }
+
+      #ifdef UNIX
+         fd_set set;
+         timeval tv;
+         FD_ZERO(&set);
+         FD_SET(m_iSocket, &set);
+         tv.tv_sec = 0;
+         tv.tv_usec = 10000;
+         select(m_iSocket+1, &set, NULL, &set, &tv);
+      #endif
+
+      // block (up to the socket receiving timeout) for the first packet only, then take what is queued
+      int res = recvmmsg(m_iSocket, msg, n, MSG_WAITFORONE, NULL);
+
+      if (res <= 0)
+      {
+         packet[0]->setLength(-1);
+         return -1;
+      }
+
+      for (int i = 0; i < res; ++ i)
+      {
+         CPacket& pkt = *packet[i];
+         if (msg[i].msg_len <= 0)
+         {
+            pkt.setLength(-1);
+            continue;
+         }
+
+         pkt.setLength(msg[i].msg_len - CPacket::m_iPktHdrSize);
+
+         for (int j = 0; j < 4; ++ j)
+            pkt.m_nHeader[j] = ntohl(pkt.m_nHeader[j]);
+
+         if (pkt.getFlag())
+            for (int j = 0, l = pkt.getLength() / 4; j < l; ++ j)
+               *((uint32_t *)pkt.m_pcData + j) = ntohl(*((uint32_t *)pkt.m_pcData + j));
+      }
+
+      return res;
+   #endif
+}
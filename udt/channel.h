@@ -154,6 +154,33 @@ public:
 
    int recvfrom(sockaddr* addr, CPacket& packet) const;
 
+      // Functionality:
+      //    Send a batch of packets, with one system call where the platform allows (sendmmsg),
+      //    and UDP segmentation offload for runs of equal-sized packets to the same address.
+      // Parameters:
+      //    0) [in] addr: destination address of each packet.
+      //    1) [in] packet: packets to send.
+      //    2) [in] num: number of packets, no more than m_iMaxBatch.
+      // Returned value:
+      //    Number of packets sent.
+
+   int sendto(const sockaddr* const* addr, CPacket* const* packet, const int& num) const;
+
+      // Functionality:
+      //    Receive up to "num" packets that are already queued on the socket (recvmmsg).
+      //    It waits for the first packet only, like the single packet version.
+      // Parameters:
+      //    0) [out] addr: source address of each packet.
+      //    1) [in, out] packet: packets to receive into; the lengths are set to the received sizes.
+      //    2) [in] num: number of packets, no more than m_iMaxBatch.
+      // Returned value:
+      //    Number of packets received, or -1 if none.
+
+   int recvfrom(sockaddr* const* addr, CPacket* const* packet, const int& num) const;
+
+public:
+   static const int m_iMaxBatch = 32;   // maximum number of packets in one batched send/recv
+
 private:
    void setUDPSockOpt();
 
@@ -164,6 +191,8 @@ private:
 
    int m_iSndBufSize;                   // UDP sending buffer size
    int m_iRcvBufSize;                   // UDP receiving buffer size
+
+   mutable bool m_bGSO;                 // if UDP segmentation offload can be used on this socket
 };
 
 
@@ -0,0 +1,236 @@
+/*****************************************************************************
+Copyright (c) 2001 - 2011, The Board of Trustees of the University of Illinois.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+* Redistributions of source code must retain the above
+  copyright notice, this list of conditions and the
+  following disclaimer.
+
+* Redistributions in binary form must reproduce the
+  above copyright notice, this list of conditions
+  and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the University of Illinois
+  nor the names of its contributors may be used to
+  endorse or promote products derived from this
+  software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*****************************************************************************/
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "channel.h"
+#include "packet.h"
+
+using namespace std;
+
+const int payload = 1456;
+
+void open_loopback(CChannel& c, sockaddr_in& addr)
+{
+   memset(&addr, 0, sizeof(sockaddr_in));
+   addr.sin_family = AF_INET;
+   addr.sin_port = 0;
+   inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+   c.setSndBufSize(8000000);
+   c.setRcvBufSize(8000000);
+   c.open((sockaddr*)&addr);
+   c.getSockAddr((sockaddr*)&addr);
+}
+
+// a batch of data packets, including a shorter last one, arrives intact and in order
+int test1()
+{
+   CChannel snd, rcv;
+   sockaddr_in saddr, raddr;
+   open_loopback(snd, saddr);
+   open_loopback(rcv, raddr);
+
+   const int num = 5;
+   char sbuf[num][payload];
+   CPacket spkt[num];
+   CPacket* sp[num];
+   const sockaddr* dst[num];
+   for (int i = 0; i < num; ++ i)
+   {
+      memset(sbuf[i], 'a' + i, payload);
+      spkt[i].m_iSeqNo = 1000 + i;
+      spkt[i].m_iID = 7;
+      spkt[i].m_pcData = sbuf[i];
+      spkt[i].setLength((i == num - 1) ? 100 : payload);
+      sp[i] = spkt + i;
+      dst[i] = (sockaddr*)&raddr;
+   }
+   assert(snd.sendto(dst, sp, num) == num);
+
+   // the sender's copy is back in host order
+   assert(spkt[2].m_iSeqNo == 1002);
+
+   char rbuf[num][payload];
+   CPacket rpkt[num];
+   CPacket* rp[num];
+   sockaddr_in src[num];
+   sockaddr* psrc[num];
+   for (int i = 0; i < num; ++ i)
+   {
+      rpkt[i].m_pcData = rbuf[i];
+      rpkt[i].setLength(payload);
+      rp[i] = rpkt + i;
+      psrc[i] = (sockaddr*)(src + i);
+   }
+
+   int recvd = 0;
+   while (recvd < num)
+   {
+      int r = rcv.recvfrom(psrc + recvd, rp + recvd, num - recvd);
+      if (r > 0)
+         recvd += r;
+   }
+
+   for (int i = 0; i < num; ++ i)
+   {
+      assert(rpkt[i].m_iSeqNo == 1000 + i);
+      assert(rpkt[i].m_iID == 7);
+      assert(rpkt[i].getLength() == ((i == num - 1) ? 100 : payload));
+      assert(rbuf[i][0] == 'a' + i);
+      assert(src[i].sin_port == saddr.sin_port);
+   }
+
+   snd.close();
+   rcv.close();
+   return 0;
+}
+
+struct RcvStat
+{
+   CChannel* m_pChannel;
+   int m_iBatch;
+   int64_t m_llPackets;
+   int64_t m_llCalls;
+};
+
+void* receiver(void* param)
+{
+   RcvStat* stat = (RcvStat*)param;
+
+   char* buf = new char[CChannel::m_iMaxBatch * payload];
+   CPacket pkt[CChannel::m_iMaxBatch];
+   CPacket* pp[CChannel::m_iMaxBatch];
+   sockaddr_in src[CChannel::m_iMaxBatch];
+   sockaddr* psrc[CChannel::m_iMaxBatch];
+   for (int i = 0; i < CChannel::m_iMaxBatch; ++ i)
+   {
+      pkt[i].m_pcData = buf + i * payload;
+      pp[i] = pkt + i;
+      psrc[i] = (sockaddr*)(src + i);
+   }
+
+   // stop after 200ms of silence
+   uint64_t last = CTimer::getTime();
+   while (CTimer::getTime() - last < 200000)
+   {
+      for (int i = 0; i < stat->m_iBatch; ++ i)
+         pkt[i].setLength(payload);
+
+      int r = (1 == stat->m_iBatch) ? ((stat->m_pChannel->recvfrom(psrc[0], pkt[0]) > 0) ? 1 : -1) : stat->m_pChannel->recvfrom(psrc, pp, stat->m_iBatch);
+      if (r > 0)
+      {
+         stat->m_llPackets += r;
+         ++ stat->m_llCalls;
+         last = CTimer::getTime();
+      }
+   }
+
+   delete [] buf;
+   return NULL;
+}
+
+// loopback throughput, one packet per system call vs. batches
+void bench(int batch)
+{
+   CChannel snd, rcv;
+   sockaddr_in saddr, raddr;
+   open_loopback(snd, saddr);
+   open_loopback(rcv, raddr);
+
+   RcvStat stat;
+   stat.m_pChannel = &rcv;
+   stat.m_iBatch = batch;
+   stat.m_llPackets = 0;
+   stat.m_llCalls = 0;
+   pthread_t t;
+   pthread_create(&t, NULL, receiver, &stat);
+
+   char buf[payload];
+   memset(buf, 0, payload);
+   CPacket pkt[CChannel::m_iMaxBatch];
+   CPacket* pp[CChannel::m_iMaxBatch];
+   const sockaddr* dst[CChannel::m_iMaxBatch];
+   for (int i = 0; i < CChannel::m_iMaxBatch; ++ i)
+   {
+      pkt[i].m_iID = 1;
+      pkt[i].m_pcData = buf;
+      pkt[i].setLength(payload);
+      pp[i] = pkt + i;
+      dst[i] = (sockaddr*)&raddr;
+   }
+
+   const int num = 200000;
+   int64_t sent = 0;
+   int64_t calls = 0;
+   uint64_t start = CTimer::getTime();
+   for (int i = 0; i < num; i += batch)
+   {
+      for (int j = 0; j < batch; ++ j)
+         pkt[j].m_iSeqNo = i + j;
+
+      if (1 == batch)
+         sent += (snd.sendto(dst[0], pkt[0]) > 0) ? 1 : 0;
+      else
+         sent += snd.sendto(dst, pp, batch);
+      ++ calls;
+   }
+   uint64_t duration = CTimer::getTime() - start;
+
+   pthread_join(t, NULL);
+   assert(stat.m_llPackets > 0);
+
+   cout << "batch " << batch << ": sent " << sent << " packets in " << duration / 1000 << " ms ("
+        << sent * (payload + CPacket::m_iPktHdrSize) * 8 / duration << " Mb/s, " << double(sent) / calls << " packets per call), received "
+        << stat.m_llPackets << " (" << double(stat.m_llPackets) / stat.m_llCalls << " packets per call)" << endl;
+
+   snd.close();
+   rcv.close();
+}
+
+int main()
+{
+   test1();
+
+   bench(1);
+   bench(CChannel::m_iMaxBatch);
+
+   return 0;
+}
@@ -173,13 +173,7 @@ void CTimer::sleepto(const uint64_t& nexttime)
    while (t < m_ullSchedTime)
    {
       #ifndef NO_BUSY_WAITING
-         #ifdef IA32
-            __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
-         #elif IA64
-            __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
-         #elif AMD64
-            __asm__ volatile ("nop; nop; nop; nop; nop;");
-         #endif
+         spin();
       #else
          #ifndef WIN32
             timeval now;
@@ -207,6 +201,60 @@ void CTimer::sleepto(const uint64_t& nexttime)
    }
 }
 
+void CTimer::sleepto(const uint64_t& nexttime, const int& pacing)
+{
+   if (UDT_PACING_HYBRID != pacing)
+   {
+      sleepto(nexttime);
+      return;
+   }
+
+   m_ullSchedTime = nexttime;
+
+   uint64_t t;
+   rdtsc(t);
+
+   while (t < m_ullSchedTime)
+   {
+      uint64_t left = (m_ullSchedTime - t) / s_ullCPUFrequency;
+
+      if (left > m_ullSpinTime)
+      {
+         // Sleep on the tick condition so that interrupt() still wakes us up. The kernel timer
+         // slack (~50us) makes this late rather than early; when packets are due more often than
+         // that, the send queue finds several of them due at wakeup and sends them in one batch.
+         #ifndef WIN32
+            timeval now;
+            timespec timeout;
+            gettimeofday(&now, 0);
+            uint64_t usec = now.tv_usec + left - m_ullSpinTime;
+            timeout.tv_sec = now.tv_sec + usec / 1000000;
+            timeout.tv_nsec = (usec % 1000000) * 1000;
+            pthread_mutex_lock(&m_TickLock);
+            pthread_cond_timedwait(&m_TickCond, &m_TickLock, &timeout);
+            pthread_mutex_unlock(&m_TickLock);
+         #else
+            WaitForSingleObject(m_TickCond, DWORD((left - m_ullSpinTime) / 1000));
+         #endif
+      }
+      else
+         spin();
+
+      rdtsc(t);
+   }
+}
+
+void CTimer::spin()
+{
+   #ifdef IA32
+      __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
+   #elif IA64
+      __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
+   #elif AMD64
+      __asm__ volatile ("nop; nop; nop; nop; nop;");
+   #endif
+}
+
 void CTimer::interrupt()
 {
    // schedule the sleepto time to the current CCs, so that it will stop
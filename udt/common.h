@@ -82,7 +82,7 @@ public:
    void sleep(const uint64_t& interval);
 
       // Functionality:
-      //    Seelp until CC "nexttime".
+      //    Sleep until CC "nexttime".
       // Parameters:
       //    0) [in] nexttime: next time the caller is waken up.
       // Returned value:
@@ -90,6 +90,16 @@ public:
 
    void sleepto(const uint64_t& nexttime);
 
+      // Functionality:
+      //    Sleep until CC "nexttime" with the given pacing mode.
+      // Parameters:
+      //    0) [in] nexttime: next time the caller is waken up.
+      //    1) [in] pacing: UDT_PACING_DEFAULT or UDT_PACING_HYBRID.
+      // Returned value:
+      //    None.
+
+   void sleepto(const uint64_t& nexttime, const int& pacing);
+
       // Functionality:
       //    Stop the sleep() or sleepto() methods.
       // Parameters:
@@ -164,6 +174,12 @@ public:
 
    static void sleep();
 
+public:
+   static const uint64_t m_ullSpinTime = 10;	// hybrid pacing: microseconds to busy wait before the scheduled time
+
+private:
+   void spin();
+
 private:
    uint64_t m_ullSchedTime;             // next schedulled time
 
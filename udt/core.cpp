@@ -115,6 +115,7 @@ CUDT::CUDT()
    m_iRcvTimeOut = -1;
    m_bReuseAddr = true;
    m_llMaxBW = -1;
+   m_iPacing = UDT_PACING_DEFAULT;
 
    m_pCCFactory = new CCCFactory<CUDTCC>;
    m_pCC = NULL;
@@ -167,6 +168,7 @@ CUDT::CUDT(const CUDT& ancestor)
    m_iRcvTimeOut = ancestor.m_iRcvTimeOut;
    m_bReuseAddr = true;	// this must be true, because all accepted sockets shared the same port with the listener
    m_llMaxBW = ancestor.m_llMaxBW;
+   m_iPacing = ancestor.m_iPacing;
 
    m_pCCFactory = ancestor.m_pCCFactory->clone();
    m_pCC = NULL;
@@ -344,6 +346,12 @@ void CUDT::setOpt(UDTOpt optName, const void* optval, const int&)
          throw CUDTException(5, 1, 0);
       m_llMaxBW = *(int64_t*)optval;
       break;
+
+   case UDT_PACING:
+      if ((UDT_PACING_DEFAULT != *(int*)optval) && (UDT_PACING_HYBRID != *(int*)optval))
+         throw CUDTException(5, 3, 0);
+      m_iPacing = *(int*)optval;
+      break;
     
    default:
       throw CUDTException(5, 0, 0);
@@ -436,6 +444,11 @@ void CUDT::getOpt(UDTOpt optName, void* optval, int& optlen)
       *(int64_t*)optval = m_llMaxBW;
       break;
 
+   case UDT_PACING:
+      *(int*)optval = m_iPacing;
+      optlen = sizeof(int);
+      break;
+
    default:
       throw CUDTException(5, 0, 0);
    }
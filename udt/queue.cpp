@@ -347,6 +347,17 @@ uint64_t CSndUList::getNextProcTime()
    return m_pHeap[0]->m_llTimeStamp;
 }
 
+uint64_t CSndUList::getNextProcTime(int& pacing)
+{
+   CGuard listguard(m_ListLock);
+
+   if (-1 == m_iLastEntry)
+      return 0;
+
+   pacing = m_pHeap[0]->m_pUDT->m_iPacing;
+   return m_pHeap[0]->m_llTimeStamp;
+}
+
 void CSndUList::insert_(const int64_t& ts, const CUDT* u)
 {
    CSNode* n = u->m_pSNode;
@@ -507,7 +518,8 @@ void CSndQueue::init(const CChannel* c, const CTimer* t)
 
    while (!self->m_bClosing)
    {
-      uint64_t ts = self->m_pSndUList->getNextProcTime();
+      int pacing = UDT_PACING_DEFAULT;
+      uint64_t ts = self->m_pSndUList->getNextProcTime(pacing);
 
       if (ts > 0)
       {
@@ -515,15 +527,29 @@ void CSndQueue::init(const CChannel* c, const CTimer* t)
          uint64_t currtime;
          CTimer::rdtsc(currtime);
          if (currtime < ts)
-            self->m_pTimer->sleepto(ts);
+            self->m_pTimer->sleepto(ts, pacing);
 
-         // it is time to process it, pop it out/remove from the list
-         sockaddr* addr;
-         CPacket pkt;
-         if (self->m_pSndUList->pop(addr, pkt) < 0)
-            continue;
+         // it is time to process it, pop it out/remove from the list,
+         // together with any other packets that are already due, and send them in one batch
+         sockaddr* addr[CChannel::m_iMaxBatch];
+         CPacket pkt[CChannel::m_iMaxBatch];
+         CPacket* ppkt[CChannel::m_iMaxBatch];
+         int num = 0;
 
-         self->m_pChannel->sendto(addr, pkt);
+         do
+         {
+            if (self->m_pSndUList->pop(addr[num], pkt[num]) >= 0)
+            {
+               ppkt[num] = pkt + num;
+               ++ num;
+            }
+
+            ts = self->m_pSndUList->getNextProcTime();
+            CTimer::rdtsc(currtime);
+         } while ((num < CChannel::m_iMaxBatch) && (ts > 0) && (ts <= currtime));
+
+         if (num > 0)
+            self->m_pChannel->sendto(addr, ppkt, num);
       }
       else
       {
@@ -924,7 +950,13 @@ void CRcvQueue::init(const int& qsize, const int& payload, const int& version, c
 {
    CRcvQueue* self = (CRcvQueue*)param;
 
-   sockaddr* addr = (AF_INET == self->m_UnitQueue.m_iIPversion) ? (sockaddr*) new sockaddr_in : (sockaddr*) new sockaddr_in6;
+   // sockaddr_in6 is large enough for both IP versions
+   sockaddr_in6 addrbuf[CChannel::m_iMaxBatch];
+   sockaddr* addrs[CChannel::m_iMaxBatch];
+   for (int i = 0; i < CChannel::m_iMaxBatch; ++ i)
+      addrs[i] = (sockaddr*)(addrbuf + i);
+   CUnit* units[CChannel::m_iMaxBatch];
+   CPacket* packets[CChannel::m_iMaxBatch];
    CUDT* u = NULL;
    int32_t id;
 
@@ -945,55 +977,84 @@ void CRcvQueue::init(const int& qsize, const int& payload, const int& version, c
          }
       }
 
-      // find next available slot for incoming packet
-      CUnit* unit = self->m_UnitQueue.getNextAvailUnit();
-      if (NULL == unit)
+      // find available slots for the next batch of incoming packets;
+      // each unit is held until the batch is read so that the next search returns a different one
+      int avail = 0;
+      for (; avail < CChannel::m_iMaxBatch; ++ avail)
+      {
+         CUnit* unit = self->m_UnitQueue.getNextAvailUnit();
+         if (NULL == unit)
+            break;
+
+         unit->m_iFlag = 1;
+         ++ self->m_UnitQueue.m_iCount;
+         unit->m_Packet.setLength(self->m_iPayloadSize);
+         units[avail] = unit;
+         packets[avail] = &unit->m_Packet;
+      }
+
+      if (0 == avail)
       {
          // no space, skip this packet
          CPacket temp;
          temp.m_pcData = new char[self->m_iPayloadSize];
          temp.setLength(self->m_iPayloadSize);
-         self->m_pChannel->recvfrom(addr, temp);
+         self->m_pChannel->recvfrom(addrs[0], temp);
          delete [] temp.m_pcData;
          goto TIMER_CHECK;
       }
 
-      unit->m_Packet.setLength(self->m_iPayloadSize);
-
-      // reading next incoming packet
-      if (self->m_pChannel->recvfrom(addr, unit->m_Packet) <= 0)
-         goto TIMER_CHECK;
+      {
+         // reading next incoming packets, up to the number of free units
+         int recvd = self->m_pChannel->recvfrom(addrs, packets, avail);
 
-      id = unit->m_Packet.m_iID;
+         // release the units, the receiver buffer marks those it keeps
+         for (int i = 0; i < avail; ++ i)
+         {
+            units[i]->m_iFlag = 0;
+            -- self->m_UnitQueue.m_iCount;
+         }
 
-      // ID 0 is for connection request, which should be passed to the listening socket or rendezvous sockets
-      if (0 == id)
-      {
-         if (NULL != self->m_pListener)
-            ((CUDT*)self->m_pListener)->listen(addr, unit->m_Packet);
-         else if (self->m_pRendezvousQueue->retrieve(addr, id))
-            self->storePkt(id, unit->m_Packet.clone());
-      }
-      else if (id > 0)
-      {
-         if (NULL != (u = self->m_pHash->lookup(id)))
+         for (int i = 0; i < recvd; ++ i)
          {
-            if (CIPAddress::ipcmp(addr, u->m_pPeerAddr, u->m_iIPversion))
+            CUnit* unit = units[i];
+            sockaddr* addr = addrs[i];
+
+            if (unit->m_Packet.getLength() <= 0)
+               continue;
+
+            id = unit->m_Packet.m_iID;
+
+            // ID 0 is for connection request, which should be passed to the listening socket or rendezvous sockets
+            if (0 == id)
+            {
+               if (NULL != self->m_pListener)
+                  ((CUDT*)self->m_pListener)->listen(addr, unit->m_Packet);
+               else if (self->m_pRendezvousQueue->retrieve(addr, id))
+                  self->storePkt(id, unit->m_Packet.clone());
+            }
+            else if (id > 0)
             {
-               if (u->m_bConnected && !u->m_bBroken && !u->m_bClosing)
+               if (NULL != (u = self->m_pHash->lookup(id)))
                {
-                  if (0 == unit->m_Packet.getFlag())
-                     u->processData(unit);
-                  else
-                     u->processCtrl(unit->m_Packet);
-
-                  u->checkTimers();
-                  self->m_pRcvUList->update(u);
+                  if (CIPAddress::ipcmp(addr, u->m_pPeerAddr, u->m_iIPversion))
+                  {
+                     if (u->m_bConnected && !u->m_bBroken && !u->m_bClosing)
+                     {
+                        if (0 == unit->m_Packet.getFlag())
+                           u->processData(unit);
+                        else
+                           u->processCtrl(unit->m_Packet);
+
+                        u->checkTimers();
+                        self->m_pRcvUList->update(u);
+                     }
+                  }
                }
+               else if (self->m_pRendezvousQueue->retrieve(addr, id))
+                  self->storePkt(id, unit->m_Packet.clone());
             }
          }
-         else if (self->m_pRendezvousQueue->retrieve(addr, id))
-            self->storePkt(id, unit->m_Packet.clone());
       }
 
 TIMER_CHECK:
@@ -1025,11 +1086,6 @@ TIMER_CHECK:
       }
    }
 
-   if (AF_INET == self->m_UnitQueue.m_iIPversion)
-      delete (sockaddr_in*)addr;
-   else
-      delete (sockaddr_in6*)addr;
-
    #ifndef WIN32
       return NULL;
    #else
@@ -198,6 +198,15 @@ public:
 
    uint64_t getNextProcTime();
 
+      // Functionality:
+      //    Retrieve the next scheduled processing time and the pacing mode of that socket.
+      // Parameters:
+      //    0) [out] pacing: UDT_PACING option of the first UDT socket in the list.
+      // Returned value:
+      //    Scheduled processing time of the first UDT socket in the list.
+
+   uint64_t getNextProcTime(int& pacing);
+
 private:
    void insert_(const int64_t& ts, const CUDT* u);
    void remove_(const CUDT* u);
@@ -0,0 +1,162 @@
+/*****************************************************************************
+Copyright (c) 2001 - 2011, The Board of Trustees of the University of Illinois.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+* Redistributions of source code must retain the above
+  copyright notice, this list of conditions and the
+  following disclaimer.
+
+* Redistributions in binary form must reproduce the
+  above copyright notice, this list of conditions
+  and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the University of Illinois
+  nor the names of its contributors may be used to
+  endorse or promote products derived from this
+  software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*****************************************************************************/
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#include "udt.h"
+#include "common.h"
+#include "channel.h"
+#include "packet.h"
+
+using namespace std;
+
+int64_t cpu_time()
+{
+   rusage ru;
+   getrusage(RUSAGE_SELF, &ru);
+   return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// hybrid sleepto is never early and not much late
+int test1()
+{
+   CTimer timer;
+
+   for (int i = 0; i < 100; ++ i)
+   {
+      uint64_t t;
+      CTimer::rdtsc(t);
+      uint64_t target = t + (100 + i * 20) * CTimer::getCPUFrequency();
+      timer.sleepto(target, UDT_PACING_HYBRID);
+      CTimer::rdtsc(t);
+      assert(t >= target);
+      assert(t < target + 10000 * CTimer::getCPUFrequency());
+   }
+
+   return 0;
+}
+
+// the option is per socket and checked
+int test2()
+{
+   UDTSOCKET u = UDT::socket(AF_INET, SOCK_STREAM, 0);
+
+   int pacing = -1;
+   int len = sizeof(int);
+   assert(UDT::getsockopt(u, 0, UDT_PACING, &pacing, &len) == 0);
+   assert(pacing == UDT_PACING_DEFAULT);
+
+   pacing = UDT_PACING_HYBRID;
+   assert(UDT::setsockopt(u, 0, UDT_PACING, &pacing, sizeof(int)) == 0);
+   assert(UDT::getsockopt(u, 0, UDT_PACING, &pacing, &len) == 0);
+   assert(pacing == UDT_PACING_HYBRID);
+
+   pacing = 100;
+   assert(UDT::setsockopt(u, 0, UDT_PACING, &pacing, sizeof(int)) == UDT::ERROR);
+
+   UDT::close(u);
+   return 0;
+}
+
+// CPU per Gbit and timing error of a paced sender: packets sent over loopback on a fixed schedule, the way CSndQueue does
+void bench(int pacing, int rate)
+{
+   CChannel snd, rcv;
+   sockaddr_in addr;
+   memset(&addr, 0, sizeof(sockaddr_in));
+   addr.sin_family = AF_INET;
+   inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+   snd.open((sockaddr*)&addr);
+   rcv.open((sockaddr*)&addr);
+   rcv.getSockAddr((sockaddr*)&addr);
+
+   const int payload = 1456;
+   char buf[payload];
+   memset(buf, 0, payload);
+   CPacket pkt;
+   pkt.m_pcData = buf;
+
+   // inter-packet interval in CPU clock cycles for "rate" Mb/s
+   const int num = 20000;
+   const int bits = (payload + CPacket::m_iPktHdrSize) * 8;
+   uint64_t interval = uint64_t(bits) * CTimer::getCPUFrequency() / rate;
+
+   CTimer timer;
+   uint64_t next;
+   CTimer::rdtsc(next);
+   int64_t start = CTimer::getTime();
+   int64_t cpu = cpu_time();
+   uint64_t late = 0;
+   for (int i = 0; i < num; ++ i)
+   {
+      next += interval;
+      timer.sleepto(next, pacing);
+      uint64_t now;
+      CTimer::rdtsc(now);
+      late += now - next;
+      pkt.setLength(payload);
+      snd.sendto((sockaddr*)&addr, pkt);
+   }
+   int64_t duration = CTimer::getTime() - start;
+   cpu = cpu_time() - cpu;
+
+   snd.close();
+   rcv.close();
+
+   double gbit = double(num) * bits / 1e9;
+   cout << ((UDT_PACING_HYBRID == pacing) ? "hybrid" : "default") << " pacing at " << rate << " Mb/s: sent at "
+        << int64_t(num) * bits / duration << " Mb/s, " << late / num / CTimer::getCPUFrequency() << " us late on average, "
+        << cpu / 1e6 / gbit << " CPU seconds per Gbit" << endl;
+}
+
+int main()
+{
+   test1();
+
+   UDT::startup();
+   test2();
+   UDT::cleanup();
+
+   bench(UDT_PACING_DEFAULT, 100);
+   bench(UDT_PACING_HYBRID, 100);
+   bench(UDT_PACING_DEFAULT, 1000);
+   bench(UDT_PACING_HYBRID, 1000);
+
+   return 0;
+}
@@ -148,7 +148,14 @@ enum UDTOpt
    UDT_SNDTIMEO,        // send() timeout
    UDT_RCVTIMEO,        // recv() timeout
    UDT_REUSEADDR,	// reuse an existing port or create a new one
-   UDT_MAXBW		// maximum bandwidth (bytes per second) that the connection can use
+   UDT_MAXBW,		// maximum bandwidth (bytes per second) that the connection can use
+   UDT_PACING		// how the sender waits between packets, see UDTPacing
+};
+
+enum UDTPacing
+{
+   UDT_PACING_DEFAULT,	// busy wait until each packet is due, or wait for timer ticks if NO_BUSY_WAITING is defined
+   UDT_PACING_HYBRID	// sleep until shortly before each packet is due, then busy wait for the last few microseconds
 };
 
 ////////////////////////////////////////////////////////////////////////////////